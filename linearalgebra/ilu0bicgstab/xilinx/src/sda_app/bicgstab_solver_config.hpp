@@ -26,15 +26,66 @@
 // macros that are spefific for a configuration
 // *****************************************************************************
 
+// Each configuration sets the data buffers (kernel ports) that hold each
+// group of arrays; the layout planner, the bank mapping of the device buffers
+// and the kernel arguments are derived from these macros. The first RO_BUF data
+// buffers have only a read port, the others have a read and a write port: the
+// results and the temporaries must be in the latter. Only the configurations
+// with a kernel in src/rtl are defined: the other PORTS_* values of
+// dev_config.hpp are rejected until their kernel exists.
+
 #if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
   // number of read/write buffers
   #define RW_BUF 5
+  // number of read-only buffers
+  #define RO_BUF 2
   // kernel name
   #define KERNEL_NAME "bicgstab_2r_3r3w_rtl_v1"
+  // data buffers holding the results (fixed by the kernel ports)
+  #define BANK_XRES_EVEN 2
+  #define BANK_RRES_ODD 2
+  #define BANK_XRES_ODD 3
+  #define BANK_RRES_EVEN 3
+  #define BANK_LRES 4
+  #define BANK_URES 4
+  // data buffers holding the other arrays (fixed by the kernel ports)
+  #define BANK_VALUES 0       // setup array, nnz values, color sizes, block diagonal
+  #define BANK_INDICES 1      // P indices, column indices, new row offsets
+  #define BANK_P 3            // P1, P2, RT
+  #define BANK_TV 4           // T, V (followed by L_res and U_res)
+  // parts 2-4 of the split nnz values: part 2 in data buffer 1, part 3 in 2,
+  // part 4 in 3; unused, since this kernel reads only the first part (see
+  // NNZ_PARTS_KERNEL)
+  #define BANK_NNZ_PART2 1
+  #define BANK_NNZ_PART3 2
+  #define BANK_NNZ_PART4 3
+  // memory banks (memory topology indices) of the data buffers and of the debug buffer
+  #if PORTS_CONFIG == PORTS_2r_3r3w_ddr
+    #define DATA_MEM_BANKS {32, 33, 2, 4, 6}    // DDR[0-1], HBM[2,4,6]
+  #else
+    #define DATA_MEM_BANKS {2, 4, 6, 8, 10}     // HBM[2,4,6,8,10]
+  #endif
+  #define DEBUG_MEM_BANK 34                     // PLRAM[0] (after HBM[0-31] and DDR[0-1])
 #else
   #error "The macro PORTS_CONFIG must be defined and set to a supported target."
 #endif
 
+// the kernel writes the results and the temporaries, and reads L_res and
+// U_res just after V
+#if BANK_XRES_EVEN < RO_BUF || BANK_RRES_ODD < RO_BUF || BANK_XRES_ODD < RO_BUF || \
+    BANK_RRES_EVEN < RO_BUF || BANK_LRES < RO_BUF || BANK_P < RO_BUF || BANK_TV < RO_BUF
+  #error "The results and the temporaries must be in read/write buffers."
+#endif
+#if BANK_LRES != BANK_TV || BANK_URES != BANK_TV
+  #error "L_res and U_res must be in the same data buffer as V."
+#endif
+
+// kernel arguments: 3 scalar parameters, the read ports of all the data
+// buffers, the write ports of the read/write buffers and the debug buffer
+#define KERNEL_ARG_READ(b)  (3 + (b))
+#define KERNEL_ARG_WRITE(b) (3 + RW_BUF + (b) - RO_BUF)
+#define KERNEL_ARG_DEBUG    (3 + 2*RW_BUF - RO_BUF)
+
 // *****************************************************************************
 // macros that are common between configurations
 // *****************************************************************************
@@ -42,6 +93,20 @@
 // number of configuration setup cachelines
 #define SETUP_LINES 5
 
+// max number of parts in which the nnz values of A, L and U can be split
+// (the setup array has a pointer slot for each part)
+#define NNZ_PARTS_MAX 4
+
+// number of parts of the nnz values that the kernel reads: a configuration
+// whose kernel reads the parts 2-4 (setup slots 31-39) defines it, the
+// others read only the whole values (slots 12, 20 and 26)
+#ifndef NNZ_PARTS_KERNEL
+  #define NNZ_PARTS_KERNEL 1
+#endif
+#if NNZ_PARTS_KERNEL < 1 || NNZ_PARTS_KERNEL > NNZ_PARTS_MAX
+  #error "NNZ_PARTS_KERNEL must be between 1 and NNZ_PARTS_MAX."
+#endif
+
 // max number of results buffers
 #define RES_BUF_MAX 10
 
@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <iostream>
 
 #include "bda_utils.hpp"
@@ -43,6 +44,10 @@ void wait_for_enter() {
   do {} while (std::cin.get() != '\n');
 }
 
+double elapsed_ms(struct timespec *start, struct timespec *end) {
+  return (double)(end->tv_sec - start->tv_sec)*1000 + (double)(end->tv_nsec - start->tv_nsec)/1000000;
+}
+
 size_t get_file_size(char *filename) {
   FILE *fin;
   size_t size;
@@ -20,11 +20,15 @@
 #ifndef __BDA_UTILS_HPP__
 #define __BDA_UTILS_HPP__
 
+#include <time.h>
+
 int roundUpTo(int i, int n);
 bool even(int n);
 void wait_for_enter();
 size_t get_file_size(char *filename);
 int get_matrix_name(char *matrix_path, char *matrix_name);
+// time in ms between two clock_gettime(CLOCK_REALTIME, ...)
+double elapsed_ms(struct timespec *start, struct timespec *end);
 
 union int2chars {
   int intVal;
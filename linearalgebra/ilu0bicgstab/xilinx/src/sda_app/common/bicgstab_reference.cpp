@@ -0,0 +1,372 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Host reference of the ILU0-preconditioned BiCGSTAB solver
+
+  The ILU0 factorization is computed in double precision, then the stored
+  factors are rounded as the data buffers packer does when the L/U values
+  (and the block diagonal, here the inverted diagonal of U) are stored as
+  floats; the solver arithmetic stays in double precision, as in the kernel.
+  Running the same system with and without rounding gives the effect of the
+  single precision preconditioner on the number of iterations, before a
+  bitstream reading float values is built. Iterations are counted in halves,
+  as the kernel does: the solver can stop after the first half of an
+  iteration. Convergence is reached when the norm of the residual, relative
+  to the initial one, is below the tolerance.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bicgstab_reference.hpp"
+
+// ILU0 factors: L (unit diagonal) and U share the sparsity pattern of A;
+// diag holds the index of the diagonal of each row and inv_diag its inverse
+struct ilu0_factors {
+  double *vals;
+  int *diag;
+  double *inv_diag;
+};
+
+static double dot(int n, const double *a, const double *b) {
+  double sum = 0.0;
+  for (int i=0;i<n;i++) sum += a[i]*b[i];
+  return sum;
+}
+
+static void spmv(struct csr_matrix *A, const double *x, double *y) {
+  for (int i=0;i<A->rows;i++) {
+    double sum = 0.0;
+    for (int k=A->row_ptr[i];k<A->row_ptr[i+1];k++) sum += A->vals[k]*x[A->cols[k]];
+    y[i] = sum;
+  }
+}
+
+static double round_to_float(double v) {
+  return (double)(float)v;
+}
+
+// --------------------------------
+// ILU0 factorization (IKJ variant)
+// --------------------------------
+
+static int ilu0_factorize(struct csr_matrix *A, unsigned int rounding, struct ilu0_factors *f) {
+  int *pos = (int *)malloc(sizeof(int) * A->rows);
+  f->vals = (double *)malloc(sizeof(double) * A->nnz);
+  f->diag = (int *)malloc(sizeof(int) * A->rows);
+  f->inv_diag = (double *)malloc(sizeof(double) * A->rows);
+  if (pos == NULL || f->vals == NULL || f->diag == NULL || f->inv_diag == NULL) {
+    printf("ERROR: %s: cannot allocate the factors of %d rows.\n",__func__,A->rows);
+    free(pos);
+    return 1;
+  }
+  memcpy(f->vals, A->vals, sizeof(double) * A->nnz);
+  for (int i=0;i<A->rows;i++) pos[i] = -1;
+
+  for (int i=0;i<A->rows;i++) {
+    int start = A->row_ptr[i], end = A->row_ptr[i+1];
+    f->diag[i] = -1;
+    for (int k=start;k<end;k++) {
+      pos[A->cols[k]] = k;
+      if (A->cols[k] == i) f->diag[i] = k;
+    }
+    if (f->diag[i] < 0) {
+      printf("ERROR: %s: row %d has no diagonal element.\n",__func__,i);
+      free(pos);
+      return 1;
+    }
+    // eliminate the elements of row i below the diagonal
+    for (int k=start;k<f->diag[i];k++) {
+      int c = A->cols[k];
+      f->vals[k] *= f->inv_diag[c];
+      for (int j=f->diag[c]+1;j<A->row_ptr[c+1];j++) {
+        if (pos[A->cols[j]] >= 0) f->vals[pos[A->cols[j]]] -= f->vals[k]*f->vals[j];
+      }
+    }
+    if (f->vals[f->diag[i]] == 0.0) {
+      printf("ERROR: %s: zero pivot in row %d.\n",__func__,i);
+      free(pos);
+      return 1;
+    }
+    f->inv_diag[i] = 1.0/f->vals[f->diag[i]];
+    for (int k=start;k<end;k++) pos[A->cols[k]] = -1;
+  }
+  free(pos);
+
+  // rounding of the stored preconditioner
+  for (int i=0;i<A->rows;i++) {
+    if (rounding & REF_ROUND_LU) {
+      for (int k=A->row_ptr[i];k<A->row_ptr[i+1];k++) {
+        if (k != f->diag[i]) f->vals[k] = round_to_float(f->vals[k]);
+      }
+    }
+    if (rounding & REF_ROUND_DIAG) f->inv_diag[i] = round_to_float(f->inv_diag[i]);
+  }
+  return 0;
+}
+
+// z = (LU)^-1 r
+static void ilu0_apply(struct csr_matrix *A, struct ilu0_factors *f, const double *r, double *z) {
+  for (int i=0;i<A->rows;i++) {
+    double sum = r[i];
+    for (int k=A->row_ptr[i];k<f->diag[i];k++) sum -= f->vals[k]*z[A->cols[k]];
+    z[i] = sum;
+  }
+  for (int i=A->rows-1;i>=0;i--) {
+    double sum = z[i];
+    for (int k=f->diag[i]+1;k<A->row_ptr[i+1];k++) sum -= f->vals[k]*z[A->cols[k]];
+    z[i] = f->inv_diag[i]*sum;
+  }
+}
+
+// ------------------------------
+// preconditioned BiCGSTAB solver
+// ------------------------------
+
+// solve A x = b, starting from the given x, with the factors of M (of A if
+// M is NULL; M must have the pattern of A); iterations gets the number of
+// (half) iterations run and rel_residual the final relative residual norm.
+// The solve stops at a breakdown (rho, <rt,v> or omega zero or not finite),
+// with the last finite iterate, and sets *breakdown (if it is not NULL)
+int bicgstab_reference_solve(struct csr_matrix *A, struct csr_matrix *M, double *b, double *x,
+ unsigned int rounding, int max_iter, double tolerance,
+ double *iterations, double *rel_residual, bool *converged, bool *breakdown) {
+  return bicgstab_reference_solve_cancel(A, M, b, x, rounding, max_iter, tolerance,
+   iterations, rel_residual, converged, breakdown, NULL);
+}
+
+// as bicgstab_reference_solve, but the solve stops at the next iteration
+// once *cancel is set by another thread (if cancel is not NULL; it is read
+// with __atomic_load_n, so the other thread sets it with __atomic_store_n)
+int bicgstab_reference_solve_cancel(struct csr_matrix *A, struct csr_matrix *M, double *b, double *x,
+ unsigned int rounding, int max_iter, double tolerance,
+ double *iterations, double *rel_residual, bool *converged, bool *breakdown, bool *cancel) {
+  struct ilu0_factors f = {NULL, NULL, NULL};
+  int n = A->rows;
+  double *work = (double *)malloc(sizeof(double) * 8 * n);
+  bool broken = false;
+
+  *iterations = 0.0;
+  *rel_residual = 1.0;
+  *converged = false;
+  if (breakdown != NULL) *breakdown = false;
+  if (M != NULL && (M->rows != A->rows || M->nnz != A->nnz)) {
+    printf("ERROR: %s: the preconditioner matrix has not the pattern of the system.\n",__func__);
+    free(work);
+    return 1;
+  }
+  if (work == NULL || ilu0_factorize((M != NULL) ? M : A, rounding, &f)) {
+    printf("ERROR: %s: cannot set up the solver.\n",__func__);
+    free(work);
+    free(f.vals);
+    free(f.diag);
+    free(f.inv_diag);
+    return 1;
+  }
+  double *r = work, *rt = work + n, *p = work + 2*n, *v = work + 3*n;
+  double *ph = work + 4*n, *s = work + 5*n, *sh = work + 6*n, *t = work + 7*n;
+
+  spmv(A, x, r);
+  for (int i=0;i<n;i++) {
+    r[i] = b[i] - r[i];
+    rt[i] = r[i];
+    p[i] = 0.0;
+    v[i] = 0.0;
+  }
+  double norm_0 = sqrt(dot(n, r, r));
+  double rho = 1.0, alpha = 1.0, omega = 1.0;
+  if (norm_0 == 0.0) {
+    *rel_residual = 0.0;
+    *converged = true;
+  }
+
+  for (int it=0;it<max_iter && !*converged;it++) {
+    if (cancel != NULL && __atomic_load_n(cancel, __ATOMIC_ACQUIRE)) break;
+    double rho_new = dot(n, rt, r);
+    if (rho_new == 0.0 || !isfinite(rho_new)) {
+      broken = true;
+      break;
+    }
+    double beta = (rho_new/rho)*(alpha/omega);
+    rho = rho_new;
+    for (int i=0;i<n;i++) p[i] = r[i] + beta*(p[i] - omega*v[i]);
+    ilu0_apply(A, &f, p, ph);
+    spmv(A, ph, v);
+    double rtv = dot(n, rt, v);
+    if (rtv == 0.0 || !isfinite(rtv)) {
+      broken = true;
+      break;
+    }
+    alpha = rho/rtv;
+    for (int i=0;i<n;i++) {
+      x[i] += alpha*ph[i];
+      s[i] = r[i] - alpha*v[i];
+    }
+    *iterations += 0.5;
+    *rel_residual = sqrt(dot(n, s, s))/norm_0;
+    if (*rel_residual < tolerance) {
+      *converged = true;
+      break;
+    }
+    ilu0_apply(A, &f, s, sh);
+    spmv(A, sh, t);
+    double tt = dot(n, t, t);
+    omega = (tt != 0.0) ? dot(n, t, s)/tt : 0.0;
+    if (omega == 0.0 || !isfinite(omega)) {
+      broken = true;
+      break;
+    }
+    for (int i=0;i<n;i++) {
+      x[i] += omega*sh[i];
+      r[i] = s[i] - omega*t[i];
+    }
+    *iterations += 0.5;
+    *rel_residual = sqrt(dot(n, r, r))/norm_0;
+    if (*rel_residual < tolerance) *converged = true;
+    if (!isfinite(*rel_residual)) break;
+  }
+  if (breakdown != NULL) *breakdown = broken;
+
+  free(work);
+  free(f.vals);
+  free(f.diag);
+  free(f.inv_diag);
+  return 0;
+}
+
+// -------------------
+// Matrix Market input
+// -------------------
+
+struct triplet {
+  int row;
+  int col;
+  double val;
+};
+
+static int triplet_compare(const void *a, const void *b) {
+  const struct triplet *ta = (const struct triplet *)a, *tb = (const struct triplet *)b;
+  if (ta->row != tb->row) return (ta->row < tb->row) ? -1 : 1;
+  if (ta->col != tb->col) return (ta->col < tb->col) ? -1 : 1;
+  return 0;
+}
+
+// read a square matrix in Matrix Market coordinate format; duplicated
+// entries are summed and symmetric matrices are expanded
+int csr_matrix_read(const char *filename, struct csr_matrix *A) {
+  char line[1024];
+  int rows, cols, entries;
+  bool symmetric;
+  FILE *fin = fopen(filename, "r");
+
+  if (fin == NULL) {
+    printf("ERROR: %s: cannot open %s.\n",__func__,filename);
+    return 1;
+  }
+  if (fgets(line, sizeof(line), fin) == NULL || strncmp(line, "%%MatrixMarket matrix coordinate", 32) != 0 ||
+      strstr(line, "complex") != NULL || strstr(line, "pattern") != NULL) {
+    printf("ERROR: %s: %s is not a real matrix in coordinate format.\n",__func__,filename);
+    fclose(fin);
+    return 1;
+  }
+  symmetric = strstr(line, "symmetric") != NULL;
+  do {
+    if (fgets(line, sizeof(line), fin) == NULL) line[0] = '\0';
+  } while (line[0] == '%');
+  if (sscanf(line, "%d %d %d", &rows, &cols, &entries) != 3 || rows != cols || rows <= 0) {
+    printf("ERROR: %s: %s is not a square matrix.\n",__func__,filename);
+    fclose(fin);
+    return 1;
+  }
+
+  struct triplet *t = (struct triplet *)malloc(sizeof(struct triplet) * 2 * (size_t)entries);
+  int num = 0;
+  for (int e=0;e<entries;e++) {
+    int i, j;
+    double v;
+    if (fscanf(fin, "%d %d %lf", &i, &j, &v) != 3 || i < 1 || i > rows || j < 1 || j > cols) {
+      printf("ERROR: %s: invalid entry %d in %s.\n",__func__,e,filename);
+      free(t);
+      fclose(fin);
+      return 1;
+    }
+    t[num++] = (struct triplet){i-1, j-1, v};
+    if (symmetric && i != j) t[num++] = (struct triplet){j-1, i-1, v};
+  }
+  fclose(fin);
+  qsort(t, num, sizeof(struct triplet), triplet_compare);
+
+  A->rows = rows;
+  A->row_ptr = (int *)calloc(rows + 1, sizeof(int));
+  A->cols = (int *)malloc(sizeof(int) * num);
+  A->vals = (double *)malloc(sizeof(double) * num);
+  A->nnz = 0;
+  for (int k=0;k<num;k++) {
+    if (A->nnz > 0 && k > 0 && t[k].row == t[k-1].row && t[k].col == t[k-1].col) {
+      A->vals[A->nnz-1] += t[k].val;
+      continue;
+    }
+    A->cols[A->nnz] = t[k].col;
+    A->vals[A->nnz] = t[k].val;
+    A->row_ptr[t[k].row+1]++;
+    A->nnz++;
+  }
+  for (int i=0;i<rows;i++) A->row_ptr[i+1] += A->row_ptr[i];
+  free(t);
+  return 0;
+}
+
+// the new row offset of the first entry of a row counts the rows advanced
+// since the last row with entries
+int csr_matrix_streams(struct csr_matrix *A, int block_size, int part,
+ short unsigned int *col, unsigned char *nr, double *vals, int *entries) {
+  int last_row = -1;
+
+  *entries = 0;
+  for (int i=0;i<A->rows;i++) {
+    bool first = true;
+    for (int k=A->row_ptr[i];k<A->row_ptr[i+1];k++) {
+      int bi = i / block_size, bj = A->cols[k] / block_size;
+      if ((part == CSR_PART_LOWER && bj >= bi) || (part == CSR_PART_UPPER && bj <= bi)) continue;
+      if (first && i - last_row > 0xff) {
+        printf("ERROR: %s: %d empty rows before row %d.\n",__func__,i-last_row-1,i);
+        return 1;
+      }
+      col[*entries] = (short unsigned int)A->cols[k];
+      nr[*entries] = first ? (unsigned char)(i - last_row) : 0;
+      if (vals != NULL) vals[*entries] = A->vals[k];
+      (*entries)++;
+      if (first) last_row = i;
+      first = false;
+    }
+  }
+  return 0;
+}
+
+void csr_matrix_free(struct csr_matrix *A) {
+  free(A->row_ptr);
+  free(A->cols);
+  free(A->vals);
+  A->row_ptr = NULL;
+  A->cols = NULL;
+  A->vals = NULL;
+}
@@ -0,0 +1,65 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __BICGSTAB_REFERENCE_HPP__
+#define __BICGSTAB_REFERENCE_HPP__
+
+// host reference of the ILU0-preconditioned BiCGSTAB solver, used to model
+// the convergence of the kernel when the preconditioner is stored in single
+// precision (see fpga_set_float_regions) or computed from a previous matrix
+// (see fpga_lu_reuse)
+
+// square matrix in CSR format: the columns of each row must be sorted and
+// the diagonal must be present
+struct csr_matrix {
+  int rows;
+  int nnz;
+  int *row_ptr;     // rows+1 elements
+  int *cols;        // nnz elements
+  double *vals;     // nnz elements
+};
+
+// rounding to single precision applied to the stored preconditioner
+#define REF_ROUND_LU    0x1   // values of the L and U factors
+#define REF_ROUND_DIAG  0x2   // inverted diagonal (block diagonal of the kernel)
+
+// read a square matrix in Matrix Market coordinate format (real, general or
+// symmetric), release it with csr_matrix_free
+int csr_matrix_read(const char *filename, struct csr_matrix *A);
+void csr_matrix_free(struct csr_matrix *A);
+
+// parts of the matrix selected by csr_matrix_streams
+#define CSR_PART_ALL    0   // all the entries
+#define CSR_PART_LOWER  1   // blocks below the diagonal
+#define CSR_PART_UPPER  2   // blocks above the diagonal
+
+// column indices, new row offsets and values (if vals is not NULL) of the
+// entries of a part of the matrix, in the natural row order, as in the
+// arrays read by the kernel with one color and no padding
+int csr_matrix_streams(struct csr_matrix *A, int block_size, int part,
+ short unsigned int *col, unsigned char *nr, double *vals, int *entries);
+
+int bicgstab_reference_solve(struct csr_matrix *A, struct csr_matrix *M, double *b, double *x,
+ unsigned int rounding, int max_iter, double tolerance,
+ double *iterations, double *rel_residual, bool *converged, bool *breakdown);
+int bicgstab_reference_solve_cancel(struct csr_matrix *A, struct csr_matrix *M, double *b, double *x,
+ unsigned int rounding, int max_iter, double tolerance,
+ double *iterations, double *rel_residual, bool *converged, bool *breakdown, bool *cancel);
+
+#endif //__BICGSTAB_REFERENCE_HPP__
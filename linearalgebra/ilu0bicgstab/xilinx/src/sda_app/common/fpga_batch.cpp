@@ -0,0 +1,355 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Batch of small independent systems
+
+  For systems of a few thousand rows, the kernel runs for a fraction of a
+  millisecond, and the fixed costs of a solve (kernel arguments, transfers,
+  synchronizations and debug buffer readback) dominate. A batch packs many
+  systems back to back in one set of data buffers: each system has its own
+  layout, planned for its sizes, with its setup array at the start of its
+  part of the data buffers, which begins at a BATCH_ALIGN boundary. The
+  kernel is given sub-buffers that start at the system, so the offsets of
+  the setup array of a system are relative to its own base.
+
+  fpga_batch_run enqueues a single chain on an in-order command queue:
+  - one write per data buffer with all the systems;
+  - for each system: the debug buffer fill pattern, the data buffer
+    arguments of the system, the kernel run, and the read of the debug
+    buffer into the debug output of the system;
+  - one read per data buffer holding results;
+  and synchronizes once at the end, then decodes the debug output of each
+  system. The results are read into the host data buffers, over the inputs
+  of the systems: the batch must be reset and the systems added again before
+  the next run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <CL/opencl.h>
+
+#include "fpga_batch.hpp"
+#include "bda_utils.hpp"
+#include "bicgstab_utils.hpp"
+#include "host_alloc.hpp"
+
+// bytes taken by a system in a data buffer (even if it has no region there,
+// a sub-buffer is given to the kernel)
+static unsigned long int fpga_batch_aligned(unsigned int bytes) {
+  if (bytes == 0) bytes = 1;
+  return ((unsigned long int)bytes + BATCH_ALIGN - 1) / BATCH_ALIGN * BATCH_ALIGN;
+}
+
+// ------------------------------
+// create the data buffers of the batch
+// ------------------------------
+
+// the data buffers hold max_systems systems of the sizes given (the largest
+// system expected); the buffers are allocated in the memory banks of the
+// compute unit of kernel (see fpga_create_device_buffer)
+int fpga_batch_create(struct fpga_batch *batch, cl_context context, cl_kernel kernel,
+ unsigned int config_bits, int max_systems, int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, unsigned int debug_outbuf_words)
+{
+  struct fpga_region regions[REG_NUM];
+  unsigned int totalSize[RW_BUF];
+  unsigned int result_offsets[6];
+  char name[32];
+
+  memset(batch, 0, sizeof(struct fpga_batch));
+  if (max_systems < 1) {
+    printf("ERROR: %s: a batch must hold at least one system (%d).\n",__func__,max_systems);
+    return 1;
+  }
+  if (nnzValArrays_num < 1 || nnzValArrays_num > NNZ_PARTS_KERNEL) {
+    printf("ERROR: %s: the kernel reads the nnz values in 1 to %d parts (%d requested).\n",
+     __func__,NNZ_PARTS_KERNEL,nnzValArrays_num);
+    return 1;
+  }
+  batch->context = context;
+  batch->kernel = kernel;
+  batch->config_bits = config_bits;
+  batch->nnz_num = nnzValArrays_num;
+  batch->max_systems = max_systems;
+  batch->debug_outbuf_words = debug_outbuf_words;
+
+  if (fpga_plan_datamem_layout(processedSizes, nnzValArrays_sizes, L_nnzValArrays_sizes,
+   U_nnzValArrays_sizes, nnzValArrays_num, regions, totalSize, result_offsets)) {
+    printf("ERROR: %s: cannot plan the data buffers layout.\n",__func__);
+    return 1;
+  }
+  for (int b=0;b<RW_BUF;b++) {
+    unsigned long int bytes = fpga_batch_aligned(totalSize[b]) * max_systems;
+    if (bytes > 0xFFFFFFFFUL) {
+      printf("ERROR: %s: data buffer %d of %d systems would exceed 4 GiB.\n",__func__,b,max_systems);
+      fpga_batch_release(batch);
+      return 1;
+    }
+    batch->capacity[b] = (unsigned int)bytes;
+    sprintf(name,"batch dataBuffer %d",b);
+    if (host_alloc(name, batch->capacity[b], (void **)&batch->dataBuffer[b]) ||
+        fpga_create_device_buffer(context, kernel, b, batch->capacity[b], NULL, &batch->cldata[b])) {
+      fpga_batch_release(batch);
+      return 1;
+    }
+  }
+  if (fpga_setup_host_debugbuf(debug_outbuf_words, &batch->debugBuffer, &batch->debugBufferSize) ||
+      fpga_setup_cu_debugbuf(context, kernel, batch->debugBuffer, &batch->cldebug, batch->debugBufferSize) ||
+      host_alloc("batch debug output", (size_t)batch->debugBufferSize * max_systems, (void **)&batch->systemDebug)) {
+    printf("ERROR: %s: cannot create the debug buffers.\n",__func__);
+    fpga_batch_release(batch);
+    return 1;
+  }
+  batch->systems = (struct fpga_batch_system *)calloc(max_systems, sizeof(struct fpga_batch_system));
+  if (batch->systems == NULL) {
+    printf("ERROR: %s: cannot allocate %d systems.\n",__func__,max_systems);
+    fpga_batch_release(batch);
+    return 1;
+  }
+  BDA_DEBUG(1,printf("INFO: %s: batch of %d systems: %u, %u, %u bytes in data buffers 0-2.\n",
+   __func__,max_systems,batch->capacity[0],batch->capacity[1],batch->capacity[2]);)
+  return 0;
+}
+
+// the scalar arguments are the same for all the systems of the batch
+int fpga_batch_set_kernel_parameters(struct fpga_batch *batch,
+ unsigned int abort_cycles, unsigned int debug_lines, unsigned int kernel_iter,
+ unsigned int debug_sample_rate, double kernel_precision, bool use_residuals)
+{
+  if (fpga_set_kernel_parameters(batch->kernel, abort_cycles, debug_lines, kernel_iter,
+   debug_sample_rate, kernel_precision, batch->cldata, batch->cldebug)) {
+    printf("ERROR: %s: cannot set the kernel parameters.\n",__func__);
+    return 1;
+  }
+  batch->abort_cycles = abort_cycles;
+  batch->use_residuals = use_residuals;
+  batch->parameters_set = true;
+  return 0;
+}
+
+// -----------------------------
+// add a system to the batch
+// -----------------------------
+
+// plan the layout of the system, pack it after the systems already added and
+// create the sub-buffers the kernel is given for it; index receives the
+// position of the system in batch->systems
+int fpga_batch_add(struct fpga_batch *batch, void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int *index)
+{
+  struct timespec time_start, time_end;
+  unsigned int totalSize[RW_BUF];
+  unsigned char *sysBuffer[RW_BUF];
+  unsigned long int dirty_mask = 0;
+  int err;
+
+  if (batch->num_systems == batch->max_systems) {
+    printf("ERROR: %s: the batch is full (%d systems).\n",__func__,batch->max_systems);
+    return 1;
+  }
+  clock_gettime(CLOCK_REALTIME, &time_start);
+  struct fpga_batch_system *sys = &batch->systems[batch->num_systems];
+  memset(sys, 0, sizeof(struct fpga_batch_system));
+  if (fpga_plan_datamem_layout(vectorSizes, nnzValArrays_sizes, L_nnzValArrays_sizes,
+   U_nnzValArrays_sizes, batch->nnz_num, sys->regions, totalSize, sys->result_offsets)) {
+    printf("ERROR: %s: cannot plan the layout of system %d.\n",__func__,batch->num_systems);
+    return 1;
+  }
+  for (int b=0;b<RW_BUF;b++) {
+    unsigned long int bytes = fpga_batch_aligned(totalSize[b]);
+    if (batch->used[b] + bytes > batch->capacity[b]) {
+      printf("ERROR: %s: system %d does not fit in data buffer %d (%lu bytes, %u free).\n",
+       __func__,batch->num_systems,b,bytes,batch->capacity[b]-batch->used[b]);
+      return 1;
+    }
+    sys->base[b] = batch->used[b];
+    sys->size[b] = (unsigned int)bytes;
+    sysBuffer[b] = batch->dataBuffer[b] + sys->base[b];
+    // the regions not packed (X2/R2 and the kernel temporaries) are uploaded
+    // too, and a previous run left its results there
+    memset(sysBuffer[b], 0, sys->size[b]);
+  }
+  for (int b=0;b<RW_BUF;b++) {
+    cl_buffer_region region = {sys->base[b], sys->size[b]};
+    sys->cldata[b] = clCreateSubBuffer(batch->cldata[b], CL_MEM_READ_WRITE,
+     CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+    if (!sys->cldata[b] || err != CL_SUCCESS) {
+      printf("ERROR: %s: cannot create sub-buffer %d of system %d (%d)\n",__func__,b,batch->num_systems,err);
+      sys->cldata[b] = NULL;
+      for (int i=0;i<b;i++) clReleaseMemObject(sys->cldata[i]);
+      return 1;
+    }
+  }
+  struct fpga_region *setup = &sys->regions[REG_SETUP];
+  fpga_fill_setup_array((long unsigned int *)&sysBuffer[setup->bank][setup->offset],
+   batch->config_bits, vectorSizes, sys->regions);
+  if (fpga_update_host_datamem(REG_MASK_INPUTS, vectorPointers, vectorSizes,
+   nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, batch->nnz_num,
+   sys->regions, sysBuffer, &dirty_mask)) {
+    printf("ERROR: %s: cannot pack system %d.\n",__func__,batch->num_systems);
+    for (int b=0;b<RW_BUF;b++) clReleaseMemObject(sys->cldata[b]);
+    return 1;
+  }
+  for (int b=0;b<RW_BUF;b++) batch->used[b] += sys->size[b];
+  sys->rows = vectorSizes[0];
+  sys->debugBuffer = batch->systemDebug + (size_t)batch->num_systems * batch->debugBufferSize / sizeof(unsigned long int);
+  *index = batch->num_systems;
+  batch->num_systems++;
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  batch->pack_ms += elapsed_ms(&time_start, &time_end);
+  return 0;
+}
+
+// -----------------------------------------
+// solve all the systems with a single chain
+// -----------------------------------------
+
+// decode the debug output of a system and locate its results
+static void fpga_batch_decode(struct fpga_batch *batch, struct fpga_batch_system *sys) {
+  if (decode_debuginfo_bicgstab(true, false,
+   sys->debugBuffer, batch->debug_outbuf_words, CACHELINE_DBL_WORDS, batch->abort_cycles,
+   &sys->kernel_cycles, &sys->kernel_iter_run, sys->norms, &sys->last_norm_idx,
+   &sys->kernel_aborted, &sys->kernel_signature, &sys->kernel_overflow,
+   &sys->kernel_noresults, &sys->kernel_wrafterend, &sys->kernel_dbgfifofull)) {
+    sys->failed = true;
+    return;
+  }
+  // results are in X2/R2 after an even number of half iterations, in X1/R1
+  // otherwise; without results, X1/R1 still hold the initial guess
+  bool even = (sys->kernel_iter_run % 2 == 0) && !sys->kernel_noresults;
+  struct fpga_region *x = &sys->regions[even ? REG_X2 : REG_X1];
+  struct fpga_region *r = &sys->regions[even ? REG_R2 : REG_R1];
+  sys->results[0] = (double *)&batch->dataBuffer[x->bank][sys->base[x->bank] + x->offset];
+  sys->results[1] = batch->use_residuals ?
+   (double *)&batch->dataBuffer[r->bank][sys->base[r->bank] + r->offset] : NULL;
+}
+
+// failures receives the number of systems without valid results; returns 1
+// if the chain could not be enqueued or failed on the device
+int fpga_batch_run(struct fpga_batch *batch, cl_command_queue commands, int *failures) {
+  struct timespec time_start, time_end;
+  unsigned int result_banks = 0;
+  int err = CL_SUCCESS;
+
+  *failures = 0;
+  if (!batch->parameters_set) {
+    printf("ERROR: %s: the kernel parameters of the batch are not set.\n",__func__);
+    return 1;
+  }
+  if (batch->num_systems == 0) return 0;
+  clock_gettime(CLOCK_REALTIME, &time_start);
+
+  // all the systems in one transfer per data buffer
+  for (int b=0;b<RW_BUF && err==CL_SUCCESS;b++) {
+    if (batch->used[b] == 0) continue;
+    err = clEnqueueWriteBuffer(commands, batch->cldata[b], CL_FALSE, 0, batch->used[b],
+     batch->dataBuffer[b], 0, NULL, NULL);
+  }
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: failed to transfer the data buffers to the device (%d)\n",__func__,err);
+    clFinish(commands);
+    return 1;
+  }
+  for (int k=0;k<batch->num_systems;k++) {
+    struct fpga_batch_system *sys = &batch->systems[k];
+    if (k == 0) {
+      if (fpga_enqueue_to_device_debugbuf(commands, batch->cldebug, batch->debugBuffer,
+       batch->debug_outbuf_words)) err = 1;
+    } else {
+      // the host copy of the debug buffer still holds the fill pattern
+      err = clEnqueueMigrateMemObjects(commands, 1, &batch->cldebug, 0, 0, NULL, NULL);
+    }
+    // the arguments are captured when the run is enqueued
+    if (err == CL_SUCCESS) err = fpga_set_kernel_data_args(batch->kernel, sys->cldata, (1U << RW_BUF) - 1);
+    if (err == CL_SUCCESS) err = clEnqueueTask(commands, batch->kernel, 0, NULL, NULL);
+    if (err == CL_SUCCESS) err = clEnqueueReadBuffer(commands, batch->cldebug, CL_FALSE, 0,
+     batch->debugBufferSize, sys->debugBuffer, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to enqueue the solve of system %d (%d)\n",__func__,k,err);
+      clFinish(commands);
+      return 1;
+    }
+  }
+  // the data buffers of the results (the banks are the same for all the systems)
+  struct fpga_region *regions = batch->systems[0].regions;
+  result_banks |= (1U << regions[REG_X2].bank) | (1U << regions[REG_X1].bank);
+  if (batch->use_residuals) result_banks |= (1U << regions[REG_R2].bank) | (1U << regions[REG_R1].bank);
+  for (int b=0;b<RW_BUF && err==CL_SUCCESS;b++) {
+    if (!(result_banks & (1U << b))) continue;
+    err = clEnqueueReadBuffer(commands, batch->cldata[b], CL_FALSE, 0, batch->used[b],
+     batch->dataBuffer[b], 0, NULL, NULL);
+  }
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: failed to transfer the results from the device (%d)\n",__func__,err);
+    clFinish(commands);
+    return 1;
+  }
+  err = clFinish(commands);
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: the batch failed on the device (%d)\n",__func__,err);
+    return 1;
+  }
+
+  for (int k=0;k<batch->num_systems;k++) {
+    struct fpga_batch_system *sys = &batch->systems[k];
+    fpga_batch_decode(batch, sys);
+    if (sys->failed) (*failures)++;
+  }
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  batch->run_ms = elapsed_ms(&time_start, &time_end);
+  BDA_DEBUG(1,printf("INFO: %s: %d systems solved in %.3lf ms, %.3lf ms per system (%d failed).\n",
+   __func__,batch->num_systems,batch->run_ms,batch->run_ms/batch->num_systems,*failures);)
+  return 0;
+}
+
+// remove all the systems
+void fpga_batch_reset(struct fpga_batch *batch) {
+  for (int k=0;k<batch->num_systems;k++) {
+    for (int b=0;b<RW_BUF;b++) {
+      if (batch->systems[k].cldata[b] != NULL) clReleaseMemObject(batch->systems[k].cldata[b]);
+      batch->systems[k].cldata[b] = NULL;
+    }
+  }
+  memset(batch->used, 0, sizeof(batch->used));
+  batch->num_systems = 0;
+  batch->pack_ms = 0.0;
+}
+
+void fpga_batch_release(struct fpga_batch *batch) {
+  fpga_batch_reset(batch);
+  for (int b=0;b<RW_BUF;b++) {
+    if (batch->cldata[b] != NULL) clReleaseMemObject(batch->cldata[b]);
+    host_free(batch->dataBuffer[b]);
+    batch->cldata[b] = NULL;
+    batch->dataBuffer[b] = NULL;
+  }
+  if (batch->cldebug != NULL) clReleaseMemObject(batch->cldebug);
+  host_free(batch->debugBuffer);
+  host_free(batch->systemDebug);
+  free(batch->systems);
+  batch->cldebug = NULL;
+  batch->debugBuffer = NULL;
+  batch->systemDebug = NULL;
+  batch->systems = NULL;
+}
@@ -0,0 +1,95 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_BATCH_HPP__
+#define __FPGA_BATCH_HPP__
+
+#include <CL/opencl.h>
+
+#include "fpga_functions_bicgstab.hpp"
+
+// --- batch of small independent systems
+// (the systems are packed back to back in one set of data buffers, each with
+// its own layout and setup array, and solved with a single enqueue chain and
+// a single synchronization. The kernel handle belongs to the batch while it
+// runs: its data buffer arguments are set for each system)
+
+// alignment of the systems in the data buffers: the kernel gets sub-buffers
+// starting at the system, and sub-buffers must start at a multiple of the
+// base address alignment of the device (4 KiB with XRT)
+#define BATCH_ALIGN 4096
+
+struct fpga_batch_system {
+  unsigned int base[RW_BUF];          // offset of the system in the data buffers
+  unsigned int size[RW_BUF];          // bytes used by the system (BATCH_ALIGN multiple)
+  struct fpga_region regions[REG_NUM]; // layout of the system, from its base
+  unsigned int result_offsets[6];
+  cl_mem cldata[RW_BUF];              // sub-buffers given to the kernel
+  unsigned long int *debugBuffer;     // debug output of the system (read back after its run)
+  int rows;
+  // results (fpga_batch_run)
+  bool failed;                        // no valid debug output, or the results are not usable
+  unsigned int kernel_cycles;
+  unsigned int kernel_iter_run;       // half iterations (see fpga_copy_from_device_debugbuf)
+  double norms[4];
+  unsigned char last_norm_idx;
+  bool kernel_aborted, kernel_signature, kernel_overflow;
+  bool kernel_noresults, kernel_wrafterend, kernel_dbgfifofull;
+  double *results[2];                 // X and R (with use_residuals) in the host data buffers
+};
+
+struct fpga_batch {
+  cl_context context;
+  cl_kernel kernel;
+  unsigned int config_bits;
+  int nnz_num;
+  unsigned int capacity[RW_BUF];      // size of the data buffers
+  unsigned int used[RW_BUF];          // bytes used by the systems added so far
+  unsigned char *dataBuffer[RW_BUF];  // host copy of the data buffers
+  cl_mem cldata[RW_BUF];              // device data buffers (no host pointer)
+  unsigned int debug_outbuf_words;
+  unsigned int debugBufferSize;
+  unsigned long int *debugBuffer;     // fill pattern of cldebug
+  cl_mem cldebug;
+  unsigned long int *systemDebug;     // debug output of all the systems
+  unsigned int abort_cycles;
+  bool use_residuals;
+  bool parameters_set;
+  int max_systems;
+  int num_systems;
+  struct fpga_batch_system *systems;
+  double pack_ms;                     // packing of the systems added since the last reset
+  double run_ms;                      // last fpga_batch_run: upload, solves and readback
+};
+
+int fpga_batch_create(struct fpga_batch *batch, cl_context context, cl_kernel kernel,
+ unsigned int config_bits, int max_systems, int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, unsigned int debug_outbuf_words);
+int fpga_batch_set_kernel_parameters(struct fpga_batch *batch,
+ unsigned int abort_cycles, unsigned int debug_lines, unsigned int kernel_iter,
+ unsigned int debug_sample_rate, double kernel_precision, bool use_residuals);
+int fpga_batch_add(struct fpga_batch *batch, void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int *index);
+int fpga_batch_run(struct fpga_batch *batch, cl_command_queue commands, int *failures);
+void fpga_batch_reset(struct fpga_batch *batch);
+void fpga_batch_release(struct fpga_batch *batch);
+
+#endif //__FPGA_BATCH_HPP__
@@ -0,0 +1,259 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Block index streams
+
+  The matrices of the reservoir simulator are made of dense blocks (3x3 for
+  black-oil), stored by the colored arrays as scalar entries: each entry has
+  a 16-bit column index (columnIndexArray) and a new row offset byte
+  (newRowOffsetArray, not zero on the first entry of each row: the number of
+  rows advanced). The B rows of a block row then hold the same list of
+  block columns, each expanded to B consecutive column indices. The encoded
+  stream is a sequence of 16-bit records:
+
+  - block record: header 0x8000 | (first_offset << 7) | blocks, followed by
+    the first column index of each block. It expands to B rows of B*blocks
+    entries: the first row starts with first_offset, the others with 1.
+  - literal record: header entries (1..0x7fff), followed by the column
+    indices of the entries and by their new row offsets, two per word (the
+    first one in the low byte).
+
+  The encoder uses block records where the streams follow the block
+  structure and literal records elsewhere (padding, rows not aligned to the
+  blocks), so any stream is encoded and the decoder reproduces it exactly.
+  Column indices are expanded with 16-bit wrap-around, as a 16-bit adder in
+  the reader of the kernel would do. The current bitstream reads the
+  original arrays: the encoder and the decoder model the expansion and give
+  the index bandwidth that a reader with the decoder would save.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fpga_block_index.hpp"
+#include "fpga_layout.hpp"
+#include "bda_utils.hpp"
+
+// -------------------
+// encoder and decoder
+// -------------------
+
+// length of the row starting at pos: up to the next entry with a new row offset
+static unsigned int row_length(unsigned char *nr, unsigned int entries, unsigned int pos) {
+  unsigned int len = 1;
+  while (pos + len < entries && nr[pos + len] == 0) len++;
+  return len;
+}
+
+// checks if the rows starting at pos are a block row, returns the number of blocks
+static unsigned int match_block_row(int block_size, short unsigned int *col, unsigned char *nr,
+ unsigned int entries, unsigned int pos) {
+  unsigned int B = (unsigned int)block_size;
+  unsigned int len = row_length(nr, entries, pos);
+
+  if (len % B != 0 || len / B > BLOCK_INDEX_BLOCKS_MAX || (size_t)pos + (size_t)B * len > entries) return 0;
+  for (unsigned int e=0;e<len;e++) {
+    if (col[pos + e] != (short unsigned int)(col[pos + e - e % B] + e % B)) return 0;
+  }
+  for (unsigned int k=1;k<B;k++) {
+    unsigned int q = pos + k * len;
+    if (nr[q] != 1) return 0;
+    if (memcmp(&col[q], &col[pos], len * sizeof(short unsigned int)) != 0) return 0;
+    for (unsigned int e=1;e<len;e++) {
+      if (nr[q + e] != 0) return 0;
+    }
+  }
+  return len / B;
+}
+
+static void put_literal(short unsigned int *col, unsigned char *nr, unsigned int pos, unsigned int num,
+ struct fpga_block_index *enc) {
+  while (num > 0) {
+    unsigned int n = (num > BLOCK_INDEX_LITERAL_MAX) ? BLOCK_INDEX_LITERAL_MAX : num;
+    enc->stream[enc->words++] = (short unsigned int)n;
+    memcpy(&enc->stream[enc->words], &col[pos], n * sizeof(short unsigned int));
+    enc->words += n;
+    for (unsigned int e=0;e<n;e+=2) {
+      unsigned int hi = (e + 1 < n) ? nr[pos + e + 1] : 0;
+      enc->stream[enc->words++] = (short unsigned int)(nr[pos + e] | (hi << 8));
+    }
+    enc->literal_entries += n;
+    pos += n;
+    num -= n;
+  }
+}
+
+int fpga_block_index_encode(int block_size, short unsigned int *columnIndexArray,
+ unsigned char *newRowOffsetArray, unsigned int entries, struct fpga_block_index *enc)
+{
+  unsigned int B = (unsigned int)block_size;
+  unsigned int pos = 0, literal_start = 0;
+
+  memset(enc, 0, sizeof(struct fpga_block_index));
+  if (block_size < BLOCK_INDEX_SIZE_MIN || block_size > BLOCK_INDEX_SIZE_MAX) {
+    printf("ERROR: %s: block size %d is not supported (%d-%d).\n",__func__,block_size,
+     BLOCK_INDEX_SIZE_MIN,BLOCK_INDEX_SIZE_MAX);
+    return 1;
+  }
+  // worst case: all entries in literal records
+  size_t max_words = (size_t)entries + entries / 2 + entries / BLOCK_INDEX_LITERAL_MAX + 2;
+  enc->stream = (short unsigned int *)malloc(max_words * sizeof(short unsigned int));
+  if (enc->stream == NULL) {
+    printf("ERROR: %s: cannot allocate the stream for %u entries.\n",__func__,entries);
+    return 1;
+  }
+  enc->block_size = block_size;
+  enc->entries = entries;
+
+  while (pos < entries) {
+    unsigned int blocks = match_block_row(block_size, columnIndexArray, newRowOffsetArray, entries, pos);
+    if (blocks == 0) {
+      pos += row_length(newRowOffsetArray, entries, pos);
+      continue;
+    }
+    put_literal(columnIndexArray, newRowOffsetArray, literal_start, pos - literal_start, enc);
+    enc->stream[enc->words++] = (short unsigned int)(BLOCK_INDEX_RECORD_BLOCK |
+     (newRowOffsetArray[pos] << 7) | blocks);
+    for (unsigned int j=0;j<blocks;j++) enc->stream[enc->words++] = columnIndexArray[pos + j * B];
+    enc->block_records++;
+    pos += B * B * blocks;
+    literal_start = pos;
+  }
+  put_literal(columnIndexArray, newRowOffsetArray, literal_start, entries - literal_start, enc);
+  return 0;
+}
+
+int fpga_block_index_decode(struct fpga_block_index *enc,
+ short unsigned int *columnIndexArray, unsigned char *newRowOffsetArray)
+{
+  unsigned int B = (unsigned int)enc->block_size;
+  unsigned int w = 0, pos = 0;
+
+  while (w < enc->words) {
+    unsigned int header = enc->stream[w++];
+    if (header & BLOCK_INDEX_RECORD_BLOCK) {
+      unsigned int blocks = header & BLOCK_INDEX_BLOCKS_MAX;
+      unsigned int first_offset = (header >> 7) & 0xff;
+      if (blocks == 0 || w + blocks > enc->words || pos + B * B * blocks > enc->entries) {
+        printf("ERROR: %s: invalid block record at word %u.\n",__func__,w-1);
+        return 1;
+      }
+      for (unsigned int k=0;k<B;k++) {
+        for (unsigned int j=0;j<blocks;j++) {
+          for (unsigned int m=0;m<B;m++) {
+            columnIndexArray[pos] = (short unsigned int)(enc->stream[w + j] + m);
+            newRowOffsetArray[pos] = (j == 0 && m == 0) ? ((k == 0) ? first_offset : 1) : 0;
+            pos++;
+          }
+        }
+      }
+      w += blocks;
+    } else {
+      unsigned int n = header;
+      if (n == 0 || w + n + (n + 1) / 2 > enc->words || pos + n > enc->entries) {
+        printf("ERROR: %s: invalid literal record at word %u.\n",__func__,w-1);
+        return 1;
+      }
+      memcpy(&columnIndexArray[pos], &enc->stream[w], n * sizeof(short unsigned int));
+      w += n;
+      for (unsigned int e=0;e<n;e++) {
+        newRowOffsetArray[pos + e] = (enc->stream[w + e / 2] >> (8 * (e % 2))) & 0xff;
+      }
+      w += (n + 1) / 2;
+      pos += n;
+    }
+  }
+  if (pos != enc->entries) {
+    printf("ERROR: %s: the stream holds %u entries instead of %u.\n",__func__,pos,enc->entries);
+    return 1;
+  }
+  return 0;
+}
+
+void fpga_block_index_free(struct fpga_block_index *enc) {
+  free(enc->stream);
+  enc->stream = NULL;
+  enc->words = 0;
+}
+
+// ----------------------
+// index bandwidth report
+// ----------------------
+
+int fpga_block_index_report(void **vectorPointers, int *vectorSizes, int block_size)
+{
+  const char *names[3] = {"A", "L", "U"};
+  double total_before = 0.0, total_after = 0.0, read_saved = 0.0;
+
+  printf("INFO: %s: block index streams (%dx%d blocks):\n",__func__,block_size,block_size);
+  printf("INFO: %s:  matrix    entries  index bytes  encoded bytes  ratio  in blocks  encode (ms)\n",__func__);
+  for (int m=0;m<3;m++) {
+    short unsigned int *col = (short unsigned int *)vectorPointers[3 + 6 * m];
+    unsigned char *nr = (unsigned char *)vectorPointers[4 + 6 * m];
+    int columns = vectorSizes[1 + 6 * m], newrows = vectorSizes[4 + 6 * m];
+    struct fpga_block_index enc;
+    struct timespec time_start, time_end;
+
+    if (columns != newrows) {
+      // the streams can be merged only with one new row offset per column index
+      printf("INFO: %s:  %-6s not encoded: %d column indices, %d new row offsets\n",
+       __func__,names[m],columns,newrows);
+      continue;
+    }
+    clock_gettime(CLOCK_REALTIME, &time_start);
+    if (fpga_block_index_encode(block_size, col, nr, (unsigned int)columns, &enc)) return 1;
+    clock_gettime(CLOCK_REALTIME, &time_end);
+
+    // the decoded streams must be identical to the original ones
+    short unsigned int *dec_col = (short unsigned int *)malloc(sizeof(short unsigned int) * (columns + 1));
+    unsigned char *dec_nr = (unsigned char *)malloc(columns + 1);
+    int rc = (dec_col == NULL || dec_nr == NULL);
+    if (rc) printf("ERROR: %s: cannot allocate the decoded streams of %s.\n",__func__,names[m]);
+    if (!rc) rc = fpga_block_index_decode(&enc, dec_col, dec_nr);
+    if (!rc && (memcmp(dec_col, col, sizeof(short unsigned int) * columns) != 0 || memcmp(dec_nr, nr, columns) != 0)) {
+      printf("ERROR: %s: the decoded streams of %s differ from the original ones.\n",__func__,names[m]);
+      rc = 1;
+    }
+    free(dec_col);
+    free(dec_nr);
+    if (rc) {
+      fpga_block_index_free(&enc);
+      return 1;
+    }
+
+    double before = (sizeof(short unsigned int) + sizeof(unsigned char)) * (double)columns;
+    double after = sizeof(short unsigned int) * (double)enc.words;
+    total_before += before;
+    total_after += after;
+    // the encoded stream is read as often as the column indices
+    read_saved += fpga_region_traffic(REG_COL_INDEX + m) * (sizeof(short unsigned int) * (double)columns - after) +
+     fpga_region_traffic(REG_NR_OFFSET + m) * (double)columns;
+    printf("INFO: %s:  %-6s %10d  %11.0lf  %13.0lf  %4.1lfx  %8.1lf%%  %11.3lf\n",
+     __func__,names[m],columns,before,after,(after > 0.0) ? before/after : 1.0,
+     (columns > 0) ? 100.0 * (columns - enc.literal_entries) / columns : 0.0,
+     elapsed_ms(&time_start, &time_end));
+    fpga_block_index_free(&enc);
+  }
+  printf("INFO: %s:  total: %.0lf encoded bytes instead of %.0lf (%.1lfx), %.0lf bytes saved on the reads of the kernel per iteration\n",
+   __func__,total_after,total_before,(total_after > 0.0) ? total_before/total_after : 1.0,read_saved);
+  return 0;
+}
@@ -0,0 +1,56 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_BLOCK_INDEX_HPP__
+#define __FPGA_BLOCK_INDEX_HPP__
+
+// --- block index streams
+// (one column index per dense block instead of one column index and one new
+// row offset per scalar entry; the stream is expanded on the fly by the reader)
+
+#define BLOCK_INDEX_SIZE_MIN       2
+#define BLOCK_INDEX_SIZE_MAX       4
+// limits of the records of the stream
+#define BLOCK_INDEX_RECORD_BLOCK   0x8000   // header flag of the block records
+#define BLOCK_INDEX_BLOCKS_MAX     127      // blocks per row in a block record
+#define BLOCK_INDEX_LITERAL_MAX    0x7fff   // entries in a literal record
+
+// encoded column indices and new row offsets of one matrix
+struct fpga_block_index {
+  int block_size;                 // rows and columns of the dense blocks
+  unsigned int entries;           // scalar entries of the original streams
+  unsigned int words;             // 16-bit words of the encoded stream
+  unsigned int block_records;     // block rows encoded as block records
+  unsigned int literal_entries;   // entries stored as they are (not in blocks)
+  short unsigned int *stream;     // encoded stream (words elements)
+};
+
+int fpga_block_index_encode(int block_size, short unsigned int *columnIndexArray,
+ unsigned char *newRowOffsetArray, unsigned int entries, struct fpga_block_index *enc);
+int fpga_block_index_decode(struct fpga_block_index *enc,
+ short unsigned int *columnIndexArray, unsigned char *newRowOffsetArray);
+void fpga_block_index_free(struct fpga_block_index *enc);
+
+// --- index bandwidth report
+// (encodes the index arrays of A, L and U, checks that the decoder reproduces
+// them and prints the bytes saved)
+
+int fpga_block_index_report(void **vectorPointers, int *vectorSizes, int block_size);
+
+#endif //__FPGA_BLOCK_INDEX_HPP__
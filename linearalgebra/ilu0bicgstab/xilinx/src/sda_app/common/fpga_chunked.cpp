@@ -0,0 +1,241 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Chunked solve
+
+  The iterations of a kernel run are limited by the 16 bits of kernel_iter,
+  and the host learns nothing about a run before it ends: a stagnating solve
+  uses its whole budget. Here the solve is split in runs (chunks) of
+  chunk_iter iterations. After each chunk, the norms of the debug buffer are
+  checked against the tolerance and the stagnation and divergence ratios of
+  the policy; the solve either stops, or continues with a new run.
+
+  The kernel solves A x = b from the initial guess in X1, with the
+  right-hand side b in R1: its first steps compute v = A X1 and the initial
+  residual R1 - v. A new run therefore restarts the BiCGSTAB from the
+  solution of the previous chunk: X1 is replaced by that solution and R1
+  keeps b. Only the X1 region is uploaded again, the matrix, the
+  preconditioner and the right-hand side stay on the device.
+
+  The kernel precision of a chunk is relative to the initial norm of that
+  chunk: it is set to tolerance * initial norm / current norm, so that the
+  kernel stops at the tolerance of the whole solve.
+
+  The decisions between the chunks (fpga_chunked_run) are separated from the
+  runs, so that they can be driven by a host model of the kernel (see
+  tools/chunked_bench.cpp); fpga_chunked_solve drives the kernel.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <CL/opencl.h>
+
+#include "fpga_chunked.hpp"
+#include "fpga_solve.hpp"
+#include "fpga_layout.hpp"
+#include "bda_utils.hpp"
+
+const char *fpga_chunked_status_name(int status) {
+  switch (status) {
+    case CHUNKED_CONVERGED: return "converged";
+    case CHUNKED_MAX_ITER:  return "max iterations";
+    case CHUNKED_STAGNATED: return "stagnated";
+    case CHUNKED_DIVERGED:  return "diverged";
+    case CHUNKED_ABORTED:   return "aborted";
+    case CHUNKED_FAILED:    return "failed";
+    default:                return "unknown";
+  }
+}
+
+// status after a chunk with results, or -1 if the solve continues
+static int fpga_chunked_check(const struct fpga_chunk_policy *policy, const struct fpga_chunk_run *run,
+ unsigned int iter_done, struct fpga_chunked_result *result) {
+  double norm = result->final_norm;
+  if (run->overflow || !isfinite(norm)) return CHUNKED_DIVERGED;
+  if (result->rel_norm <= policy->tolerance) return CHUNKED_CONVERGED;
+  if (run->aborted) return CHUNKED_ABORTED;
+  if (result->rel_norm > policy->divergence_ratio) return CHUNKED_DIVERGED;
+  if (iter_done >= policy->max_iter) return CHUNKED_MAX_ITER;
+  if (norm > policy->stagnation_ratio * run->initial_norm) return CHUNKED_STAGNATED;
+  return -1;
+}
+
+// ------------------------------------
+// decisions between the chunks
+// ------------------------------------
+
+// x is the initial guess, and receives the solution of the last chunk with
+// results; r receives its residual (it is not written if no chunk has
+// results). Returns 1 on invalid arguments only: the end of the solve is
+// given by result->status
+int fpga_chunked_run(const struct fpga_chunk_policy *policy, fpga_chunk_runner runner, void *data,
+ double *x, double *r, struct fpga_chunked_result *result)
+{
+  struct timespec time_start, time_end;
+  struct fpga_chunk_run run;
+  unsigned int iter_done = 0;
+  double precision = policy->tolerance;
+
+  memset(result, 0, sizeof(struct fpga_chunked_result));
+  result->status = CHUNKED_FAILED;
+  if (policy->chunk_iter < 1 || policy->chunk_iter > 0xFFFF || policy->max_iter < 1) {
+    printf("ERROR: %s: chunks of 1 to 65535 iterations and at least one iteration are needed (%u, %u).\n",
+     __func__,policy->chunk_iter,policy->max_iter);
+    return 1;
+  }
+  if (!(policy->tolerance > 0.0 && policy->tolerance < 1.0)) {
+    printf("ERROR: %s: the tolerance must be between 0 and 1 (%le).\n",__func__,policy->tolerance);
+    return 1;
+  }
+  if (x == NULL || r == NULL) {
+    printf("ERROR: %s: the solution and the residual arrays are needed.\n",__func__);
+    return 1;
+  }
+  clock_gettime(CLOCK_REALTIME, &time_start);
+
+  while (true) {
+    unsigned int iter = policy->max_iter - iter_done;
+    if (iter > policy->chunk_iter) iter = policy->chunk_iter;
+    result->chunks++;
+    iter_done += iter;
+    memset(&run, 0, sizeof(struct fpga_chunk_run));
+    if (runner(data, result->chunks, iter, precision, x, r, &run) || run.failed) {
+      printf("ERROR: %s: the solve of chunk %d failed.\n",__func__,result->chunks);
+      break;
+    }
+    if (result->chunks == 1) result->initial_norm = run.initial_norm;
+    result->kernel_ms += run.kernel_ms;
+    if (run.noresults) {
+      // the solution of the previous chunk (or the initial guess) is already
+      // precise enough
+      if (result->chunks == 1) {
+        result->final_norm = run.initial_norm;
+        result->rel_norm = 1.0;
+      }
+      result->status = CHUNKED_CONVERGED;
+      break;
+    }
+    result->iterations += run.iterations;
+    result->final_norm = run.final_norm;
+    result->rel_norm = result->final_norm / result->initial_norm;
+    BDA_DEBUG(1,printf("INFO: %s: chunk %d: %.1f iterations, norm %le (relative %le).\n",
+     __func__,result->chunks,run.iterations,result->final_norm,result->rel_norm);)
+
+    int status = fpga_chunked_check(policy, &run, iter_done, result);
+    if (status >= 0) {
+      result->status = status;
+      break;
+    }
+    precision = policy->tolerance / result->rel_norm;
+  }
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  result->solve_ms = elapsed_ms(&time_start, &time_end);
+  BDA_DEBUG(1,printf("INFO: %s: %s after %d chunks, %.1f iterations, relative norm %le, %.3lf ms.\n",
+   __func__,fpga_chunked_status_name(result->status),result->chunks,result->iterations,
+   result->rel_norm,result->solve_ms);)
+  return 0;
+}
+
+// -----------------------------
+// solve a system in chunks
+// -----------------------------
+
+struct fpga_chunked_device {
+  cl_command_queue commands;
+  cl_kernel kernel;
+  struct fpga_bufset *bufset;
+  cl_mem cldebug;
+  unsigned long int *debugBuffer;
+  unsigned int debug_outbuf_words;
+  unsigned int abort_cycles;
+  unsigned int debug_lines;
+  unsigned int debug_sample_rate;
+  void **vectorPointers;
+  int *vectorSizes;
+  int *nnzValArrays_sizes;
+  int *L_nnzValArrays_sizes;
+  int *U_nnzValArrays_sizes;
+};
+
+// a kernel run (fpga_chunk_runner); the first chunk starts from the system
+// in the pool, the next ones from x
+static int fpga_chunked_device_run(void *data, int chunk, unsigned int iter, double precision,
+ double *x, double *r, struct fpga_chunk_run *run) {
+  struct fpga_chunked_device *dev = (struct fpga_chunked_device *)data;
+  struct fpga_bufset *bufset = dev->bufset;
+  struct fpga_solve solve;
+  void *continuation[21];
+  int rows = dev->vectorSizes[0];
+
+  if (chunk > 1) {
+    // the new initial guess: R1 keeps the right-hand side
+    memcpy(continuation, dev->vectorPointers, sizeof(continuation));
+    continuation[20] = x;
+    if (fpga_bufset_update(bufset, REG_BIT(REG_X1), continuation, dev->vectorSizes,
+     dev->nnzValArrays_sizes, dev->L_nnzValArrays_sizes, dev->U_nnzValArrays_sizes)) return 1;
+  }
+  if (fpga_set_kernel_parameters(dev->kernel, dev->abort_cycles, dev->debug_lines, iter,
+   dev->debug_sample_rate, precision, bufset->cldata, dev->cldebug)) return 1;
+  bufset->rebind_mask = 0;
+  if (fpga_solve_submit(&solve, dev->commands, dev->kernel, bufset, dev->cldebug, dev->debugBuffer,
+   dev->debug_outbuf_words, dev->abort_cycles, true, NULL, NULL) || fpga_solve_wait(&solve)) {
+    fpga_solve_release(&solve);
+    return 1;
+  }
+  // the results and the flags of the kernel are cleared by the release
+  run->noresults = solve.kernel_noresults;
+  run->overflow = solve.kernel_overflow;
+  run->aborted = solve.kernel_aborted;
+  run->initial_norm = solve.norms[0];
+  run->final_norm = solve.norms[solve.last_norm_idx];
+  run->iterations = solve.kernel_iter_run/2.0+0.5;
+  run->kernel_ms = solve.kernel_ms;
+  if (!solve.kernel_noresults) {
+    memcpy(x, solve.results[0], sizeof(double) * rows);
+    memcpy(r, solve.results[1], sizeof(double) * rows);
+  }
+  fpga_solve_release(&solve);
+  return 0;
+}
+
+// x and r (vectorSizes[0] elements) receive the solution and the residual of
+// the last chunk with results; x is the initial guess (vectorPointers[20]) and
+// r is not written if no chunk has results. The pool is owned by the solve until it returns, and
+// its kernel parameters are changed. Returns 1 on invalid arguments only: the
+// end of the solve is given by result->status
+int fpga_chunked_solve(cl_command_queue commands, cl_kernel kernel, struct fpga_bufset *bufset,
+ cl_mem cldebug, unsigned long int *debugBuffer, unsigned int debug_outbuf_words,
+ unsigned int abort_cycles, unsigned int debug_lines, unsigned int debug_sample_rate,
+ const struct fpga_chunk_policy *policy,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ double *x, double *r, struct fpga_chunked_result *result)
+{
+  struct fpga_chunked_device dev = {commands, kernel, bufset, cldebug, debugBuffer, debug_outbuf_words,
+   abort_cycles, debug_lines, debug_sample_rate, vectorPointers, vectorSizes,
+   nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes};
+  int rows = vectorSizes[0];
+
+  if (x != NULL && x != vectorPointers[20]) memcpy(x, vectorPointers[20], sizeof(double) * rows);
+  return fpga_chunked_run(policy, fpga_chunked_device_run, &dev, x, r, result);
+}
@@ -0,0 +1,91 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_CHUNKED_HPP__
+#define __FPGA_CHUNKED_HPP__
+
+#include <CL/opencl.h>
+
+#include "fpga_functions_bicgstab.hpp"
+
+// --- chunked solve
+// (the kernel is launched for chunk_iter iterations at a time; after each
+// launch the norms of the debug buffer decide whether the solve stops or
+// restarts from the current solution, which is the only region uploaded
+// again. The system must be in the data buffers pool (fpga_bufset_update)
+// before fpga_chunked_solve, which sets the kernel parameters for each
+// launch)
+
+// end of a chunked solve
+#define CHUNKED_CONVERGED   0   // relative norm below the tolerance
+#define CHUNKED_MAX_ITER    1   // max_iter iterations run
+#define CHUNKED_STAGNATED   2   // a chunk reduced the norm by less than the stagnation ratio
+#define CHUNKED_DIVERGED    3   // norm above the divergence ratio, not finite, or overflow
+#define CHUNKED_ABORTED     4   // the kernel was stopped by abort_cycles
+#define CHUNKED_FAILED      5   // the solve of a chunk failed (no valid debug output)
+
+struct fpga_chunk_policy {
+  unsigned int chunk_iter;            // iterations per launch (1 to 65535)
+  unsigned int max_iter;              // iterations of the whole solve
+  double tolerance;                   // norm relative to the initial norm
+  double stagnation_ratio;            // stop if norm(end of chunk)/norm(start of chunk) is above
+  double divergence_ratio;            // stop if norm/initial norm is above
+};
+
+struct fpga_chunked_result {
+  int status;                         // CHUNKED_*
+  int chunks;                         // kernel launches
+  double iterations;
+  double initial_norm;                // norm at the start of the first chunk
+  double final_norm;                  // last norm of the last chunk with results
+  double rel_norm;                    // final_norm / initial_norm
+  double kernel_ms;                   // device time of the kernels (0 without queue profiling)
+  double solve_ms;                    // whole solve, with the uploads between the chunks
+};
+
+// outcome of a chunk
+struct fpga_chunk_run {
+  bool failed;                        // no valid output
+  bool noresults;                     // the initial guess is precise enough: x and r not written
+  bool overflow;
+  bool aborted;
+  double initial_norm;                // norm of the residual of the initial guess
+  double final_norm;
+  double iterations;
+  double kernel_ms;
+};
+
+// runs a chunk of at most iter iterations from the initial guess x, until the
+// norm is below precision times the initial norm; x and r receive the
+// solution and its residual. Returns 1 if the chunk cannot be run
+typedef int (*fpga_chunk_runner)(void *data, int chunk, unsigned int iter, double precision,
+ double *x, double *r, struct fpga_chunk_run *run);
+
+const char *fpga_chunked_status_name(int status);
+int fpga_chunked_run(const struct fpga_chunk_policy *policy, fpga_chunk_runner runner, void *data,
+ double *x, double *r, struct fpga_chunked_result *result);
+int fpga_chunked_solve(cl_command_queue commands, cl_kernel kernel, struct fpga_bufset *bufset,
+ cl_mem cldebug, unsigned long int *debugBuffer, unsigned int debug_outbuf_words,
+ unsigned int abort_cycles, unsigned int debug_lines, unsigned int debug_sample_rate,
+ const struct fpga_chunk_policy *policy,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ double *x, double *r, struct fpga_chunked_result *result);
+
+#endif //__FPGA_CHUNKED_HPP__
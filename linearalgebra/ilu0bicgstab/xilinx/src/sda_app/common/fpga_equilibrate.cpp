@@ -0,0 +1,267 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Row and column equilibration
+
+  The equations of the reservoir Jacobians (pressure, saturations) have very
+  different scales, which costs iterations to the solver. The system solved
+  by the kernel is scaled: A' = Dr A Dc, b' = Dr b, x = Dc x'. Dr makes the
+  largest entry of each row (block row) of A about 1, then Dc does the same
+  for the columns (block columns) of Dr A. The factors are rounded to powers
+  of 2, so scaling and unscaling don't change the mantissas.
+
+  This is a host model (see tools/equil_bench.cpp): with powers of 2, the
+  ILU0-preconditioned BiCGSTAB runs the same iterations on the scaled
+  system, up to the norm of the stopping test, so the device systems are not
+  scaled.
+
+  The ILU0 factors of A' are the scaled factors of A, so the factors computed
+  by the host for A are scaled too: with A ~ (I + L)(D + U) and the block
+  diagonal holding the inverses of the diagonal blocks of D + U,
+    L' = Dr L Dr^-1,  U' = Dr U Dc,  inv(D')= Dc^-1 inv(D) Dr^-1
+  (the blocks of the block diagonal are stored by rows). The initial guess
+  X1 is scaled by Dc^-1 and the right-hand side R1 by Dr.
+
+  The factors are computed from the values of A, walking the column indices
+  and the new row offsets (the rows are numbered by the new row offsets, as
+  the reader of the kernel does: the value of an entry is the number of rows
+  advanced); fpga_equilibration_scale scales a chunk of a stream from the
+  row stored every EQUIL_ROW_STEP entries, as a packer would.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fpga_equilibrate.hpp"
+#include "fpga_layout.hpp"
+#include "bda_utils.hpp"
+
+// power of 2 closest to 1/m from below: m times the factor is in [0.5, 1)
+static double fpga_equil_factor(double m) {
+  int e;
+  if (m == 0.0 || !isfinite(m)) return 1.0;
+  frexp(m, &e);
+  return ldexp(1.0, -e);
+}
+
+// with block scaling, all the rows of a block get the max of the block
+static void fpga_equil_block_max(double *max, int rows, int block_size) {
+  for (int i=0;i<rows;i+=block_size) {
+    double m = 0.0;
+    for (int k=0;k<block_size;k++) m = (max[i+k] > m) ? max[i+k] : m;
+    for (int k=0;k<block_size;k++) max[i+k] = m;
+  }
+}
+
+static int fpga_equil_grow(const char *caller, void **ptr, int *capacity, int num, size_t elem_bytes) {
+  if (num <= *capacity && *ptr != NULL) return 0;
+  free(*ptr);
+  *ptr = malloc(elem_bytes * (num > 0 ? num : 1));
+  *capacity = 0;
+  if (*ptr == NULL) {
+    printf("ERROR: %s: cannot allocate %d elements.\n",caller,num);
+    return 1;
+  }
+  *capacity = num;
+  return 0;
+}
+
+// walk the stream of matrix m: check the rows and the columns and store the
+// row of every EQUIL_ROW_STEP-th entry; with values, get the max of the rows
+// (col_max NULL) or of the scaled columns
+static int fpga_equil_walk(struct fpga_equilibration *eq, int m, const double *vals,
+ double *row_max, double *col_max) {
+  int row = -1;
+  for (int e=0;e<eq->entries[m];e++) {
+    row += eq->nr[m][e];
+    int c = eq->col[m][e];
+    if (row < 0 || row >= eq->rows || c >= eq->rows) {
+      printf("ERROR: %s: entry %d of matrix %d out of the system: row %d, column %d (%d rows).\n",
+       __func__,e,m,row,c,eq->rows);
+      return 1;
+    }
+    if (e % EQUIL_ROW_STEP == 0) eq->step_rows[m][e / EQUIL_ROW_STEP] = row;
+    if (vals == NULL) continue;
+    double a = fabs(vals[e]);
+    if (col_max == NULL) {
+      if (a > row_max[row]) row_max[row] = a;
+    } else {
+      a *= eq->row_scale[row];
+      if (a > col_max[c]) col_max[c] = a;
+    }
+  }
+  return 0;
+}
+
+// compute the scale factors from the values of A; the nnz values must not be
+// split, and each stream must have one column index and one new row offset
+// per value (see the supported systems in fpga_equilibrate.hpp)
+int fpga_equilibration_compute(struct fpga_equilibration *eq, int mode,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num)
+{
+  int *sizes[3] = {nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes};
+  int rows = vectorSizes[0];
+
+  if (mode != EQUIL_SCALAR && mode != EQUIL_BLOCK) {
+    printf("ERROR: %s: unknown equilibration mode %d.\n",__func__,mode);
+    return 1;
+  }
+  if (nnzValArrays_num != 1) {
+    printf("ERROR: %s: equilibration needs whole nnz values (%d parts).\n",__func__,nnzValArrays_num);
+    return 1;
+  }
+  int block_size = (rows > 0) ? vectorSizes[5] / rows : 0;
+  if (rows <= 0 || block_size < 1 || vectorSizes[5] != rows * block_size || rows % block_size != 0) {
+    printf("ERROR: %s: %d rows do not match a block diagonal of %d elements.\n",__func__,rows,vectorSizes[5]);
+    return 1;
+  }
+  eq->mode = mode;
+  eq->block_size = block_size;
+  eq->rows = rows;
+  for (int m=0;m<3;m++) {
+    eq->col[m] = (const short unsigned int *)vectorPointers[3 + 6*m];
+    eq->nr[m] = (const unsigned char *)vectorPointers[4 + 6*m];
+    eq->entries[m] = vectorSizes[1 + 6*m];
+    if (vectorSizes[4 + 6*m] != eq->entries[m] || sizes[m][0] != eq->entries[m]) {
+      printf("ERROR: %s: matrix %d has %d values, %d column indices and %d new row offsets: "
+       "only single color systems without padding can be equilibrated.\n",
+       __func__,m,sizes[m][0],eq->entries[m],vectorSizes[4 + 6*m]);
+      return 1;
+    }
+    if (fpga_equil_grow(__func__, (void **)&eq->step_rows[m], &eq->step_capacity[m],
+     eq->entries[m] / EQUIL_ROW_STEP + 1, sizeof(int))) return 1;
+  }
+  int capacity = eq->capacity;
+  if (fpga_equil_grow(__func__, (void **)&eq->row_scale, &capacity, rows, sizeof(double)) ||
+      fpga_equil_grow(__func__, (void **)&eq->col_scale, &eq->capacity, rows, sizeof(double))) return 1;
+  double *max = (double *)calloc(rows, sizeof(double));
+  if (max == NULL) {
+    printf("ERROR: %s: cannot allocate %d rows.\n",__func__,rows);
+    return 1;
+  }
+
+  // rows, then columns of the scaled rows
+  const double *vals = ((double **)vectorPointers[2])[0];
+  int rc = fpga_equil_walk(eq, 0, vals, max, NULL);
+  if (rc == 0) {
+    if (mode == EQUIL_BLOCK) fpga_equil_block_max(max, rows, block_size);
+    for (int i=0;i<rows;i++) eq->row_scale[i] = fpga_equil_factor(max[i]);
+    memset(max, 0, sizeof(double) * rows);
+    rc = fpga_equil_walk(eq, 0, vals, NULL, max);
+  }
+  if (rc == 0) {
+    if (mode == EQUIL_BLOCK) fpga_equil_block_max(max, rows, block_size);
+    for (int i=0;i<rows;i++) eq->col_scale[i] = fpga_equil_factor(max[i]);
+    // only the rows of the factors are needed
+    rc = fpga_equil_walk(eq, 1, NULL, NULL, NULL) || fpga_equil_walk(eq, 2, NULL, NULL, NULL);
+  }
+  free(max);
+  if (rc) return 1;
+
+  BDA_DEBUG(1,
+    double range[4];
+    range[0] = range[2] = HUGE_VAL;
+    range[1] = range[3] = 0.0;
+    for (int i=0;i<rows;i++) {
+      range[0] = fmin(range[0], eq->row_scale[i]);
+      range[1] = fmax(range[1], eq->row_scale[i]);
+      range[2] = fmin(range[2], eq->col_scale[i]);
+      range[3] = fmax(range[3], eq->col_scale[i]);
+    }
+    printf("INFO: %s: %s scaling of %d rows (blocks of %d): rows %.3le-%.3le, columns %.3le-%.3le\n",
+     __func__,(mode == EQUIL_BLOCK) ? "block" : "scalar",rows,block_size,range[0],range[1],range[2],range[3]);
+  )
+  return 0;
+}
+
+// scale num elements of a region, starting from element first of its input,
+// into dst (doubles, or floats if to_float)
+void fpga_equilibration_scale(const struct fpga_equilibration *eq, int region,
+ const double *src, void *dst, bool to_float, size_t first, size_t num)
+{
+  const double *rs = eq->row_scale, *cs = eq->col_scale;
+  int B = eq->block_size, m = -1;
+  size_t row = 0;
+
+  if (region == REG_NNZ_VALS) m = 0;
+  else if (region == REG_L_NNZ_VALS) m = 1;
+  else if (region == REG_U_NNZ_VALS) m = 2;
+  if (m >= 0) {
+    // row of the first entry, from the nearest stored one
+    size_t e = (first / EQUIL_ROW_STEP) * EQUIL_ROW_STEP;
+    row = eq->step_rows[m][first / EQUIL_ROW_STEP];
+    for (e=e+1;e<=first;e++) row += eq->nr[m][e];
+  }
+  for (size_t i=0;i<num;i++) {
+    size_t e = first + i;
+    double f;
+    if (m >= 0) {
+      if (i > 0) row += eq->nr[m][e];
+      int c = eq->col[m][e];
+      f = (m == 1) ? rs[row] / rs[c] : rs[row] * cs[c];
+    } else if (region == REG_BLKD) {
+      size_t blk = e / (B*B), k = e % (B*B);
+      f = 1.0 / (cs[blk*B + k/B] * rs[blk*B + k%B]);
+    } else if (region == REG_R1) {
+      f = rs[e];
+    } else {
+      f = 1.0 / cs[e];  // REG_X1
+    }
+    if (to_float) ((float *)dst)[i] = (float)(src[i] * f);
+    else ((double *)dst)[i] = src[i] * f;
+  }
+}
+
+// unscale the solution (REG_X1, REG_X2: x = Dc x') or the residual (REG_R1,
+// REG_R2: r = Dr^-1 r') read from the device; src and dst can be the same
+int fpga_equilibration_unscale(const struct fpga_equilibration *eq, int region,
+ const double *src, double *dst, int num)
+{
+  if (num > eq->rows) {
+    printf("ERROR: %s: %d elements for a system of %d rows.\n",__func__,num,eq->rows);
+    return 1;
+  }
+  if (region == REG_X1 || region == REG_X2) {
+    for (int i=0;i<num;i++) dst[i] = src[i] * eq->col_scale[i];
+  } else if (region == REG_R1 || region == REG_R2) {
+    for (int i=0;i<num;i++) dst[i] = src[i] / eq->row_scale[i];
+  } else {
+    printf("ERROR: %s: region %s is not a result.\n",__func__,fpga_region_name(region));
+    return 1;
+  }
+  return 0;
+}
+
+void fpga_equilibration_free(struct fpga_equilibration *eq) {
+  free(eq->row_scale);
+  free(eq->col_scale);
+  eq->row_scale = NULL;
+  eq->col_scale = NULL;
+  eq->capacity = 0;
+  for (int m=0;m<3;m++) {
+    free(eq->step_rows[m]);
+    eq->step_rows[m] = NULL;
+    eq->step_capacity[m] = 0;
+  }
+}
@@ -0,0 +1,72 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_EQUILIBRATE_HPP__
+#define __FPGA_EQUILIBRATE_HPP__
+
+// --- row and column equilibration (host model)
+// (Dr A Dc y = Dr b, then x = Dc y, on the streams of the kernel; used by
+// tools/equil_bench.cpp with the host reference solver. It is not applied to
+// the device systems: the factors are powers of 2, so the ILU0-preconditioned
+// iterations are those of the unscaled system, and the streams of colored
+// systems, whose new row offsets are padded at the end of each color, are
+// not supported)
+//
+// Supported streams: the row of each value is found by walking the new row
+// offsets, which must be one per value (vectorSizes[4+6m] ==
+// vectorSizes[1+6m]): one color without padding, as the natural-order streams
+// of the tools. Split nnz values (nnzValArrays_num > 1) and block diagonals
+// that are not rows * block size elements are rejected too.
+
+// scale factors
+#define EQUIL_SCALAR  1   // one factor per scalar row and column
+#define EQUIL_BLOCK   2   // one factor per block row and column
+
+// the row of every EQUIL_ROW_STEP-th entry of the streams is stored, so that
+// the packing of a chunk of values starts without reading the previous ones
+#define EQUIL_ROW_STEP 4096
+
+// must be zeroed before the first fpga_equilibration_compute
+struct fpga_equilibration {
+  int mode;                             // EQUIL_SCALAR or EQUIL_BLOCK
+  int block_size;                       // rows of the blocks of the block diagonal
+  int rows;
+  int capacity;                         // allocated rows
+  double *row_scale;                    // Dr (powers of 2)
+  double *col_scale;                    // Dc (powers of 2)
+  // streams of A, L and U: pointers to the input arrays, which must stay
+  // valid until the values are scaled
+  const short unsigned int *col[3];
+  const unsigned char *nr[3];
+  int entries[3];
+  int *step_rows[3];                    // row of the entries multiple of EQUIL_ROW_STEP
+  int step_capacity[3];
+};
+
+int fpga_equilibration_compute(struct fpga_equilibration *eq, int mode,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num);
+void fpga_equilibration_scale(const struct fpga_equilibration *eq, int region,
+ const double *src, void *dst, bool to_float, size_t first, size_t num);
+int fpga_equilibration_unscale(const struct fpga_equilibration *eq, int region,
+ const double *src, double *dst, int num);
+void fpga_equilibration_free(struct fpga_equilibration *eq);
+
+#endif //__FPGA_EQUILIBRATE_HPP__
@@ -33,6 +33,15 @@
     --sp=${KERNEL}_1.m04_axi:HBM[6] --sp=${KERNEL}_1.m05_axi:HBM[2]
     --sp=${KERNEL}_1.m06_axi:HBM[4] --sp=${KERNEL}_1.m07_axi:HBM[6]
     --sp=${KERNEL}_1.m08_axi:PLRAM[0]
+  * for a second compute unit (--nk=${KERNEL}:2:${KERNEL}_1.${KERNEL}_2), map it to its own banks:
+    --sp=${KERNEL}_2.m00_axi:HBM[12] --sp=${KERNEL}_2.m01_axi:HBM[14]
+    --sp=${KERNEL}_2.m02_axi:HBM[16] --sp=${KERNEL}_2.m03_axi:HBM[18]
+    --sp=${KERNEL}_2.m04_axi:HBM[20] --sp=${KERNEL}_2.m05_axi:HBM[16]
+    --sp=${KERNEL}_2.m06_axi:HBM[18] --sp=${KERNEL}_2.m07_axi:HBM[20]
+    --sp=${KERNEL}_2.m08_axi:PLRAM[1]
+    the buffers of the data buffers pools created for a compute unit (fpga_bufset_create
+    with its kernel handle) are allocated in the banks of that compute unit, while
+    DATA_MEM_BANKS and DEBUG_MEM_BANK are the banks of the first one
 */
 
 // this define avoids the warning about deprecated OpenCL functions
@@ -41,6 +50,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <CL/opencl.h>
 #include <time.h>
 #include <assert.h>
@@ -48,6 +58,7 @@
 #include "fpga_functions_bicgstab.hpp"
 #include "bda_utils.hpp"
 #include "bicgstab_utils.hpp"
+#include "worker_pool.hpp"
 
 // =============================================================================
 // host data setup
@@ -68,9 +79,9 @@ int fpga_setup_host_debugbuf(unsigned int debug_outbuf_words,
   BDA_DEBUG(1,printf("INFO: %s: allocating debug output buffer: %d bytes, %d cachelines\n",
    __func__,*debugbufferSize,*debugbufferSize/CACHELINE_BYTES);)
   // SDx needs aligned memory when using CL_MEM_USE_HOST_PTR
-  err=posix_memalign((void **)debugBuffer, SDX_MEM_ALIGNMENT, *debugbufferSize);
+  err=host_alloc("debugBuffer", *debugbufferSize, (void **)debugBuffer);
   if (err) {
-    printf("ERROR: %s: posix_memalign failed to allocate debugBuffer\n",__func__);
+    printf("ERROR: %s: failed to allocate debugBuffer\n",__func__);
     return 1;
   }
 
@@ -81,6 +92,40 @@ int fpga_setup_host_debugbuf(unsigned int debug_outbuf_words,
 // setup host data buffers
 // -----------------------
 
+// reset and fill the setup array (see the map of the setup array cachelines
+// in fpga_setup_host_datamem)
+void fpga_fill_setup_array(long unsigned int *setupArray, unsigned int config_bits,
+ int *processedSizes, struct fpga_region regions[REG_NUM]) {
+  BDA_DEBUG(1,printf("INFO: %s: cleanup of setup array.\n",__func__);)
+  for (int i=0;i<SETUP_LINES*CACHELINE_DBL_WORDS;i++) setupArray[i] = 0xDEADC0DEDEADC0DEULL; // cleanup
+  BDA_DEBUG(1,printf("INFO: %s: filling setup array.\n",__func__);)
+  // sizes and configuration (cachelines 0, 1 and 2)
+  setupArray[0] = (((long unsigned int) processedSizes[1]) << 32) + (long unsigned int) processedSizes[0];
+  setupArray[1] = (((long unsigned int) config_bits) << 32) + (long unsigned int) processedSizes[2];
+  setupArray[8] = (((long unsigned int) processedSizes[7]) << 32) + (long unsigned int) processedSizes[6];
+  setupArray[9] = (long unsigned int) processedSizes[8];
+  setupArray[16] = (((long unsigned int) processedSizes[13]) << 32) + (long unsigned int) processedSizes[12];
+  setupArray[17] = (long unsigned int) processedSizes[14];
+  // pointers to the arrays: all other slots of cachelines 0-4
+  fpga_fill_setup_pointers(regions, setupArray);
+
+  BDA_DEBUG(2,
+    printf("INFO: %s: setup array:\n",__func__);
+    for (int i=0;i<SETUP_LINES*CACHELINE_DBL_WORDS;i++) {
+      if (i==0 || i==1 || i==8 || i==9 || i==16 || i==17) {
+        printf(" %2d: 0x%016lX [ %10d, %10d ]\n",
+       i,setupArray[i],(int)(setupArray[i]>>32),(int)(setupArray[i]&0xFFFFFFFF));
+      } else {
+        if (setupArray[i] == 0xDEADC0DEDEADC0DEULL) {
+          printf(" %2d: 0x%016lX [ unused ]\n",i,setupArray[i]);
+        } else {
+          printf(" %2d: 0x%016lX [ %10ld ]\n",i,setupArray[i],(long)(setupArray[i]));
+        }
+      }
+    }
+  )
+}
+
 int fpga_setup_host_datamem(bool level_scheduling, unsigned int config_bits, 
  int *processedSizes,
  long unsigned int **setupArray,
@@ -99,10 +144,7 @@ int fpga_setup_host_datamem(bool level_scheduling, unsigned int config_bits,
   int rowSize, columnSize, valSize, numColors, newrowSize, blkdiagSize;
   int L_rowSize, L_columnSize, L_valSize, L_numColors, L_newrowSize, L_blkdiagSize;
   int U_rowSize, U_columnSize, U_valSize, U_numColors, U_newrowSize, U_blkdiagSize;
-  int *len_nzval = NULL, *len_L_nzval = NULL, *len_U_nzval = NULL;
-
-  // always 1 for this version of the solver
-  assert(nnzValArrays_num==1);
+  struct fpga_region regions[REG_NUM];
 
   // assign vector sizes:
   // these sizes must be, for the vectors that may change between executions,
@@ -127,22 +169,6 @@ int fpga_setup_host_datamem(bool level_scheduling, unsigned int config_bits,
   U_newrowSize = processedSizes[16];
   U_blkdiagSize = processedSizes[17];
 
-  // allocate the vector holding the rounded nnz arrays sizes
-  len_nzval = (int*)malloc(sizeof(int) * nnzValArrays_num);
-  memset(len_nzval,0,sizeof(int) * nnzValArrays_num);
-  len_L_nzval = (int*)malloc(sizeof(int) * nnzValArrays_num);
-  memset(len_L_nzval,0,sizeof(int) * nnzValArrays_num);
-  len_U_nzval = (int*)malloc(sizeof(int) * nnzValArrays_num);
-  memset(len_U_nzval,0,sizeof(int) * nnzValArrays_num);
-
-  /// allocate array of pointers for nnz vectors
-  *nnzValArrays = (double**)malloc(sizeof(double*) * nnzValArrays_num);
-  memset(*nnzValArrays,0,sizeof(double*) * nnzValArrays_num);
-  *L_nnzValArrays = (double**)malloc(sizeof(double*) * nnzValArrays_num);
-  memset(*L_nnzValArrays,0,sizeof(double*) * nnzValArrays_num);
-  *U_nnzValArrays = (double**)malloc(sizeof(double*) * nnzValArrays_num);
-  memset(*U_nnzValArrays,0,sizeof(double*) * nnzValArrays_num);
-
   BDA_DEBUG(1,
     printf("INFO: %s: sizes  : rowSize=%6d, columnSize=%6d, valSize=%7d, numColors=%3d, newrowSize=%7d, blkdiagSize=%6d\n",
      __func__,rowSize,columnSize,valSize,numColors,newrowSize,blkdiagSize);
@@ -167,51 +193,9 @@ int fpga_setup_host_datamem(bool level_scheduling, unsigned int config_bits,
     }
   )
 
-  // Calculate the complete size (in bytes) of each array
-  int len_setup           = CACHELINE_BYTES*SETUP_LINES;  // setup cachelines
-  int len_r1_vector       = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double)); // <-- output: residuals
-  int len_r2_vector       = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double)); // <-- output: residuals
-  int len_x1_vector       = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double)); // <-- output: results
-  int len_x2_vector       = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double)); // <-- output: results
-  int len_p1_vector       = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double));
-  int len_p2_vector       = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double));
-  int len_rt_vector       = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double));
-  int len_t_vector        = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double));
-  int len_v_vector        = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double));
-  int len_L_res_vector    = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double));
-  int len_U_res_vector    = sizeof(double) *    roundUpTo(rowSize, CACHELINE_BYTES/sizeof(double));
-  int len_blkd_vector     = sizeof(double) *    roundUpTo(blkdiagSize, CACHELINE_BYTES/sizeof(double));
-  int len_color_sizes     = sizeof(int) *       roundUpTo(4 * numColors, CACHELINE_BYTES/sizeof(int));
-  int len_p_index         = sizeof(int) *       roundUpTo(columnSize, CACHELINE_BYTES/sizeof(int));
-  for (int i=0;i<nnzValArrays_num;i++) {
-    len_nzval[i]          = sizeof(double) *    roundUpTo(nnzValArrays_sizes[i], CACHELINE_BYTES/sizeof(double));
-  }
-  int len_col_index       = sizeof(short int) * roundUpTo(valSize, CACHELINE_BYTES/sizeof(short int));
-  int len_newrow_offset   = sizeof(char) *      roundUpTo(newrowSize, CACHELINE_BYTES/sizeof(char));
-  int len_L_color_sizes   = sizeof(int) *       roundUpTo(4 * L_numColors, CACHELINE_BYTES/sizeof(int));
-  int len_L_p_index       = sizeof(int) *       roundUpTo(L_columnSize, CACHELINE_BYTES/sizeof(int));
-  for (int i=0;i<nnzValArrays_num;i++) {
-    len_L_nzval[i]        = sizeof(double) *    roundUpTo(L_nnzValArrays_sizes[i], CACHELINE_BYTES/sizeof(double));
-  }
-  int len_L_col_index     = sizeof(short int) * roundUpTo(L_valSize, CACHELINE_BYTES/sizeof(short int));
-  int len_L_newrow_offset = sizeof(char) *      roundUpTo(L_newrowSize, CACHELINE_BYTES/sizeof(char));
-  int len_U_color_sizes   = sizeof(int) *       roundUpTo(4 * U_numColors, CACHELINE_BYTES/sizeof(int));
-  int len_U_p_index       = sizeof(int) *       roundUpTo(U_columnSize, CACHELINE_BYTES/sizeof(int));
-  for (int i=0;i<nnzValArrays_num;i++) {
-    len_U_nzval[i]        = sizeof(double) *    roundUpTo(U_nnzValArrays_sizes[i], CACHELINE_BYTES/sizeof(double));
-  }
-  int len_U_col_index     = sizeof(short int) * roundUpTo(U_valSize, CACHELINE_BYTES/sizeof(short int));
-  int len_U_newrow_offset = sizeof(char) *      roundUpTo(U_newrowSize, CACHELINE_BYTES/sizeof(char));
-  int len_dbg_buffer      = dbgbuffer_bytes;
-  if (len_dbg_buffer % CACHELINE_BYTES != 0) {
+  if (dbgbuffer_bytes % CACHELINE_BYTES != 0) {
     printf("ERROR: %s: dbgbuffer_bytes (%d) must be aligned to the cacheline size (%d bytes).\n",
-     __func__,len_dbg_buffer,CACHELINE_BYTES);
-    free(len_nzval);
-    free(len_L_nzval);
-    free(len_U_nzval);
-    free(*nnzValArrays);
-    free(*L_nnzValArrays);
-    free(*U_nnzValArrays);
+     __func__,dbgbuffer_bytes,CACHELINE_BYTES);
     return 1;
   }
 
@@ -219,98 +203,46 @@ int fpga_setup_host_datamem(bool level_scheduling, unsigned int config_bits,
   *totalSize = (unsigned int*)malloc(sizeof(int) * RW_BUF);
   memset(*totalSize,0,sizeof(int) * RW_BUF);
 
-  // fill the vectors with the position of the arrays in the data buffers
+  // compute the position of the arrays in the data buffers
   // and fill the totalSize array
-  // WARNING: this depends on the number of ports available in the kernel!
-  // * the position values are expressed in bytes *
-  #define MAX_DBUFPOS 20
-  unsigned int dbufpos[RW_BUF][MAX_DBUFPOS] = {0}; // [bank number][array number]
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  #if RW_BUF != 5
-    #error "Expected RW_BUF=5 for configuration PORTS_2r_3r3w*"
-  #endif
-  // data buffer 0
-  dbufpos[0][0] = 0;                                  // setup lines
-  dbufpos[0][1] = dbufpos[0][0] + len_setup;          // nnz_vals1_addr
-  dbufpos[0][2] = dbufpos[0][1] + len_nzval[0];       // L_nnz_vals1_addr
-  dbufpos[0][3] = dbufpos[0][2] + len_L_nzval[0];     // U_nnz_vals1_addr
-  dbufpos[0][4] = dbufpos[0][3] + len_U_nzval[0];     // color_sizes_addr
-  dbufpos[0][5] = dbufpos[0][4] + len_color_sizes;    // L_color_sizes_addr
-  dbufpos[0][6] = dbufpos[0][5] + len_L_color_sizes;  // U_color_sizes_addr
-  dbufpos[0][7] = dbufpos[0][6] + len_U_color_sizes;  // block_diag_addr
-  dbufpos[0][8] = dbufpos[0][7] + len_blkd_vector;    // --> total size
-  (*totalSize)[0] = dbufpos[0][8];
-  // data buffer 1
-  dbufpos[1][0] = 0;                                   // P_indices_addr
-  dbufpos[1][1] = dbufpos[1][0] + len_p_index;         // L_P_indices_addr
-  dbufpos[1][2] = dbufpos[1][1] + len_L_p_index;       // U_P_indices_addr
-  dbufpos[1][3] = dbufpos[1][2] + len_U_p_index;       // col_inds_addr
-  dbufpos[1][4] = dbufpos[1][3] + len_col_index;       // L_col_inds_addr
-  dbufpos[1][5] = dbufpos[1][4] + len_L_col_index;     // U_col_inds_addr
-  dbufpos[1][6] = dbufpos[1][5] + len_U_col_index;     // NRs_addr
-  dbufpos[1][7] = dbufpos[1][6] + len_newrow_offset;   // L_NRs_addr
-  dbufpos[1][8] = dbufpos[1][7] + len_L_newrow_offset; // U_NRs_addr
-  dbufpos[1][9] = dbufpos[1][8] + len_U_newrow_offset; // --> total size
-  (*totalSize)[1] = dbufpos[1][9];
-  // data buffer 2
-  dbufpos[2][0] = 0;                                  // vector X2
-  dbufpos[2][1] = dbufpos[2][0] + len_x2_vector;      // vector R1
-  dbufpos[2][2] = dbufpos[2][1] + len_r1_vector;      // --> total size
-  (*totalSize)[2] = dbufpos[2][2];
-  #define BANK_XRES_EVEN 2
-  #define BANK_RRES_ODD 2
-  result_offsets[0] = dbufpos[2][0]; // X even results
-  result_offsets[3] = dbufpos[2][1]; // R odd results
-  // data buffer 3
-  dbufpos[3][0] = 0;                                  // vector X1
-  dbufpos[3][1] = dbufpos[3][0] + len_x1_vector;      // vector R2
-  dbufpos[3][2] = dbufpos[3][1] + len_r2_vector;      // vector P1
-  dbufpos[3][3] = dbufpos[3][2] + len_p1_vector;      // vector P2
-  dbufpos[3][4] = dbufpos[3][3] + len_p2_vector;      // vector RT
-  dbufpos[3][5] = dbufpos[3][4] + len_rt_vector;       // --> total size
-  (*totalSize)[3] = dbufpos[3][5];
-  #define BANK_XRES_ODD 3
-  #define BANK_RRES_EVEN 3
-  result_offsets[2] = dbufpos[3][0]; // X odd results
-  result_offsets[1] = dbufpos[3][1]; // R even results
-  // data buffer 4
-  dbufpos[4][0] = 0;                                  // T vector
-  dbufpos[4][1] = dbufpos[4][0] + len_t_vector;       // V vector
-  dbufpos[4][2] = dbufpos[4][1] + len_v_vector;       // L_res vector - address isn't in setup line: ALWAYS after v vector
-  dbufpos[4][3] = dbufpos[4][2] + len_L_res_vector;   // U_res vector - address isn't in setup line: ALWAYS after L_res vector
-  dbufpos[4][4] = dbufpos[4][3] + len_U_res_vector;   // --> total size
-  (*totalSize)[4] = dbufpos[4][4];
-  #define BANK_LRES 4
-  #define BANK_URES 4
-  result_offsets[4] = dbufpos[4][2]; // L results
-  result_offsets[5] = dbufpos[4][3]; // U results
-#else
-  #error "Undefined"
-#endif
-  free(len_nzval);
-  free(len_L_nzval);
-  free(len_U_nzval);
+  if (fpga_plan_datamem_layout(processedSizes,
+   nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, nnzValArrays_num,
+   regions, *totalSize, result_offsets)) {
+    printf("ERROR: %s: cannot plan the data buffers layout.\n",__func__);
+    free(*totalSize);
+    return 1;
+  }
 
   BDA_DEBUG(2,
     for (int b=0;b<RW_BUF;b++) {
       printf("INFO: %s: data buffer #%d, total size (bytes/cachelines): %d/%d\n",
        __func__,b,(*totalSize)[b],(*totalSize)[b]/CACHELINE_BYTES);
-      for (int d=0;d<MAX_DBUFPOS;d++) {
-        int pos = dbufpos[b][d];
-        if (d>1 && pos==0) break;
+      for (int r=0;r<REG_NUM;r++) {
+        if (regions[r].bank != b) continue;
+        int pos = regions[r].offset;
         printf("INFO: %s: dataBuffer[%d] index: %d (cl: %d)\n",__func__,b,pos,pos/CACHELINE_BYTES);
       }
     }
   )
 
+  /// allocate array of pointers for nnz vectors
+  *nnzValArrays = (double**)malloc(sizeof(double*) * nnzValArrays_num);
+  memset(*nnzValArrays,0,sizeof(double*) * nnzValArrays_num);
+  *L_nnzValArrays = (double**)malloc(sizeof(double*) * nnzValArrays_num);
+  memset(*L_nnzValArrays,0,sizeof(double*) * nnzValArrays_num);
+  *U_nnzValArrays = (double**)malloc(sizeof(double*) * nnzValArrays_num);
+  memset(*U_nnzValArrays,0,sizeof(double*) * nnzValArrays_num);
+
   // allocate data buffers
   for (int b=0; b<RW_BUF; b++) {
     BDA_DEBUG(1,printf("INFO: %s: allocating data buffer %d: %d bytes, %d cachelines\n",
       __func__,b, (*totalSize)[b],(*totalSize)[b]/CACHELINE_BYTES);)
     // SDx needs aligned memory when using CL_MEM_USE_HOST_PTR
-    int err=posix_memalign((void **)&dataBuffer[b], SDX_MEM_ALIGNMENT, sizeof(char) * (*totalSize)[b]);
+    char name[32];
+    sprintf(name,"dataBuffer %d",b);
+    int err=host_alloc(name, sizeof(char) * (*totalSize)[b], (void **)&dataBuffer[b]);
     if (err) {
-      printf("ERROR: %s: posix_memalign failed to allocate dataBuffer %d.\n",__func__,b);
+      printf("ERROR: %s: failed to allocate dataBuffer %d.\n",__func__,b);
       free(*nnzValArrays);
       free(*L_nnzValArrays);
       free(*U_nnzValArrays);
@@ -324,47 +256,40 @@ int fpga_setup_host_datamem(bool level_scheduling, unsigned int config_bits,
   }
 
   // create references to all different arrays in each dataBuffer
-  // and fill the setup array with the proper indices (byte-based)
   // buffer names starting with "temp_" are currently not used (intermediary kernel data)
-  // WARNING: references depend on the number of ports available in the kernel!
   BDA_DEBUG(1,printf("INFO: %s: creating data buffer references.\n",__func__);)
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  // data buffer 0
-  *setupArray =   (long unsigned int *)&dataBuffer[0][ dbufpos[0][0] ];
-  (*nnzValArrays)[0] =         (double *)&dataBuffer[0][ dbufpos[0][1] ];
-  (*L_nnzValArrays)[0] =       (double *)&dataBuffer[0][ dbufpos[0][2] ];
-  (*U_nnzValArrays)[0] =       (double *)&dataBuffer[0][ dbufpos[0][3] ];
-  *colorSizesArray =   (unsigned int *)&dataBuffer[0][ dbufpos[0][4] ];
-  *L_colorSizesArray = (unsigned int *)&dataBuffer[0][ dbufpos[0][5] ];
-  *U_colorSizesArray = (unsigned int *)&dataBuffer[0][ dbufpos[0][6] ];
-  *BLKDArray =               (double *)&dataBuffer[0][ dbufpos[0][7] ];
-  // data buffer 1
-  *PIndexArray =             (unsigned int *)&dataBuffer[1][ dbufpos[1][0] ];
-  *L_PIndexArray =           (unsigned int *)&dataBuffer[1][ dbufpos[1][1] ];
-  *U_PIndexArray =           (unsigned int *)&dataBuffer[1][ dbufpos[1][2] ];
-  *columnIndexArray =   (short unsigned int*)&dataBuffer[1][ dbufpos[1][3] ];
-  *L_columnIndexArray = (short unsigned int*)&dataBuffer[1][ dbufpos[1][4] ];
-  *U_columnIndexArray = (short unsigned int*)&dataBuffer[1][ dbufpos[1][5] ];
-  *newRowOffsetArray =      (unsigned char *)&dataBuffer[1][ dbufpos[1][6] ];
-  *L_newRowOffsetArray =    (unsigned char *)&dataBuffer[1][ dbufpos[1][7] ];
-  *U_newRowOffsetArray =    (unsigned char *)&dataBuffer[1][ dbufpos[1][8] ];
-  // data buffer 2
-  *X2Array = (double *)&dataBuffer[2][ dbufpos[2][0] ];
-  *R1Array = (double *)&dataBuffer[2][ dbufpos[2][1] ];
-  // data buffer 3
-  *X1Array =             (double *)&dataBuffer[3][ dbufpos[3][0] ];
-  *R2Array =             (double *)&dataBuffer[3][ dbufpos[3][1] ];
-  //double *temp_P1Array =        (double *)&dataBuffer[3][ dbufpos[3][2] ];
-  //double *temp_P2Array =        (double *)&dataBuffer[3][ dbufpos[3][3] ];
-  //double *temp_RTArray =        (double *)&dataBuffer[3][ dbufpos[3][4] ];
-  // data buffer 4
-  //unsigned char *temp_TArray = (unsigned char *)&dataBuffer[4][ dbufpos[4][0] ];
-  //unsigned char *temp_VArray = (unsigned char *)&dataBuffer[4][ dbufpos[4][1] ];
-  *LresArray =                        (double *)&dataBuffer[4][ dbufpos[4][2] ];
-  *UresArray =                        (double *)&dataBuffer[4][ dbufpos[4][3] ];
-#else
-  #error "Undefined"
-#endif
+  #define REGION_PTR(r) (&dataBuffer[regions[r].bank][regions[r].offset])
+  *setupArray =   (long unsigned int *)REGION_PTR(REG_SETUP);
+  for (int p=0;p<nnzValArrays_num;p++) {
+    (*nnzValArrays)[p] =       (double *)REGION_PTR(fpga_nnz_region(0, p));
+    (*L_nnzValArrays)[p] =     (double *)REGION_PTR(fpga_nnz_region(1, p));
+    (*U_nnzValArrays)[p] =     (double *)REGION_PTR(fpga_nnz_region(2, p));
+  }
+  *colorSizesArray =     (unsigned int *)REGION_PTR(REG_COLOR_SIZES);
+  *L_colorSizesArray =   (unsigned int *)REGION_PTR(REG_L_COLOR_SIZES);
+  *U_colorSizesArray =   (unsigned int *)REGION_PTR(REG_U_COLOR_SIZES);
+  *BLKDArray =                 (double *)REGION_PTR(REG_BLKD);
+  *PIndexArray =         (unsigned int *)REGION_PTR(REG_P_INDEX);
+  *L_PIndexArray =       (unsigned int *)REGION_PTR(REG_L_P_INDEX);
+  *U_PIndexArray =       (unsigned int *)REGION_PTR(REG_U_P_INDEX);
+  *columnIndexArray =   (short unsigned int*)REGION_PTR(REG_COL_INDEX);
+  *L_columnIndexArray = (short unsigned int*)REGION_PTR(REG_L_COL_INDEX);
+  *U_columnIndexArray = (short unsigned int*)REGION_PTR(REG_U_COL_INDEX);
+  *newRowOffsetArray =      (unsigned char *)REGION_PTR(REG_NR_OFFSET);
+  *L_newRowOffsetArray =    (unsigned char *)REGION_PTR(REG_L_NR_OFFSET);
+  *U_newRowOffsetArray =    (unsigned char *)REGION_PTR(REG_U_NR_OFFSET);
+  *X2Array =                   (double *)REGION_PTR(REG_X2);
+  *R1Array =                   (double *)REGION_PTR(REG_R1);
+  *X1Array =                   (double *)REGION_PTR(REG_X1);
+  *R2Array =                   (double *)REGION_PTR(REG_R2);
+  //double *temp_P1Array =     (double *)REGION_PTR(REG_P1);
+  //double *temp_P2Array =     (double *)REGION_PTR(REG_P2);
+  //double *temp_RTArray =     (double *)REGION_PTR(REG_RT);
+  //double *temp_TArray =      (double *)REGION_PTR(REG_T);
+  //double *temp_VArray =      (double *)REGION_PTR(REG_V);
+  *LresArray =                 (double *)REGION_PTR(REG_LRES);
+  *UresArray =                 (double *)REGION_PTR(REG_URES);
+  #undef REGION_PTR
 
   // Setup array cachelines map
   // All setup array pointers are expressed as indices of the 512-bit cachelines.
@@ -382,7 +307,7 @@ int fpga_setup_host_datamem(bool level_scheduling, unsigned int config_bits,
   //  - [9]  *unused* (63..32)   | L_num_colors (31..0)
   //  - [10] Pointer to color sizes vector
   //  - [11] Pointer to P indices vector
-  //  - [12] Pointer to non-zero matrix values vector, part 1 (whole for this kernel)
+  //  - [12] Pointer to non-zero matrix values vector, part 1 (whole if nnzValArrays_num is 1)
   //  - [13] Pointer to column indices vector
   //  - [14] Pointer to row offsets vector
   //  - [15] Pointer to RT vector, temp data used by solver
@@ -391,118 +316,502 @@ int fpga_setup_host_datamem(bool level_scheduling, unsigned int config_bits,
   //  - [17] *unused* (63..32)   | U_num_colors (31..0)
   //  - [18] Pointer to L color sizes vector
   //  - [19] Pointer to L P indices vector
-  //  - [20] Pointer to L non-zero matrix values vector, part 1 (whole for this kernel)
+  //  - [20] Pointer to L non-zero matrix values vector, part 1 (whole if nnzValArrays_num is 1)
   //  - [21] Pointer to L column indices vector
   //  - [22] Pointer to L row offsets vector
   //  - [23] Pointer to block diagonal vector
   // Cacheline 3:
   //  - [24] Pointer to U color sizes vector
   //  - [25] Pointer to U P indices vector
-  //  - [26] Pointer to U non-zero matrix values vector, part 1 (whole for this kernel)
+  //  - [26] Pointer to U non-zero matrix values vector, part 1 (whole if nnzValArrays_num is 1)
   //  - [27] Pointer to U column indices vector
   //  - [28] Pointer to U row offsets vector
   //  - [29] Pointer to T vector, temp data used by solver
   //  - [30] Pointer to V vector, temp data used by solver
-  //  - [31] Pointer to non-zero matrix values vector, part 2 (unused for this kernel)
+  //  - [31] Pointer to non-zero matrix values vector, part 2 (if nnzValArrays_num > 1)
   // Cacheline 4:
-  //  - [32] Pointer to L non-zero matrix values vector, part 2 (unused for this kernel)
-  //  - [33] Pointer to U non-zero matrix values vector, part 2 (unused for this kernel)
-  //  - [34] *reserved* for pointer to non-zero matrix values vector, part 3)
-  //  - [35] *reserved* for pointer to L non-zero matrix values vector, part 3
-  //  - [36] *reserved* for pointer to U non-zero matrix values vector, part 3
-  //  - [37] *reserved* for pointer to non-zero matrix values vector, part 4
-  //  - [38] *reserved* for pointer to L non-zero matrix values vector, part 4
-  //  - [39] *reserved* for pointer to U non-zero matrix values vector, part 4
+  //  - [32] Pointer to L non-zero matrix values vector, part 2 (if nnzValArrays_num > 1)
+  //  - [33] Pointer to U non-zero matrix values vector, part 2 (if nnzValArrays_num > 1)
+  //  - [34] Pointer to non-zero matrix values vector, part 3 (if nnzValArrays_num > 2)
+  //  - [35] Pointer to L non-zero matrix values vector, part 3 (if nnzValArrays_num > 2)
+  //  - [36] Pointer to U non-zero matrix values vector, part 3 (if nnzValArrays_num > 2)
+  //  - [37] Pointer to non-zero matrix values vector, part 4 (if nnzValArrays_num > 3)
+  //  - [38] Pointer to L non-zero matrix values vector, part 4 (if nnzValArrays_num > 3)
+  //  - [39] Pointer to U non-zero matrix values vector, part 4 (if nnzValArrays_num > 3)
+  // The parts of the nnz values are interleaved at cacheline granularity
+  // (see fpga_nnz_part_sizes): nnzValArrays_sizes give the size of each part.
 
   // reset and fill the setup array
-  BDA_DEBUG(1,printf("INFO: %s: cleanup of setup array.\n",__func__);)
-  for (int i=0;i<SETUP_LINES*CACHELINE_DBL_WORDS;i++) (*setupArray)[i] = 0xDEADC0DEDEADC0DEULL; // cleanup
-  BDA_DEBUG(1,printf("INFO: %s: filling setup array.\n",__func__);)
-  // cacheline 0
-  (*setupArray)[0] = (((long unsigned int) valSize) << 32) + (long unsigned int) rowSize;
-  (*setupArray)[1] = (((long unsigned int) config_bits) << 32) + (long unsigned int) numColors;
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  (*setupArray)[2] = dbufpos[2][1]/CACHELINE_BYTES;  // vector R1 addr
-  (*setupArray)[3] = dbufpos[3][1]/CACHELINE_BYTES;  // vector R2 addr [temp,uninitialized,output]
-  (*setupArray)[4] = dbufpos[3][0]/CACHELINE_BYTES;  // vector X1 addr
-  (*setupArray)[5] = dbufpos[2][0]/CACHELINE_BYTES;  // vector X2 addr [temp,uninitialized,output]
-  (*setupArray)[6] = dbufpos[3][2]/CACHELINE_BYTES;  // vector P1 addr [temp,uninitialized]
-  (*setupArray)[7] = dbufpos[3][3]/CACHELINE_BYTES;  // vector P2 addr [temp,uninitialized]
-#else
-  #error "Undefined"
-#endif
-  // cacheline 1
-  (*setupArray)[8] = (((long unsigned int) L_valSize) << 32) + (long unsigned int) L_rowSize;
-  (*setupArray)[9] = (long unsigned int) L_numColors;
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  (*setupArray)[10] = dbufpos[0][4]/CACHELINE_BYTES; // color_sizes_addr
-  (*setupArray)[11] = dbufpos[1][0]/CACHELINE_BYTES; // P_indices_addr
-  (*setupArray)[12] = dbufpos[0][1]/CACHELINE_BYTES; // nnz_vals1_addr
-  (*setupArray)[13] = dbufpos[1][3]/CACHELINE_BYTES; // col_inds_addr
-  (*setupArray)[14] = dbufpos[1][6]/CACHELINE_BYTES; // NRs_addr
-  (*setupArray)[15] = dbufpos[3][4]/CACHELINE_BYTES; // vector RT addr [temp,uninitialized]
-#else
-  #error "Undefined"
-#endif
-  // cacheline 2
-  (*setupArray)[16] = (((long unsigned int) U_valSize) << 32) + (long unsigned int) U_rowSize;
-  (*setupArray)[17] = (long unsigned int) U_numColors;
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  (*setupArray)[18] = dbufpos[0][5]/CACHELINE_BYTES; // L_color_sizes_addr
-  (*setupArray)[19] = dbufpos[1][1]/CACHELINE_BYTES; // L_P_indices_addr
-  (*setupArray)[20] = dbufpos[0][2]/CACHELINE_BYTES; // L_nnz_vals1_addr
-  (*setupArray)[21] = dbufpos[1][4]/CACHELINE_BYTES; // L_col_inds_addr
-  (*setupArray)[22] = dbufpos[1][7]/CACHELINE_BYTES; // L_NRs_addr
-  (*setupArray)[23] = dbufpos[0][7]/CACHELINE_BYTES; // block_diag_addr
-#else
-  #error "Undefined"
-#endif
-  // cacheline 3
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  (*setupArray)[24] = dbufpos[0][6]/CACHELINE_BYTES; // U_color_sizes_addr
-  (*setupArray)[25] = dbufpos[1][2]/CACHELINE_BYTES; // U_P_indices_addr
-  (*setupArray)[26] = dbufpos[0][3]/CACHELINE_BYTES; // U_nnz_vals1_addr
-  (*setupArray)[27] = dbufpos[1][5]/CACHELINE_BYTES; // U_col_inds_addr
-  (*setupArray)[28] = dbufpos[1][8]/CACHELINE_BYTES; // U_NRs_addr
-  (*setupArray)[29] = dbufpos[4][0]/CACHELINE_BYTES; // vector T addr [temp,uninitialized]
-  (*setupArray)[30] = dbufpos[4][1]/CACHELINE_BYTES; // vector V addr [temp,uninitialized]
-#else
-  #error "Undefined"
-#endif
-  // cacheline 4
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  // (unused for this kernel)
-#else
-  #error "Undefined"
-#endif
+  fpga_fill_setup_array(*setupArray, config_bits, processedSizes, regions);
 
-  BDA_DEBUG(2,
-    printf("INFO: %s: setup array:\n",__func__);
-    for (int i=0;i<SETUP_LINES*CACHELINE_DBL_WORDS;i++) {
-      if (i==0 || i==1 || i==8 || i==9 || i==16 || i==17) {
-        printf(" %2d: 0x%016lX [ %10d, %10d ]\n",
-       i,(*setupArray)[i],(int)((*setupArray)[i]>>32),(int)((*setupArray)[i]&0xFFFFFFFF));
-      } else {
-        if ((*setupArray)[i] == 0xDEADC0DEDEADC0DEULL) {
-          printf(" %2d: 0x%016lX [ unused ]\n",i,(*setupArray)[i]);
-        } else {
-          printf(" %2d: 0x%016lX [ %10ld ]\n",i,(*setupArray)[i],(long)((*setupArray)[i]));
-        }
-      }
-    }
-  )
+  return 0;
+}
+
+// -----------------------------------
+// strategy of the host -> device transfers
+// -----------------------------------
+
+// profile of the uploads of the data buffers pool: NULL means plain writes
+// and migrations
+static struct fpga_transfer_profile *transfer_profile = NULL;
+
+// set the profile used by the uploads (NULL to disable); profile must stay
+// valid while it is set; fails while a session exists (see
+// fpga_settings_change_begin), and must not be called while an upload is
+// running
+int fpga_set_transfer_profile(struct fpga_transfer_profile *profile) {
+  if (fpga_settings_change_begin(__func__)) return 1;
+  transfer_profile = profile;
+  fpga_settings_change_end();
+  BDA_DEBUG(1,printf("INFO: %s: transfer profile %s.\n",__func__,(profile != NULL) ? "enabled" : "disabled");)
+  return 0;
+}
+
+struct fpga_transfer_profile *fpga_get_transfer_profile(void) {
+  return transfer_profile;
+}
+
+// -----------------------------------------
+// pipelined copy of the host data buffers
+// -----------------------------------------
 
+// queue and device data buffers of the pipelined copy: NULL means that
+// fpga_copy_host_datamem only packs, and fpga_copy_to_device_datamem migrates.
+// The state of the pipelined copy belongs to the single-system functions
+// (fpga_copy_host_datamem, fpga_copy_to_device_datamem), which are called
+// from one thread; the data buffers pools of the sessions don't use it
+static cl_command_queue pipeline_commands = NULL;
+static cl_mem *pipeline_cldata = NULL;
+// migrations enqueued by fpga_copy_host_datamem, not yet waited for
+static cl_event pipeline_done[RW_BUF] = {NULL};
+static bool pipeline_pending = false;
+static struct timespec pipeline_start;
+static struct fpga_upload_times pipeline_times;
+
+// set the queue and the device data buffers (those of the host data buffers
+// given to fpga_copy_host_datamem) of the pipelined copy; NULL commands
+// disables it. cldata must stay valid while it is set; fails while a copy is
+// pending or a session exists
+int fpga_set_pipelined_copy(cl_command_queue commands, cl_mem *cldata) {
+  if (pipeline_pending) {
+    printf("ERROR: %s: the migrations of the last copy have not been waited for.\n",__func__);
+    return 1;
+  }
+  if (commands != NULL && cldata == NULL) {
+    printf("ERROR: %s: the device data buffers must be given with the queue.\n",__func__);
+    return 1;
+  }
+  if (fpga_settings_change_begin(__func__)) return 1;
+  pipeline_commands = commands;
+  pipeline_cldata = (commands != NULL) ? cldata : NULL;
+  fpga_settings_change_end();
+  BDA_DEBUG(1,printf("INFO: %s: pipelined copy %s.\n",__func__,(commands != NULL) ? "enabled" : "disabled");)
   return 0;
 }
 
+struct fpga_upload_times *fpga_get_pipelined_copy_times(void) {
+  return &pipeline_times;
+}
+
+// ---------------------------------
+// parallel packing of data buffers
+// ---------------------------------
+
+// The packing of the data buffers is split in jobs (copy, clear or fill with
+// the pre-defined results pattern) that are executed by a pool of worker
+// threads; large regions are split in chunks of PACK_CHUNK_BYTES, which start
+// at cacheline boundaries (regions are cacheline aligned), so that two
+// threads never write the same cacheline. Since the jobs of a list never
+// overlap, the result is the same as the serial execution. The parts of split
+// nnz values are gathered from the whole values, one cacheline every stride
+// bytes (see fpga_nnz_part_sizes).
+
+// size of the chunks in which the regions are split (multiple of cachelines)
+#define PACK_CHUNK_BYTES (256*1024)
+
+enum pack_op { PACK_COPY = 0, PACK_ZERO, PACK_PATTERN, PACK_GATHER, PACK_FLOAT };
+
+struct pack_job {
+  int op;
+  unsigned char *dst;
+  const unsigned char *src;   // only for PACK_COPY, PACK_GATHER and PACK_FLOAT (doubles)
+  size_t bytes;
+  size_t first;               // index of the first element (PACK_PATTERN)
+  size_t stride;              // distance of the source cachelines (PACK_GATHER)
+};
+
+struct pack_list {
+  int num;
+  int max;
+  struct pack_job *jobs;
+};
+
+// pool used for packing: NULL means serial packing
+static struct worker_pool *pack_pool = NULL;
+
+// set the number of threads used to pack the data buffers (1 = serial);
+// fails while a session exists, and must not be called while a packing
+// function is running
+int fpga_set_pack_threads(int num_threads) {
+  if (num_threads < 1) {
+    printf("ERROR: %s: the number of threads must be at least 1 (%d).\n",__func__,num_threads);
+    return 1;
+  }
+  if (fpga_settings_change_begin(__func__)) return 1;
+  if (num_threads == worker_pool_threads(pack_pool)) {
+    fpga_settings_change_end();
+    return 0;
+  }
+  worker_pool_destroy(pack_pool);
+  pack_pool = NULL;
+  int rc = (num_threads > 1) ? worker_pool_create(num_threads, &pack_pool) : 0;
+  fpga_settings_change_end();
+  if (rc) return 1;
+  BDA_DEBUG(1,printf("INFO: %s: data buffers packed with %d threads.\n",__func__,num_threads);)
+  return 0;
+}
+
+int fpga_get_pack_threads(void) {
+  return worker_pool_threads(pack_pool);
+}
+
+// next free job of the list
+static struct pack_job *fpga_pack_next(struct pack_list *list) {
+  if (list->num == list->max) {
+    list->max = (list->max == 0) ? 64 : list->max * 2;
+    list->jobs = (struct pack_job *)realloc(list->jobs, sizeof(struct pack_job) * list->max);
+  }
+  return &list->jobs[list->num++];
+}
+
+// add a job to the list, splitting it in chunks
+static void fpga_pack_add(struct pack_list *list, int op, void *dst, const void *src,
+ size_t bytes, size_t first) {
+  for (size_t pos=0;pos<bytes;pos+=PACK_CHUNK_BYTES) {
+    struct pack_job *job = fpga_pack_next(list);
+    job->op = op;
+    job->dst = (unsigned char *)dst + pos;
+    // PACK_FLOAT reads two bytes of doubles for each byte of floats written
+    job->src = (src == NULL) ? NULL : (const unsigned char *)src + ((op == PACK_FLOAT) ? 2*pos : pos);
+    job->bytes = (bytes - pos < PACK_CHUNK_BYTES) ? bytes - pos : PACK_CHUNK_BYTES;
+    job->first = first + pos/sizeof(double);
+    job->stride = 0;
+  }
+}
+
+// add the jobs copying the input array of a region: contiguous when stride is
+// 0, gathered one cacheline every stride bytes otherwise; the regions stored
+// in single precision are rounded from the doubles of the input
+static void fpga_pack_add_input(struct pack_list *list, int region, void *dst, const void *src,
+ size_t bytes, size_t stride) {
+  int first_job = list->num;
+  if (fpga_region_type(region) == REG_TYPE_FLOAT) {
+    fpga_pack_add(list, PACK_FLOAT, dst, src, bytes, 0);
+    return;
+  }
+  fpga_pack_add(list, (stride == 0) ? PACK_COPY : PACK_GATHER, dst, src, bytes, 0);
+  if (stride == 0) return;
+  for (int j=first_job;j<list->num;j++) {
+    size_t pos = list->jobs[j].dst - (unsigned char *)dst;
+    list->jobs[j].src = (const unsigned char *)src + (pos/CACHELINE_BYTES)*stride;
+    list->jobs[j].stride = stride;
+  }
+}
+
+static void fpga_pack_gather(struct pack_job *job) {
+  for (size_t pos=0;pos<job->bytes;pos+=CACHELINE_BYTES) {
+    size_t n = (job->bytes - pos < CACHELINE_BYTES) ? job->bytes - pos : CACHELINE_BYTES;
+    memcpy(job->dst + pos, job->src + (pos/CACHELINE_BYTES)*job->stride, n);
+  }
+}
+
+// the results pattern has 0x9696..96 in the upper 32 bits and the element
+// index in the lower 32 bits
+static void fpga_pack_pattern(double *dst, size_t first, size_t num) {
+  for (size_t d=0;d<num;d++) {
+    union double2int dw;
+    dw.int_val = 0UL;
+    for (int j=15;j>=8;j--) {
+      unsigned char c = (j % 2 == 0) ? 0x9 : 0x6;
+      dw.int_val |= (((unsigned long int)c&0xF) << j*4);
+    }
+    dw.int_val |= (unsigned long int)(first + d);
+    dst[d] = dw.double_val;
+  }
+}
+
+static void fpga_pack_task(void *arg, int task) {
+  struct pack_job *job = &((struct pack_list *)arg)->jobs[task];
+  switch (job->op) {
+    case PACK_COPY:    memcpy(job->dst, job->src, job->bytes); break;
+    case PACK_ZERO:    memset(job->dst, 0, job->bytes); break;
+    case PACK_PATTERN: fpga_pack_pattern((double *)job->dst, job->first, job->bytes/sizeof(double)); break;
+    case PACK_GATHER:  fpga_pack_gather(job); break;
+    case PACK_FLOAT:
+      for (size_t i=0;i<job->bytes/sizeof(float);i++) {
+        ((float *)job->dst)[i] = (float)((const double *)job->src)[i];
+      }
+      break;
+  }
+}
+
+// execute all the jobs of the list, then empty the list
+static void fpga_pack_run(struct pack_list *list) {
+  worker_pool_run(pack_pool, fpga_pack_task, list, list->num);
+  list->num = 0;
+}
+
 // ------------------------------------
 // copy input data to host data buffers
 // ------------------------------------
 
+// get the source and the size (in bytes) of an input array from the vectors
+// created by level scheduling/graph coloring; vectorPointers arrays contain
+// non-padded data, so we must copy exactly the number of elements. The nnz
+// values are given whole: when they are split, each part is gathered from
+// them with the given stride (0 for contiguous arrays). The size is the one
+// stored in the region: half of the input for the regions stored as floats.
+// returns 1 if the region is not filled from vectorPointers
+static int fpga_region_input(int region, void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, const void **src, size_t *bytes, size_t *stride) {
+  int matrix, part;
+  *stride = 0;
+  if (fpga_region_nnz_part(region, &matrix, &part)) {
+    int *sizes[3] = {nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes};
+    if (part >= nnzValArrays_num) return 1;
+    *src = ((double**)vectorPointers[2 + 6*matrix])[0] + part*CACHELINE_DBL_WORDS;
+    *bytes = fpga_region_type_bytes(fpga_region_type(region)) * sizes[matrix][part];
+    if (nnzValArrays_num > 1) *stride = CACHELINE_BYTES * nnzValArrays_num;
+    return 0;
+  }
+  switch (region) {
+    case REG_COLOR_SIZES:   *src = (int*)vectorPointers[0] + 8;   *bytes = sizeof(int) * 4 * vectorSizes[2];  break;
+    case REG_L_COLOR_SIZES: *src = (int*)vectorPointers[6] + 8;   *bytes = sizeof(int) * 4 * vectorSizes[8];  break;
+    case REG_U_COLOR_SIZES: *src = (int*)vectorPointers[12] + 8;  *bytes = sizeof(int) * 4 * vectorSizes[14]; break;
+    case REG_P_INDEX:       *src = vectorPointers[1];             *bytes = sizeof(int) * vectorSizes[3];      break;
+    case REG_L_P_INDEX:     *src = vectorPointers[7];             *bytes = sizeof(int) * vectorSizes[9];      break;
+    case REG_U_P_INDEX:     *src = vectorPointers[13];            *bytes = sizeof(int) * vectorSizes[15];     break;
+    case REG_COL_INDEX:     *src = vectorPointers[3];             *bytes = sizeof(short int) * vectorSizes[1];  break;
+    case REG_L_COL_INDEX:   *src = vectorPointers[9];             *bytes = sizeof(short int) * vectorSizes[7];  break;
+    case REG_U_COL_INDEX:   *src = vectorPointers[15];            *bytes = sizeof(short int) * vectorSizes[13]; break;
+    case REG_NR_OFFSET:     *src = vectorPointers[4];             *bytes = sizeof(char) * vectorSizes[4];       break;
+    case REG_L_NR_OFFSET:   *src = vectorPointers[10];            *bytes = sizeof(char) * vectorSizes[10];      break;
+    case REG_U_NR_OFFSET:   *src = vectorPointers[16];            *bytes = sizeof(char) * vectorSizes[16];      break;
+    case REG_R1:            *src = vectorPointers[19];            *bytes = sizeof(double) * vectorSizes[0];     break;
+    case REG_X1:            *src = vectorPointers[20];            *bytes = sizeof(double) * vectorSizes[0];     break;
+    case REG_BLKD:          *src = vectorPointers[18];            *bytes = fpga_region_type_bytes(fpga_region_type(region)) * vectorSizes[5]; break;
+    default: return 1;
+  }
+  return 0;
+}
+
+// update the setup array with the sizes for the current system to be solved;
+// all other values are to be left unchanged
+static void fpga_update_setup_sizes(long unsigned int *setupArray, int *vectorSizes) {
+  // Cacheline 0:
+  //  - [0]  val size (63..32) | row_size (31..0)
+  setupArray[0] = (((long unsigned int) vectorSizes[1]) << 32) + (long unsigned int) vectorSizes[0];
+  // Cacheline 1:
+  //  - [8]  L_val size (63..32) | L_row_size (31..0)
+  setupArray[8] = (((long unsigned int) vectorSizes[7]) << 32) + (long unsigned int) vectorSizes[6];
+  // Cacheline 2:
+  //  - [16] U_val size (63..32) | U_row_size (31..0)
+  setupArray[16] = (((long unsigned int) vectorSizes[13]) << 32) + (long unsigned int) vectorSizes[12];
+}
+
+// check that bytes can be written at ptr: the room available goes up to the
+// next known array in the same data buffer, or to the end of the data buffer
+static int fpga_check_room(const char *caller, const char *name, unsigned char *ptr, size_t bytes,
+ unsigned char **known, int known_num, unsigned char **dataBuffer, unsigned int *totalSize) {
+  unsigned char *limit = NULL;
+  for (int b=0;b<RW_BUF;b++) {
+    if (ptr >= dataBuffer[b] && ptr < dataBuffer[b] + totalSize[b]) limit = dataBuffer[b] + totalSize[b];
+  }
+  if (limit == NULL) {
+    printf("ERROR: %s: array %s is not inside the data buffers.\n",caller,name);
+    return 1;
+  }
+  for (int k=0;k<known_num;k++) {
+    if (known[k] > ptr && known[k] < limit) limit = known[k];
+  }
+  if (bytes > (size_t)(limit - ptr)) {
+    printf("ERROR: %s: array %s needs %lu bytes, but only %lu bytes are allocated.\n",
+     caller,name,(unsigned long)bytes,(unsigned long)(limit - ptr));
+    return 1;
+  }
+  return 0;
+}
+
+// ---------------------------------
+// sharing of identical input arrays
+// ---------------------------------
+
+// The pattern arrays of L and U are often the same as the ones of A, or a
+// prefix of them (e.g. the column indices of L, when the first colors of A
+// have no entries above the diagonal). When sharing is enabled, such a region
+// is neither packed nor transferred: its pointer in the setup array is set to
+// the copy of the region holding the same data (its alias), which the kernel
+// only reads. The kernel reads the number of elements given by the sizes of
+// the system, so the data after the prefix is never used. Shared regions and
+// their aliases cannot be written in place (see fpga_region_data).
+
+// if true, look for shared arrays in the pattern regions
+static bool share_arrays = false;
+
+// enable or disable the sharing of identical input arrays; fails while a
+// session exists, and must not be called while a packing function is running
+int fpga_set_share_arrays(bool enable) {
+  if (fpga_settings_change_begin(__func__)) return 1;
+  share_arrays = enable;
+  fpga_settings_change_end();
+  BDA_DEBUG(1,printf("INFO: %s: sharing of identical input arrays %s.\n",__func__,enable ? "enabled" : "disabled");)
+  return 0;
+}
+
+bool fpga_get_share_arrays(void) {
+  return share_arrays;
+}
+
+// find the alias of each shareable region: the first region that can be read
+// instead of it and whose input starts with the same bytes; an alias is never
+// shared itself. All the aliases are -1 when sharing is disabled. bytes gets
+// the size of the input of the shareable regions.
+static void fpga_find_aliases(void **vectorPointers, int *vectorSizes,
+ int alias[REG_NUM], size_t bytes[REG_NUM]) {
+  const void *src[REG_NUM];
+  size_t stride;
+
+  for (int r=0;r<REG_NUM;r++) {
+    alias[r] = -1;
+    if (!share_arrays || !(REG_MASK_SHAREABLE & REG_BIT(r))) continue;
+    // the pattern arrays don't depend on the nnz values sizes
+    fpga_region_input(r, vectorPointers, vectorSizes, NULL, NULL, NULL, 1, &src[r], &bytes[r], &stride);
+    for (int o=0;o<r;o++) {
+      if (!fpga_region_can_share(r, o) || alias[o] >= 0 || bytes[r] > bytes[o]) continue;
+      if (src[r] == src[o] || memcmp(src[r], src[o], bytes[r]) == 0) {
+        alias[r] = o;
+        break;
+      }
+    }
+  }
+}
+
+// update the aliases of the shareable regions, when update_mask selects one
+// of them; the setup array pointers are updated for the regions whose alias
+// has changed. Returns the regions to be copied: update_mask without the
+// shared regions, plus the regions that are no longer shared (their copy is
+// outdated) and the setup array, if it has been modified.
+static unsigned long int fpga_share_regions(unsigned long int update_mask,
+ void **vectorPointers, int *vectorSizes,
+ struct fpga_region regions[REG_NUM], long unsigned int *setupArray) {
+  int alias[REG_NUM];
+  size_t bytes[REG_NUM];
+  bool changed = false;
+
+  if (!(update_mask & REG_MASK_SHAREABLE)) return update_mask;
+  fpga_find_aliases(vectorPointers, vectorSizes, alias, bytes);
+  for (int r=0;r<REG_NUM;r++) {
+    if (!(REG_MASK_SHAREABLE & REG_BIT(r))) continue;
+    if (alias[r] != regions[r].alias) {
+      if (alias[r] < 0) update_mask |= REG_BIT(r);
+      regions[r].alias = alias[r];
+      changed = true;
+    }
+    if (alias[r] >= 0) {
+      BDA_DEBUG(1,printf("INFO: %s: region %s is read from the copy of %s.\n",
+       __func__,fpga_region_name(r),fpga_region_name(alias[r]));)
+      // the kernel reads used bytes from the copy of the alias
+      update_mask &= ~REG_BIT(r);
+      regions[r].used = bytes[r];
+    }
+  }
+  if (changed) {
+    fpga_fill_setup_pointers(regions, setupArray);
+    update_mask |= REG_BIT(REG_SETUP);
+  }
+  return update_mask;
+}
+
+// position (in cachelines) of an array in the data buffer that contains it
+static long unsigned int fpga_buffer_cacheline(const void *ptr,
+ unsigned char **dataBuffer, unsigned int *totalSize) {
+  for (int b=0;b<RW_BUF;b++) {
+    if ((unsigned char *)ptr >= dataBuffer[b] && (unsigned char *)ptr < dataBuffer[b] + totalSize[b]) {
+      return ((unsigned char *)ptr - dataBuffer[b])/CACHELINE_BYTES;
+    }
+  }
+  return 0;
+}
+
+// data buffer that contains an array (-1 if none)
+static int fpga_buffer_index(const void *ptr, unsigned char **dataBuffer, unsigned int *totalSize) {
+  for (int b=0;b<RW_BUF;b++) {
+    if ((unsigned char *)ptr >= dataBuffer[b] && (unsigned char *)ptr < dataBuffer[b] + totalSize[b]) return b;
+  }
+  return -1;
+}
+
+static int fpga_pipelined_copy_wait(const char *caller);
+
+// run the jobs one data buffer at a time (the resets of a data buffer before
+// its other jobs), and enqueue the migration of each data buffer as soon as
+// its jobs are done: the transfer of a data buffer overlaps with the packing
+// of the next ones. fpga_copy_to_device_datamem waits for the migrations.
+static int fpga_pack_pipelined(const char *caller, struct pack_list *resets, struct pack_list *jobs,
+ unsigned int *totalSize, unsigned char **dataBuffer) {
+  struct pack_list *lists[2] = {resets, jobs};
+  struct pack_list bank_jobs = {0, 0, NULL};
+  struct fpga_upload_times *times = &pipeline_times;
+  struct timespec time_mark, time_end;
+
+  // the data buffers of the previous copy must not be changed while in flight
+  if (pipeline_pending && fpga_pipelined_copy_wait(caller)) return 1;
+  memset(times, 0, sizeof(struct fpga_upload_times));
+  clock_gettime(CLOCK_REALTIME, &pipeline_start);
+  pipeline_pending = true;
+  for (int b=0;b<RW_BUF;b++) {
+    for (int l=0;l<2;l++) {
+      for (int j=0;j<lists[l]->num;j++) {
+        // (the arrays have been checked to be in the data buffers)
+        int bank = fpga_buffer_index(lists[l]->jobs[j].dst, dataBuffer, totalSize);
+        if (bank == b || (bank < 0 && b == 0)) *fpga_pack_next(&bank_jobs) = lists[l]->jobs[j];
+      }
+    }
+    clock_gettime(CLOCK_REALTIME, &time_mark);
+    fpga_pack_run(&bank_jobs);
+    clock_gettime(CLOCK_REALTIME, &time_end);
+    times->pack_ms += elapsed_ms(&time_mark, &time_end);
+    int err = clEnqueueMigrateMemObjects(pipeline_commands, 1, &pipeline_cldata[b], 0, 0, NULL,
+     &pipeline_done[b]);
+    if (err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to transfer input buffer %d to device (%d)\n",caller,b,err);
+      pipeline_done[b] = NULL;
+      free(bank_jobs.jobs);
+      fpga_pipelined_copy_wait(caller);
+      return 1;
+    }
+    clFlush(pipeline_commands);
+    times->bytes += totalSize[b];
+    times->transfers++;
+  }
+  free(bank_jobs.jobs);
+  resets->num = 0;
+  jobs->num = 0;
+  return 0;
+}
+
+// ------------------------------------------
+// copy a new system to the host data buffers
+// ------------------------------------------
+
 // this function is used to copy data after initialization: it will allow to
 // update the system to be solved, but it won't reallocate the buffers to a
-// bigger size if they are bigger that the first allocation
-//FIXME: add checks that the mbuffer sizes are not bigger than the allocation!
+// bigger size if they are bigger that the first allocation: the sizes are
+// checked against the allocation, and the function fails if they don't fit
+// (use a data buffers pool, see fpga_bufset_update, to grow the buffers).
+// With a pipelined copy (see fpga_set_pipelined_copy), the migration of each
+// data buffer is enqueued as soon as it is packed.
 int fpga_copy_host_datamem(void **vectorPointers, int *vectorSizes, long unsigned int *setupArray,
  double **nnzValArrays, int *nnzValArrays_sizes, short unsigned int *columnIndexArray, unsigned char *newRowOffsetArray,
  unsigned int *PIndexArray, unsigned int *colorSizesArray,
@@ -520,9 +829,6 @@ int fpga_copy_host_datamem(void **vectorPointers, int *vectorSizes, long unsigne
   int L_rowSize, L_columnSize, L_valSize, L_numColors, L_newrowSize, L_blkdiagSize;
   int U_rowSize, U_columnSize, U_valSize, U_numColors, U_newrowSize, U_blkdiagSize;
 
-  // always 1 for this version of the solver
-  assert(nnzValArrays_num==1);
-
   // assign vector sizes:
   // these sizes must be the actual ones for the system to be solved
   rowSize = vectorSizes[0];         // rowSize (not rounded)
@@ -553,80 +859,136 @@ int fpga_copy_host_datamem(void **vectorPointers, int *vectorSizes, long unsigne
      __func__,U_rowSize,U_columnSize,U_valSize,U_numColors,U_newrowSize,U_blkdiagSize);
   )
 
-  // reset/fill data buffer (if requested)
+  // destination of the input arrays
+  void *dst[REG_NUM] = {NULL};
+  dst[REG_COLOR_SIZES] = colorSizesArray;
+  dst[REG_L_COLOR_SIZES] = L_colorSizesArray;
+  dst[REG_U_COLOR_SIZES] = U_colorSizesArray;
+  dst[REG_P_INDEX] = PIndexArray;
+  dst[REG_L_P_INDEX] = L_PIndexArray;
+  dst[REG_U_P_INDEX] = U_PIndexArray;
+  for (int p=0;p<nnzValArrays_num;p++) {
+    dst[fpga_nnz_region(0, p)] = nnzValArrays[p];
+    dst[fpga_nnz_region(1, p)] = L_nnzValArrays[p];
+    dst[fpga_nnz_region(2, p)] = U_nnzValArrays[p];
+  }
+  dst[REG_COL_INDEX] = columnIndexArray;
+  dst[REG_L_COL_INDEX] = L_columnIndexArray;
+  dst[REG_U_COL_INDEX] = U_columnIndexArray;
+  dst[REG_NR_OFFSET] = newRowOffsetArray;
+  dst[REG_L_NR_OFFSET] = L_newRowOffsetArray;
+  dst[REG_U_NR_OFFSET] = U_newRowOffsetArray;
+  dst[REG_R1] = R1Array;
+  dst[REG_X1] = X1Array;
+  dst[REG_BLKD] = BLKDArray;
+
+  // check that the arrays of the current system fit in the space allocated
+  // by fpga_setup_host_datamem, before anything is written
+  unsigned char *known[REG_NUM+5];
+  int known_num = 0;
+  for (int r=0;r<REG_NUM;r++) if (dst[r] != NULL) known[known_num++] = (unsigned char *)dst[r];
+  known[known_num++] = (unsigned char *)setupArray;
+  known[known_num++] = (unsigned char *)X2Array;
+  known[known_num++] = (unsigned char *)R2Array;
+  known[known_num++] = (unsigned char *)LresArray;
+  known[known_num++] = (unsigned char *)UresArray;
+  int fill_size = roundUpTo(rowSize, 8);
+  for (int r=0;r<REG_NUM;r++) {
+    const void *src;
+    size_t bytes, stride;
+    if (dst[r] == NULL) continue;
+    fpga_region_input(r, vectorPointers, vectorSizes,
+     nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, nnzValArrays_num,
+     &src, &bytes, &stride);
+    if (fpga_check_room(__func__, fpga_region_name(r), (unsigned char *)dst[r], bytes,
+     known, known_num, dataBuffer, totalSize)) return 1;
+  }
+  if (fpga_check_room(__func__, "X2", (unsigned char *)X2Array, sizeof(double) * fill_size,
+       known, known_num, dataBuffer, totalSize) ||
+      fpga_check_room(__func__, "R2", (unsigned char *)R2Array, sizeof(double) * fill_size,
+       known, known_num, dataBuffer, totalSize)) return 1;
+  if (use_LU_res && fill_results_buffers) {
+    if (fpga_check_room(__func__, "L_res", (unsigned char *)LresArray, sizeof(double) * fill_size,
+         known, known_num, dataBuffer, totalSize) ||
+        fpga_check_room(__func__, "U_res", (unsigned char *)UresArray, sizeof(double) * fill_size,
+         known, known_num, dataBuffer, totalSize)) return 1;
+  }
+
+  struct pack_list resets = {0, 0, NULL};
+  struct pack_list jobs = {0, 0, NULL};
+
+  // reset data buffers (if requested): this is done before all other jobs,
+  // which overwrite parts of the buffers (with a pipelined copy, before the
+  // other jobs of the same data buffer)
   if (reset_data_buffers) {
     BDA_DEBUG(1,printf("INFO: %s: clearing data buffers.\n",__func__);)
     for (int b=0; b<RW_BUF; b++) {
       // must skip the setupArray, because that's already copied to the buffer #0
       if (b==0) {
         size_t offset = (SETUP_LINES*CACHELINE_DBL_WORDS)*sizeof(long unsigned int);
-        memset(dataBuffer[b]+offset,0,totalSize[b]-offset);
+        fpga_pack_add(&resets, PACK_ZERO, dataBuffer[b]+offset, NULL, totalSize[b]-offset, 0);
       } else {
-        memset(dataBuffer[b],0,totalSize[b]);
+        fpga_pack_add(&resets, PACK_ZERO, dataBuffer[b], NULL, totalSize[b], 0);
       }
     }
+    if (pipeline_commands == NULL) fpga_pack_run(&resets);
   }
 
   // Set the output regions of the data buffers to a pre-defined value
-  // before transferring to device memory
+  // before transferring to device memory; the first rowSize elements of
+  // X2/R2 are cleared below, so only the padding gets the pattern there
   if (fill_results_buffers) {
     BDA_DEBUG(1,printf("INFO: %s: setting predefined values in output regions of data buffers.\n",__func__);)
-    for (int d=0;d<roundUpTo(rowSize, 8);d++) {
-      union double2int dw;
-      dw.int_val = 0UL;
-      for (int j=15;j>=8;j--) {
-        unsigned char c = (j % 2 == 0) ? 0x9 : 0x6;
-        dw.int_val |= (((unsigned long int)c&0xF) << j*4);
-      }
-      dw.int_val |= (unsigned long int)d;
-      X2Array[d] = dw.double_val;
-      R2Array[d] = dw.double_val;
-      if (use_LU_res) {
-        LresArray[d] = dw.double_val;
-        UresArray[d] = dw.double_val;
-      }
-      BDA_DEBUG(3,
-        printf(" X2/R2/Lres/Ures buf: idx %6d: %13le (%016lx)\n",d,dw.double_val,dw.int_val);
-      )
+    fpga_pack_add(&jobs, PACK_PATTERN, X2Array + rowSize, NULL, sizeof(double) * (fill_size - rowSize), rowSize);
+    fpga_pack_add(&jobs, PACK_PATTERN, R2Array + rowSize, NULL, sizeof(double) * (fill_size - rowSize), rowSize);
+    if (use_LU_res) {
+      fpga_pack_add(&jobs, PACK_PATTERN, LresArray, NULL, sizeof(double) * fill_size, 0);
+      fpga_pack_add(&jobs, PACK_PATTERN, UresArray, NULL, sizeof(double) * fill_size, 0);
     }
+    BDA_DEBUG(3,
+      for (int d=0;d<fill_size;d++) {
+        union double2int dw;
+        fpga_pack_pattern(&dw.double_val, d, 1);
+        printf(" X2/R2/Lres/Ures buf: idx %6d: %13le (%016lx)\n",d,dw.double_val,dw.int_val);
+      }
+    )
   }
 
-  // update the setup array with the sizes for the current system to be solved;
-  // all other values are to be left unchanged
-  // Cacheline 0:
-  //  - [0]  val size (63..32) | row_size (31..0)
-  setupArray[0] = (((long unsigned int) valSize) << 32) + (long unsigned int) rowSize;
-  // Cacheline 1:
-  //  - [8]  L_val size (63..32) | L_row_size (31..0)
-  setupArray[8] = (((long unsigned int) L_valSize) << 32) + (long unsigned int) L_rowSize;
-  // Cacheline 2:
-  //  - [16] U_val size (63..32) | U_row_size (31..0)
-  setupArray[16] = (((long unsigned int) U_valSize) << 32) + (long unsigned int) U_rowSize;
-
-  // copy vectorPointers (from level scheduling/graph coloring) to data buffers
-  // vectorPointers arrays contain non-padded data, so we must copy exactly the number of elements
-  memcpy(colorSizesArray,     (int*)vectorPointers[0]  + 8,   sizeof(int) *       4 * numColors);
-  memcpy(L_colorSizesArray,   (int*)vectorPointers[6]  + 8,   sizeof(int) *       4 * L_numColors);
-  memcpy(U_colorSizesArray,   (int*)vectorPointers[12] + 8,   sizeof(int) *       4 * U_numColors);
-  memcpy(PIndexArray,         (int*)vectorPointers[1],        sizeof(int) *       columnSize);
-  memcpy(L_PIndexArray,       (int*)vectorPointers[7],        sizeof(int) *       L_columnSize);
-  memcpy(U_PIndexArray,       (int*)vectorPointers[13],       sizeof(int) *       U_columnSize);
-  for (int i=0;i<nnzValArrays_num;i++) {
-    memcpy(nnzValArrays[i],   ((double**)vectorPointers[2])[i],  sizeof(double) * nnzValArrays_sizes[i]);
-    memcpy(L_nnzValArrays[i], ((double**)vectorPointers[8])[i],  sizeof(double) * L_nnzValArrays_sizes[i]);
-    memcpy(U_nnzValArrays[i], ((double**)vectorPointers[14])[i], sizeof(double) * U_nnzValArrays_sizes[i]);
-  }
-  memcpy(columnIndexArray,    (short int*)vectorPointers[3],  sizeof(short int) * valSize);
-  memcpy(L_columnIndexArray,  (short int*)vectorPointers[9],  sizeof(short int) * L_valSize);
-  memcpy(U_columnIndexArray,  (short int*)vectorPointers[15], sizeof(short int) * U_valSize);
-  memcpy(newRowOffsetArray,   (char*)vectorPointers[4],       sizeof(char) *      newrowSize);
-  memcpy(L_newRowOffsetArray, (char*)vectorPointers[10],      sizeof(char) *      L_newrowSize);
-  memcpy(U_newRowOffsetArray, (char*)vectorPointers[16],      sizeof(char) *      U_newrowSize);
-  memcpy(R1Array,             (double*)vectorPointers[19],    sizeof(double) *    rowSize);
-  memset(R2Array,             0,                                 sizeof(double) *    rowSize); // must be initialized or memory map will fail
-  memcpy(X1Array,             (double*)vectorPointers[20],    sizeof(double) *    rowSize);
-  memset(X2Array,             0,                                 sizeof(double) *    rowSize); // must be initialized or memory map will fail
-  memcpy(BLKDArray,           (double*)vectorPointers[18],    sizeof(double) *    blkdiagSize);
+  // update the setup array with the sizes for the current system to be solved
+  fpga_update_setup_sizes(setupArray, vectorSizes);
+
+  // copy vectorPointers (from level scheduling/graph coloring) to data buffers;
+  // the shared regions are not copied: their setup array pointer is set to
+  // the copy of their alias (and restored when they are no longer shared)
+  int alias[REG_NUM];
+  size_t alias_bytes[REG_NUM];
+  fpga_find_aliases(vectorPointers, vectorSizes, alias, alias_bytes);
+  for (int r=0;r<REG_NUM;r++) {
+    const void *src;
+    size_t bytes, stride;
+    if (dst[r] == NULL) continue;
+    if (REG_MASK_SHAREABLE & REG_BIT(r)) {
+      void *copy = (alias[r] >= 0) ? dst[alias[r]] : dst[r];
+      setupArray[fpga_region_setup_slot(r)] = fpga_buffer_cacheline(copy, dataBuffer, totalSize);
+      if (alias[r] >= 0) continue;
+    }
+    fpga_region_input(r, vectorPointers, vectorSizes,
+     nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, nnzValArrays_num,
+     &src, &bytes, &stride);
+    fpga_pack_add_input(&jobs, r, dst[r], src, bytes, stride);
+  }
+  fpga_pack_add(&jobs, PACK_ZERO, R2Array, NULL, sizeof(double) * rowSize, 0); // must be initialized or memory map will fail
+  fpga_pack_add(&jobs, PACK_ZERO, X2Array, NULL, sizeof(double) * rowSize, 0); // must be initialized or memory map will fail
+  BDA_DEBUG(1,printf("INFO: %s: packing %d jobs with %d threads.\n",__func__,resets.num+jobs.num,fpga_get_pack_threads());)
+  int rc = 0;
+  if (pipeline_commands != NULL) {
+    rc = fpga_pack_pipelined(__func__, &resets, &jobs, totalSize, dataBuffer);
+  } else {
+    fpga_pack_run(&jobs);
+  }
+  free(resets.jobs);
+  free(jobs.jobs);
+  if (rc) return 1;
 
   // (partial) dump of R1 input buffer
   BDA_DEBUG(2,
@@ -690,6 +1052,175 @@ int fpga_copy_host_datamem(void **vectorPointers, int *vectorSizes, long unsigne
   return 0;
 }
 
+// ----------------------------------------------
+// refresh selected regions of host data buffers
+// ----------------------------------------------
+
+// this function copies only the regions selected in update_mask: when the
+// sparsity pattern doesn't change between two systems, only the values
+// (REG_MASK_VALUES, REG_MASK_BLKD) and the right-hand side (REG_MASK_RHS) must
+// be refreshed, while the pattern-dependent arrays can stay on the device;
+// the regions that have been copied are added to dirty_mask, which must be
+// given to fpga_copy_to_device_regions to transfer them to the device
+int fpga_update_host_datamem(unsigned long int update_mask,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ unsigned long int *dirty_mask) {
+  size_t total_bytes = 0;
+  struct pack_list jobs = {0, 0, NULL};
+
+  if (update_mask & ~REG_MASK_INPUTS) {
+    printf("ERROR: %s: only input regions can be updated (mask 0x%lx).\n",__func__,update_mask);
+    return 1;
+  }
+  update_mask = fpga_share_regions(update_mask, vectorPointers, vectorSizes, regions,
+   (long unsigned int *)&dataBuffer[regions[REG_SETUP].bank][regions[REG_SETUP].offset]);
+
+  for (int r=0;r<REG_NUM;r++) {
+    const void *src = NULL;
+    size_t bytes, stride = 0;
+    if (!(update_mask & REG_BIT(r))) continue;
+    unsigned char *dst = &dataBuffer[regions[r].bank][regions[r].offset];
+    if (r == REG_SETUP) {
+      bytes = CACHELINE_BYTES*SETUP_LINES;
+    } else if (fpga_region_input(r, vectorPointers, vectorSizes,
+     nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, nnzValArrays_num,
+     &src, &bytes, &stride)) {
+      // parts of the nnz values that are not used
+      continue;
+    }
+    if (bytes > regions[r].size) {
+      printf("ERROR: %s: region %d needs %lu bytes, but only %u bytes are allocated.\n",
+       __func__,r,(unsigned long)bytes,regions[r].size);
+      free(jobs.jobs);
+      return 1;
+    }
+    if (r == REG_SETUP) {
+      fpga_update_setup_sizes((long unsigned int *)dst, vectorSizes);
+    } else {
+      fpga_pack_add_input(&jobs, r, dst, src, bytes, stride);
+    }
+    regions[r].used = bytes;
+    total_bytes += bytes;
+  }
+  fpga_pack_run(&jobs);
+  free(jobs.jobs);
+  *dirty_mask |= update_mask;
+
+  BDA_DEBUG(1,printf("INFO: %s: refreshed regions (mask 0x%lx): %lu bytes.\n",
+   __func__,update_mask,(unsigned long)total_bytes);)
+
+  return 0;
+}
+
+// ---------------------------------------
+// direct access to the host data buffers
+// ---------------------------------------
+
+// these functions give direct access to the regions of the data buffers, so
+// that the input arrays can be written in place, instead of being built in
+// separate arrays and then copied by fpga_copy_host_datamem; the color sizes
+// must be written without the 8 header words used in vectorPointers.
+// After a region has been filled, fpga_commit_host_region must be called to
+// record its size and to mark it for the transfer to the device; when the
+// sizes of the system change, fpga_commit_host_sizes updates the setup array.
+// R2/X2 are not touched: they must be cleared once, e.g. by setting
+// reset_data_buffers in fpga_setup_host_datamem.
+
+// number of elements that fit in a region
+unsigned int fpga_region_capacity(struct fpga_region regions[REG_NUM], int region) {
+  if (region < 0 || region >= REG_NUM) return 0;
+  return regions[region].size / fpga_region_type_bytes(regions[region].type);
+}
+
+// pointer to the first element of a region, after checking that the region
+// holds elements of the expected type and that count elements fit in it
+static void *fpga_region_data(const char *caller,
+ struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, int type, unsigned int count) {
+  if (region < 0 || region >= REG_NUM) {
+    printf("ERROR: %s: invalid region %d.\n",caller,region);
+    return NULL;
+  }
+  if (regions[region].type != type) {
+    printf("ERROR: %s: region %d holds elements of type %d, not %d.\n",
+     caller,region,regions[region].type,type);
+    return NULL;
+  }
+  if (count > fpga_region_capacity(regions, region)) {
+    printf("ERROR: %s: region %d can hold %u elements, %u requested.\n",
+     caller,region,fpga_region_capacity(regions, region),count);
+    return NULL;
+  }
+  if (regions[region].device_only || dataBuffer[regions[region].bank] == NULL) {
+    printf("ERROR: %s: region %d has no copy on the host.\n",caller,region);
+    return NULL;
+  }
+  for (int r=0;r<REG_NUM;r++) {
+    if ((r == region && regions[r].alias >= 0) || regions[r].alias == region) {
+      printf("ERROR: %s: region %d is shared with region %d: it must be updated with fpga_update_host_datamem.\n",
+       caller,region,(r == region) ? regions[r].alias : r);
+      return NULL;
+    }
+  }
+  return &dataBuffer[regions[region].bank][regions[region].offset];
+}
+
+double *fpga_region_doubles(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count) {
+  return (double *)fpga_region_data(__func__, regions, dataBuffer, region, REG_TYPE_DOUBLE, count);
+}
+
+unsigned int *fpga_region_uints(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count) {
+  return (unsigned int *)fpga_region_data(__func__, regions, dataBuffer, region, REG_TYPE_UINT, count);
+}
+
+short unsigned int *fpga_region_ushorts(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count) {
+  return (short unsigned int *)fpga_region_data(__func__, regions, dataBuffer, region, REG_TYPE_USHORT, count);
+}
+
+unsigned char *fpga_region_uchars(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count) {
+  return (unsigned char *)fpga_region_data(__func__, regions, dataBuffer, region, REG_TYPE_UCHAR, count);
+}
+
+float *fpga_region_floats(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count) {
+  return (float *)fpga_region_data(__func__, regions, dataBuffer, region, REG_TYPE_FLOAT, count);
+}
+
+// record the number of elements written in a region
+int fpga_commit_host_region(struct fpga_region regions[REG_NUM], int region,
+ unsigned int count, unsigned long int *dirty_mask) {
+  if (region < 0 || region >= REG_NUM || !(REG_MASK_INPUTS & REG_BIT(region)) || region == REG_SETUP) {
+    printf("ERROR: %s: region %d is not an input region.\n",__func__,region);
+    return 1;
+  }
+  if (count > fpga_region_capacity(regions, region)) {
+    printf("ERROR: %s: region %d can hold %u elements, %u written.\n",
+     __func__,region,fpga_region_capacity(regions, region),count);
+    return 1;
+  }
+  regions[region].used = count * fpga_region_type_bytes(regions[region].type);
+  *dirty_mask |= REG_BIT(region);
+  return 0;
+}
+
+// update the sizes of the current system in the setup array
+int fpga_commit_host_sizes(int *vectorSizes,
+ struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ unsigned long int *dirty_mask) {
+  fpga_update_setup_sizes((long unsigned int *)&dataBuffer[regions[REG_SETUP].bank][regions[REG_SETUP].offset],
+   vectorSizes);
+  regions[REG_SETUP].used = regions[REG_SETUP].size;
+  *dirty_mask |= REG_BIT(REG_SETUP);
+  return 0;
+}
+
 // --------------------------------------------
 // set host debug buffer to a pre-defined value
 // --------------------------------------------
@@ -727,6 +1258,14 @@ static int fpga_fill_host_debugbuf(unsigned int debug_outbuf_words,
 // -------------------------
 
 int fpga_setup_device_debugbuf(cl_context context,
+ unsigned long int *debugBuffer, cl_mem *cldebug, unsigned int debugbufferSize) {
+  return fpga_setup_cu_debugbuf(context, NULL, debugBuffer, cldebug, debugbufferSize);
+}
+
+// with kernel not NULL, the debug buffer is mapped to the memory bank of the
+// debug port of the compute unit the kernel handle was created for (see
+// fpga_create_device_buffer)
+int fpga_setup_cu_debugbuf(cl_context context, cl_kernel kernel,
  unsigned long int *debugBuffer, cl_mem *cldebug, unsigned int debugbufferSize) {
   unsigned int offset;
 
@@ -735,13 +1274,14 @@ int fpga_setup_device_debugbuf(cl_context context,
    __func__,debugbufferSize);)
   // explicit bank mapping
   cl_mem_ext_ptr_t cl_ptr_struct;
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  offset = 34;  // skip HBM (0-31) and DDR (32-33), map to PLRAM (34-36)
-#else
-  #error "Undefined"
-#endif
-  cl_ptr_struct.flags = (offset+0)|XCL_MEM_TOPOLOGY; // PLRAM[0]
-  cl_ptr_struct.param = 0;
+  if (kernel != NULL) {
+    cl_ptr_struct.flags = KERNEL_ARG_DEBUG;
+    cl_ptr_struct.param = kernel;
+  } else {
+    offset = DEBUG_MEM_BANK;  // PLRAM[0] (see bicgstab_solver_config.hpp)
+    cl_ptr_struct.flags = (offset+0)|XCL_MEM_TOPOLOGY; // PLRAM[0]
+    cl_ptr_struct.param = 0;
+  }
   cl_ptr_struct.obj = debugBuffer;
   *cldebug = clCreateBuffer(context,CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR | CL_MEM_EXT_PTR_XILINX,
    debugbufferSize, &cl_ptr_struct, NULL);
@@ -757,42 +1297,50 @@ int fpga_setup_device_debugbuf(cl_context context,
 // setup device data buffers 
 // -------------------------
 
+// create the device buffer of data buffer b, mapped to its memory bank; when
+// dataBuffer is NULL, the buffer has no host copy: it is never migrated, and
+// the host must use explicit reads/writes to access it. With kernel NULL, the
+// bank is the one of DATA_MEM_BANKS (first compute unit); otherwise it is the
+// bank connected to the read port of the buffer of the compute unit the
+// kernel handle was created for (for kernels with several compute units,
+// each with its own banks)
+int fpga_create_device_buffer(cl_context context, cl_kernel kernel, int b,
+ unsigned int databufferSize, unsigned char *dataBuffer, cl_mem *cldata) {
+  BDA_DEBUG(1,printf("INFO: %s: allocating CL data buffer %d, %d bytes\n",
+   __func__,b,databufferSize);)
+  // explicit bank mapping
+  cl_mem_ext_ptr_t cl_ptr_struct;
+  // memory bank of each data buffer (e.g. with 2r_3r3w_ddr: DDR 32-33 for
+  // buffers 0-1, HBM 2,4,6 for buffers 2-4)
+  static const int mem_banks[RW_BUF] = DATA_MEM_BANKS;
+  if (kernel != NULL) {
+    // the write port of a buffer is connected to the same bank
+    cl_ptr_struct.flags = KERNEL_ARG_READ(b);
+    cl_ptr_struct.param = kernel;
+  } else {
+    cl_ptr_struct.flags = mem_banks[b]|XCL_MEM_TOPOLOGY;
+    cl_ptr_struct.param = 0;
+  }
+  cl_ptr_struct.obj = dataBuffer;
+  *cldata = clCreateBuffer(context,
+   CL_MEM_READ_WRITE | (dataBuffer != NULL ? CL_MEM_USE_HOST_PTR : 0) | CL_MEM_EXT_PTR_XILINX,
+   databufferSize,&cl_ptr_struct,NULL);
+  if (!*cldata) {
+    printf("ERROR: %s: failed to allocate device memory for data buffer %d\n",
+     __func__,b);
+    return 1;
+  }
+  BDA_DEBUG(1,printf("INFO: %s: CL data buffer %d: %p\n",__func__,b,*cldata);)
+  return 0;
+}
+
 int fpga_setup_device_datamem(cl_context context,
  unsigned int *databufferSize, unsigned char *dataBuffer[RW_BUF],
  cl_mem *cldata) {
 
   BDA_DEBUG(1,printf("INFO: %s: creating CL buffers.\n",__func__);)
   for (int b=0;b<RW_BUF;b++) {
-    BDA_DEBUG(1,printf("INFO: %s: allocating CL data buffer %d, %d bytes\n",
-     __func__,b,databufferSize[b]);)
-    // explicit bank mapping
-    cl_mem_ext_ptr_t cl_ptr_struct;
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr
-    // when using DDR for the first two ports:
-    if (b<2) {
-      // for buffers <2: skip HBM (0-31), map to DDR (32-33)
-      cl_ptr_struct.flags = (32+b)|XCL_MEM_TOPOLOGY;
-    } else {
-      // for buffers >=2: map to HBM (0-31)
-      cl_ptr_struct.flags = ((b-1)*2)|XCL_MEM_TOPOLOGY; // map to HBM 2,4,6
-    }
-#elif PORTS_CONFIG == PORTS_2r_3r3w_hbm
-    // when mapping all ports to HBM:
-    // map to HBM (0-31)
-    cl_ptr_struct.flags = ((b+1)*2)|XCL_MEM_TOPOLOGY; // map to HBM 2,4,6,...
-#else
-  #error "Undefined"
-#endif
-    cl_ptr_struct.obj = dataBuffer[b];
-    cl_ptr_struct.param = 0;
-    cldata[b] = clCreateBuffer(context,CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR | CL_MEM_EXT_PTR_XILINX,
-     databufferSize[b],&cl_ptr_struct,NULL);
-    if (!cldata[b]) {
-      printf("ERROR: %s: failed to allocate device memory for data buffer %d\n",
-       __func__,b);
-      return 1;
-    }
-    BDA_DEBUG(1,printf("INFO: %s: CL data buffer %d: %p\n",__func__,b,cldata[b]);)
+    if (fpga_create_device_buffer(context, NULL, b, databufferSize[b], dataBuffer[b], &cldata[b])) return 1;
   }
   return 0;
 }
@@ -805,9 +1353,11 @@ int fpga_setup_device_datamem(cl_context context,
 // copy to device the debug buffer
 // -------------------------------
 
-int fpga_copy_to_device_debugbuf(cl_command_queue commands,
- cl_mem cldebug, unsigned long int *debugBuffer, unsigned int debugBufferSize,
- unsigned int debug_outbuf_words) {
+// fill the debug buffer with a pre-defined value and enqueue its transfer to
+// the device: the debug buffer must not be changed until the transfer is
+// complete (e.g. when it is read back after the kernel run)
+int fpga_enqueue_to_device_debugbuf(cl_command_queue commands,
+ cl_mem cldebug, unsigned long int *debugBuffer, unsigned int debug_outbuf_words) {
   int err;
 
   // we need at least 2 words in the debug buffer (one for status and one for summary)
@@ -820,12 +1370,20 @@ int fpga_copy_to_device_debugbuf(cl_command_queue commands,
   fpga_fill_host_debugbuf(debug_outbuf_words, debugBuffer);
 
   // copy debug buffer to device memory
-  BDA_DEBUG(1,printf("INFO: %s: transferring debug buffer (host -> device, %u bytes).\n",__func__,debugBufferSize);)
+  BDA_DEBUG(1,printf("INFO: %s: transferring debug buffer (host -> device, %u bytes).\n",
+   __func__,CACHELINE_BYTES*debug_outbuf_words);)
   err = clEnqueueMigrateMemObjects(commands, 1, &cldebug, 0, 0, NULL, NULL);
   if (err != CL_SUCCESS){
     printf("ERROR: %s: failed to transfer debug output buffer to device (%d)\n",__func__,err);
     return 1;
   }
+  return 0;
+}
+
+int fpga_copy_to_device_debugbuf(cl_command_queue commands,
+ cl_mem cldebug, unsigned long int *debugBuffer, unsigned int debugBufferSize,
+ unsigned int debug_outbuf_words) {
+  if (fpga_enqueue_to_device_debugbuf(commands, cldebug, debugBuffer, debug_outbuf_words)) return 1;
   clFinish(commands);
   // clean the debug buffer
   memset(debugBuffer,0,(size_t)debugBufferSize);
@@ -837,28 +1395,81 @@ int fpga_copy_to_device_debugbuf(cl_command_queue commands,
 // copy to device the data buffers
 // -------------------------------
 
-int fpga_copy_to_device_datamem(cl_command_queue commands,
- int dataBufNum, cl_mem *cldata) {
+// with wait false, the transfer is only enqueued
+static int fpga_migrate_to_device_datamem(const char *caller, cl_command_queue commands,
+ int dataBufNum, cl_mem *cldata, bool wait) {
   int err;
   struct timespec time_start, time_end;
   double time_elapsed_ms;
 
-  BDA_DEBUG(1,printf("INFO: %s: transferring %d data buffers (host -> device).\n",__func__,dataBufNum);)
+  BDA_DEBUG(1,printf("INFO: %s: transferring %d data buffers (host -> device).\n",caller,dataBufNum);)
   clock_gettime(CLOCK_REALTIME, &time_start);
   err = clEnqueueMigrateMemObjects(commands, dataBufNum, cldata, 0, 0, NULL, NULL);
   if (err != CL_SUCCESS){
-    printf("ERROR: %s: failed to transfer input buffers to device (%d)\n",__func__,err);
+    printf("ERROR: %s: failed to transfer input buffers to device (%d)\n",caller,err);
     return 1;
   }
+  if (!wait) return 0;
   clFinish(commands);
   clock_gettime(CLOCK_REALTIME, &time_end);
-  time_elapsed_ms = (double)(time_end.tv_sec - time_start.tv_sec)*1000 +
-   (double)(time_end.tv_nsec - time_start.tv_nsec) / 1000000;
-  BDA_DEBUG(1,printf("INFO: %s: transfer time: %lf ms\n",__func__,time_elapsed_ms);)
+  time_elapsed_ms = elapsed_ms(&time_start, &time_end);
+  BDA_DEBUG(1,printf("INFO: %s: transfer time: %lf ms\n",caller,time_elapsed_ms);)
 
   return 0;
 }
 
+// wait for the transfer from a staging slot, adding its device time to the
+// upload times (when the queue has profiling enabled)
+static int fpga_upload_slot_wait(cl_event *done, struct fpga_upload_times *times) {
+  struct timespec time_start, time_end;
+  cl_ulong start, end;
+
+  if (*done == NULL) return 0;
+  clock_gettime(CLOCK_REALTIME, &time_start);
+  int err = clWaitForEvents(1, done);
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  times->wait_ms += elapsed_ms(&time_start, &time_end);
+  if (err == CL_SUCCESS &&
+   clGetEventProfilingInfo(*done, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) == CL_SUCCESS &&
+   clGetEventProfilingInfo(*done, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) == CL_SUCCESS) {
+    times->transfer_ms += (double)(end - start) / 1000000;
+  }
+  clReleaseEvent(*done);
+  *done = NULL;
+  return (err != CL_SUCCESS);
+}
+
+// wait for the migrations enqueued by a pipelined copy
+static int fpga_pipelined_copy_wait(const char *caller) {
+  struct fpga_upload_times *times = &pipeline_times;
+  struct timespec time_end;
+  int rc = 0;
+
+  for (int b=0;b<RW_BUF;b++) {
+    if (fpga_upload_slot_wait(&pipeline_done[b], times) && rc == 0) {
+      printf("ERROR: %s: failed to wait for the transfer of data buffer %d to device.\n",caller,b);
+      rc = 1;
+    }
+  }
+  pipeline_pending = false;
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  times->total_ms = elapsed_ms(&pipeline_start, &time_end);
+  BDA_DEBUG(1,printf("INFO: %s: pipelined copy: %lu bytes in %d data buffers, pack %.3lf ms, waiting %.3lf ms, transfer %.3lf ms, total %.3lf ms.\n",
+   caller,(unsigned long)times->bytes,times->transfers,
+   times->pack_ms,times->wait_ms,times->transfer_ms,times->total_ms);)
+  return rc;
+}
+
+// after a pipelined copy to the same queue and data buffers, the migrations
+// have already been enqueued: only wait for them
+int fpga_copy_to_device_datamem(cl_command_queue commands,
+ int dataBufNum, cl_mem *cldata) {
+  if (pipeline_pending && commands == pipeline_commands && cldata == pipeline_cldata) {
+    return fpga_pipelined_copy_wait(__func__);
+  }
+  return fpga_migrate_to_device_datamem(__func__, commands, dataBufNum, cldata, true);
+}
+
 int DEBUG_fpga_copy_to_device_datamem(cl_command_queue commands,
  int dataBufNum, cl_mem *cldata, unsigned int *dataBufferSize, unsigned char **dataBuffer) {
   int err;
@@ -876,13 +1487,79 @@ int DEBUG_fpga_copy_to_device_datamem(cl_command_queue commands,
   }
   clFinish(commands);
   clock_gettime(CLOCK_REALTIME, &time_end);
-  time_elapsed_ms = (double)(time_end.tv_sec - time_start.tv_sec)*1000 +
-   (double)(time_end.tv_nsec - time_start.tv_nsec) / 1000000;
+  time_elapsed_ms = elapsed_ms(&time_start, &time_end);
   BDA_DEBUG(1,printf("INFO: %s: transfer time: %lf ms\n",__func__,time_elapsed_ms);)
 
   return 0;
 }
 
+// ----------------------------------------------------
+// copy to device only the modified data buffer regions
+// ----------------------------------------------------
+
+// transfer to the device the regions set in dirty_mask (see
+// fpga_update_host_datamem), then clear dirty_mask; regions that are adjacent
+// in the same data buffer are coalesced in a single transfer
+// with wait false, the transfers are only enqueued
+static int fpga_write_to_device_regions(const char *caller, cl_command_queue commands,
+ cl_mem *cldata, unsigned char **dataBuffer,
+ struct fpga_region regions[REG_NUM], unsigned long int *dirty_mask, bool wait) {
+  int err;
+  struct timespec time_start, time_end;
+  double time_elapsed_ms;
+  size_t total_bytes = 0;
+  int transfers = 0;
+
+  clock_gettime(CLOCK_REALTIME, &time_start);
+  for (int b=0;b<RW_BUF;b++) {
+    // list of the dirty regions of this data buffer, sorted by offset
+    int list[REG_NUM];
+    int n = 0;
+    for (int r=0;r<REG_NUM;r++) {
+      if (!(*dirty_mask & REG_BIT(r)) || regions[r].bank != b || regions[r].used == 0) continue;
+      int i = n++;
+      while (i>0 && regions[list[i-1]].offset > regions[r].offset) {
+        list[i] = list[i-1];
+        i--;
+      }
+      list[i] = r;
+    }
+    for (int i=0;i<n;) {
+      size_t start = regions[list[i]].offset;
+      size_t end = start + roundUpTo(regions[list[i]].used, CACHELINE_BYTES);
+      int j = i+1;
+      while (j<n && regions[list[j]].offset == regions[list[j-1]].offset + regions[list[j-1]].size) {
+        end = regions[list[j]].offset + roundUpTo(regions[list[j]].used, CACHELINE_BYTES);
+        j++;
+      }
+      BDA_DEBUG(2,printf("INFO: %s: data buffer %d: transferring bytes %lu..%lu (regions %d..%d).\n",
+       caller,b,(unsigned long)start,(unsigned long)end-1,list[i],list[j-1]);)
+      err = clEnqueueWriteBuffer(commands, cldata[b], CL_FALSE, start, end-start, dataBuffer[b]+start, 0, NULL, NULL);
+      if (err != CL_SUCCESS) {
+        printf("ERROR: %s: failed to transfer regions of data buffer %d to device (%d)\n",caller,b,err);
+        return 1;
+      }
+      total_bytes += end-start;
+      transfers++;
+      i = j;
+    }
+  }
+  if (wait) clFinish(commands);
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  time_elapsed_ms = elapsed_ms(&time_start, &time_end);
+  BDA_DEBUG(1,printf("INFO: %s: transferred %lu bytes in %d transfers (mask 0x%lx), time: %lf ms\n",
+   caller,(unsigned long)total_bytes,transfers,*dirty_mask,time_elapsed_ms);)
+  *dirty_mask = 0;
+
+  return 0;
+}
+
+int fpga_copy_to_device_regions(cl_command_queue commands,
+ cl_mem *cldata, unsigned char **dataBuffer,
+ struct fpga_region regions[REG_NUM], unsigned long int *dirty_mask) {
+  return fpga_write_to_device_regions(__func__, commands, cldata, dataBuffer, regions, dirty_mask, true);
+}
+
 // ---------------------------------
 // copy from device the debug buffer 
 // ---------------------------------
@@ -1241,6 +1918,19 @@ int fpga_unmap_results(bool evenBuffers,
 // kernel parameters setup
 // -----------------------
 
+// set the kernel arguments of the data buffers selected in bank_mask: the
+// read ports of all data buffers and the write ports of the read/write
+// buffers (RO_BUF and above)
+int fpga_set_kernel_data_args(cl_kernel kernel, cl_mem *cldata, unsigned int bank_mask) {
+  int err = 0;
+  for (int b=0;b<RW_BUF;b++) {
+    if (!(bank_mask & (1U << b))) continue;
+    err |= clSetKernelArg(kernel, KERNEL_ARG_READ(b), sizeof(cl_mem), &cldata[b]);
+    if (b >= RO_BUF) err |= clSetKernelArg(kernel, KERNEL_ARG_WRITE(b), sizeof(cl_mem), &cldata[b]);
+  }
+  return err;
+}
+
 // WARNING: as per Xilinx recommendations (see UG1393), this must be done before
 // any host-device data movement
 int fpga_set_kernel_parameters(cl_kernel kernel,
@@ -1278,19 +1968,8 @@ int fpga_set_kernel_parameters(cl_kernel kernel,
   err |= clSetKernelArg(kernel,  0, sizeof(cl_ulong), &clparam[0]);
   err |= clSetKernelArg(kernel,  1, sizeof(cl_ulong), &clparam[1]);
   err |= clSetKernelArg(kernel,  2, sizeof(cl_ulong), &clparam[2]);
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  err |= clSetKernelArg(kernel,  3, sizeof(cl_mem), &cldata[0]);
-  err |= clSetKernelArg(kernel,  4, sizeof(cl_mem), &cldata[1]);
-  err |= clSetKernelArg(kernel,  5, sizeof(cl_mem), &cldata[2]);
-  err |= clSetKernelArg(kernel,  6, sizeof(cl_mem), &cldata[3]);
-  err |= clSetKernelArg(kernel,  7, sizeof(cl_mem), &cldata[4]);
-  err |= clSetKernelArg(kernel,  8, sizeof(cl_mem), &cldata[2]);
-  err |= clSetKernelArg(kernel,  9, sizeof(cl_mem), &cldata[3]);
-  err |= clSetKernelArg(kernel, 10, sizeof(cl_mem), &cldata[4]);
-  err |= clSetKernelArg(kernel, 11, sizeof(cl_mem), &cldebug);
-#else
-  #error "Undefined"
-#endif
+  err |= fpga_set_kernel_data_args(kernel, cldata, (1U << RW_BUF) - 1);
+  err |= clSetKernelArg(kernel, KERNEL_ARG_DEBUG, sizeof(cl_mem), &cldebug);
   if (err != CL_SUCCESS) {
     printf("ERROR: %s: failed to set kernel arguments (%d)\n",__func__, err);
     return 1;
@@ -1315,8 +1994,7 @@ int fpga_kernel_run(cl_command_queue commands, cl_kernel kernel, double *time_el
   }
   clFinish(commands);
   clock_gettime(CLOCK_REALTIME, &time_end);
-  *time_elapsed_ms = (double)(time_end.tv_sec - time_start.tv_sec)*1000 +
-   (double)(time_end.tv_nsec - time_start.tv_nsec) / 1000000;
+  *time_elapsed_ms = elapsed_ms(&time_start, &time_end);
   BDA_DEBUG(1,
     printf("INFO: %s: kernel finished.\n",__func__);
     printf("INFO: %s: kernel execution time: %lf ms\n",__func__,*time_elapsed_ms);
@@ -1356,9 +2034,9 @@ int fpga_kernel_query(cl_context context, cl_command_queue commands, cl_kernel k
   for (int b=0;b<RW_BUF;b++) {
     temp_dataBufferSize[b] = 4096;
     // SDx needs aligned memory when using CL_MEM_USE_HOST_PTR
-    err=posix_memalign((void **)&temp_dataBuffer[b], SDX_MEM_ALIGNMENT, temp_dataBufferSize[b]);
+    err=host_alloc("temp_dataBuffer", temp_dataBufferSize[b], (void **)&temp_dataBuffer[b]);
     if (err) {
-      printf("ERROR: %s: posix_memalign failed to allocate temp_dataBuffer %d.\n",__func__,b);
+      printf("ERROR: %s: failed to allocate temp_dataBuffer %d.\n",__func__,b);
       return 1;
     }
     memset(temp_dataBuffer[b],0,temp_dataBufferSize[b]);
@@ -1386,19 +2064,8 @@ int fpga_kernel_query(cl_context context, cl_command_queue commands, cl_kernel k
   err |= clSetKernelArg(kernel,  0, sizeof(cl_ulong), &clparam[0]);
   err |= clSetKernelArg(kernel,  1, sizeof(cl_ulong), &clparam[1]);
   err |= clSetKernelArg(kernel,  2, sizeof(cl_ulong), &clparam[2]);
-#if PORTS_CONFIG == PORTS_2r_3r3w_ddr || PORTS_CONFIG == PORTS_2r_3r3w_hbm
-  err |= clSetKernelArg(kernel,  3, sizeof(cl_mem), &temp_cldata[0]);
-  err |= clSetKernelArg(kernel,  4, sizeof(cl_mem), &temp_cldata[1]);
-  err |= clSetKernelArg(kernel,  5, sizeof(cl_mem), &temp_cldata[2]);
-  err |= clSetKernelArg(kernel,  6, sizeof(cl_mem), &temp_cldata[3]);
-  err |= clSetKernelArg(kernel,  7, sizeof(cl_mem), &temp_cldata[4]);
-  err |= clSetKernelArg(kernel,  8, sizeof(cl_mem), &temp_cldata[2]);
-  err |= clSetKernelArg(kernel,  9, sizeof(cl_mem), &temp_cldata[3]);
-  err |= clSetKernelArg(kernel, 10, sizeof(cl_mem), &temp_cldata[4]);
-  err |= clSetKernelArg(kernel, 11, sizeof(cl_mem), &cldebug);
-#else
-  #error "Undefined"
-#endif
+  err |= fpga_set_kernel_data_args(kernel, temp_cldata, (1U << RW_BUF) - 1);
+  err |= clSetKernelArg(kernel, KERNEL_ARG_DEBUG, sizeof(cl_mem), &cldebug);
   if (err != CL_SUCCESS) {
     printf("ERROR: %s: failed to set kernel arguments (%d)\n",__func__,err);
     return 1;
@@ -1418,7 +2085,7 @@ int fpga_kernel_query(cl_context context, cl_command_queue commands, cl_kernel k
   for (int b=0;b<RW_BUF;b++) {
     clReleaseMemObject(temp_cldata[b]);
     temp_cldata[b] = NULL;
-    free(temp_dataBuffer[b]);
+    host_free(temp_dataBuffer[b]);
   }
 
   // TODO: modify function fpga_copy_from_device_debugbuf to transfer debug and
@@ -1451,3 +2118,682 @@ int fpga_kernel_query(cl_context context, cl_command_queue commands, cl_kernel k
   return 0;
 }
 
+
+// =============================================================================
+// growable data buffers pool
+// =============================================================================
+
+// The pool owns the host data buffers, the device buffers and the layout of
+// the regions. The layout is planned for capacities (sizes of the system)
+// that grow geometrically: when a system doesn't fit, the grown sizes are
+// multiplied by the growth factor, the layout is re-planned and only the data
+// buffers that don't fit their current allocation are reallocated (host and
+// device); the kernel arguments are set again only for those data buffers.
+// With BUFSET_DEVICE_SCRATCH, the layout is split (see fpga_plan_split_layout):
+// the temporaries and the results written by the kernel exist only in device
+// memory, the host keeps a copy of the input regions only, and the transfers
+// are explicit writes of the modified input regions: nothing is migrated.
+// With BUFSET_STAGE_INPUTS, the host doesn't keep the input regions either:
+// fpga_bufset_update only records the source arrays, and fpga_bufset_upload
+// packs the input regions one at a time in a staging buffer, writes them to
+// the device and reuses the staging buffer for the next region (and for the
+// next system). The host memory needed is the largest input region, instead
+// of the whole data buffers; the source arrays must stay valid until
+// fpga_bufset_upload. With BUFSET_PIPELINE_UPLOAD, the inputs are staged as
+// well, but the regions are packed in chunks, in a ring of staging slots: a
+// chunk is written to the device without waiting, and its slot is reused only
+// when that transfer has completed, so that the transfers of the packed chunks
+// overlap with the packing of the next ones.
+
+// setup array of the pool: kept apart from the data buffers when staging
+static long unsigned int *fpga_bufset_setup(struct fpga_bufset *bufset) {
+  if (bufset->stage_inputs) return bufset->setupArray;
+  return (long unsigned int *)&bufset->dataBuffer[0][bufset->regions[REG_SETUP].offset];
+}
+
+// plan the layout for the current capacities
+static int fpga_bufset_plan(struct fpga_bufset *bufset) {
+  if (fpga_get_float_regions() != bufset->float_regions) {
+    printf("ERROR: %s: the single precision regions have changed since the pool was created (0x%lx, now 0x%lx).\n",
+     __func__,bufset->float_regions,fpga_get_float_regions());
+    return 1;
+  }
+  if (bufset->device_scratch) {
+    return fpga_plan_split_layout(bufset->sizes,
+     bufset->nnz_sizes[0], bufset->nnz_sizes[1], bufset->nnz_sizes[2], bufset->nnz_num,
+     bufset->regions, bufset->totalSize, bufset->hostSize, bufset->result_offsets);
+  }
+  if (fpga_plan_datamem_layout(bufset->sizes,
+   bufset->nnz_sizes[0], bufset->nnz_sizes[1], bufset->nnz_sizes[2], bufset->nnz_num,
+   bufset->regions, bufset->totalSize, bufset->result_offsets)) return 1;
+  memcpy(bufset->hostSize, bufset->totalSize, sizeof(bufset->hostSize));
+  return 0;
+}
+
+// allocate the host and device memory of data buffer b
+static int fpga_bufset_alloc(struct fpga_bufset *bufset, int b) {
+  char name[32];
+  sprintf(name,"dataBuffer %d",b);
+  if (bufset->hostSize[b] > 0 && !bufset->stage_inputs) {
+    if (host_alloc(name, bufset->hostSize[b], (void **)&bufset->dataBuffer[b])) return 1;
+    memset(bufset->dataBuffer[b], 0, bufset->hostSize[b]);
+  }
+  bufset->allocSize[b] = bufset->totalSize[b];
+  // with a split layout, the device buffer is bigger than its host copy
+  if (fpga_create_device_buffer(bufset->context, bufset->kernel, b, bufset->allocSize[b],
+   bufset->device_scratch ? NULL : bufset->dataBuffer[b], &bufset->cldata[b])) return 1;
+  return 0;
+}
+
+// ----------------------------
+// create the data buffers pool
+// ----------------------------
+
+// kernel selects the memory banks of the data buffers (see
+// fpga_create_device_buffer): NULL for the banks of DATA_MEM_BANKS
+int fpga_bufset_create(cl_context context, cl_kernel kernel, unsigned int config_bits,
+ int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, double growth, unsigned int residency,
+ struct fpga_bufset *bufset) {
+
+  if (nnzValArrays_num < 1 || nnzValArrays_num > NNZ_PARTS_KERNEL) {
+    printf("ERROR: %s: the kernel reads the nnz values in 1 to %d parts (%d requested).\n",
+     __func__,NNZ_PARTS_KERNEL,nnzValArrays_num);
+    return 1;
+  }
+  if (growth < 1.0) {
+    printf("ERROR: %s: growth factor must be at least 1.0 (%.2lf).\n",__func__,growth);
+    return 1;
+  }
+  memset(bufset, 0, sizeof(struct fpga_bufset));
+  bufset->context = context;
+  bufset->kernel = kernel;
+  bufset->config_bits = config_bits;
+  bufset->growth = growth;
+  // the staged inputs are written to device-only buffers
+  bufset->pipeline_upload = (residency & BUFSET_PIPELINE_UPLOAD) != 0;
+  bufset->stage_inputs = bufset->pipeline_upload || (residency & BUFSET_STAGE_INPUTS) != 0;
+  bufset->device_scratch = bufset->stage_inputs || (residency & BUFSET_DEVICE_SCRATCH) != 0;
+  memcpy(bufset->sizes, processedSizes, sizeof(bufset->sizes));
+  bufset->float_regions = fpga_get_float_regions();
+  bufset->nnz_num = nnzValArrays_num;
+  for (int p=0;p<nnzValArrays_num;p++) {
+    bufset->nnz_sizes[0][p] = nnzValArrays_sizes[p];
+    bufset->nnz_sizes[1][p] = L_nnzValArrays_sizes[p];
+    bufset->nnz_sizes[2][p] = U_nnzValArrays_sizes[p];
+  }
+
+  if (fpga_bufset_plan(bufset)) {
+    printf("ERROR: %s: cannot plan the data buffers layout.\n",__func__);
+    return 1;
+  }
+  for (int b=0;b<RW_BUF;b++) {
+    if (fpga_bufset_alloc(bufset, b)) {
+      fpga_bufset_release(bufset);
+      return 1;
+    }
+  }
+  fpga_fill_setup_array(fpga_bufset_setup(bufset), config_bits, bufset->sizes, bufset->regions);
+  // the whole data buffers must be transferred and set as kernel arguments
+  // (the staged inputs are never migrated: all of them must be staged once)
+  bufset->migrate_mask = (1U << RW_BUF) - 1;
+  bufset->rebind_mask = (1U << RW_BUF) - 1;
+  bufset->stage_all = bufset->stage_inputs;
+
+  return 0;
+}
+
+// ----------------------------------------------
+// make room in the data buffers for a new system
+// ----------------------------------------------
+
+// grown capacity for a size that doesn't fit: the capacity times the growth
+// factor, or just the needed size if that is more, or if the grown capacity
+// doesn't fit an int
+static int fpga_bufset_grow(int capacity, int needed, double growth) {
+  double grown = (double)capacity * growth;
+  if (grown > (double)INT_MAX) return needed;
+  unsigned long int size = (unsigned long int)grown;
+  return (size > (unsigned long int)needed) ? (int)size : needed;
+}
+
+// check that the system with the given sizes fits in the current layout;
+// if not, grow the capacities and re-plan the layout, reallocating only the
+// data buffers that are too small. When the layout changes, all the input
+// regions must be copied again (see fpga_bufset_update). The nnz values
+// sizes are given for the parts the pool was created with. If the new layout
+// can't be planned, the pool keeps the previous one; if a reallocation fails,
+// all the data buffers are released and the pool can only be released.
+int fpga_bufset_reserve(struct fpga_bufset *bufset, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ bool *replanned) {
+  struct fpga_region needed[REG_NUM];
+  int *req_nnz[3] = {nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes};
+  bool fits = true;
+
+  *replanned = false;
+  if (bufset->unusable) {
+    printf("ERROR: %s: the data buffers have been released after a failed reallocation.\n",__func__);
+    return 1;
+  }
+  if (fpga_plan_datamem_layout(vectorSizes, req_nnz[0], req_nnz[1], req_nnz[2], bufset->nnz_num,
+   needed, NULL, NULL)) return 1;
+  for (int r=0;r<REG_NUM;r++) {
+    if (needed[r].size > bufset->regions[r].size) fits = false;
+  }
+  if (fits) return 0;
+
+  // keep the current layout, to be restored if the new one can't be planned
+  int prevSizes[18], prevNnzSizes[3][NNZ_PARTS_MAX];
+  struct fpga_region prevRegions[REG_NUM];
+  unsigned int prevTotalSize[RW_BUF], prevHostSize[RW_BUF];
+  memcpy(prevSizes, bufset->sizes, sizeof(prevSizes));
+  memcpy(prevNnzSizes, bufset->nnz_sizes, sizeof(prevNnzSizes));
+  memcpy(prevRegions, bufset->regions, sizeof(prevRegions));
+  memcpy(prevTotalSize, bufset->totalSize, sizeof(prevTotalSize));
+  memcpy(prevHostSize, bufset->hostSize, sizeof(prevHostSize));
+
+  // grow geometrically the sizes that are too small
+  for (int i=0;i<18;i++) {
+    if (vectorSizes[i] > bufset->sizes[i]) {
+      bufset->sizes[i] = fpga_bufset_grow(bufset->sizes[i], vectorSizes[i], bufset->growth);
+    }
+  }
+  for (int i=0;i<3;i++) {
+    for (int p=0;p<bufset->nnz_num;p++) {
+      if (req_nnz[i][p] > bufset->nnz_sizes[i][p]) {
+        bufset->nnz_sizes[i][p] = fpga_bufset_grow(bufset->nnz_sizes[i][p], req_nnz[i][p], bufset->growth);
+      }
+    }
+  }
+  if (fpga_bufset_plan(bufset)) {
+    printf("ERROR: %s: cannot plan the data buffers layout.\n",__func__);
+    memcpy(bufset->sizes, prevSizes, sizeof(prevSizes));
+    memcpy(bufset->nnz_sizes, prevNnzSizes, sizeof(prevNnzSizes));
+    memcpy(bufset->regions, prevRegions, sizeof(prevRegions));
+    memcpy(bufset->totalSize, prevTotalSize, sizeof(prevTotalSize));
+    memcpy(bufset->hostSize, prevHostSize, sizeof(prevHostSize));
+    return 1;
+  }
+  bufset->replans++;
+
+  // reallocate only the data buffers that are too small
+  for (int b=0;b<RW_BUF;b++) {
+    // (the capacities only grow, so do the host and device parts)
+    if (bufset->totalSize[b] > bufset->allocSize[b] || bufset->hostSize[b] > prevHostSize[b]) {
+      BDA_DEBUG(1,printf("INFO: %s: growing data buffer %d: %u -> %u bytes.\n",
+       __func__,b,bufset->allocSize[b],bufset->totalSize[b]);)
+      clReleaseMemObject(bufset->cldata[b]);
+      bufset->cldata[b] = NULL;
+      host_free(bufset->dataBuffer[b]);
+      bufset->dataBuffer[b] = NULL;
+      bufset->allocSize[b] = 0;
+      if (fpga_bufset_alloc(bufset, b)) {
+        // the previous data buffer is gone: don't leave a partial pool
+        fpga_bufset_release(bufset);
+        bufset->unusable = true;
+        return 1;
+      }
+      bufset->rebind_mask |= 1U << b;
+      bufset->reallocs++;
+    } else if (bufset->dataBuffer[b] != NULL) {
+      memset(bufset->dataBuffer[b], 0, bufset->hostSize[b]);
+    }
+  }
+  fpga_fill_setup_array(fpga_bufset_setup(bufset), bufset->config_bits, bufset->sizes, bufset->regions);
+  bufset->migrate_mask = (1U << RW_BUF) - 1;
+  bufset->dirty_mask = 0;
+  *replanned = true;
+
+  BDA_DEBUG(1,
+    printf("INFO: %s: layout re-planned (%u times, %u data buffers reallocated):",
+     __func__,bufset->replans,bufset->reallocs);
+    for (int b=0;b<RW_BUF;b++) printf(" %u/%u",bufset->totalSize[b],bufset->allocSize[b]);
+    printf(" bytes used/allocated\n");
+  )
+
+  return 0;
+}
+
+// ------------------------------------------
+// copy a new system in the data buffers pool
+// ------------------------------------------
+
+// record the input arrays of the regions in update_mask, to be packed by
+// fpga_bufset_upload
+static int fpga_bufset_stage(struct fpga_bufset *bufset, unsigned long int update_mask,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes) {
+  if (update_mask & ~REG_MASK_INPUTS) {
+    printf("ERROR: %s: only input regions can be updated (mask 0x%lx).\n",__func__,update_mask);
+    return 1;
+  }
+  update_mask = fpga_share_regions(update_mask, vectorPointers, vectorSizes, bufset->regions,
+   bufset->setupArray);
+  for (int r=0;r<REG_NUM;r++) {
+    const void *src;
+    size_t bytes, stride;
+    if (bufset->regions[r].alias >= 0) bufset->staged_mask &= ~REG_BIT(r);
+    if (!(update_mask & REG_BIT(r)) || r == REG_SETUP) continue;
+    if (fpga_region_input(r, vectorPointers, vectorSizes,
+     nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, bufset->nnz_num,
+     &src, &bytes, &stride)) {
+      // parts of the nnz values that are not used
+      update_mask &= ~REG_BIT(r);
+      continue;
+    }
+    if (bytes > bufset->regions[r].size) {
+      printf("ERROR: %s: region %d needs %lu bytes, but only %u bytes are allocated.\n",
+       __func__,r,(unsigned long)bytes,bufset->regions[r].size);
+      return 1;
+    }
+    bufset->regions[r].used = bytes;
+  }
+  if (update_mask & REG_BIT(REG_SETUP)) {
+    fpga_update_setup_sizes(bufset->setupArray, vectorSizes);
+    bufset->regions[REG_SETUP].used = bufset->regions[REG_SETUP].size;
+  }
+  bufset->staged_pointers = vectorPointers;
+  memcpy(bufset->staged_sizes, vectorSizes, sizeof(bufset->staged_sizes));
+  for (int p=0;p<bufset->nnz_num;p++) {
+    bufset->staged_nnz[0][p] = nnzValArrays_sizes[p];
+    bufset->staged_nnz[1][p] = L_nnzValArrays_sizes[p];
+    bufset->staged_nnz[2][p] = U_nnzValArrays_sizes[p];
+  }
+  bufset->staged_mask |= update_mask;
+  return 0;
+}
+
+// same as fpga_update_host_datamem, but the data buffers are grown if the
+// system doesn't fit; after a re-plan, and at the first update of staged
+// inputs, all the input regions are copied
+int fpga_bufset_update(struct fpga_bufset *bufset, unsigned long int update_mask,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes) {
+  bool replanned;
+
+  if (fpga_bufset_reserve(bufset, vectorSizes,
+   nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, &replanned)) return 1;
+  if (replanned || bufset->stage_all) update_mask |= REG_MASK_INPUTS;
+  if (bufset->stage_inputs) {
+    if (fpga_bufset_stage(bufset, update_mask, vectorPointers, vectorSizes,
+     nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes)) return 1;
+    bufset->stage_all = false;
+  } else {
+    if (fpga_update_host_datamem(update_mask, vectorPointers, vectorSizes,
+     nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, bufset->nnz_num,
+     bufset->regions, bufset->dataBuffer, &bufset->dirty_mask)) return 1;
+  }
+  // the capacities can have more colors than the system: set the actual ones
+  if (update_mask & REG_BIT(REG_SETUP)) {
+    long unsigned int *setupArray = fpga_bufset_setup(bufset);
+    setupArray[1] = (setupArray[1] & 0xFFFFFFFF00000000UL) | (long unsigned int)vectorSizes[2];
+    setupArray[9] = (long unsigned int)vectorSizes[8];
+    setupArray[17] = (long unsigned int)vectorSizes[14];
+  }
+  return 0;
+}
+
+// ---------------------------------------------------
+// set the kernel arguments of the reallocated buffers
+// ---------------------------------------------------
+
+int fpga_bufset_bind(struct fpga_bufset *bufset, cl_kernel kernel) {
+  if (bufset->unusable) {
+    printf("ERROR: %s: the data buffers have been released after a failed reallocation.\n",__func__);
+    return 1;
+  }
+  if (bufset->rebind_mask == 0) return 0;
+  BDA_DEBUG(1,printf("INFO: %s: setting kernel arguments of data buffers (mask 0x%x).\n",
+   __func__,bufset->rebind_mask);)
+  if (fpga_set_kernel_data_args(kernel, bufset->cldata, bufset->rebind_mask) != CL_SUCCESS) {
+    printf("ERROR: %s: failed to set kernel arguments.\n",__func__);
+    return 1;
+  }
+  bufset->rebind_mask = 0;
+  return 0;
+}
+
+// ----------------------------------------
+// copy to device the modified data buffers
+// ----------------------------------------
+
+// source and size of a staged region; returns 1 if the region is not staged
+static int fpga_bufset_staged_input(struct fpga_bufset *bufset, int region,
+ const void **src, size_t *bytes, size_t *stride) {
+  *stride = 0;
+  if (!(bufset->staged_mask & REG_BIT(region))) return 1;
+  if (region == REG_SETUP) {
+    *src = bufset->setupArray;
+    *bytes = bufset->regions[region].size;
+    return 0;
+  }
+  return fpga_region_input(region, bufset->staged_pointers, bufset->staged_sizes,
+   bufset->staged_nnz[0], bufset->staged_nnz[1], bufset->staged_nnz[2], bufset->nnz_num,
+   src, bytes, stride);
+}
+
+// pack the staged input regions, one at a time, in the staging buffer and
+// transfer them; the staging buffer is reused for all the regions
+static int fpga_bufset_upload_staged(struct fpga_bufset *bufset, cl_command_queue commands) {
+  struct pack_list jobs = {0, 0, NULL};
+  struct fpga_upload_times *times = &bufset->upload_times;
+  struct timespec time_start, time_mark, time_end;
+  unsigned int staging_bytes = 0;
+
+  for (int r=0;r<REG_NUM;r++) {
+    if ((bufset->staged_mask & REG_BIT(r)) && bufset->regions[r].size > staging_bytes) {
+      staging_bytes = bufset->regions[r].size;
+    }
+  }
+  if (staging_bytes > bufset->stagingSize) {
+    host_free(bufset->staging);
+    bufset->staging = NULL;
+    bufset->stagingSize = 0;
+    if (host_alloc("staging buffer", staging_bytes, (void **)&bufset->staging)) return 1;
+    bufset->stagingSize = staging_bytes;
+  }
+  memset(times, 0, sizeof(struct fpga_upload_times));
+  clock_gettime(CLOCK_REALTIME, &time_start);
+  for (int r=0;r<REG_NUM;r++) {
+    const void *src;
+    size_t bytes, stride;
+    if (fpga_bufset_staged_input(bufset, r, &src, &bytes, &stride)) continue;
+    // the padding of the last cacheline is cleared
+    size_t padded = roundUpTo(bytes, CACHELINE_BYTES);
+    clock_gettime(CLOCK_REALTIME, &time_mark);
+    fpga_pack_add_input(&jobs, r, bufset->staging, src, bytes, stride);
+    fpga_pack_add(&jobs, PACK_ZERO, bufset->staging + bytes, NULL, padded - bytes, 0);
+    fpga_pack_run(&jobs);
+    clock_gettime(CLOCK_REALTIME, &time_end);
+    times->pack_ms += elapsed_ms(&time_mark, &time_end);
+    int err = clEnqueueWriteBuffer(commands, bufset->cldata[bufset->regions[r].bank], CL_TRUE,
+     bufset->regions[r].offset, padded, bufset->staging, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to transfer region %s to device (%d)\n",__func__,fpga_region_name(r),err);
+      free(jobs.jobs);
+      return 1;
+    }
+    clock_gettime(CLOCK_REALTIME, &time_mark);
+    // the blocking write is the whole transfer
+    times->wait_ms += elapsed_ms(&time_end, &time_mark);
+    times->bytes += padded;
+    times->transfers++;
+  }
+  free(jobs.jobs);
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  times->total_ms = elapsed_ms(&time_start, &time_end);
+  times->transfer_ms = times->wait_ms;
+  BDA_DEBUG(1,printf("INFO: %s: staged regions (mask 0x%lx): %lu bytes, staging buffer %u bytes, pack %.3lf ms, transfer %.3lf ms, total %.3lf ms.\n",
+   __func__,bufset->staged_mask,(unsigned long)times->bytes,bufset->stagingSize,
+   times->pack_ms,times->transfer_ms,times->total_ms);)
+  bufset->staged_mask = 0;
+  bufset->staged_pointers = NULL;
+  return 0;
+}
+
+// size of the chunks of the pipelined upload (multiple of PACK_CHUNK_BYTES)
+// and number of staging slots: while a chunk is packed, the chunks packed in
+// the other slots can be in flight
+#define UPLOAD_CHUNK_BYTES (4*1024*1024)
+#define UPLOAD_SLOTS 3
+
+// pack the staged input regions in chunks of UPLOAD_CHUNK_BYTES, each in the
+// next slot of the staging buffer, and write each chunk to the device as soon
+// as it is packed; a slot is packed again only after its previous transfer
+// has completed. The pre-kernel time approaches the largest of the packing
+// and the transfer times, instead of their sum.
+static int fpga_bufset_upload_pipelined(struct fpga_bufset *bufset, cl_command_queue commands) {
+  struct pack_list jobs = {0, 0, NULL};
+  struct fpga_upload_times *times = &bufset->upload_times;
+  struct timespec time_start, time_mark, time_end;
+  cl_event done[UPLOAD_SLOTS] = {NULL};
+  unsigned int staging_bytes = UPLOAD_SLOTS * UPLOAD_CHUNK_BYTES;
+  int slot = 0, rc = 0;
+
+  if (staging_bytes > bufset->stagingSize) {
+    host_free(bufset->staging);
+    bufset->staging = NULL;
+    bufset->stagingSize = 0;
+    if (host_alloc("staging buffer", staging_bytes, (void **)&bufset->staging)) return 1;
+    bufset->stagingSize = staging_bytes;
+  }
+  memset(times, 0, sizeof(struct fpga_upload_times));
+  clock_gettime(CLOCK_REALTIME, &time_start);
+  for (int r=0;r<REG_NUM && rc==0;r++) {
+    const void *src;
+    size_t bytes, stride;
+    if (fpga_bufset_staged_input(bufset, r, &src, &bytes, &stride)) continue;
+    // the padding of the last cacheline is cleared
+    size_t padded = roundUpTo(bytes, CACHELINE_BYTES);
+    for (size_t pos=0;pos<padded;pos+=UPLOAD_CHUNK_BYTES) {
+      size_t chunk = (padded - pos < UPLOAD_CHUNK_BYTES) ? padded - pos : UPLOAD_CHUNK_BYTES;
+      size_t input = (bytes - pos < chunk) ? bytes - pos : chunk;
+      unsigned char *dst = bufset->staging + (size_t)slot * UPLOAD_CHUNK_BYTES;
+      if (fpga_upload_slot_wait(&done[slot], times)) {
+        printf("ERROR: %s: failed to wait for a transfer to device.\n",__func__);
+        rc = 1;
+        break;
+      }
+      // the source of the chunk: the float regions read two bytes of
+      // doubles per byte, the gathered parts one cacheline every stride bytes
+      const unsigned char *chunk_src = (const unsigned char *)src +
+       ((stride != 0) ? (pos / CACHELINE_BYTES) * stride : (fpga_region_type(r) == REG_TYPE_FLOAT) ? 2 * pos : pos);
+      clock_gettime(CLOCK_REALTIME, &time_mark);
+      fpga_pack_add_input(&jobs, r, dst, chunk_src, input, stride);
+      fpga_pack_add(&jobs, PACK_ZERO, dst + input, NULL, chunk - input, 0);
+      fpga_pack_run(&jobs);
+      clock_gettime(CLOCK_REALTIME, &time_end);
+      times->pack_ms += elapsed_ms(&time_mark, &time_end);
+      int err = clEnqueueWriteBuffer(commands, bufset->cldata[bufset->regions[r].bank], CL_FALSE,
+       bufset->regions[r].offset + pos, chunk, dst, 0, NULL, &done[slot]);
+      if (err != CL_SUCCESS) {
+        printf("ERROR: %s: failed to transfer region %s to device (%d)\n",__func__,fpga_region_name(r),err);
+        done[slot] = NULL;
+        rc = 1;
+        break;
+      }
+      clFlush(commands);
+      times->bytes += chunk;
+      times->transfers++;
+      slot = (slot + 1) % UPLOAD_SLOTS;
+    }
+  }
+  // the source arrays and the staging buffer are in use until all the transfers complete
+  for (int i=0;i<UPLOAD_SLOTS;i++) {
+    if (fpga_upload_slot_wait(&done[i], times) && rc == 0) {
+      printf("ERROR: %s: failed to wait for a transfer to device.\n",__func__);
+      rc = 1;
+    }
+  }
+  free(jobs.jobs);
+  if (rc) return 1;
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  times->total_ms = elapsed_ms(&time_start, &time_end);
+  BDA_DEBUG(1,printf("INFO: %s: staged regions (mask 0x%lx): %lu bytes in %d chunks, pack %.3lf ms, waiting %.3lf ms, transfer %.3lf ms, total %.3lf ms.\n",
+   __func__,bufset->staged_mask,(unsigned long)times->bytes,times->transfers,
+   times->pack_ms,times->wait_ms,times->transfer_ms,times->total_ms);)
+  bufset->staged_mask = 0;
+  bufset->staged_pointers = NULL;
+  return 0;
+}
+
+// data buffers that have been reallocated or re-planned are transferred
+// whole (only their host part, with a split layout), otherwise only the
+// modified regions are transferred; with wait false, the transfers of the
+// host copies are only enqueued (the staged inputs are always uploaded)
+static int fpga_bufset_transfer(const char *caller, struct fpga_bufset *bufset,
+ cl_command_queue commands, bool wait) {
+  if (bufset->unusable) {
+    printf("ERROR: %s: the data buffers have been released after a failed reallocation.\n",caller);
+    return 1;
+  }
+  if (bufset->stage_inputs) {
+    // after a re-plan, fpga_bufset_update has staged all the input regions
+    bufset->migrate_mask = 0;
+    if (bufset->staged_mask == 0) return 0;
+    if (bufset->pipeline_upload) return fpga_bufset_upload_pipelined(bufset, commands);
+    return fpga_bufset_upload_staged(bufset, commands);
+  }
+  if (bufset->migrate_mask != 0) {
+    // whole data buffers: the device part of a split layout is never
+    // transferred, the others are migrated; when all the data buffers are
+    // transferred, they use instead the strategy of the transfer profile for
+    // their mean size, as the profile measures transfers to all the banks
+    cl_mem migrate[RW_BUF];
+    int num = 0;
+    unsigned int bank_mask = 0;
+    int strategy = bufset->device_scratch ? TRANSFER_WRITE : TRANSFER_MIGRATE;
+    size_t chunk = 0;
+    if (!bufset->device_scratch && bufset->migrate_mask == (1U << RW_BUF) - 1) {
+      size_t bytes = 0;
+      for (int b=0;b<RW_BUF;b++) bytes += bufset->hostSize[b];
+      strategy = fpga_transfer_select(transfer_profile, bufset->context, bytes / RW_BUF, true, &chunk);
+      if (strategy == TRANSFER_PARALLEL && bufset->bank_queues[0] == NULL &&
+       fpga_transfer_queues(caller, commands, bufset->bank_queues)) return 1;
+    }
+    for (int b=0;b<RW_BUF;b++) {
+      if (!(bufset->migrate_mask & (1U << b))) continue;
+      if (bufset->device_scratch && bufset->hostSize[b] == 0) continue;
+      if (strategy == TRANSFER_MIGRATE) {
+        migrate[num++] = bufset->cldata[b];
+      } else {
+        BDA_DEBUG(1,printf("INFO: %s: transferring host part of data buffer %d (%u of %u bytes).\n",
+         caller,b,bufset->hostSize[b],bufset->totalSize[b]);)
+        if (fpga_transfer_write(caller, commands, bufset->bank_queues, strategy, chunk, bufset->cldata[b], b,
+         0, bufset->hostSize[b], bufset->dataBuffer[b], &bank_mask)) {
+          fpga_transfer_join(caller, commands, bufset->bank_queues, bank_mask, true);
+          return 1;
+        }
+      }
+      for (int r=0;r<REG_NUM;r++) {
+        if (bufset->regions[r].bank == b) bufset->dirty_mask &= ~REG_BIT(r);
+      }
+    }
+    if (fpga_transfer_join(caller, commands, bufset->bank_queues, bank_mask, wait)) return 1;
+    if (num > 0) {
+      if (fpga_migrate_to_device_datamem(caller, commands, num, migrate, wait)) return 1;
+    } else if (wait) {
+      clFinish(commands);
+    }
+    bufset->migrate_mask = 0;
+  }
+  if (bufset->dirty_mask != 0) {
+    if (fpga_write_to_device_regions(caller, commands, bufset->cldata, bufset->dataBuffer,
+     bufset->regions, &bufset->dirty_mask, wait)) return 1;
+  }
+  return 0;
+}
+
+int fpga_bufset_upload(struct fpga_bufset *bufset, cl_command_queue commands) {
+  return fpga_bufset_transfer(__func__, bufset, commands, true);
+}
+
+// same as fpga_bufset_upload, without waiting for the transfers of the host
+// copies: the data buffers must not be changed until they are complete
+int fpga_bufset_enqueue_upload(struct fpga_bufset *bufset, cl_command_queue commands) {
+  return fpga_bufset_transfer(__func__, bufset, commands, false);
+}
+
+// ------------------------------------------
+// report of the bytes transferred per solve
+// ------------------------------------------
+
+// compare the bytes moved for a solve that refreshes the regions in
+// update_mask: with host-mirrored data buffers (fpga_copy_to_device_datamem
+// migrates them whole) and with the device-only temporaries of a split layout
+// (only the refreshed input regions are written); the results read back are
+// the same in both cases. To be called after fpga_bufset_update, which sets
+// the used sizes of the regions; mirrored_bytes and split_bytes can be NULL.
+int fpga_bufset_transfer_report(struct fpga_bufset *bufset, unsigned long int update_mask,
+ bool use_residuals, bool use_LU_res, size_t *mirrored_bytes, size_t *split_bytes) {
+  struct fpga_region mirrored[REG_NUM], split[REG_NUM];
+  unsigned int mirroredSize[RW_BUF], splitSize[RW_BUF], hostSize[RW_BUF];
+  size_t to_mirrored = 0, to_split = 0, from_device, host_saved = 0, shared_bytes = 0;
+  size_t float_upload = 0;
+  double float_stream = 0.0;
+
+  if (update_mask & ~REG_MASK_INPUTS) {
+    printf("ERROR: %s: only input regions can be updated (mask 0x%lx).\n",__func__,update_mask);
+    return 1;
+  }
+  if (fpga_plan_datamem_layout(bufset->sizes,
+       bufset->nnz_sizes[0], bufset->nnz_sizes[1], bufset->nnz_sizes[2], bufset->nnz_num,
+       mirrored, mirroredSize, NULL) ||
+      fpga_plan_split_layout(bufset->sizes,
+       bufset->nnz_sizes[0], bufset->nnz_sizes[1], bufset->nnz_sizes[2], bufset->nnz_num,
+       split, splitSize, hostSize, NULL)) {
+    printf("ERROR: %s: cannot plan the data buffers layout.\n",__func__);
+    return 1;
+  }
+  for (int b=0;b<RW_BUF;b++) {
+    to_mirrored += mirroredSize[b];
+    host_saved += splitSize[b] - hostSize[b];
+  }
+  for (int r=0;r<REG_NUM;r++) {
+    // the regions stored as floats have half the size of the double inputs,
+    // both for the transfer and for the reads of the kernel
+    if (bufset->regions[r].type == REG_TYPE_FLOAT) {
+      if (update_mask & REG_BIT(r)) float_upload += roundUpTo(bufset->regions[r].used, CACHELINE_BYTES);
+      float_stream += fpga_region_traffic(r) * bufset->regions[r].used;
+    }
+    if (!(update_mask & REG_BIT(r))) continue;
+    if (bufset->regions[r].alias >= 0) {
+      shared_bytes += roundUpTo(bufset->regions[r].used, CACHELINE_BYTES);
+    } else {
+      to_split += roundUpTo(bufset->regions[r].used, CACHELINE_BYTES);
+    }
+  }
+  // X (and R, L_res, U_res) have the size of the vectors of the system
+  size_t vector_bytes = bufset->regions[REG_X1].used;
+  from_device = vector_bytes * (1 + (use_residuals ? 1 : 0) + (use_LU_res ? 2 : 0));
+
+  printf("INFO: %s: bytes per solve (update mask 0x%lx):\n",__func__,update_mask);
+  printf("INFO: %s:  host-mirrored data buffers: %10lu to device, %10lu from device\n",
+   __func__,(unsigned long)to_mirrored,(unsigned long)from_device);
+  printf("INFO: %s:  device-only temporaries   : %10lu to device, %10lu from device (%.1lf%% less)\n",
+   __func__,(unsigned long)to_split,(unsigned long)from_device,
+   100.0 * (1.0 - (double)(to_split + from_device) / (double)(to_mirrored + from_device)));
+  printf("INFO: %s:  host memory not allocated for device-only regions: %lu bytes\n",
+   __func__,(unsigned long)host_saved);
+  if (shared_bytes > 0) {
+    printf("INFO: %s:  shared input arrays: %lu bytes not packed nor transferred\n",
+     __func__,(unsigned long)shared_bytes);
+  }
+  if (bufset->float_regions != 0) {
+    printf("INFO: %s:  single precision values: %lu bytes less to device, %.0lf bytes less read by the kernel per iteration\n",
+     __func__,(unsigned long)float_upload,float_stream);
+  }
+  if (bufset->stage_inputs) {
+    size_t host_inputs = 0, staging = 0;
+    for (int b=0;b<RW_BUF;b++) host_inputs += hostSize[b];
+    for (int r=0;r<REG_NUM;r++) {
+      if ((REG_MASK_INPUTS & REG_BIT(r)) && split[r].size > staging) staging = split[r].size;
+    }
+    printf("INFO: %s:  host memory for the inputs: %lu bytes of staging instead of %lu bytes of host copies\n",
+     __func__,(unsigned long)staging,(unsigned long)host_inputs);
+  }
+  if (mirrored_bytes != NULL) *mirrored_bytes = to_mirrored + from_device;
+  if (split_bytes != NULL) *split_bytes = to_split + from_device;
+
+  return 0;
+}
+
+// -----------------------------
+// release the data buffers pool
+// -----------------------------
+
+void fpga_bufset_release(struct fpga_bufset *bufset) {
+  for (int b=0;b<RW_BUF;b++) {
+    if (bufset->cldata[b] != NULL) clReleaseMemObject(bufset->cldata[b]);
+    host_free(bufset->dataBuffer[b]);
+    bufset->cldata[b] = NULL;
+    bufset->dataBuffer[b] = NULL;
+    bufset->allocSize[b] = 0;
+  }
+  host_free(bufset->staging);
+  bufset->staging = NULL;
+  bufset->stagingSize = 0;
+  fpga_transfer_queues_release(bufset->bank_queues);
+}
@@ -24,8 +24,57 @@
 
 #include "dev_config.hpp"
 #include "bicgstab_solver_config.hpp"
+#include "host_alloc.hpp"
+#include "fpga_layout.hpp"
+#include "fpga_transfer.hpp"
+
+// --- number of threads used to pack the host data buffers
+
+int fpga_set_pack_threads(int num_threads);
+int fpga_get_pack_threads(void);
+
+// --- sharing of identical input arrays
+// (when enabled, the regions written in place with the direct access functions
+// must not be updated with fpga_copy_host_datamem)
+
+int fpga_set_share_arrays(bool enable);
+bool fpga_get_share_arrays(void);
+
+// --- strategy of the host -> device transfers
+// (with a profile of fpga_transfer.hpp, the uploads of all the data buffers
+// of a pool use the fastest strategy for their size; the parallel writes only
+// for the pools of the context of the profile, on queues of the pool)
+
+int fpga_set_transfer_profile(struct fpga_transfer_profile *profile);
+struct fpga_transfer_profile *fpga_get_transfer_profile(void);
+
+// --- pipelined copy of the host data buffers
+// (with a queue set, fpga_copy_host_datamem packs one data buffer at a time and
+// enqueues its migration as soon as it is packed, so that the transfers overlap
+// with the packing of the next data buffers; fpga_copy_to_device_datamem, with
+// the same queue and cldata, only waits for them. The times of the phases of
+// the last copy are in fpga_get_pipelined_copy_times, with the transfer times
+// only if the queue has profiling enabled)
+
+// phases of the last pipelined copy, or of the last upload of the staged
+// inputs (ms)
+struct fpga_upload_times {
+  double pack_ms;       // packing of the regions (in the staging buffer when staged)
+  double wait_ms;       // host waiting for the transfers to complete
+  double transfer_ms;   // transfers: blocking writes, or device time of the chunks when
+                        // pipelined (0 without queue profiling)
+  double total_ms;      // whole upload: with pipelining, less than pack_ms + transfer_ms
+  size_t bytes;         // bytes transferred
+  int transfers;        // number of transfers (chunks, or data buffers of a pipelined copy)
+};
+
+int fpga_set_pipelined_copy(cl_command_queue commands, cl_mem *cldata);
+struct fpga_upload_times *fpga_get_pipelined_copy_times(void);
 
 // --- host data setup
+// (debugBuffer and dataBuffer are allocated with host_alloc: release them with host_free;
+// the L/U values and BLKD pointers point to floats for the regions selected with
+// fpga_set_float_regions)
 
 int fpga_setup_host_debugbuf(unsigned int debug_outbuf_words,
  unsigned long int **debugBuffer, unsigned int *debugbufferSize);
@@ -60,20 +109,56 @@ int fpga_copy_host_datamem(void **vectorPointers, int *vectorSizes, long unsigne
  bool reset_data_buffers, bool fill_results_buffers,
  int dump_data_buffers, unsigned int sequence);
 
+void fpga_fill_setup_array(long unsigned int *setupArray, unsigned int config_bits,
+ int *processedSizes, struct fpga_region regions[REG_NUM]);
+
+int fpga_update_host_datamem(unsigned long int update_mask,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ unsigned long int *dirty_mask);
+
+// --- direct access to host data buffers
+
+unsigned int fpga_region_capacity(struct fpga_region regions[REG_NUM], int region);
+double *fpga_region_doubles(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count);
+unsigned int *fpga_region_uints(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count);
+short unsigned int *fpga_region_ushorts(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count);
+unsigned char *fpga_region_uchars(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count);
+float *fpga_region_floats(struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ int region, unsigned int count);
+
+int fpga_commit_host_region(struct fpga_region regions[REG_NUM], int region,
+ unsigned int count, unsigned long int *dirty_mask);
+int fpga_commit_host_sizes(int *vectorSizes,
+ struct fpga_region regions[REG_NUM], unsigned char **dataBuffer,
+ unsigned long int *dirty_mask);
+
 // --- device data setup
 
 int fpga_setup_device_debugbuf(cl_context context,
  unsigned long int *debugBuffer, cl_mem *cldebug, unsigned int debugbufferSize);
+int fpga_setup_cu_debugbuf(cl_context context, cl_kernel kernel,
+ unsigned long int *debugBuffer, cl_mem *cldebug, unsigned int debugbufferSize);
 
 int fpga_setup_device_datamem(cl_context context,
  unsigned int *databufferSize, unsigned char *dataBuffer[RW_BUF],
  cl_mem *cldata);
+int fpga_create_device_buffer(cl_context context, cl_kernel kernel, int b,
+ unsigned int databufferSize, unsigned char *dataBuffer, cl_mem *cldata);
 
 // --- data movement to/from device
 
 int fpga_copy_to_device_debugbuf(cl_command_queue commands,
  cl_mem cldebug, unsigned long int *debugBuffer, unsigned int debugbufferSize,
  unsigned int debug_outbuf_words);
+int fpga_enqueue_to_device_debugbuf(cl_command_queue commands,
+ cl_mem cldebug, unsigned long int *debugBuffer, unsigned int debug_outbuf_words);
 
 int fpga_copy_to_device_datamem(cl_command_queue commands,
  int dataBufNum, cl_mem *cldata);
@@ -81,6 +166,10 @@ int fpga_copy_to_device_datamem(cl_command_queue commands,
 int DEBUG_fpga_copy_to_device_datamem(cl_command_queue commands,
  int dataBufNum, cl_mem *cldata, unsigned int *dataBufferSize, unsigned char **dataBuffer);
 
+int fpga_copy_to_device_regions(cl_command_queue commands,
+ cl_mem *cldata, unsigned char **dataBuffer,
+ struct fpga_region regions[REG_NUM], unsigned long int *dirty_mask);
+
 int fpga_copy_from_device_debugbuf(bool quiet,
  cl_command_queue commands,
  unsigned int debug_outbuf_words, unsigned int debugBufferSize,
@@ -116,6 +205,7 @@ int fpga_unmap_results(bool evenBuffers,
 
 // --- kernel setup/run
 
+int fpga_set_kernel_data_args(cl_kernel kernel, cl_mem *cldata, unsigned int bank_mask);
 int fpga_set_kernel_parameters(cl_kernel kernel,
  unsigned int abort_cycles, unsigned int debug_lines, unsigned int kernel_iter,
  unsigned int debug_sample_rate, double kernel_precision,
@@ -135,5 +225,75 @@ int fpga_kernel_query(cl_context context, cl_command_queue commands, cl_kernel k
  unsigned char *hw_num_read_ports, unsigned char *hw_num_write_ports,
  unsigned short *hw_reset_cycles, unsigned short *hw_reset_settle);
 
+// --- growable data buffers pool
+// (with BUFSET_DEVICE_SCRATCH, the results must be read with explicit reads or
+// maps, e.g. DEBUG_fpga_copy_from_device_results/fpga_map_results with the
+// cldata and result_offsets of the pool; with BUFSET_STAGE_INPUTS, the arrays
+// given to fpga_bufset_update must stay valid until fpga_bufset_upload; with
+// BUFSET_PIPELINE_UPLOAD, the command queue given to fpga_bufset_upload fills
+// the transfer time of upload_times only if it has profiling enabled)
+
+// residency of the regions (fpga_bufset_create)
+#define BUFSET_MIRRORED        0x0  // host copy of the whole data buffers
+#define BUFSET_DEVICE_SCRATCH  0x1  // temporaries and results only in device memory
+#define BUFSET_STAGE_INPUTS    0x2  // also no host copy of the inputs: staged one region at a time at upload
+#define BUFSET_PIPELINE_UPLOAD 0x4  // staged inputs packed in chunks while the previous chunks are transferred
+
+struct fpga_bufset {
+  cl_context context;
+  cl_kernel kernel;                   // compute unit whose memory banks are used (NULL: DATA_MEM_BANKS)
+  unsigned int config_bits;
+  double growth;                      // growth factor of the capacities
+  bool device_scratch;                // temporaries and results only in device memory
+  bool stage_inputs;                  // inputs packed in the staging buffer at upload
+  bool pipeline_upload;               // staged inputs packed and transferred chunk by chunk
+  int sizes[18];                      // capacities (as processedSizes) used for the layout
+  unsigned long int float_regions;    // regions stored in single precision (see fpga_set_float_regions)
+  int nnz_num;                        // number of parts of the nnz values arrays
+  int nnz_sizes[3][NNZ_PARTS_MAX];    // capacities of the nnz values parts of A, L and U
+  struct fpga_region regions[REG_NUM];
+  unsigned int totalSize[RW_BUF];     // size of the data buffers used by the layout
+  unsigned int hostSize[RW_BUF];      // size of the part of the data buffers copied on the host
+  unsigned int allocSize[RW_BUF];     // allocated size of the data buffers
+  unsigned char *dataBuffer[RW_BUF];
+  cl_mem cldata[RW_BUF];
+  cl_command_queue bank_queues[RW_BUF];  // queues of the parallel writes (see fpga_transfer.hpp), created at first use
+  unsigned int result_offsets[6];
+  unsigned long int dirty_mask;       // regions to be transferred to the device
+  unsigned int migrate_mask;          // data buffers to be transferred whole
+  unsigned int rebind_mask;           // data buffers to be set as kernel arguments
+  unsigned int replans;               // number of layout re-plans
+  unsigned int reallocs;              // number of data buffer reallocations
+  bool unusable;                      // a reallocation failed: the data buffers are released
+  // with stage_inputs: setup array, staging buffer and inputs to be packed
+  long unsigned int setupArray[SETUP_LINES*CACHELINE_DBL_WORDS];
+  unsigned char *staging;
+  unsigned int stagingSize;
+  unsigned long int staged_mask;
+  bool stage_all;                     // all the input regions must be staged at the next update
+  void **staged_pointers;
+  int staged_sizes[18];
+  int staged_nnz[3][NNZ_PARTS_MAX];
+  struct fpga_upload_times upload_times;
+};
+
+int fpga_bufset_create(cl_context context, cl_kernel kernel, unsigned int config_bits,
+ int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, double growth, unsigned int residency,
+ struct fpga_bufset *bufset);
+int fpga_bufset_reserve(struct fpga_bufset *bufset, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ bool *replanned);
+int fpga_bufset_update(struct fpga_bufset *bufset, unsigned long int update_mask,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes);
+int fpga_bufset_bind(struct fpga_bufset *bufset, cl_kernel kernel);
+int fpga_bufset_upload(struct fpga_bufset *bufset, cl_command_queue commands);
+int fpga_bufset_enqueue_upload(struct fpga_bufset *bufset, cl_command_queue commands);
+int fpga_bufset_transfer_report(struct fpga_bufset *bufset, unsigned long int update_mask,
+ bool use_residuals, bool use_LU_res, size_t *mirrored_bytes, size_t *split_bytes);
+void fpga_bufset_release(struct fpga_bufset *bufset);
+
 #endif //__FPGA_FUNCTIONS_BICGSTAB_HPP__
 
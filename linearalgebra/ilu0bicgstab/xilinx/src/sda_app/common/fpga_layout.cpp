@@ -0,0 +1,534 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Layout of the arrays (regions) in the data buffers
+
+  Each region is described by an entry of a table: element type, size (as a
+  function of the sizes of the system), alignment, data buffers (ports) from
+  which the kernel can access it, position of its pointer in the setup array
+  and estimated traffic per solver iteration. The planner assigns each region,
+  by decreasing traffic, to the least loaded of its eligible ports (on HBM
+  the slowest port sets the speed of the kernel), then places the regions in
+  each data buffer in table order. The kernels read each array from a fixed
+  port, so the assignment follows the configuration; the traffic of each
+  data buffer is reported to check its balance.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "fpga_layout.hpp"
+#include "bda_utils.hpp"
+
+// special size sources (other values are indices in processedSizes)
+#define SIZE_SETUP  -1    // setup cachelines
+// size of part p of the nnz values of matrix m (0: A, 1: L, 2: U), i.e.
+// nnzValArrays_sizes[p], L_nnzValArrays_sizes[p] or U_nnzValArrays_sizes[p]
+#define SIZE_NNZ(m,p)  (-2 - (m)*NNZ_PARTS_MAX - (p))
+#define SIZE_NNZ_A  SIZE_NNZ(0,0)
+#define SIZE_NNZ_L  SIZE_NNZ(1,0)
+#define SIZE_NNZ_U  SIZE_NNZ(2,0)
+#define IS_SIZE_NNZ(s) ((s) <= SIZE_NNZ(0,0) && (s) >= SIZE_NNZ(2,NNZ_PARTS_MAX-1))
+
+// regions stored in single precision (see fpga_set_float_regions)
+static unsigned long int float_regions = 0;
+
+#define PORT(b) (1U << (b))
+
+// description of a region
+struct fpga_region_desc {
+  int region;             // region identifier (entries are in the enum order)
+  const char *name;
+  int type;               // type of the elements
+  int size_src;           // number of elements: size_mult * size source
+  int size_mult;
+  unsigned int align;     // alignment (bytes) of the region
+  unsigned int ports;     // mask of the data buffers the kernel can read/write it from
+  int follows;            // region that must be placed just before this one (-1: none)
+  int setup_slot;         // index of the pointer in the setup array (-1: none)
+  float traffic;          // estimated accesses per iteration (multiples of the size)
+};
+
+// Traffic estimates: each iteration runs two SpMV with A and two ILU0
+// applications (L, U and block diagonal); vectors are counted from the reads
+// and writes of the BiCGSTAB updates. The kernel reads each array from a
+// fixed port (see bicgstab_solver_config.hpp), so every region has a single
+// eligible data buffer.
+static const struct fpga_region_desc region_table[REG_NUM] = {
+  // region            name              type             size_src       mult align            ports                  follows   slot traffic
+  {REG_SETUP,         "setup",          REG_TYPE_ULONG,  SIZE_SETUP,    1, CACHELINE_BYTES, PORT(BANK_VALUES),     -1,       -1,  0.0f},
+  {REG_NNZ_VALS,      "nnz_vals",       REG_TYPE_DOUBLE, SIZE_NNZ_A,    1, CACHELINE_BYTES, PORT(BANK_VALUES),     -1,       12,  2.0f},
+  {REG_L_NNZ_VALS,    "L_nnz_vals",     REG_TYPE_DOUBLE, SIZE_NNZ_L,    1, CACHELINE_BYTES, PORT(BANK_VALUES),     -1,       20,  2.0f},
+  {REG_U_NNZ_VALS,    "U_nnz_vals",     REG_TYPE_DOUBLE, SIZE_NNZ_U,    1, CACHELINE_BYTES, PORT(BANK_VALUES),     -1,       26,  2.0f},
+  {REG_COLOR_SIZES,   "color_sizes",    REG_TYPE_UINT,   2,             4, CACHELINE_BYTES, PORT(BANK_VALUES),     -1,       10,  2.0f},
+  {REG_L_COLOR_SIZES, "L_color_sizes",  REG_TYPE_UINT,   8,             4, CACHELINE_BYTES, PORT(BANK_VALUES),     -1,       18,  2.0f},
+  {REG_U_COLOR_SIZES, "U_color_sizes",  REG_TYPE_UINT,   14,            4, CACHELINE_BYTES, PORT(BANK_VALUES),     -1,       24,  2.0f},
+  {REG_BLKD,          "block_diag",     REG_TYPE_DOUBLE, 5,             1, CACHELINE_BYTES, PORT(BANK_VALUES),     -1,       23,  2.0f},
+  {REG_P_INDEX,       "P_indices",      REG_TYPE_UINT,   3,             1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       11,  2.0f},
+  {REG_L_P_INDEX,     "L_P_indices",    REG_TYPE_UINT,   9,             1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       19,  2.0f},
+  {REG_U_P_INDEX,     "U_P_indices",    REG_TYPE_UINT,   15,            1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       25,  2.0f},
+  {REG_COL_INDEX,     "col_inds",       REG_TYPE_USHORT, 1,             1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       13,  2.0f},
+  {REG_L_COL_INDEX,   "L_col_inds",     REG_TYPE_USHORT, 7,             1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       21,  2.0f},
+  {REG_U_COL_INDEX,   "U_col_inds",     REG_TYPE_USHORT, 13,            1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       27,  2.0f},
+  {REG_NR_OFFSET,     "NRs",            REG_TYPE_UCHAR,  4,             1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       14,  2.0f},
+  {REG_L_NR_OFFSET,   "L_NRs",          REG_TYPE_UCHAR,  10,            1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       22,  2.0f},
+  {REG_U_NR_OFFSET,   "U_NRs",          REG_TYPE_UCHAR,  16,            1, CACHELINE_BYTES, PORT(BANK_INDICES),    -1,       28,  2.0f},
+  {REG_X2,            "X2",             REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_XRES_EVEN),  -1,       5,   1.0f},
+  {REG_R1,            "R1",             REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_RRES_ODD),   -1,       2,   2.0f},
+  {REG_X1,            "X1",             REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_XRES_ODD),   -1,       4,   1.0f},
+  {REG_R2,            "R2",             REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_RRES_EVEN),  -1,       3,   2.0f},
+  {REG_P1,            "P1",             REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_P),          -1,       6,   2.0f},
+  {REG_P2,            "P2",             REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_P),          -1,       7,   2.0f},
+  {REG_RT,            "RT",             REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_P),          -1,       15,  2.0f},
+  {REG_T,             "T",              REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_TV),         -1,       29,  2.0f},
+  {REG_V,             "V",              REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_TV),         -1,       30,  3.0f},
+  // the addresses of L_res and U_res are not in the setup array: they ALWAYS follow V
+  {REG_LRES,          "L_res",          REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_LRES),       REG_V,    -1,  0.0f},
+  {REG_URES,          "U_res",          REG_TYPE_DOUBLE, 0,             1, CACHELINE_BYTES, PORT(BANK_URES),       REG_LRES, -1,  0.0f},
+  // parts 2-4 of the nnz values, each one read from a different port (a
+  // different HBM pseudo-channel) by a kernel that reads the values in parallel
+  {REG_NNZ_VALS_2,    "nnz_vals_2",     REG_TYPE_DOUBLE, SIZE_NNZ(0,1), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART2),  -1,       31,  2.0f},
+  {REG_L_NNZ_VALS_2,  "L_nnz_vals_2",   REG_TYPE_DOUBLE, SIZE_NNZ(1,1), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART2),  -1,       32,  2.0f},
+  {REG_U_NNZ_VALS_2,  "U_nnz_vals_2",   REG_TYPE_DOUBLE, SIZE_NNZ(2,1), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART2),  -1,       33,  2.0f},
+  {REG_NNZ_VALS_3,    "nnz_vals_3",     REG_TYPE_DOUBLE, SIZE_NNZ(0,2), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART3),  -1,       34,  2.0f},
+  {REG_L_NNZ_VALS_3,  "L_nnz_vals_3",   REG_TYPE_DOUBLE, SIZE_NNZ(1,2), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART3),  -1,       35,  2.0f},
+  {REG_U_NNZ_VALS_3,  "U_nnz_vals_3",   REG_TYPE_DOUBLE, SIZE_NNZ(2,2), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART3),  -1,       36,  2.0f},
+  {REG_NNZ_VALS_4,    "nnz_vals_4",     REG_TYPE_DOUBLE, SIZE_NNZ(0,3), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART4),  -1,       37,  2.0f},
+  {REG_L_NNZ_VALS_4,  "L_nnz_vals_4",   REG_TYPE_DOUBLE, SIZE_NNZ(1,3), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART4),  -1,       38,  2.0f},
+  {REG_U_NNZ_VALS_4,  "U_nnz_vals_4",   REG_TYPE_DOUBLE, SIZE_NNZ(2,3), 1, CACHELINE_BYTES, PORT(BANK_NNZ_PART4),  -1,       39,  2.0f},
+};
+
+// -------------------
+// region descriptions
+// -------------------
+
+// size in bytes of the elements of a given type
+unsigned int fpga_region_type_bytes(int type) {
+  switch (type) {
+    case REG_TYPE_ULONG:  return sizeof(long unsigned int);
+    case REG_TYPE_DOUBLE: return sizeof(double);
+    case REG_TYPE_UINT:   return sizeof(unsigned int);
+    case REG_TYPE_USHORT: return sizeof(short unsigned int);
+    case REG_TYPE_FLOAT:  return sizeof(float);
+    default:              return sizeof(unsigned char);
+  }
+}
+
+const char *fpga_region_name(int region) {
+  if (region < 0 || region >= REG_NUM) return "invalid";
+  return region_table[region].name;
+}
+
+// type of the elements stored in a region: the double values selected with
+// fpga_set_float_regions are stored as floats
+int fpga_region_type(int region) {
+  if (region < 0 || region >= REG_NUM) return REG_TYPE_UCHAR;
+  if (float_regions & REG_BIT(region)) return REG_TYPE_FLOAT;
+  return region_table[region].type;
+}
+
+// estimated accesses per iteration (multiples of the size of the region)
+float fpga_region_traffic(int region) {
+  if (region < 0 || region >= REG_NUM) return 0.0f;
+  return region_table[region].traffic;
+}
+
+// check if a region holds (a part of) the nnz values of a matrix: if so, set
+// matrix (0: A, 1: L, 2: U) and part (0 to NNZ_PARTS_MAX-1) and return 1
+int fpga_region_nnz_part(int region, int *matrix, int *part) {
+  if (region < 0 || region >= REG_NUM || !IS_SIZE_NNZ(region_table[region].size_src)) return 0;
+  int k = SIZE_NNZ(0,0) - region_table[region].size_src;
+  *matrix = k / NNZ_PARTS_MAX;
+  *part = k % NNZ_PARTS_MAX;
+  return 1;
+}
+
+// index of the pointer to a region in the setup array (-1: none)
+int fpga_region_setup_slot(int region) {
+  if (region < 0 || region >= REG_NUM) return -1;
+  return region_table[region].setup_slot;
+}
+
+// check if the kernel can read a region from the copy of owner, when the
+// content of the region is the same as (or a prefix of) the one of owner:
+// the owner must come first, hold elements of the same type and be read from
+// the same ports, and both must be pattern arrays addressed by the setup array
+bool fpga_region_can_share(int region, int owner) {
+  if (owner < 0 || region <= owner || region >= REG_NUM) return false;
+  if (!(REG_MASK_SHAREABLE & REG_BIT(region)) || !(REG_MASK_SHAREABLE & REG_BIT(owner))) return false;
+  return region_table[region].type == region_table[owner].type &&
+   region_table[region].ports == region_table[owner].ports &&
+   region_table[region].setup_slot >= 0 && region_table[owner].setup_slot >= 0;
+}
+
+// -----------------------
+// single precision values
+// -----------------------
+
+// The values of the ILU0 factors (and the block diagonal) can be stored as
+// floats, halving their size in the data buffers and the bytes the kernel
+// streams for each application of the preconditioner; the vectors and the
+// values of A stay in double precision. The inputs are still given as
+// doubles and rounded when packed. The layout and the setup pointers follow
+// from the sizes of the float regions; the kernel must be built to read them.
+// Single precision is only supported with whole (not split) nnz values.
+
+int fpga_set_float_regions(unsigned long int float_mask) {
+  if (float_mask & ~REG_MASK_FLOAT_CAPABLE) {
+    printf("ERROR: %s: only the L/U values and the block diagonal can be stored as floats (mask 0x%lx).\n",
+     __func__,float_mask);
+    return 1;
+  }
+  if (fpga_settings_change_begin(__func__)) return 1;
+  float_regions = float_mask;
+  fpga_settings_change_end();
+  return 0;
+}
+
+unsigned long int fpga_get_float_regions(void) {
+  return float_regions;
+}
+
+// ----------------------
+// process-wide settings
+// ----------------------
+
+// The lock orders the changes of the settings before the creation of the
+// sessions that read them; the sessions read them without locking, since
+// they cannot change while a session holds them.
+
+static pthread_mutex_t settings_lock = PTHREAD_MUTEX_INITIALIZER;
+static int settings_holders = 0;
+
+void fpga_settings_hold(void) {
+  pthread_mutex_lock(&settings_lock);
+  settings_holders++;
+  pthread_mutex_unlock(&settings_lock);
+}
+
+void fpga_settings_unhold(void) {
+  pthread_mutex_lock(&settings_lock);
+  assert(settings_holders > 0);
+  settings_holders--;
+  pthread_mutex_unlock(&settings_lock);
+}
+
+// on success, the lock is held until fpga_settings_change_end
+int fpga_settings_change_begin(const char *caller) {
+  pthread_mutex_lock(&settings_lock);
+  if (settings_holders > 0) {
+    printf("ERROR: %s: the setting cannot be changed while %d sessions exist.\n",caller,settings_holders);
+    pthread_mutex_unlock(&settings_lock);
+    return 1;
+  }
+  return 0;
+}
+
+void fpga_settings_change_end(void) {
+  pthread_mutex_unlock(&settings_lock);
+}
+
+// -----------------------
+// split of the nnz values
+// -----------------------
+
+// The nnz values are split in parts interleaved at cacheline granularity:
+// cacheline c of the values goes to part c % nnzValArrays_num, so that a
+// kernel reading all parts in parallel gets the values in their original
+// order. Only the part holding the last cacheline can end with a partial one.
+// The values are split only for a kernel that reads the parts (see
+// NNZ_PARTS_KERNEL in bicgstab_solver_config.hpp).
+
+// region holding a part of the nnz values of a matrix (0: A, 1: L, 2: U)
+int fpga_nnz_region(int matrix, int part) {
+  static const int first_parts[3] = {REG_NNZ_VALS, REG_L_NNZ_VALS, REG_U_NNZ_VALS};
+  if (part == 0) return first_parts[matrix];
+  return REG_NNZ_VALS_2 + (part-1)*3 + matrix;
+}
+
+// number of values in each part of an array of nnz values
+void fpga_nnz_part_sizes(int nnz, int nnzValArrays_num, int *part_sizes) {
+  int lines = (nnz + CACHELINE_DBL_WORDS - 1) / CACHELINE_DBL_WORDS;
+  for (int p=0;p<nnzValArrays_num;p++) {
+    int part_lines = (lines > p) ? (lines - p + nnzValArrays_num - 1) / nnzValArrays_num : 0;
+    part_sizes[p] = part_lines * CACHELINE_DBL_WORDS;
+    if (lines > 0 && p == (lines - 1) % nnzValArrays_num) {
+      part_sizes[p] -= lines * CACHELINE_DBL_WORDS - nnz;
+    }
+  }
+}
+
+// allocated size (bytes) of a region: the number of elements is rounded up to
+// fill whole cachelines; the parts of the nnz values beyond nnzValArrays_num
+// are empty
+static unsigned int fpga_region_bytes(const struct fpga_region_desc *desc, int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num) {
+  unsigned int elem_bytes = fpga_region_type_bytes(fpga_region_type(desc->region));
+  int elems, matrix, part;
+
+  if (desc->size_src == SIZE_SETUP) return CACHELINE_BYTES*SETUP_LINES;
+  if (fpga_region_nnz_part(desc->region, &matrix, &part)) {
+    int *sizes[3] = {nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes};
+    elems = (part < nnzValArrays_num) ? sizes[matrix][part] : 0;
+  } else {
+    elems = processedSizes[desc->size_src];
+  }
+  return elem_bytes * roundUpTo(desc->size_mult * elems, CACHELINE_BYTES/elem_bytes);
+}
+
+// ---------------
+// port assignment
+// ---------------
+
+// assign a data buffer to each region: by decreasing traffic, each region
+// goes to its least loaded eligible port
+static int fpga_plan_ports(unsigned int bytes[REG_NUM], int bank[REG_NUM]) {
+  unsigned int ports[REG_NUM];  // eligible ports of each region
+  double traffic[REG_NUM];      // traffic (bytes) of each region, including the ones following it
+  double load[RW_BUF] = {0};
+  int order[REG_NUM];
+  int num = 0;
+
+  for (int r=0;r<REG_NUM;r++) {
+    ports[r] = region_table[r].ports;
+    traffic[r] = (double)region_table[r].traffic * bytes[r];
+  }
+  // a region that follows another one is placed in the same data buffer:
+  // its traffic is moved to the first region of the chain
+  for (int r=REG_NUM-1;r>=0;r--) {
+    int f = region_table[r].follows;
+    if (f < 0) continue;
+    ports[f] &= ports[r];
+    traffic[f] += traffic[r];
+    traffic[r] = 0;
+  }
+  for (int r=0;r<REG_NUM;r++) {
+    if (region_table[r].follows >= 0) continue;
+    if ((ports[r] & (PORT(RW_BUF)-1)) == 0) {
+      printf("ERROR: %s: region %s has no eligible data buffer.\n",__func__,region_table[r].name);
+      return 1;
+    }
+    // insertion in the list, by decreasing traffic
+    int i = num++;
+    while (i > 0 && traffic[order[i-1]] < traffic[r]) {
+      order[i] = order[i-1];
+      i--;
+    }
+    order[i] = r;
+  }
+
+  for (int i=0;i<num;i++) {
+    int r = order[i], best = -1;
+    for (int b=0;b<RW_BUF;b++) {
+      if ((ports[r] & PORT(b)) && (best < 0 || load[b] < load[best])) best = b;
+    }
+    bank[r] = best;
+    load[best] += traffic[r];
+  }
+  for (int r=0;r<REG_NUM;r++) {
+    int f = r;
+    while (region_table[f].follows >= 0) f = region_table[f].follows;
+    bank[r] = bank[f];
+  }
+  return 0;
+}
+
+// ----------------------------
+// plan the data buffers layout
+// ----------------------------
+
+// compute the position of all the arrays in the data buffers, the total size
+// of each data buffer and the offsets of the results regions; with split set,
+// the regions in REG_MASK_DEVICE_ONLY are placed after all the other regions
+// of their data buffer, and hostSize gets the size of the part of each data
+// buffer that must have a copy on the host
+static int fpga_plan_layout(bool split, int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM], unsigned int totalSize[RW_BUF],
+ unsigned int hostSize[RW_BUF], unsigned int result_offsets[6]) {
+  unsigned int bytes[REG_NUM];
+  int bank[REG_NUM];
+  unsigned int bank_end[RW_BUF] = {0};
+  unsigned int host_end[RW_BUF] = {0};
+
+  if (nnzValArrays_num < 1 || nnzValArrays_num > NNZ_PARTS_KERNEL) {
+    printf("ERROR: %s: the kernel reads the nnz values in 1 to %d parts (%d requested).\n",
+     __func__,NNZ_PARTS_KERNEL,nnzValArrays_num);
+    return 1;
+  }
+  if (nnzValArrays_num > 1 && float_regions != 0) {
+    printf("ERROR: %s: single precision values need whole nnz values (%d parts requested).\n",
+     __func__,nnzValArrays_num);
+    return 1;
+  }
+
+  // size (in bytes) of each array
+  for (int r=0;r<REG_NUM;r++) {
+    assert(region_table[r].region == r);
+    bytes[r] = fpga_region_bytes(&region_table[r], processedSizes,
+     nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, nnzValArrays_num);
+  }
+
+  // choose the data buffer of each array
+  if (fpga_plan_ports(bytes, bank)) return 1;
+
+  // place the arrays in each data buffer, in table order (when splitting,
+  // the device-only arrays in a second pass)
+  // * the position values are expressed in bytes *
+  for (int pass=0;pass<(split ? 2 : 1);pass++) {
+    for (int r=0;r<REG_NUM;r++) {
+      bool device_only = split && (REG_MASK_DEVICE_ONLY & REG_BIT(r));
+      if (device_only != (pass == 1)) continue;
+      int b = bank[r];
+      bank_end[b] = roundUpTo(bank_end[b], region_table[r].align);
+      regions[r].bank = b;
+      regions[r].type = fpga_region_type(r);
+      regions[r].offset = bank_end[b];
+      regions[r].size = bytes[r];
+      regions[r].used = 0;
+      regions[r].device_only = device_only;
+      regions[r].alias = -1;
+      bank_end[b] += bytes[r];
+    }
+    if (pass == 0) memcpy(host_end, bank_end, sizeof(host_end));
+  }
+  // a data buffer holding no region (e.g. the read-only buffers of the nnz
+  // values parts when the values are not split) still needs a device buffer
+  // to be set as kernel argument
+  for (int b=0;b<RW_BUF;b++) {
+    if (bank_end[b] == 0) bank_end[b] = host_end[b] = CACHELINE_BYTES;
+  }
+  for (int r=0;r<REG_NUM;r++) {
+    int f = region_table[r].follows;
+    if (f >= 0 && regions[r].offset != regions[f].offset + regions[f].size) {
+      printf("ERROR: %s: region %s must follow region %s.\n",__func__,region_table[r].name,region_table[f].name);
+      return 1;
+    }
+  }
+  // the kernel writes the results in fixed data buffers
+  if (regions[REG_X2].bank != BANK_XRES_EVEN || regions[REG_R2].bank != BANK_RRES_EVEN ||
+      regions[REG_X1].bank != BANK_XRES_ODD || regions[REG_R1].bank != BANK_RRES_ODD ||
+      regions[REG_LRES].bank != BANK_LRES || regions[REG_URES].bank != BANK_URES) {
+    printf("ERROR: %s: results regions placed in the wrong data buffers.\n",__func__);
+    return 1;
+  }
+
+  BDA_DEBUG(1,
+    double load[RW_BUF] = {0};
+    int busiest = 0;
+    for (int r=0;r<REG_NUM;r++) load[regions[r].bank] += (double)region_table[r].traffic * bytes[r];
+    for (int b=0;b<RW_BUF;b++) {
+      if (load[b] > load[busiest]) busiest = b;
+      printf("INFO: %s: data buffer #%d: %u bytes (%u on host), estimated traffic %.0lf bytes/iteration\n",
+       __func__,b,bank_end[b],host_end[b],load[b]);
+    }
+    printf("INFO: %s: busiest port: data buffer #%d\n",__func__,busiest);
+  )
+  BDA_DEBUG(2,
+    for (int r=0;r<REG_NUM;r++) {
+      printf("INFO: %s: %-14s: data buffer #%d, offset %9u (cl: %7u), size %9u%s\n",
+       __func__,region_table[r].name,regions[r].bank,regions[r].offset,
+       regions[r].offset/CACHELINE_BYTES,regions[r].size,regions[r].device_only ? " (device only)" : "");
+    }
+  )
+
+  if (totalSize != NULL) {
+    for (int b=0;b<RW_BUF;b++) totalSize[b] = bank_end[b];
+  }
+  if (hostSize != NULL) {
+    for (int b=0;b<RW_BUF;b++) hostSize[b] = host_end[b];
+  }
+  if (result_offsets != NULL) {
+    result_offsets[0] = regions[REG_X2].offset;   // X even results
+    result_offsets[1] = regions[REG_R2].offset;   // R even results
+    result_offsets[2] = regions[REG_X1].offset;   // X odd results
+    result_offsets[3] = regions[REG_R1].offset;   // R odd results
+    result_offsets[4] = regions[REG_LRES].offset; // L results
+    result_offsets[5] = regions[REG_URES].offset; // U results
+  }
+
+  return 0;
+}
+
+// compute the position of all the arrays in the data buffers, the total size
+// of each data buffer and the offsets of the results regions (totalSize and
+// result_offsets can be NULL)
+int fpga_plan_datamem_layout(int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM], unsigned int totalSize[RW_BUF],
+ unsigned int result_offsets[6]) {
+  return fpga_plan_layout(false, processedSizes,
+   nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, nnzValArrays_num,
+   regions, totalSize, NULL, result_offsets);
+}
+
+// same as fpga_plan_datamem_layout, but the temporaries and the results
+// written by the kernel (REG_MASK_DEVICE_ONLY) are moved to the end of their
+// data buffer: only the first hostSize[b] bytes of data buffer b need a copy
+// on the host, the rest can live only in device memory
+int fpga_plan_split_layout(int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM], unsigned int totalSize[RW_BUF],
+ unsigned int hostSize[RW_BUF], unsigned int result_offsets[6]) {
+  return fpga_plan_layout(true, processedSizes,
+   nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, nnzValArrays_num,
+   regions, totalSize, hostSize, result_offsets);
+}
+
+// write the pointers of the regions (in cachelines) in the setup array; the
+// slots of the parts of the nnz values that are not used are left unchanged,
+// and the shared regions point to the copy of their alias
+void fpga_fill_setup_pointers(struct fpga_region regions[REG_NUM],
+ long unsigned int *setupArray) {
+  for (int r=0;r<REG_NUM;r++) {
+    int matrix, part;
+    if (region_table[r].setup_slot < 0) continue;
+    if (fpga_region_nnz_part(r, &matrix, &part) && part > 0 && regions[r].size == 0) continue;
+    int copy = (regions[r].alias >= 0) ? regions[r].alias : r;
+    setupArray[region_table[r].setup_slot] = regions[copy].offset/CACHELINE_BYTES;
+  }
+}
+
+// -------------------------------------
+// get the position of the data regions
+// -------------------------------------
+
+// the sizes must be the same ones given to fpga_setup_host_datamem, to obtain
+// the same layout that was used to allocate the data buffers
+int fpga_get_datamem_regions(int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM]) {
+
+  if (regions == NULL) {
+    printf("ERROR: %s: regions array must be already allocated.\n",__func__);
+    return 1;
+  }
+  return fpga_plan_datamem_layout(processedSizes,
+   nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes, nnzValArrays_num,
+   regions, NULL, NULL);
+}
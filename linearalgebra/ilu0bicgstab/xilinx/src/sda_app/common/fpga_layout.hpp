@@ -0,0 +1,152 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_LAYOUT_HPP__
+#define __FPGA_LAYOUT_HPP__
+
+#include "dev_config.hpp"
+#include "bicgstab_solver_config.hpp"
+
+// --- data buffers regions
+
+// identifiers of the arrays (regions) stored in the data buffers
+enum fpga_region_id {
+  REG_SETUP = 0,
+  REG_NNZ_VALS, REG_L_NNZ_VALS, REG_U_NNZ_VALS,
+  REG_COLOR_SIZES, REG_L_COLOR_SIZES, REG_U_COLOR_SIZES,
+  REG_BLKD,
+  REG_P_INDEX, REG_L_P_INDEX, REG_U_P_INDEX,
+  REG_COL_INDEX, REG_L_COL_INDEX, REG_U_COL_INDEX,
+  REG_NR_OFFSET, REG_L_NR_OFFSET, REG_U_NR_OFFSET,
+  REG_X2, REG_R1, REG_X1, REG_R2, REG_P1, REG_P2, REG_RT,
+  REG_T, REG_V, REG_LRES, REG_URES,
+  // parts 2-4 of the nnz values, when they are split (nnzValArrays_num > 1)
+  REG_NNZ_VALS_2, REG_L_NNZ_VALS_2, REG_U_NNZ_VALS_2,
+  REG_NNZ_VALS_3, REG_L_NNZ_VALS_3, REG_U_NNZ_VALS_3,
+  REG_NNZ_VALS_4, REG_L_NNZ_VALS_4, REG_U_NNZ_VALS_4,
+  REG_NUM
+};
+
+// masks of regions, used to select which regions must be refreshed
+#define REG_BIT(r) (1UL << (r))
+#define REG_MASK_VALUES (REG_BIT(REG_NNZ_VALS) | REG_BIT(REG_L_NNZ_VALS) | REG_BIT(REG_U_NNZ_VALS) | \
+ REG_BIT(REG_NNZ_VALS_2) | REG_BIT(REG_L_NNZ_VALS_2) | REG_BIT(REG_U_NNZ_VALS_2) | \
+ REG_BIT(REG_NNZ_VALS_3) | REG_BIT(REG_L_NNZ_VALS_3) | REG_BIT(REG_U_NNZ_VALS_3) | \
+ REG_BIT(REG_NNZ_VALS_4) | REG_BIT(REG_L_NNZ_VALS_4) | REG_BIT(REG_U_NNZ_VALS_4))
+// values of the ILU0 factors (all the parts), kept on the device when the
+// factors are reused (see fpga_lu_reuse)
+#define REG_MASK_LU_VALUES (REG_BIT(REG_L_NNZ_VALS) | REG_BIT(REG_U_NNZ_VALS) | \
+ REG_BIT(REG_L_NNZ_VALS_2) | REG_BIT(REG_U_NNZ_VALS_2) | \
+ REG_BIT(REG_L_NNZ_VALS_3) | REG_BIT(REG_U_NNZ_VALS_3) | \
+ REG_BIT(REG_L_NNZ_VALS_4) | REG_BIT(REG_U_NNZ_VALS_4))
+#define REG_MASK_BLKD    REG_BIT(REG_BLKD)
+#define REG_MASK_RHS    (REG_BIT(REG_R1) | REG_BIT(REG_X1))
+#define REG_MASK_PATTERN (REG_BIT(REG_SETUP) | \
+ REG_BIT(REG_COLOR_SIZES) | REG_BIT(REG_L_COLOR_SIZES) | REG_BIT(REG_U_COLOR_SIZES) | \
+ REG_BIT(REG_P_INDEX) | REG_BIT(REG_L_P_INDEX) | REG_BIT(REG_U_P_INDEX) | \
+ REG_BIT(REG_COL_INDEX) | REG_BIT(REG_L_COL_INDEX) | REG_BIT(REG_U_COL_INDEX) | \
+ REG_BIT(REG_NR_OFFSET) | REG_BIT(REG_L_NR_OFFSET) | REG_BIT(REG_U_NR_OFFSET))
+#define REG_MASK_INPUTS (REG_MASK_PATTERN | REG_MASK_VALUES | REG_MASK_BLKD | REG_MASK_RHS)
+// pattern arrays that the kernel can read from the copy of another region
+// with the same content (see fpga_region_can_share)
+#define REG_MASK_SHAREABLE (REG_MASK_PATTERN & ~REG_BIT(REG_SETUP))
+// regions that can be packed in single precision (see fpga_set_float_regions):
+// the values of the ILU0 factors and the block diagonal
+#define REG_MASK_FLOAT_CAPABLE (REG_BIT(REG_L_NNZ_VALS) | REG_BIT(REG_U_NNZ_VALS) | REG_BIT(REG_BLKD))
+// regions that are only written by the kernel: temporaries and results that
+// need no copy on the host (see fpga_plan_split_layout)
+#define REG_MASK_DEVICE_ONLY (REG_BIT(REG_X2) | REG_BIT(REG_R2) | \
+ REG_BIT(REG_P1) | REG_BIT(REG_P2) | REG_BIT(REG_RT) | REG_BIT(REG_T) | REG_BIT(REG_V) | \
+ REG_BIT(REG_LRES) | REG_BIT(REG_URES))
+
+// types of the elements stored in the regions
+enum fpga_region_type {
+  REG_TYPE_ULONG = 0,   // long unsigned int (setup array)
+  REG_TYPE_DOUBLE,      // double
+  REG_TYPE_UINT,        // unsigned int
+  REG_TYPE_USHORT,      // short unsigned int
+  REG_TYPE_UCHAR,       // unsigned char
+  REG_TYPE_FLOAT        // float (values packed in single precision)
+};
+
+// position of a region in the data buffers
+struct fpga_region {
+  int bank;             // data buffer holding the region
+  int type;             // type of the elements (see fpga_region_type)
+  unsigned int offset;  // offset (bytes) from the start of the data buffer
+  unsigned int size;    // allocated size (bytes, cacheline aligned)
+  unsigned int used;    // size (bytes) filled for the current system
+  bool device_only;     // the region has no copy in the host data buffer
+  int alias;            // region whose copy is read by the kernel instead of this one (-1: none)
+};
+
+// --- layout planner
+
+unsigned int fpga_region_type_bytes(int type);
+const char *fpga_region_name(int region);
+int fpga_region_type(int region);
+float fpga_region_traffic(int region);
+int fpga_region_nnz_part(int region, int *matrix, int *part);
+int fpga_region_setup_slot(int region);
+bool fpga_region_can_share(int region, int owner);
+
+// --- single precision values
+// (the setting must be the same when the data buffers are planned and filled)
+
+int fpga_set_float_regions(unsigned long int float_mask);
+unsigned long int fpga_get_float_regions(void);
+
+// --- process-wide settings
+// (the float regions and the settings of fpga_functions_bicgstab.hpp are read
+// without locks by the threads of the sessions, and of the pools that run
+// sessions: each session holds the settings from fpga_session_create to
+// fpga_session_release, and the setters fail while they are held. A setter
+// brackets its change with fpga_settings_change_begin/end)
+
+void fpga_settings_hold(void);
+void fpga_settings_unhold(void);
+int fpga_settings_change_begin(const char *caller);
+void fpga_settings_change_end(void);
+
+// --- split of the nnz values
+
+int fpga_nnz_region(int matrix, int part);
+void fpga_nnz_part_sizes(int nnz, int nnzValArrays_num, int *part_sizes);
+
+int fpga_plan_datamem_layout(int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM], unsigned int totalSize[RW_BUF],
+ unsigned int result_offsets[6]);
+
+int fpga_plan_split_layout(int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM], unsigned int totalSize[RW_BUF],
+ unsigned int hostSize[RW_BUF], unsigned int result_offsets[6]);
+
+void fpga_fill_setup_pointers(struct fpga_region regions[REG_NUM],
+ long unsigned int *setupArray);
+
+int fpga_get_datamem_regions(int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num,
+ struct fpga_region regions[REG_NUM]);
+
+#endif //__FPGA_LAYOUT_HPP__
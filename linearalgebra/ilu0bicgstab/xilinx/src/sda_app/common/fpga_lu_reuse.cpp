@@ -0,0 +1,190 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Reuse of the ILU0 factors across solves
+
+  Between two Newton iterations the Jacobian often changes little, and the
+  factors of a previous one are still a good preconditioner: reusing them
+  saves the host factorization and the upload of the L/U values (about two
+  thirds of the values bytes). The values of A and the right-hand side are
+  refreshed at every solve, and by default the block diagonal too; a caller
+  that takes the block diagonal from the factorization adds REG_MASK_BLKD to
+  reuse_mask to keep it with the factors.
+
+  Usage, for each solve:
+  - fpga_lu_reuse_decide with the values of A: if refresh is set, compute the
+    factors;
+  - fpga_lu_reuse_mask on the update mask of fpga_bufset_update (or of
+    fpga_update_host_datamem);
+  - after the solve, fpga_lu_reuse_record with the iterations run. A solve
+    that did not converge with reused factors invalidates them: the caller
+    can decide again and solve with new factors.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "fpga_lu_reuse.hpp"
+#include "fpga_layout.hpp"
+#include "bda_utils.hpp"
+
+int fpga_lu_reuse_init(struct fpga_lu_reuse *lu, unsigned int policy,
+ double max_iter_growth, int max_age, double max_value_change)
+{
+  memset(lu, 0, sizeof(struct fpga_lu_reuse));
+  if (policy & ~(LU_REFRESH_ITER_GROWTH | LU_REFRESH_AGE | LU_REFRESH_VALUE_CHANGE)) {
+    printf("ERROR: %s: unknown refresh criteria (policy 0x%x).\n",__func__,policy);
+    return 1;
+  }
+  if (((policy & LU_REFRESH_ITER_GROWTH) && max_iter_growth < 1.0) ||
+      ((policy & LU_REFRESH_AGE) && max_age < 1) ||
+      ((policy & LU_REFRESH_VALUE_CHANGE) && max_value_change < 0.0)) {
+    printf("ERROR: %s: invalid limits: iterations growth %lf, age %d, values change %lf.\n",
+     __func__,max_iter_growth,max_age,max_value_change);
+    return 1;
+  }
+  lu->policy = policy;
+  lu->max_iter_growth = max_iter_growth;
+  lu->max_age = max_age;
+  lu->max_value_change = max_value_change;
+  lu->reuse_mask = REG_MASK_LU_VALUES;
+  lu->base_iterations = -1.0;
+  return 0;
+}
+
+// relative change (2-norm) of the values of A from the reference values; the
+// parts of a split matrix are compared one after the other
+static double fpga_lu_value_change(struct fpga_lu_reuse *lu,
+ double **nnzValArrays, int *nnzValArrays_sizes, int nnzValArrays_num)
+{
+  double diff = 0.0;
+  int pos = 0;
+  for (int p=0;p<nnzValArrays_num;p++) {
+    for (int i=0;i<nnzValArrays_sizes[p];i++) {
+      double d = nnzValArrays[p][i] - lu->ref_vals[pos++];
+      diff += d*d;
+    }
+  }
+  if (lu->ref_norm == 0.0) return (diff == 0.0) ? 0.0 : HUGE_VAL;
+  return sqrt(diff)/lu->ref_norm;
+}
+
+// store the values of A of the factorization
+static int fpga_lu_store_values(struct fpga_lu_reuse *lu,
+ double **nnzValArrays, int *nnzValArrays_sizes, int nnzValArrays_num, int nnz)
+{
+  if (nnz > lu->ref_capacity || lu->ref_vals == NULL) {
+    free(lu->ref_vals);
+    lu->ref_vals = (double *)malloc(sizeof(double) * (nnz > 0 ? nnz : 1));
+    lu->ref_capacity = 0;
+    if (lu->ref_vals == NULL) {
+      printf("ERROR: %s: cannot allocate the reference values (%d nonzeros).\n",__func__,nnz);
+      return 1;
+    }
+    lu->ref_capacity = nnz;
+  }
+  double norm = 0.0;
+  int pos = 0;
+  for (int p=0;p<nnzValArrays_num;p++) {
+    memcpy(&lu->ref_vals[pos], nnzValArrays[p], sizeof(double) * nnzValArrays_sizes[p]);
+    for (int i=0;i<nnzValArrays_sizes[p];i++) norm += nnzValArrays[p][i]*nnzValArrays[p][i];
+    pos += nnzValArrays_sizes[p];
+  }
+  lu->ref_norm = sqrt(norm);
+  return 0;
+}
+
+// decide if the factors must be refreshed for the next solve, given the
+// values of A of the system (nnzValArrays as for fpga_copy_host_datamem)
+int fpga_lu_reuse_decide(struct fpga_lu_reuse *lu,
+ double **nnzValArrays, int *nnzValArrays_sizes, int nnzValArrays_num,
+ bool *refresh)
+{
+  int nnz = 0;
+  for (int p=0;p<nnzValArrays_num;p++) nnz += nnzValArrays_sizes[p];
+
+  lu->reason = NULL;
+  lu->last_change = 0.0;
+  if (!lu->valid) lu->reason = "no valid factors";
+  else if (lu->policy == 0) lu->reason = "refresh at every solve";
+  else if (nnz != lu->ref_nnz) lu->reason = "number of nonzeros changed";
+  else if ((lu->policy & LU_REFRESH_AGE) && lu->age >= lu->max_age) lu->reason = "age";
+  else if ((lu->policy & LU_REFRESH_ITER_GROWTH) && lu->base_iterations > 0.0 &&
+   lu->last_iterations > lu->max_iter_growth * lu->base_iterations) lu->reason = "iterations growth";
+  else if (lu->policy & LU_REFRESH_VALUE_CHANGE) {
+    lu->last_change = fpga_lu_value_change(lu, nnzValArrays, nnzValArrays_sizes, nnzValArrays_num);
+    if (lu->last_change > lu->max_value_change) lu->reason = "values change";
+  }
+
+  lu->refresh = (lu->reason != NULL);
+  if (lu->refresh) {
+    if ((lu->policy & LU_REFRESH_VALUE_CHANGE) &&
+     fpga_lu_store_values(lu, nnzValArrays, nnzValArrays_sizes, nnzValArrays_num, nnz)) return 1;
+    lu->ref_nnz = nnz;
+    lu->age = 0;
+    lu->base_iterations = -1.0;
+    lu->refreshes++;
+  } else {
+    lu->reuses++;
+  }
+  BDA_DEBUG(1,
+    if (lu->refresh) printf("INFO: %s: refreshing the factors (%s).\n",__func__,lu->reason);
+    else printf("INFO: %s: reusing the factors (age %d, last iterations %.1lf, values change %.3le).\n",
+     __func__,lu->age,lu->last_iterations,lu->last_change);
+  )
+  *refresh = lu->refresh;
+  return 0;
+}
+
+// record the outcome of the solve run after fpga_lu_reuse_decide; the factors
+// are valid from now on, unless the solve did not converge
+void fpga_lu_reuse_record(struct fpga_lu_reuse *lu, double iterations, bool converged)
+{
+  lu->valid = converged;
+  lu->age++;
+  lu->last_iterations = iterations;
+  if (lu->refresh) lu->base_iterations = iterations;
+  if (!converged) {
+    BDA_DEBUG(1,printf("INFO: %s: solve not converged with %s factors: they will be refreshed.\n",
+     __func__,lu->refresh ? "new" : "reused");)
+  }
+}
+
+// update mask for the current solve: without the regions of the factors when
+// they are reused
+unsigned long int fpga_lu_reuse_mask(struct fpga_lu_reuse *lu, unsigned long int update_mask)
+{
+  return lu->refresh ? update_mask : (update_mask & ~lu->reuse_mask);
+}
+
+// the factors on the device are lost (e.g. new data buffers, other pattern)
+void fpga_lu_reuse_invalidate(struct fpga_lu_reuse *lu)
+{
+  lu->valid = false;
+}
+
+void fpga_lu_reuse_free(struct fpga_lu_reuse *lu)
+{
+  free(lu->ref_vals);
+  lu->ref_vals = NULL;
+  lu->ref_capacity = 0;
+}
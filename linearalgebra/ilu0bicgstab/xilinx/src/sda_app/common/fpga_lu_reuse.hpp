@@ -0,0 +1,69 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_LU_REUSE_HPP__
+#define __FPGA_LU_REUSE_HPP__
+
+// --- reuse of the ILU0 factors across solves
+// (the host decides before each solve if the factors must be computed and
+// uploaded again; while they are reused, the update mask given to
+// fpga_bufset_update/fpga_update_host_datamem leaves their regions untouched
+// on the device. The arrays of the factors given to these functions must
+// stay the last uploaded ones: a re-plan of the layout copies them again)
+
+// criteria that refresh the factors (any of them)
+#define LU_REFRESH_ITER_GROWTH   0x1  // iterations of the last solve grew over those of the first solve
+#define LU_REFRESH_AGE           0x2  // factors used for a number of solves
+#define LU_REFRESH_VALUE_CHANGE  0x4  // relative change of the values of A since the factorization
+
+struct fpga_lu_reuse {
+  // policy
+  unsigned int policy;                // criteria (LU_REFRESH_*); 0: refresh at every solve
+  double max_iter_growth;             // max ratio of the iterations to those of the first solve
+  int max_age;                        // max solves with the same factors
+  double max_value_change;            // max relative change (2-norm) of the values of A
+  unsigned long int reuse_mask;       // regions kept on the device while the factors are reused
+  // state
+  bool valid;                         // factors on the device, usable for the next solve
+  bool refresh;                       // decision for the current solve
+  int age;                            // solves with the current factors
+  double base_iterations;             // iterations of the first solve with the current factors (<0: unknown)
+  double last_iterations;             // iterations of the last solve
+  double last_change;                 // relative change of the values of A at the last decision
+  const char *reason;                 // criterion that triggered the last refresh
+  unsigned int refreshes;             // solves with new factors
+  unsigned int reuses;                // solves with reused factors
+  // values of A at the last refresh (ref_vals only with LU_REFRESH_VALUE_CHANGE)
+  int ref_nnz;
+  int ref_capacity;
+  double *ref_vals;
+  double ref_norm;
+};
+
+int fpga_lu_reuse_init(struct fpga_lu_reuse *lu, unsigned int policy,
+ double max_iter_growth, int max_age, double max_value_change);
+int fpga_lu_reuse_decide(struct fpga_lu_reuse *lu,
+ double **nnzValArrays, int *nnzValArrays_sizes, int nnzValArrays_num,
+ bool *refresh);
+void fpga_lu_reuse_record(struct fpga_lu_reuse *lu, double iterations, bool converged);
+unsigned long int fpga_lu_reuse_mask(struct fpga_lu_reuse *lu, unsigned long int update_mask);
+void fpga_lu_reuse_invalidate(struct fpga_lu_reuse *lu);
+void fpga_lu_reuse_free(struct fpga_lu_reuse *lu);
+
+#endif //__FPGA_LU_REUSE_HPP__
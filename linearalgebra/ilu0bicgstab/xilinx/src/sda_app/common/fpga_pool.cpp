@@ -0,0 +1,527 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Pool of devices
+
+  Every device that matches the target name (all the devices if NULL) and
+  accepts the bitstream gets its own context and program. The compute units
+  of the kernel on each device (see find_compute_units) are the units of
+  work of the pool: each one gets a double-buffered session (see
+  fpga_session.cpp), with its data buffers in the memory banks connected to
+  that compute unit, and a thread that drives the session. The requests are
+  placed in the queue of a compute unit when submitted:
+  - POOL_LEAST_LOADED: on the compute unit with the least outstanding work,
+    the nnz of the queued and running requests;
+  - POOL_WORK_STEALING: round robin; a compute unit with a free slot and an
+    empty queue takes the oldest request of the compute unit with the longest
+    queue.
+  The thread of a compute unit keeps both slots of its session busy: it
+  submits a request as soon as a slot is free, and when the oldest solve
+  completes it copies its results to the arrays of the request. The compute
+  units of a device run concurrently, each on its own banks.
+
+  The submission does not take the lock of the pool, so that many host
+  threads can submit at once without waiting: the requests are pushed
+  on a lock-free queue (an intrusive multi-producer, single-consumer list,
+  with an atomic exchange per push) and a semaphore is posted. A dispatcher
+  thread takes the requests in submission order and places them on the
+  compute units. The queues of the compute units are protected by the lock of
+  the pool, which is held only to move the requests (solves take
+  milliseconds, so there is no contention).
+  The utilization of a compute unit is the time with a kernel running, from
+  the profiling timestamps of the runs, over the lifetime of the pool.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <CL/opencl.h>
+
+#include "fpga_pool.hpp"
+#include "opencl_lib.hpp"
+#include "bda_utils.hpp"
+
+// take the next request for a compute unit (pool locked)
+static struct fpga_pool_request *fpga_pool_take(struct fpga_pool *pool, struct fpga_pool_unit *unit) {
+  struct fpga_pool_unit *from = unit;
+
+  if (unit->head == NULL) {
+    if (pool->mode != POOL_WORK_STEALING) return NULL;
+    from = NULL;
+    for (int u=0;u<pool->num_units;u++) {
+      struct fpga_pool_unit *other = &pool->units[u];
+      if (other->head != NULL && (from == NULL || other->queued > from->queued)) from = other;
+    }
+    if (from == NULL) return NULL;
+  }
+  struct fpga_pool_request *req = from->head;
+  from->head = req->next;
+  if (from->head == NULL) from->tail = NULL;
+  from->queued--;
+  req->next = NULL;
+  if (from != unit) {
+    from->load -= req->weight;
+    unit->load += req->weight;
+    req->stolen = true;
+    unit->stats.stolen++;
+    BDA_DEBUG(2,printf("INFO: %s: unit %d takes a request of unit %d.\n",__func__,unit->index,from->index);)
+  }
+  req->unit = unit->index;
+  req->device = unit->device;
+  req->cu = unit->cu;
+  __atomic_store_n(&req->state, POOL_REQ_RUNNING, __ATOMIC_RELEASE);
+  return req;
+}
+
+// called by the OpenCL runtime when the solve of a request is complete: wake
+// up the thread of the compute unit
+static void fpga_pool_solve_done(struct fpga_solve *solve, void *user_data) {
+  struct fpga_pool_request *req = (struct fpga_pool_request *)user_data;
+  struct fpga_pool *pool = req->pool;
+  pthread_mutex_lock(&pool->lock);
+  req->solve_done = true;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// submit a request to the session of the compute unit
+static void fpga_pool_start(struct fpga_pool_unit *unit, struct fpga_pool_request *req) {
+  struct fpga_pool *pool = unit->pool;
+  struct fpga_solve *solve;
+
+  req->solve_done = false;
+  // the systems are independent: all the inputs are copied
+  int rc = fpga_session_submit(&unit->session, REG_MASK_INPUTS, req->vectorPointers, req->vectorSizes,
+   req->nnzValArrays_sizes, req->L_nnzValArrays_sizes, req->U_nnzValArrays_sizes,
+   fpga_pool_solve_done, req, &solve);
+  pthread_mutex_lock(&pool->lock);
+  if (rc) {
+    printf("ERROR: %s: cannot submit a request to unit %d.\n",__func__,unit->index);
+    // completed as a failed solve
+    req->solve_done = true;
+    solve = NULL;
+  }
+  unit->in_flight[unit->num_in_flight] = req;
+  unit->solves[unit->num_in_flight] = solve;
+  unit->num_in_flight++;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// copy the results of the oldest request of the compute unit, release its
+// solve, complete the request, then call its callback
+static void fpga_pool_finish(struct fpga_pool_unit *unit) {
+  struct fpga_pool *pool = unit->pool;
+  struct fpga_pool_request *req = unit->in_flight[0];
+  struct fpga_solve *solve = unit->solves[0];
+  fpga_pool_callback callback = req->callback;
+  void *user_data = req->user_data;
+  cl_ulong kernel_start = 0, kernel_end = 0;
+  int state = POOL_REQ_FAILED;
+
+  if (solve != NULL && fpga_solve_wait(solve) == 0) {
+    int rows = req->vectorSizes[0];
+    req->iterations = solve->kernel_iter_run/2.0+0.5;
+    memcpy(req->norms, solve->norms, sizeof(req->norms));
+    req->last_norm_idx = solve->last_norm_idx;
+    req->kernel_aborted = solve->kernel_aborted;
+    req->kernel_noresults = solve->kernel_noresults;
+    req->kernel_ms = solve->kernel_ms;
+    req->solve_ms = solve->solve_ms;
+    if (solve->kernel_noresults) {
+      // the initial guess is already precise enough
+      memcpy(req->x, req->vectorPointers[20], sizeof(double) * rows);
+      if (req->r != NULL) memcpy(req->r, req->vectorPointers[19], sizeof(double) * rows);
+    } else {
+      memcpy(req->x, solve->results[0], sizeof(double) * rows);
+      if (req->r != NULL) memcpy(req->r, solve->results[1], sizeof(double) * rows);
+    }
+    kernel_start = solve->kernel_start;
+    kernel_end = solve->kernel_end;
+    state = POOL_REQ_DONE;
+  }
+  // the results are copied: the slot of the session is free for the next
+  // request (its failure is counted below, not by the session)
+  if (solve != NULL) fpga_solve_release(solve);
+
+  pthread_mutex_lock(&pool->lock);
+  for (int i=1;i<unit->num_in_flight;i++) {
+    unit->in_flight[i-1] = unit->in_flight[i];
+    unit->solves[i-1] = unit->solves[i];
+  }
+  unit->num_in_flight--;
+  unit->load -= req->weight;
+  if (state == POOL_REQ_DONE) {
+    unit->stats.solves++;
+    unit->stats.kernel_ms += req->kernel_ms;
+    // only the part of the run after the end of the previous one is counted
+    if (kernel_end > unit->busy_until) {
+      cl_ulong start = (kernel_start > unit->busy_until) ? kernel_start : unit->busy_until;
+      unit->stats.busy_ms += (double)(kernel_end - start) / 1000000;
+      unit->busy_until = kernel_end;
+    }
+  } else {
+    unit->stats.failures++;
+  }
+  __atomic_store_n(&req->state, state, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&pool->done_cond);
+  pthread_mutex_unlock(&pool->lock);
+  // complete: the callback sees the final state (see fpga_pool_callback)
+  if (callback != NULL) callback(req, user_data);
+}
+
+static void *fpga_pool_thread(void *data) {
+  struct fpga_pool_unit *unit = (struct fpga_pool_unit *)data;
+  struct fpga_pool *pool = unit->pool;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    struct fpga_pool_request *req = NULL;
+    if (unit->num_in_flight > 0 && unit->in_flight[0]->solve_done) {
+      pthread_mutex_unlock(&pool->lock);
+      fpga_pool_finish(unit);
+      pthread_mutex_lock(&pool->lock);
+      continue;
+    }
+    if (unit->num_in_flight < SESSION_SLOTS && (req = fpga_pool_take(pool, unit)) != NULL) {
+      pthread_mutex_unlock(&pool->lock);
+      fpga_pool_start(unit, req);
+      pthread_mutex_lock(&pool->lock);
+      continue;
+    }
+    if (pool->shutdown && unit->num_in_flight == 0) break;
+    pthread_cond_wait(&pool->work_cond, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+// ----------------------------
+// submission queue, dispatcher
+// ----------------------------
+
+// push a request (any thread): the request becomes the head, then the
+// previous head is linked to it
+static void fpga_pool_inbox_push(struct fpga_pool *pool, struct fpga_pool_request *req) {
+  __atomic_store_n(&req->inbox_next, (struct fpga_pool_request *)NULL, __ATOMIC_RELAXED);
+  struct fpga_pool_request *prev = __atomic_exchange_n(&pool->inbox_head, req, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&prev->inbox_next, req, __ATOMIC_RELEASE);
+}
+
+// take the oldest request (dispatcher only); NULL if the queue is empty, or
+// if the push of the next request is in progress (it is posted afterwards)
+static struct fpga_pool_request *fpga_pool_inbox_pop(struct fpga_pool *pool) {
+  struct fpga_pool_request *stub = &pool->inbox_stub;
+  struct fpga_pool_request *tail = pool->inbox_tail;
+  struct fpga_pool_request *next = __atomic_load_n(&tail->inbox_next, __ATOMIC_ACQUIRE);
+
+  if (tail == stub) {
+    if (next == NULL) return NULL;
+    pool->inbox_tail = next;
+    tail = next;
+    next = __atomic_load_n(&next->inbox_next, __ATOMIC_ACQUIRE);
+  }
+  if (next != NULL) {
+    pool->inbox_tail = next;
+    return tail;
+  }
+  if (tail != __atomic_load_n(&pool->inbox_head, __ATOMIC_ACQUIRE)) return NULL;
+  // last request: the stub is pushed again to keep the list non-empty
+  fpga_pool_inbox_push(pool, stub);
+  next = __atomic_load_n(&tail->inbox_next, __ATOMIC_ACQUIRE);
+  if (next == NULL) return NULL;
+  pool->inbox_tail = next;
+  return tail;
+}
+
+// place a request on a compute unit (pool locked)
+static void fpga_pool_place(struct fpga_pool *pool, struct fpga_pool_request *req) {
+  struct fpga_pool_unit *unit = &pool->units[0];
+  if (pool->mode == POOL_LEAST_LOADED) {
+    for (int u=1;u<pool->num_units;u++) {
+      if (pool->units[u].load < unit->load) unit = &pool->units[u];
+    }
+  } else {
+    unit = &pool->units[pool->next_unit];
+    pool->next_unit = (pool->next_unit + 1) % pool->num_units;
+  }
+  if (unit->tail != NULL) unit->tail->next = req;
+  else unit->head = req;
+  unit->tail = req;
+  unit->queued++;
+  unit->load += req->weight;
+}
+
+// place the requests submitted so far, with one lock of the pool
+static void fpga_pool_dispatch(struct fpga_pool *pool) {
+  struct fpga_pool_request *req = fpga_pool_inbox_pop(pool);
+  if (req == NULL) return;
+  pthread_mutex_lock(&pool->lock);
+  while (req != NULL) {
+    fpga_pool_place(pool, req);
+    __atomic_sub_fetch(&pool->inbox_count, 1, __ATOMIC_SEQ_CST);
+    req = fpga_pool_inbox_pop(pool);
+  }
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// the dispatcher stops when the pool is closing and no submission is in
+// progress, after placing the last requests. A submission in progress when
+// the pool closes posts the semaphore before it ends (or never, if it is
+// rejected), so the semaphore is not used once the dispatcher stops
+static void *fpga_pool_dispatcher(void *data) {
+  struct fpga_pool *pool = (struct fpga_pool *)data;
+  while (!__atomic_load_n(&pool->closing, __ATOMIC_SEQ_CST)) {
+    while (sem_wait(&pool->inbox_sem) != 0 && errno == EINTR);
+    fpga_pool_dispatch(pool);
+  }
+  // the submissions in progress take a few instructions
+  while (__atomic_load_n(&pool->submitting, __ATOMIC_SEQ_CST) > 0) sched_yield();
+  fpga_pool_dispatch(pool);
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+// -------------------------------------------------
+// setup of the devices, compute units and sessions
+// -------------------------------------------------
+
+int fpga_pool_create(struct fpga_pool *pool, const char *target_device_name, int max_devices, int max_cus,
+ char *kernel_name, char *xclbin, int mode,
+ unsigned int config_bits, int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, double growth, unsigned int residency,
+ unsigned int debug_outbuf_words)
+{
+  cl_device_id device_ids[POOL_MAX_DEVICES];
+  cl_context contexts[POOL_MAX_DEVICES];
+  cl_program programs[POOL_MAX_DEVICES];
+  char cu_names[POOL_MAX_CUS][CU_NAME_LEN];
+  int num_devices;
+
+  memset(pool, 0, sizeof(struct fpga_pool));
+  if (mode != POOL_LEAST_LOADED && mode != POOL_WORK_STEALING) {
+    printf("ERROR: %s: unknown placement mode %d.\n",__func__,mode);
+    return 1;
+  }
+  if (max_devices < 1 || max_devices > POOL_MAX_DEVICES) max_devices = POOL_MAX_DEVICES;
+  if (max_cus < 1 || max_cus > POOL_MAX_CUS) max_cus = POOL_MAX_CUS;
+  if (setup_opencl_devices(target_device_name, max_devices, device_ids, contexts, programs,
+   xclbin, &num_devices)) return 1;
+  pool->mode = mode;
+  pool->inbox_head = &pool->inbox_stub;
+  pool->inbox_tail = &pool->inbox_stub;
+  sem_init(&pool->inbox_sem, 0, 0);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  for (int d=0;d<num_devices;d++) {
+    struct fpga_pool_device *dev = &pool->devices[d];
+    dev->device_id = device_ids[d];
+    dev->context = contexts[d];
+    dev->program = programs[d];
+  }
+  pool->num_devices = num_devices;
+  for (int d=0;d<num_devices;d++) {
+    struct fpga_pool_device *dev = &pool->devices[d];
+    if (find_compute_units(dev->program, kernel_name, max_cus, cu_names, &dev->num_cus)) {
+      printf("ERROR: %s: cannot find the compute units of device %d.\n",__func__,d);
+      fpga_pool_release(pool);
+      return 1;
+    }
+    for (int c=0;c<dev->num_cus;c++) {
+      struct fpga_pool_unit *unit = &pool->units[pool->num_units];
+      unit->pool = pool;
+      unit->index = pool->num_units;
+      unit->device = d;
+      unit->cu = c;
+      strcpy(unit->cu_name, cu_names[c]);
+      if (fpga_session_create(&unit->session, dev->device_id, dev->context, dev->program, unit->cu_name,
+       config_bits, processedSizes, nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes,
+       nnzValArrays_num, growth, residency, debug_outbuf_words)) {
+        printf("ERROR: %s: cannot create the session of compute unit %d of device %d.\n",__func__,c,d);
+        fpga_pool_release(pool);
+        return 1;
+      }
+      pool->num_units++;
+    }
+  }
+  clock_gettime(CLOCK_REALTIME, &pool->start_time);
+  for (int u=0;u<pool->num_units;u++) {
+    struct fpga_pool_unit *unit = &pool->units[u];
+    if (pthread_create(&unit->thread, NULL, fpga_pool_thread, unit) != 0) {
+      printf("ERROR: %s: cannot start the thread of unit %d.\n",__func__,u);
+      fpga_pool_release(pool);
+      return 1;
+    }
+    unit->thread_started = true;
+  }
+  if (pthread_create(&pool->dispatcher, NULL, fpga_pool_dispatcher, pool) != 0) {
+    printf("ERROR: %s: cannot start the dispatcher.\n",__func__);
+    fpga_pool_release(pool);
+    return 1;
+  }
+  pool->dispatcher_started = true;
+  BDA_DEBUG(1,printf("INFO: %s: pool of %d devices, %d compute units created.\n",__func__,num_devices,pool->num_units);)
+  return 0;
+}
+
+// the kernel parameters can be set only when no request is queued or running
+int fpga_pool_set_kernel_parameters(struct fpga_pool *pool,
+ unsigned int abort_cycles, unsigned int debug_lines, unsigned int kernel_iter,
+ unsigned int debug_sample_rate, double kernel_precision)
+{
+  int rc = 0;
+  pthread_mutex_lock(&pool->lock);
+  if (__atomic_load_n(&pool->inbox_count, __ATOMIC_SEQ_CST) > 0) {
+    printf("ERROR: %s: requests are being submitted.\n",__func__);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+  }
+  for (int u=0;u<pool->num_units;u++) {
+    if (pool->units[u].queued > 0 || pool->units[u].num_in_flight > 0) {
+      printf("ERROR: %s: unit %d has requests in progress.\n",__func__,u);
+      pthread_mutex_unlock(&pool->lock);
+      return 1;
+    }
+  }
+  for (int u=0;u<pool->num_units && rc==0;u++) {
+    rc = fpga_session_set_kernel_parameters(&pool->units[u].session, abort_cycles, debug_lines,
+     kernel_iter, debug_sample_rate, kernel_precision, true);
+  }
+  __atomic_store_n(&pool->parameters_set, (rc == 0), __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&pool->lock);
+  return rc;
+}
+
+// ----------------------------------
+// submission/completion of requests
+// ----------------------------------
+
+// lock-free: can be called from any thread, also while fpga_pool_release
+// runs (but not after it returns); a rejected request is failed
+int fpga_pool_submit(struct fpga_pool *pool, struct fpga_pool_request *req) {
+  req->pool = pool;
+  req->state = POOL_REQ_QUEUED;
+  req->unit = -1;
+  req->device = -1;
+  req->cu = -1;
+  req->stolen = false;
+  req->solve_done = false;
+  req->next = NULL;
+  req->weight = (unsigned int)req->vectorSizes[1] + req->vectorSizes[7] + req->vectorSizes[13];
+
+  // the dispatcher does not stop while a submission is in progress
+  __atomic_add_fetch(&pool->submitting, 1, __ATOMIC_SEQ_CST);
+  bool closing = __atomic_load_n(&pool->closing, __ATOMIC_SEQ_CST);
+  if (closing || !__atomic_load_n(&pool->parameters_set, __ATOMIC_ACQUIRE)) {
+    // nothing queued: the dispatcher is not woken up
+    __atomic_sub_fetch(&pool->submitting, 1, __ATOMIC_SEQ_CST);
+    printf("ERROR: %s: the pool is %s.\n",__func__,closing ? "shut down" : "not ready (kernel parameters)");
+    __atomic_store_n(&req->state, POOL_REQ_FAILED, __ATOMIC_RELEASE);
+    return 1;
+  }
+  __atomic_add_fetch(&pool->inbox_count, 1, __ATOMIC_SEQ_CST);
+  fpga_pool_inbox_push(pool, req);
+  // posted before the end of the submission: the semaphore still exists
+  sem_post(&pool->inbox_sem);
+  __atomic_sub_fetch(&pool->submitting, 1, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+// block until the request is complete; returns 1 if it failed
+int fpga_pool_wait(struct fpga_pool *pool, struct fpga_pool_request *req) {
+  pthread_mutex_lock(&pool->lock);
+  while (req->state == POOL_REQ_QUEUED || req->state == POOL_REQ_RUNNING) {
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  }
+  int state = req->state;
+  pthread_mutex_unlock(&pool->lock);
+  return (state != POOL_REQ_DONE);
+}
+
+// non-blocking test of the completion of the request (any thread); returns 1
+// if it failed
+int fpga_pool_poll(struct fpga_pool_request *req, bool *complete) {
+  int state = __atomic_load_n(&req->state, __ATOMIC_ACQUIRE);
+  *complete = (state == POOL_REQ_DONE || state == POOL_REQ_FAILED);
+  return (state == POOL_REQ_FAILED);
+}
+
+int fpga_pool_stats(struct fpga_pool *pool, int unit, struct fpga_pool_unit_stats *stats) {
+  struct timespec now;
+
+  if (unit < 0 || unit >= pool->num_units) {
+    printf("ERROR: %s: unit %d is not in the pool (%d compute units).\n",__func__,unit,pool->num_units);
+    return 1;
+  }
+  clock_gettime(CLOCK_REALTIME, &now);
+  pthread_mutex_lock(&pool->lock);
+  struct fpga_pool_unit *u = &pool->units[unit];
+  *stats = u->stats;
+  stats->queued = u->queued;
+  stats->in_flight = u->num_in_flight;
+  pthread_mutex_unlock(&pool->lock);
+  double lifetime_ms = elapsed_ms(&pool->start_time, &now);
+  stats->utilization = (lifetime_ms > 0.0) ? stats->busy_ms / lifetime_ms : 0.0;
+  return 0;
+}
+
+// the queued requests are completed before the threads stop
+void fpga_pool_release(struct fpga_pool *pool) {
+  __atomic_store_n(&pool->closing, true, __ATOMIC_SEQ_CST);
+  if (pool->dispatcher_started) {
+    sem_post(&pool->inbox_sem);
+    pthread_join(pool->dispatcher, NULL);
+    pool->dispatcher_started = false;
+  } else {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  for (int u=0;u<pool->num_units;u++) {
+    struct fpga_pool_unit *unit = &pool->units[u];
+    if (unit->thread_started) pthread_join(unit->thread, NULL);
+    unit->thread_started = false;
+    fpga_session_release(&unit->session);
+  }
+  pool->num_units = 0;
+  for (int d=0;d<pool->num_devices;d++) {
+    struct fpga_pool_device *dev = &pool->devices[d];
+    if (dev->program != NULL) clReleaseProgram(dev->program);
+    if (dev->context != NULL) clReleaseContext(dev->context);
+    dev->program = NULL;
+    dev->context = NULL;
+  }
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->lock);
+  sem_destroy(&pool->inbox_sem);
+  pool->num_devices = 0;
+}
@@ -0,0 +1,165 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_POOL_HPP__
+#define __FPGA_POOL_HPP__
+
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <CL/opencl.h>
+
+#include "fpga_session.hpp"
+#include "opencl_lib.hpp"
+
+// --- pool of devices
+// (one double-buffered session per compute unit of each device, driven by a
+// thread per compute unit: independent systems are submitted to the pool,
+// placed on the compute units and their results copied to the arrays of the
+// request. fpga_pool_submit can be called from any thread: it does not take
+// the lock of the pool. The requests must stay valid, and their arrays
+// unchanged, until they are complete)
+
+#define POOL_MAX_DEVICES  16
+#define POOL_MAX_CUS      4   // compute units of the kernel on a device
+#define POOL_MAX_UNITS    (POOL_MAX_DEVICES*POOL_MAX_CUS)
+
+// placement of the requests
+#define POOL_LEAST_LOADED  0  // on the compute unit with the least outstanding work (nnz)
+#define POOL_WORK_STEALING 1  // round robin; idle compute units take the requests queued on the busiest one
+
+// states of a request
+#define POOL_REQ_QUEUED    0
+#define POOL_REQ_RUNNING   1
+#define POOL_REQ_DONE      2
+#define POOL_REQ_FAILED    3
+
+struct fpga_pool_request;
+
+// called by the thread of the compute unit after the request is complete or
+// failed: its state is set and the threads waiting for it are woken up. A
+// request with a callback must stay valid until the callback returns, so it
+// is released by the callback, or by its owner after the callback has run
+typedef void (*fpga_pool_callback)(struct fpga_pool_request *req, void *user_data);
+
+struct fpga_pool_request {
+  // system: the arrays must hold the whole system (as for fpga_copy_host_datamem)
+  void **vectorPointers;
+  int *vectorSizes;
+  int *nnzValArrays_sizes, *L_nnzValArrays_sizes, *U_nnzValArrays_sizes;
+  double *x;                          // solution (rows elements)
+  double *r;                          // residual (rows elements), can be NULL
+  fpga_pool_callback callback;        // can be NULL
+  void *user_data;
+  // set by the pool
+  struct fpga_pool *pool;
+  int state;
+  int unit;                           // compute unit (of the pool) that solved the request
+  int device, cu;                     // its device and compute unit on the device
+  bool stolen;                        // taken from the queue of another compute unit
+  unsigned int weight;                // work estimate: nnz of A, L and U
+  bool solve_done;                    // the solve of the request has completed on the compute unit
+  struct fpga_pool_request *inbox_next; // submission queue link
+  struct fpga_pool_request *next;     // queue link
+  double iterations;
+  double norms[4];
+  unsigned char last_norm_idx;
+  bool kernel_aborted, kernel_noresults;
+  double kernel_ms, solve_ms;
+};
+
+struct fpga_pool_unit_stats {
+  unsigned int solves;
+  unsigned int failures;
+  unsigned int stolen;                // requests taken from the queues of other compute units
+  int queued;                         // requests waiting in the queue of the compute unit
+  int in_flight;                      // requests submitted to the session
+  double kernel_ms;                   // device time of the kernel runs
+  double busy_ms;                     // time with a kernel running (the runs of the slots may overlap)
+  double utilization;                 // busy time over the lifetime of the pool
+};
+
+struct fpga_pool_device {
+  cl_device_id device_id;
+  cl_context context;
+  cl_program program;
+  int num_cus;
+};
+
+struct fpga_pool_unit {
+  struct fpga_pool *pool;
+  int index;
+  int device, cu;
+  char cu_name[CU_NAME_LEN];          // kernel name that selects the compute unit
+  struct fpga_session session;
+  pthread_t thread;
+  bool thread_started;
+  // queue of the requests placed on the compute unit
+  struct fpga_pool_request *head, *tail;
+  int queued;
+  unsigned long int load;             // weight of the queued and in flight requests
+  // requests submitted to the session (oldest first) and their solves
+  struct fpga_pool_request *in_flight[SESSION_SLOTS];
+  struct fpga_solve *solves[SESSION_SLOTS];
+  int num_in_flight;
+  cl_ulong busy_until;                // end of the last kernel run (profiling timestamp)
+  struct fpga_pool_unit_stats stats;
+};
+
+struct fpga_pool {
+  int mode;                           // POOL_LEAST_LOADED or POOL_WORK_STEALING
+  int num_devices;
+  int num_units;                      // compute units of all the devices
+  int next_unit;                      // round robin placement
+  bool shutdown;                      // the dispatcher has placed the last requests
+  bool closing;                       // no more submissions (atomic)
+  bool parameters_set;                // (atomic)
+  // submission queue: lock-free, multiple producers, the dispatcher consumes
+  struct fpga_pool_request *inbox_head;   // last request pushed (atomic)
+  struct fpga_pool_request *inbox_tail;   // next request to dispatch
+  struct fpga_pool_request inbox_stub;
+  sem_t inbox_sem;                    // one post per submission
+  int inbox_count;                    // submitted, not placed yet (atomic)
+  int submitting;                     // submissions in progress (atomic)
+  pthread_t dispatcher;
+  bool dispatcher_started;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;           // new requests, completed solves, shutdown
+  pthread_cond_t done_cond;           // completed requests
+  struct timespec start_time;
+  struct fpga_pool_device devices[POOL_MAX_DEVICES];
+  struct fpga_pool_unit units[POOL_MAX_UNITS];
+};
+
+int fpga_pool_create(struct fpga_pool *pool, const char *target_device_name, int max_devices, int max_cus,
+ char *kernel_name, char *xclbin, int mode,
+ unsigned int config_bits, int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, double growth, unsigned int residency,
+ unsigned int debug_outbuf_words);
+int fpga_pool_set_kernel_parameters(struct fpga_pool *pool,
+ unsigned int abort_cycles, unsigned int debug_lines, unsigned int kernel_iter,
+ unsigned int debug_sample_rate, double kernel_precision);
+int fpga_pool_submit(struct fpga_pool *pool, struct fpga_pool_request *req);
+int fpga_pool_wait(struct fpga_pool *pool, struct fpga_pool_request *req);
+int fpga_pool_poll(struct fpga_pool_request *req, bool *complete);
+int fpga_pool_stats(struct fpga_pool *pool, int unit, struct fpga_pool_unit_stats *stats);
+void fpga_pool_release(struct fpga_pool *pool);
+
+#endif //__FPGA_POOL_HPP__
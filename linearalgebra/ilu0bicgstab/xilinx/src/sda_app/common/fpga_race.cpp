@@ -0,0 +1,336 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Speculative solve on the FPGA and on the host
+
+  A fixed abort_cycles is either too loose (a pathological system runs for
+  the whole budget before the host knows) or too tight (good systems are
+  aborted). Here the cycles of the run are predicted from the structure of
+  the system (fpga_cycle_model) and the expected iterations, and the
+  watchdog is set at a margin above the prediction. The model is corrected
+  with the cycles and iterations of every run decoded.
+
+  While the kernel runs, the host reference ILU0-BiCGSTAB solver
+  (bicgstab_reference_solve_cancel) is started on the same system in a
+  thread, after host_delay_ms, or at once when the kernel fails, is aborted
+  or ends without converging. The race ends with the first converged
+  solution:
+  - the kernel wins: the host solve is cancelled at its next iteration;
+  - the host wins: the kernel run is ignored, and released (after the
+    watchdog at most) by fpga_race_wait, which is also called by the next
+    fpga_race_solve.
+  The matrix A, the right-hand side b and the initial guess x0 of the host
+  solve must be the system packed in the pool, in the same (reordered) row
+  order, so that both solutions have the same order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <CL/opencl.h>
+
+#include "fpga_race.hpp"
+#include "fpga_layout.hpp"
+#include "bda_utils.hpp"
+
+// weight of the last run in the correction of the model
+#define RACE_MODEL_ALPHA 0.25
+
+// initial coefficients of the model, for a 512-bit data path: they are only
+// the starting point of the correction by the runs observed
+int fpga_race_init(struct fpga_race *race) {
+  memset(race, 0, sizeof(struct fpga_race));
+  race->model.setup = 20000.0;
+  race->model.per_nnz = 0.25;
+  race->model.per_row = 2.0;
+  race->model.per_color = 100.0;
+  race->model.scale = 1.0;
+  race->model.iterations = 20.0;
+  if (pthread_mutex_init(&race->lock, NULL) || pthread_cond_init(&race->cond, NULL)) {
+    printf("ERROR: %s: cannot create the synchronization of the race.\n",__func__);
+    return 1;
+  }
+  return 0;
+}
+
+// -------------------------------
+// prediction of the kernel cycles
+// -------------------------------
+
+static double fpga_race_iteration_cycles(const struct fpga_cycle_model *model, int *vectorSizes) {
+  double nnz = (double)vectorSizes[1] + vectorSizes[7] + vectorSizes[13];
+  double colors = (double)vectorSizes[2] + vectorSizes[8] + vectorSizes[14];
+  return model->per_nnz * 2 * nnz + model->per_row * vectorSizes[0] + model->per_color * colors;
+}
+
+double fpga_race_predict(const struct fpga_cycle_model *model, int *vectorSizes, double iterations) {
+  return model->setup + iterations * model->scale * fpga_race_iteration_cycles(model, vectorSizes);
+}
+
+// correct the model with a run of the kernel; the iterations of a run that
+// did not end by itself (complete false) are not in the average
+void fpga_race_observe(struct fpga_cycle_model *model, int *vectorSizes,
+ unsigned int kernel_cycles, double iterations, bool complete) {
+  double cycles = fpga_race_iteration_cycles(model, vectorSizes);
+  if (iterations <= 0.0 || cycles <= 0.0 || kernel_cycles <= model->setup) return;
+  double scale = (kernel_cycles - model->setup) / (iterations * cycles);
+  model->scale = (model->runs == 0) ? scale : model->scale + RACE_MODEL_ALPHA * (scale - model->scale);
+  model->runs++;
+  if (complete) {
+    model->iterations = (model->complete_runs == 0) ? iterations :
+     model->iterations + RACE_MODEL_ALPHA * (iterations - model->iterations);
+    model->complete_runs++;
+  }
+  BDA_DEBUG(2,printf("INFO: %s: %u cycles for %.1f iterations: scale %.3f (%u runs).\n",
+   __func__,kernel_cycles,iterations,model->scale,model->runs);)
+}
+
+// ------------------------------
+// host solve and kernel callback
+// ------------------------------
+
+// called from a thread of the OpenCL runtime (no OpenCL calls)
+static void fpga_race_fpga_done(struct fpga_solve *solve, void *user_data) {
+  struct fpga_race *race = (struct fpga_race *)user_data;
+  pthread_mutex_lock(&race->lock);
+  race->fpga_done = true;
+  pthread_cond_broadcast(&race->cond);
+  pthread_mutex_unlock(&race->lock);
+}
+
+static void *fpga_race_host(void *data) {
+  struct fpga_race *race = (struct fpga_race *)data;
+  struct timespec deadline = race->start_time;
+  long int delay_ns = (long int)(race->host_delay_ms * 1000000);
+  double iterations = 0.0, rel_residual = 1.0;
+  bool converged = false;
+  int rc = 0;
+
+  deadline.tv_sec += delay_ns / 1000000000 + (deadline.tv_nsec + delay_ns % 1000000000) / 1000000000;
+  deadline.tv_nsec = (deadline.tv_nsec + delay_ns % 1000000000) % 1000000000;
+  pthread_mutex_lock(&race->lock);
+  while (!__atomic_load_n(&race->cancel, __ATOMIC_ACQUIRE) && !race->host_start_now) {
+    if (pthread_cond_timedwait(&race->cond, &race->lock, &deadline) == ETIMEDOUT) break;
+  }
+  bool run = !__atomic_load_n(&race->cancel, __ATOMIC_ACQUIRE);
+  race->host_started = run;
+  pthread_mutex_unlock(&race->lock);
+
+  if (run) {
+    BDA_DEBUG(1,printf("INFO: %s: starting the host solve.\n",__func__);)
+    rc = bicgstab_reference_solve_cancel(race->A, NULL, race->b, race->host_x, 0,
+     race->host_max_iter, race->tolerance, &iterations, &rel_residual, &converged, NULL, &race->cancel);
+  }
+  pthread_mutex_lock(&race->lock);
+  race->host_rc = rc;
+  race->host_iterations = iterations;
+  race->host_rel_residual = rel_residual;
+  race->host_converged = (rc == 0) && converged;
+  race->host_done = true;
+  pthread_cond_broadcast(&race->cond);
+  pthread_mutex_unlock(&race->lock);
+  return NULL;
+}
+
+// ------------
+// run the race
+// ------------
+
+// x receives the solution of the winner (x0 if no solve has results)
+int fpga_race_solve(struct fpga_race *race, cl_command_queue commands, cl_kernel kernel,
+ struct fpga_bufset *bufset, cl_mem cldebug, unsigned long int *debugBuffer,
+ unsigned int debug_outbuf_words, unsigned int debug_lines, unsigned int kernel_iter,
+ unsigned int debug_sample_rate, double tolerance, const struct fpga_race_params *params,
+ int *vectorSizes, struct csr_matrix *A, double *b, double *x0, double *x,
+ struct fpga_race_result *result)
+{
+  struct timespec time_end;
+  struct fpga_solve *solve = &race->solve;
+  bool host = (params->host_delay_ms >= 0.0);
+  int rows = vectorSizes[0];
+
+  memset(result, 0, sizeof(struct fpga_race_result));
+  result->winner = RACE_NONE;
+  fpga_race_wait(race);
+  if (host && (A == NULL || b == NULL || A->rows != rows)) {
+    printf("ERROR: %s: the host solve needs the matrix of the system (%d rows).\n",__func__,rows);
+    return 1;
+  }
+
+  // watchdog
+  double iterations = (params->expected_iter > 0.0) ? params->expected_iter : race->model.iterations;
+  result->predicted_cycles = fpga_race_predict(&race->model, vectorSizes, iterations);
+  double abort_cycles = params->watchdog_margin * result->predicted_cycles;
+  result->abort_cycles = (abort_cycles < 1.0) ? 1 : (abort_cycles > 4294967295.0) ? 0xFFFFFFFF : (unsigned int)abort_cycles;
+  BDA_DEBUG(1,printf("INFO: %s: %.0f cycles predicted for %.1f iterations, watchdog at %u cycles.\n",
+   __func__,result->predicted_cycles,iterations,result->abort_cycles);)
+  if (fpga_set_kernel_parameters(kernel, result->abort_cycles, debug_lines, kernel_iter,
+   debug_sample_rate, tolerance, bufset->cldata, cldebug)) return 1;
+  bufset->rebind_mask = 0;
+
+  if (host && race->host_capacity < rows) {
+    free(race->host_x);
+    race->host_x = (double *)malloc(sizeof(double) * rows);
+    race->host_capacity = (race->host_x != NULL) ? rows : 0;
+    if (race->host_x == NULL) {
+      printf("ERROR: %s: cannot allocate the host solution (%d rows).\n",__func__,rows);
+      return 1;
+    }
+  }
+  if (host) memcpy(race->host_x, x0, sizeof(double) * rows);
+  race->fpga_done = false;
+  race->host_start_now = false;
+  __atomic_store_n(&race->cancel, false, __ATOMIC_RELEASE);
+  race->host_started = false;
+  race->host_done = false;
+  race->host_converged = false;
+  race->host_iterations = 0.0;
+  race->host_rel_residual = 1.0;
+  race->host_delay_ms = params->host_delay_ms;
+  race->host_max_iter = params->host_max_iter;
+  race->tolerance = tolerance;
+  race->A = A;
+  race->b = b;
+  memcpy(race->sizes, vectorSizes, sizeof(race->sizes));
+  clock_gettime(CLOCK_REALTIME, &race->start_time);
+
+  // the callback is not called if the submission fails
+  if (fpga_solve_submit(solve, commands, kernel, bufset, cldebug, debugBuffer,
+   debug_outbuf_words, result->abort_cycles, false, fpga_race_fpga_done, race)) race->fpga_done = true;
+  race->solve_pending = true;
+  if (host) {
+    if (pthread_create(&race->host_thread, NULL, fpga_race_host, race)) {
+      printf("ERROR: %s: cannot start the host solve.\n",__func__);
+      host = false;
+    } else {
+      race->host_thread_running = true;
+    }
+  }
+
+  // wait for the first converged solution
+  bool fpga_checked = false, fpga_won = false;
+  pthread_mutex_lock(&race->lock);
+  while (true) {
+    if (race->fpga_done && !fpga_checked) {
+      fpga_checked = true;
+      if (solve->state == SOLVE_COMPLETE && !solve->kernel_aborted && !solve->kernel_overflow) {
+        fpga_won = solve->kernel_noresults || solve->norms[solve->last_norm_idx] <= tolerance * solve->norms[0];
+      }
+      if (fpga_won) break;
+      // the host solve starts at once
+      race->host_start_now = true;
+      pthread_cond_broadcast(&race->cond);
+    }
+    if (race->host_done && (race->host_converged || fpga_checked)) break;
+    if (fpga_checked && !host) break;
+    pthread_cond_wait(&race->cond, &race->lock);
+  }
+  if (fpga_won) {
+    __atomic_store_n(&race->cancel, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&race->cond);
+  }
+  result->host_started = race->host_started;
+  result->host_done = race->host_done;
+  result->host_iterations = race->host_iterations;
+  result->host_rel_residual = race->host_rel_residual;
+  bool host_converged = race->host_converged;
+  pthread_mutex_unlock(&race->lock);
+
+  // results of the kernel run
+  bool fpga_results = false;
+  if (fpga_checked) {
+    result->fpga_done = true;
+    result->fpga_aborted = (solve->state != SOLVE_COMPLETE) || solve->kernel_aborted;
+    // the debug buffer of an aborted run is decoded, but the solve has failed
+    if (solve->state == SOLVE_COMPLETE || solve->kernel_aborted) {
+      result->kernel_cycles = solve->kernel_cycles;
+      result->fpga_iterations = solve->kernel_iter_run/2.0+0.5;
+      fpga_race_observe(&race->model, vectorSizes, solve->kernel_cycles, result->fpga_iterations,
+       !solve->kernel_aborted);
+    }
+    if (solve->state == SOLVE_COMPLETE) {
+      fpga_results = (solve->results[0] != NULL);
+      if (fpga_results) result->fpga_rel_norm = solve->norms[solve->last_norm_idx] / solve->norms[0];
+    }
+  }
+  if (fpga_won) {
+    result->winner = RACE_FPGA;
+  } else if (result->host_done && host_converged) {
+    result->winner = RACE_HOST;
+  }
+  // without a winner, the solution with the lowest relative norm
+  bool use_host = (result->winner == RACE_HOST) || (result->winner == RACE_NONE && result->host_started &&
+   result->host_done && (!fpga_results || result->host_rel_residual <= result->fpga_rel_norm));
+  if (use_host) {
+    memcpy(x, race->host_x, sizeof(double) * rows);
+  } else if (fpga_results) {
+    memcpy(x, solve->results[0], sizeof(double) * rows);
+  } else if (x != x0) {
+    memcpy(x, x0, sizeof(double) * rows);
+  }
+  if (fpga_checked) {
+    fpga_solve_release(solve);
+    race->solve_pending = false;
+  }
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  result->race_ms = elapsed_ms(&race->start_time, &time_end);
+  BDA_DEBUG(1,printf("INFO: %s: winner %s after %.3lf ms (kernel %s, host %s).\n",__func__,
+   (result->winner == RACE_FPGA) ? "FPGA" : (result->winner == RACE_HOST) ? "host" : "none",
+   result->race_ms,result->fpga_done ? (result->fpga_aborted ? "aborted" : "done") : "running",
+   result->host_done ? "done" : (result->host_started ? "cancelled" : "not started"));)
+  return 0;
+}
+
+// wait for the end of the solve that lost the race: the kernel run is
+// released (and observed by the model), the host solve is cancelled
+int fpga_race_wait(struct fpga_race *race) {
+  int rc = 0;
+  if (race->host_thread_running) {
+    pthread_mutex_lock(&race->lock);
+    __atomic_store_n(&race->cancel, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&race->cond);
+    pthread_mutex_unlock(&race->lock);
+    pthread_join(race->host_thread, NULL);
+    race->host_thread_running = false;
+  }
+  if (race->solve_pending) {
+    struct fpga_solve *solve = &race->solve;
+    if (solve->state != SOLVE_IDLE && (fpga_solve_wait(solve) == 0 || solve->kernel_aborted)) {
+      BDA_DEBUG(2,printf("INFO: %s: kernel run ignored: %u cycles.\n",__func__,solve->kernel_cycles);)
+      fpga_race_observe(&race->model, race->sizes, solve->kernel_cycles, solve->kernel_iter_run/2.0+0.5,
+       !solve->kernel_aborted);
+    }
+    rc = fpga_solve_release(solve);
+    race->solve_pending = false;
+  }
+  return rc;
+}
+
+void fpga_race_release(struct fpga_race *race) {
+  fpga_race_wait(race);
+  free(race->host_x);
+  race->host_x = NULL;
+  race->host_capacity = 0;
+  pthread_cond_destroy(&race->cond);
+  pthread_mutex_destroy(&race->lock);
+}
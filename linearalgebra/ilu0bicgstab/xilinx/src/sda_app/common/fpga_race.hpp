@@ -0,0 +1,123 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_RACE_HPP__
+#define __FPGA_RACE_HPP__
+
+#include <pthread.h>
+#include <CL/opencl.h>
+
+#include "fpga_functions_bicgstab.hpp"
+#include "fpga_solve.hpp"
+#include "bicgstab_reference.hpp"
+
+// --- speculative solve on the FPGA and on the host
+// (the kernel runs with an abort_cycles watchdog set from a prediction of its
+// cycles, and the host reference solver starts on the same system after a
+// delay, or at once if the kernel fails or is aborted: the first converged
+// solution is kept. The other solve is cancelled (host) or ignored (kernel,
+// which stops at the watchdog): fpga_race_wait must be called before the
+// data buffers pool, the matrix or the right-hand side are changed)
+
+// cycles of a kernel run:
+//   setup + iterations * scale * (per_nnz * 2 (nnz A + nnz L + nnz U)
+//                                + per_row * rows + per_color * colors)
+// (each iteration has two products by A and two applications of L and U)
+struct fpga_cycle_model {
+  double setup;                       // cycles of a run without iterations
+  double per_nnz;
+  double per_row;
+  double per_color;                   // pipeline drain at the end of each color
+  double scale;                       // correction from the runs observed
+  double iterations;                  // average iterations of the complete runs observed
+  unsigned int runs;                  // runs observed
+  unsigned int complete_runs;         // runs not stopped by the watchdog
+};
+
+// winner of a race
+#define RACE_NONE  0   // no converged solution: x holds the best one
+#define RACE_FPGA  1
+#define RACE_HOST  2
+
+struct fpga_race_params {
+  double expected_iter;               // iterations of the prediction (<= 0: average of the model)
+  double watchdog_margin;             // abort_cycles = margin * predicted cycles
+  double host_delay_ms;               // start of the host solve after the submission (< 0: no host solve)
+  int host_max_iter;
+};
+
+struct fpga_race_result {
+  int winner;                         // RACE_*
+  double predicted_cycles;
+  unsigned int abort_cycles;
+  bool fpga_done;                     // the kernel run was complete when the race ended
+  bool fpga_aborted;                  // stopped by the watchdog (or failed)
+  unsigned int kernel_cycles;
+  double fpga_iterations;
+  double fpga_rel_norm;
+  bool host_started;
+  bool host_done;                     // the host solve was complete when the race ended
+  double host_iterations;
+  double host_rel_residual;
+  double race_ms;                     // from the submission to the end of the race
+};
+
+struct fpga_race {
+  struct fpga_cycle_model model;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // current race
+  struct fpga_solve solve;
+  bool solve_pending;                 // kernel run not released yet
+  bool fpga_done;
+  pthread_t host_thread;
+  bool host_thread_running;
+  bool host_start_now;
+  bool cancel;                        // stop the host solve (atomic accesses)
+  bool host_started;
+  bool host_done;
+  struct timespec start_time;
+  int sizes[18];                      // vectorSizes of the system (for the model)
+  double host_delay_ms;
+  int host_max_iter;
+  double tolerance;
+  struct csr_matrix *A;
+  double *b;
+  double *host_x;                     // solution of the host solve
+  int host_capacity;
+  int host_rc;
+  double host_iterations;
+  double host_rel_residual;
+  bool host_converged;
+};
+
+int fpga_race_init(struct fpga_race *race);
+double fpga_race_predict(const struct fpga_cycle_model *model, int *vectorSizes, double iterations);
+void fpga_race_observe(struct fpga_cycle_model *model, int *vectorSizes,
+ unsigned int kernel_cycles, double iterations, bool complete);
+int fpga_race_solve(struct fpga_race *race, cl_command_queue commands, cl_kernel kernel,
+ struct fpga_bufset *bufset, cl_mem cldebug, unsigned long int *debugBuffer,
+ unsigned int debug_outbuf_words, unsigned int debug_lines, unsigned int kernel_iter,
+ unsigned int debug_sample_rate, double tolerance, const struct fpga_race_params *params,
+ int *vectorSizes, struct csr_matrix *A, double *b, double *x0, double *x,
+ struct fpga_race_result *result);
+int fpga_race_wait(struct fpga_race *race);
+void fpga_race_release(struct fpga_race *race);
+
+#endif //__FPGA_RACE_HPP__
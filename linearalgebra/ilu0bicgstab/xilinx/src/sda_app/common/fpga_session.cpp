@@ -0,0 +1,217 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Double-buffered (ping-pong) solver session
+
+  With a single data buffers pool, system N+1 can be packed only when the
+  results of system N have been read. A session holds two pools (slots), and
+  the systems use them in turn: while the kernel solves system N from one
+  slot, the host packs system N+1 in the other one, and its upload is
+  enqueued on the command queue of that slot, so it runs while the kernel is
+  busy. The kernel starts on system N+1 when it is done with system N (the
+  runtime serializes the runs of a compute unit), and the results of system N
+  are read back on the queue of its slot while system N+1 runs.
+
+  Each slot has its own kernel handle, created from the same program, whose
+  data buffer arguments stay bound to the pool of the slot: switching slots
+  doesn't set kernel arguments. A session drives one compute unit: with a
+  kernel name that selects a compute unit (see find_compute_units), the
+  buffers of both slots are allocated in the memory banks of that unit.
+
+  The arrays given to fpga_session_submit must always hold the whole current
+  system: a slot holds the system of two submissions before, so the regions
+  changed since then (the update masks of both submissions) are copied again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+// this define avoids the warning about deprecated function "clCreateCommandQueue"
+// (see opencl_lib.cpp)
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#include <CL/opencl.h>
+
+#include "fpga_session.hpp"
+#include "bda_utils.hpp"
+#include "host_alloc.hpp"
+
+int fpga_session_create(struct fpga_session *session,
+ cl_device_id device_id, cl_context context, cl_program program, const char *kernel_name,
+ unsigned int config_bits, int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, double growth, unsigned int residency,
+ unsigned int debug_outbuf_words)
+{
+  int err;
+
+  memset(session, 0, sizeof(struct fpga_session));
+  // the settings of the packing and the transfers can't change until the release
+  fpga_settings_hold();
+  session->holds_settings = true;
+  session->context = context;
+  session->debug_outbuf_words = debug_outbuf_words;
+  for (int s=0;s<SESSION_SLOTS;s++) {
+    struct fpga_session_slot *slot = &session->slots[s];
+    slot->commands = clCreateCommandQueue(context, device_id, CL_QUEUE_PROFILING_ENABLE, &err); // DEPRECATED
+    if (!slot->commands) {
+      printf("ERROR: %s: failed to create the command queue of slot %d (%d)\n",__func__,s,err);
+      fpga_session_release(session);
+      return 1;
+    }
+    slot->kernel = clCreateKernel(program, kernel_name, &err);
+    if (!slot->kernel || err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to create compute kernel %s for slot %d (%d)\n",__func__,kernel_name,s,err);
+      slot->kernel = NULL;
+      fpga_session_release(session);
+      return 1;
+    }
+    // the buffers are in the memory banks of the compute unit of the kernel
+    if (fpga_bufset_create(context, slot->kernel, config_bits, processedSizes,
+     nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes,
+     nnzValArrays_num, growth, residency, &slot->bufset)) {
+      printf("ERROR: %s: cannot create the data buffers of slot %d.\n",__func__,s);
+      fpga_session_release(session);
+      return 1;
+    }
+    if (fpga_setup_host_debugbuf(debug_outbuf_words, &slot->debugBuffer, &slot->debugBufferSize) ||
+        fpga_setup_cu_debugbuf(context, slot->kernel, slot->debugBuffer, &slot->cldebug, slot->debugBufferSize)) {
+      printf("ERROR: %s: cannot create the debug buffer of slot %d.\n",__func__,s);
+      fpga_session_release(session);
+      return 1;
+    }
+    slot->pending_mask = REG_MASK_INPUTS;
+  }
+  BDA_DEBUG(1,printf("INFO: %s: session with %d slots created.\n",__func__,SESSION_SLOTS);)
+  return 0;
+}
+
+// set the kernel parameters of both slots; as for fpga_set_kernel_parameters,
+// this must be done before the first submission (the solves in flight are
+// not affected)
+int fpga_session_set_kernel_parameters(struct fpga_session *session,
+ unsigned int abort_cycles, unsigned int debug_lines, unsigned int kernel_iter,
+ unsigned int debug_sample_rate, double kernel_precision, bool use_residuals)
+{
+  for (int s=0;s<SESSION_SLOTS;s++) {
+    struct fpga_session_slot *slot = &session->slots[s];
+    if (fpga_set_kernel_parameters(slot->kernel, abort_cycles, debug_lines, kernel_iter,
+     debug_sample_rate, kernel_precision, slot->bufset.cldata, slot->cldebug)) {
+      printf("ERROR: %s: cannot set the kernel parameters of slot %d.\n",__func__,s);
+      return 1;
+    }
+    slot->bufset.rebind_mask = 0;
+  }
+  session->abort_cycles = abort_cycles;
+  session->use_residuals = use_residuals;
+  session->parameters_set = true;
+  return 0;
+}
+
+// wait for the last solve of a slot and release it: its pool can be updated
+static int fpga_session_free_slot(struct fpga_session *session, struct fpga_session_slot *slot) {
+  struct timespec time_start, time_end;
+
+  if (slot->solve.state == SOLVE_IDLE) return 0;
+  clock_gettime(CLOCK_REALTIME, &time_start);
+  int rc = fpga_solve_release(&slot->solve);
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  session->wait_ms += elapsed_ms(&time_start, &time_end);
+  return rc;
+}
+
+// -----------------------------
+// submission of the next system
+// -----------------------------
+
+// update_mask selects the regions changed since the previous submission (see
+// fpga_update_host_datamem); the returned solve is polled or waited for with
+// fpga_solve_poll/fpga_solve_wait, but must not be released by the caller
+int fpga_session_submit(struct fpga_session *session, unsigned long int update_mask,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ fpga_solve_callback callback, void *user_data, struct fpga_solve **solve)
+{
+  struct fpga_session_slot *slot = &session->slots[session->next];
+
+  *solve = NULL;
+  if (!session->parameters_set) {
+    printf("ERROR: %s: the kernel parameters of the session are not set.\n",__func__);
+    return 1;
+  }
+  for (int s=0;s<SESSION_SLOTS;s++) session->slots[s].pending_mask |= update_mask;
+  // the results of the system submitted two times before are dropped here;
+  // its failure is reported by fpga_session_drain
+  if (fpga_session_free_slot(session, slot)) {
+    printf("WARNING: %s: the solve dropped from slot %d failed.\n",__func__,session->next);
+    session->dropped_failures++;
+  }
+  if (fpga_bufset_update(&slot->bufset, slot->pending_mask, vectorPointers, vectorSizes,
+   nnzValArrays_sizes, L_nnzValArrays_sizes, U_nnzValArrays_sizes)) {
+    printf("ERROR: %s: cannot update the data buffers of slot %d.\n",__func__,session->next);
+    return 1;
+  }
+  slot->pending_mask = 0;
+  if (fpga_bufset_bind(&slot->bufset, slot->kernel)) return 1;
+  if (fpga_solve_submit(&slot->solve, slot->commands, slot->kernel, &slot->bufset,
+   slot->cldebug, slot->debugBuffer, session->debug_outbuf_words, session->abort_cycles,
+   session->use_residuals, callback, user_data)) {
+    printf("ERROR: %s: cannot submit system %u on slot %d.\n",__func__,session->submitted,session->next);
+    // the inputs of the slot may be partially transferred
+    slot->pending_mask = REG_MASK_INPUTS;
+    return 1;
+  }
+  BDA_DEBUG(1,printf("INFO: %s: system %u submitted on slot %d.\n",__func__,session->submitted,session->next);)
+  *solve = &slot->solve;
+  session->submitted++;
+  session->next = (session->next + 1) % SESSION_SLOTS;
+  return 0;
+}
+
+// wait for all the solves and release them; returns 1 if any failed, including
+// the ones dropped by fpga_session_submit since the previous drain
+int fpga_session_drain(struct fpga_session *session) {
+  int rc = (session->dropped_failures > 0);
+  session->dropped_failures = 0;
+  for (int s=0;s<SESSION_SLOTS;s++) {
+    // the oldest solve first
+    int k = (session->next + s) % SESSION_SLOTS;
+    rc |= fpga_session_free_slot(session, &session->slots[k]);
+  }
+  return rc;
+}
+
+void fpga_session_release(struct fpga_session *session) {
+  fpga_session_drain(session);
+  for (int s=0;s<SESSION_SLOTS;s++) {
+    struct fpga_session_slot *slot = &session->slots[s];
+    if (slot->kernel != NULL) clReleaseKernel(slot->kernel);
+    if (slot->commands != NULL) clReleaseCommandQueue(slot->commands);
+    if (slot->cldebug != NULL) clReleaseMemObject(slot->cldebug);
+    host_free(slot->debugBuffer);
+    fpga_bufset_release(&slot->bufset);
+    slot->kernel = NULL;
+    slot->commands = NULL;
+    slot->cldebug = NULL;
+    slot->debugBuffer = NULL;
+  }
+  if (session->holds_settings) fpga_settings_unhold();
+  session->holds_settings = false;
+}
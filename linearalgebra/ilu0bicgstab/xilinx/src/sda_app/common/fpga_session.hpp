@@ -0,0 +1,78 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_SESSION_HPP__
+#define __FPGA_SESSION_HPP__
+
+#include <CL/opencl.h>
+
+#include "fpga_functions_bicgstab.hpp"
+#include "fpga_solve.hpp"
+
+// --- double-buffered (ping-pong) solver session
+// (two complete data buffers pools, each with its own setup array, debug
+// buffer, command queue and kernel handle, used in turn: the next system is
+// packed and uploaded while the previous one runs. The solve returned by
+// fpga_session_submit belongs to the session: its results are valid until
+// the second next submission, or until fpga_session_drain/release)
+
+#define SESSION_SLOTS 2
+
+struct fpga_session_slot {
+  struct fpga_bufset bufset;
+  cl_command_queue commands;          // in-order, with profiling enabled
+  cl_kernel kernel;                   // arguments bound to the pool of this slot
+  unsigned long int *debugBuffer;
+  unsigned int debugBufferSize;
+  cl_mem cldebug;
+  unsigned long int pending_mask;     // regions changed since the last system of this slot
+  struct fpga_solve solve;
+};
+
+struct fpga_session {
+  cl_context context;
+  unsigned int debug_outbuf_words;
+  unsigned int abort_cycles;
+  bool use_residuals;
+  bool parameters_set;
+  bool holds_settings;                // see fpga_settings_hold
+  int next;                           // slot of the next system
+  unsigned int submitted;             // number of systems submitted
+  double wait_ms;                     // host waiting for a slot to be free
+  unsigned int dropped_failures;      // failed solves dropped by a submission, since the last drain
+  struct fpga_session_slot slots[SESSION_SLOTS];
+};
+
+int fpga_session_create(struct fpga_session *session,
+ cl_device_id device_id, cl_context context, cl_program program, const char *kernel_name,
+ unsigned int config_bits, int *processedSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ int nnzValArrays_num, double growth, unsigned int residency,
+ unsigned int debug_outbuf_words);
+int fpga_session_set_kernel_parameters(struct fpga_session *session,
+ unsigned int abort_cycles, unsigned int debug_lines, unsigned int kernel_iter,
+ unsigned int debug_sample_rate, double kernel_precision, bool use_residuals);
+int fpga_session_submit(struct fpga_session *session, unsigned long int update_mask,
+ void **vectorPointers, int *vectorSizes,
+ int *nnzValArrays_sizes, int *L_nnzValArrays_sizes, int *U_nnzValArrays_sizes,
+ fpga_solve_callback callback, void *user_data, struct fpga_solve **solve);
+int fpga_session_drain(struct fpga_session *session);
+void fpga_session_release(struct fpga_session *session);
+
+#endif //__FPGA_SESSION_HPP__
@@ -0,0 +1,287 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Asynchronous solve
+
+  The synchronous path (fpga_bufset_upload, fpga_kernel_run,
+  fpga_copy_from_device_debugbuf, fpga_map_results) ends every step with a
+  clFinish, so the calling thread is blocked for the whole solve. Here the
+  steps are enqueued as a chain on an in-order command queue:
+
+    upload of the data buffers pool (fpga_bufset_enqueue_upload)
+    upload of the debug buffer (fpga_enqueue_to_device_debugbuf)
+    kernel run
+    readback of the debug buffer
+    non-blocking maps of the even and odd result buffers
+    marker (the "done" event)
+
+  and a callback registered on the marker decodes the debug buffer, selects
+  the result buffers and wakes up the threads waiting for the solve. The
+  kernel arguments (fpga_set_kernel_parameters, fpga_bufset_bind) must be set
+  before the submission. With staged inputs (BUFSET_STAGE_INPUTS), the inputs
+  are still packed and transferred by fpga_solve_submit before it returns.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <CL/opencl.h>
+
+#include "fpga_solve.hpp"
+#include "fpga_layout.hpp"
+#include "bda_utils.hpp"
+#include "bicgstab_utils.hpp"
+
+// mapped[] indexes, in the order of the result_offsets of the pool
+#define SOLVE_MAP_X_EVEN  0
+#define SOLVE_MAP_R_EVEN  1
+#define SOLVE_MAP_X_ODD   2
+#define SOLVE_MAP_R_ODD   3
+
+// called by the OpenCL runtime when the chain is complete (or has failed)
+static void CL_CALLBACK fpga_solve_complete(cl_event event, cl_int status, void *data) {
+  struct fpga_solve *solve = (struct fpga_solve *)data;
+  struct timespec time_end;
+  cl_ulong start, end;
+  int state = SOLVE_COMPLETE;
+
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  if (status != CL_COMPLETE) {
+    printf("ERROR: %s: the solve failed on the device (%d)\n",__func__,status);
+    state = SOLVE_FAILED;
+  } else {
+    if (decode_debuginfo_bicgstab(true, false,
+     solve->debugBuffer, solve->debug_outbuf_words, CACHELINE_DBL_WORDS, solve->abort_cycles,
+     &solve->kernel_cycles, &solve->kernel_iter_run, solve->norms, &solve->last_norm_idx,
+     &solve->kernel_aborted, &solve->kernel_signature, &solve->kernel_overflow,
+     &solve->kernel_noresults, &solve->kernel_wrafterend, &solve->kernel_dbgfifofull)) state = SOLVE_FAILED;
+    // results are in X2/R2 after an even number of half iterations, in X1/R1 otherwise
+    solve->evenBuffers = (solve->kernel_iter_run % 2 == 0);
+    if (!solve->kernel_noresults && state == SOLVE_COMPLETE) {
+      int x = solve->evenBuffers ? SOLVE_MAP_X_EVEN : SOLVE_MAP_X_ODD;
+      solve->results[0] = solve->mapped[x];
+      solve->results[1] = solve->use_residuals ? solve->mapped[x + 1] : NULL;
+    }
+    if (clGetEventProfilingInfo(solve->kernel_done, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) == CL_SUCCESS &&
+     clGetEventProfilingInfo(solve->kernel_done, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) == CL_SUCCESS) {
+      solve->kernel_ms = (double)(end - start) / 1000000;
+      solve->kernel_start = start;
+      solve->kernel_end = end;
+    }
+  }
+  solve->solve_ms = elapsed_ms(&solve->submit_time, &time_end);
+  BDA_DEBUG(1,printf("INFO: %s: solve %s: %.1f iterations, %u cycles, kernel %.3lf ms, total %.3lf ms.\n",
+   __func__,(state == SOLVE_COMPLETE) ? "complete" : "failed",
+   (float)(solve->kernel_iter_run/2.0+0.5),solve->kernel_cycles,solve->kernel_ms,solve->solve_ms);)
+
+  // the user callback is called before the waiting threads are woken up, so
+  // that the solve is not released while it runs (the waits of the callback
+  // itself don't wait for it, see fpga_solve_callback_pending)
+  if (solve->callback != NULL) {
+    pthread_mutex_lock(&solve->lock);
+    solve->state = state;
+    solve->in_callback = true;
+    solve->callback_thread = pthread_self();
+    pthread_mutex_unlock(&solve->lock);
+    solve->callback(solve, solve->user_data);
+  }
+  pthread_mutex_lock(&solve->lock);
+  solve->state = state;
+  solve->callback = NULL;
+  solve->in_callback = false;
+  pthread_cond_broadcast(&solve->cond);
+  pthread_mutex_unlock(&solve->lock);
+}
+
+// enqueue a non-blocking map of a result region (the mapped pointer is valid
+// when the chain is complete)
+static int fpga_solve_map(struct fpga_solve *solve, int bank, int region, unsigned int offset, int idx) {
+  int err;
+  solve->mapped[idx] = (double *)clEnqueueMapBuffer(solve->commands, solve->bufset->cldata[bank], CL_FALSE,
+   CL_MAP_READ, offset, solve->bufset->regions[region].size, 0, NULL, NULL, &err);
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: failed to map results region %s (%d)\n",__func__,fpga_region_name(region),err);
+    solve->mapped[idx] = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+// enqueue the unmaps of the mapped result regions
+static void fpga_solve_unmap(struct fpga_solve *solve) {
+  const int banks[4] = {BANK_XRES_EVEN, BANK_RRES_EVEN, BANK_XRES_ODD, BANK_RRES_ODD};
+  for (int i=0;i<4;i++) {
+    if (solve->mapped[i] == NULL) continue;
+    clEnqueueUnmapMemObject(solve->commands, solve->bufset->cldata[banks[i]], solve->mapped[i], 0, NULL, NULL);
+    solve->mapped[i] = NULL;
+  }
+}
+
+// ---------------------
+// submission of a solve
+// ---------------------
+
+// the solve structure is initialized here and must stay valid until
+// fpga_solve_release; commands must be an in-order command queue
+int fpga_solve_submit(struct fpga_solve *solve, cl_command_queue commands, cl_kernel kernel,
+ struct fpga_bufset *bufset, cl_mem cldebug, unsigned long int *debugBuffer,
+ unsigned int debug_outbuf_words, unsigned int abort_cycles, bool use_residuals,
+ fpga_solve_callback callback, void *user_data)
+{
+  cl_command_queue_properties properties;
+  int err;
+
+  memset(solve, 0, sizeof(struct fpga_solve));
+  err = clGetCommandQueueInfo(commands, CL_QUEUE_PROPERTIES, sizeof(properties), &properties, NULL);
+  if (err != CL_SUCCESS || (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)) {
+    printf("ERROR: %s: the solve needs an in-order command queue.\n",__func__);
+    return 1;
+  }
+  solve->commands = commands;
+  solve->bufset = bufset;
+  solve->cldebug = cldebug;
+  solve->debugBuffer = debugBuffer;
+  solve->debug_outbuf_words = debug_outbuf_words;
+  solve->abort_cycles = abort_cycles;
+  solve->use_residuals = use_residuals;
+  solve->callback = callback;
+  solve->user_data = user_data;
+  pthread_mutex_init(&solve->lock, NULL);
+  pthread_cond_init(&solve->cond, NULL);
+  clock_gettime(CLOCK_REALTIME, &solve->submit_time);
+
+  // chain of commands
+  int rc = fpga_bufset_enqueue_upload(bufset, commands);
+  if (rc == 0) rc = fpga_enqueue_to_device_debugbuf(commands, cldebug, debugBuffer, debug_outbuf_words);
+  if (rc == 0) {
+    BDA_DEBUG(1,printf("INFO: %s: enqueuing the kernel.\n",__func__);)
+    err = clEnqueueTask(commands, kernel, 0, NULL, &solve->kernel_done);
+    if (err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to enqueue the kernel (%d)\n",__func__,err);
+      solve->kernel_done = NULL;
+      rc = 1;
+    }
+  }
+  if (rc == 0) {
+    err = clEnqueueMigrateMemObjects(commands, 1, &cldebug, CL_MIGRATE_MEM_OBJECT_HOST, 0, NULL, NULL);
+    if (err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to transfer debug buffer from device (%d)\n",__func__,err);
+      rc = 1;
+    }
+  }
+  // the buffers holding the results are known only after the debug buffer is
+  // decoded: both the even and the odd ones are mapped
+  if (rc == 0) rc = fpga_solve_map(solve, BANK_XRES_EVEN, REG_X2, bufset->result_offsets[0], SOLVE_MAP_X_EVEN);
+  if (rc == 0) rc = fpga_solve_map(solve, BANK_XRES_ODD, REG_X1, bufset->result_offsets[2], SOLVE_MAP_X_ODD);
+  if (rc == 0 && use_residuals) {
+    rc = fpga_solve_map(solve, BANK_RRES_EVEN, REG_R2, bufset->result_offsets[1], SOLVE_MAP_R_EVEN);
+    if (rc == 0) rc = fpga_solve_map(solve, BANK_RRES_ODD, REG_R1, bufset->result_offsets[3], SOLVE_MAP_R_ODD);
+  }
+  if (rc == 0) {
+    err = clEnqueueMarkerWithWaitList(commands, 0, NULL, &solve->done);
+    if (err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to enqueue the end of the solve (%d)\n",__func__,err);
+      solve->done = NULL;
+      rc = 1;
+    }
+  }
+  if (rc == 0) {
+    solve->state = SOLVE_RUNNING;
+    err = clSetEventCallback(solve->done, CL_COMPLETE, fpga_solve_complete, solve);
+    if (err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to set the completion callback (%d)\n",__func__,err);
+      rc = 1;
+    }
+  }
+  if (rc) {
+    // wait for what has been enqueued, without calling the user callback
+    clFinish(commands);
+    pthread_mutex_lock(&solve->lock);
+    solve->callback = NULL;
+    solve->state = SOLVE_FAILED;
+    pthread_mutex_unlock(&solve->lock);
+    return 1;
+  }
+  clFlush(commands);
+  return 0;
+}
+
+// --------------------------------
+// completion of a solve: poll/wait
+// --------------------------------
+
+// the user callback has not returned yet, and the caller is not the callback
+// (solve locked)
+static bool fpga_solve_callback_pending(struct fpga_solve *solve) {
+  if (solve->callback == NULL) return false;
+  return !(solve->in_callback && pthread_equal(solve->callback_thread, pthread_self()));
+}
+
+// complete is set when the solve is complete or failed
+int fpga_solve_poll(struct fpga_solve *solve, bool *complete) {
+  pthread_mutex_lock(&solve->lock);
+  int state = solve->state;
+  bool callback_pending = fpga_solve_callback_pending(solve);
+  pthread_mutex_unlock(&solve->lock);
+  if (state == SOLVE_IDLE) {
+    printf("ERROR: %s: the solve has not been submitted.\n",__func__);
+    return 1;
+  }
+  *complete = (state != SOLVE_RUNNING && !callback_pending);
+  return 0;
+}
+
+// block until the solve is complete; returns 1 if the solve failed
+int fpga_solve_wait(struct fpga_solve *solve) {
+  pthread_mutex_lock(&solve->lock);
+  if (solve->state == SOLVE_IDLE) {
+    pthread_mutex_unlock(&solve->lock);
+    printf("ERROR: %s: the solve has not been submitted.\n",__func__);
+    return 1;
+  }
+  while (solve->state == SOLVE_RUNNING || fpga_solve_callback_pending(solve)) {
+    pthread_cond_wait(&solve->cond, &solve->lock);
+  }
+  int state = solve->state;
+  pthread_mutex_unlock(&solve->lock);
+  return (state != SOLVE_COMPLETE);
+}
+
+// wait for the solve, then unmap the results and release the events: the
+// results must not be used anymore, and the pool can be updated again
+int fpga_solve_release(struct fpga_solve *solve) {
+  if (solve->state == SOLVE_IDLE) return 0;
+  int rc = fpga_solve_wait(solve);
+  fpga_solve_unmap(solve);
+  // the unmaps must be complete before the pool is changed
+  clFinish(solve->commands);
+  if (solve->kernel_done != NULL) clReleaseEvent(solve->kernel_done);
+  if (solve->done != NULL) clReleaseEvent(solve->done);
+  solve->kernel_done = NULL;
+  solve->done = NULL;
+  solve->results[0] = NULL;
+  solve->results[1] = NULL;
+  pthread_cond_destroy(&solve->cond);
+  pthread_mutex_destroy(&solve->lock);
+  solve->state = SOLVE_IDLE;
+  return rc;
+}
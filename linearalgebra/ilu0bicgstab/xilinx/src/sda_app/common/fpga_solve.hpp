@@ -0,0 +1,95 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_SOLVE_HPP__
+#define __FPGA_SOLVE_HPP__
+
+#include <time.h>
+#include <pthread.h>
+#include <CL/opencl.h>
+
+#include "fpga_functions_bicgstab.hpp"
+
+// --- asynchronous solve
+// (fpga_solve_submit enqueues the upload of a data buffers pool and of the
+// debug buffer, the kernel run, the readback of the debug buffer and the
+// mapping of the results on an in-order command queue, and returns without
+// waiting: the solve is then polled, waited for, or completed with a
+// callback. Until the solve is complete, the pool, the debug buffer and the
+// arrays staged in the pool must not be changed; the results stay mapped
+// until fpga_solve_release)
+
+// states of a solve
+#define SOLVE_IDLE      0   // not submitted, or released
+#define SOLVE_RUNNING   1   // enqueued on the device
+#define SOLVE_COMPLETE  2   // debug buffer decoded, results mapped
+#define SOLVE_FAILED    3   // enqueue or execution error, or kernel error (see the flags)
+
+struct fpga_solve;
+
+// called once when the solve is complete or failed, from a thread of the
+// OpenCL runtime: it can poll or wait for its own solve, which is then
+// complete, but it must not call OpenCL functions (e.g. fpga_solve_release)
+typedef void (*fpga_solve_callback)(struct fpga_solve *solve, void *user_data);
+
+struct fpga_solve {
+  // request
+  cl_command_queue commands;
+  struct fpga_bufset *bufset;
+  cl_mem cldebug;
+  unsigned long int *debugBuffer;
+  unsigned int debug_outbuf_words;
+  unsigned int abort_cycles;
+  bool use_residuals;
+  fpga_solve_callback callback;
+  void *user_data;
+  // chain: the results are mapped from both the even and the odd buffers,
+  // since the buffers holding them are known only from the debug buffer
+  cl_event kernel_done;
+  cl_event done;                      // end of the chain
+  double *mapped[4];                  // X even, R even, X odd, R odd
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int state;
+  bool in_callback;                   // the user callback is running, in callback_thread
+  pthread_t callback_thread;
+  struct timespec submit_time;
+  // results (state SOLVE_COMPLETE or SOLVE_FAILED after a kernel error)
+  double solve_ms;                    // from the submission to the completion of the chain
+  double kernel_ms;                   // device time of the kernel (0 without queue profiling)
+  cl_ulong kernel_start, kernel_end;  // profiling timestamps of the kernel (ns)
+  unsigned int kernel_cycles;
+  unsigned int kernel_iter_run;       // half iterations (see fpga_copy_from_device_debugbuf)
+  double norms[4];
+  unsigned char last_norm_idx;
+  bool kernel_aborted, kernel_signature, kernel_overflow;
+  bool kernel_noresults, kernel_wrafterend, kernel_dbgfifofull;
+  bool evenBuffers;                   // results read from the even buffers
+  double *results[2];                 // X and R (with use_residuals); NULL with kernel_noresults
+};
+
+int fpga_solve_submit(struct fpga_solve *solve, cl_command_queue commands, cl_kernel kernel,
+ struct fpga_bufset *bufset, cl_mem cldebug, unsigned long int *debugBuffer,
+ unsigned int debug_outbuf_words, unsigned int abort_cycles, bool use_residuals,
+ fpga_solve_callback callback, void *user_data);
+int fpga_solve_poll(struct fpga_solve *solve, bool *complete);
+int fpga_solve_wait(struct fpga_solve *solve);
+int fpga_solve_release(struct fpga_solve *solve);
+
+#endif //__FPGA_SOLVE_HPP__
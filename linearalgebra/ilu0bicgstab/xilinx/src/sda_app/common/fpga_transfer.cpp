@@ -0,0 +1,466 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Strategy of the host -> device transfers
+
+  The data buffers can be transferred with a migration of the whole buffers
+  (fpga_copy_to_device_datamem), or with writes (DEBUG_fpga_copy_to_device_datamem,
+  the regions uploads of the data buffers pool); which is faster depends on
+  the size, on the platform and on the memory banks. fpga_transfer_tune
+  measures, for sizes from TRANSFER_MIN_BYTES to max_bytes by powers of 4,
+  the transfer of the same number of bytes to each data buffer bank with:
+  - TRANSFER_MIGRATE: one migration of sub-buffers of that size;
+  - TRANSFER_WRITE: one write per bank, on one queue;
+  - TRANSFER_CHUNKED: writes of 256 KiB, 1 MiB or 4 MiB, on one queue (the
+    fastest chunk size is kept);
+  - TRANSFER_PARALLEL: one write per bank, each on its own queue, so that the
+    runtime can run the transfers to the banks at the same time.
+  Each measure is the fastest of the repeats, after a first transfer that is
+  not timed.
+
+  The profile is saved as a text file, with the name of the device: it is
+  loaded instead of tuned by the next setups on the same device
+  (fpga_transfer_setup). fpga_transfer_select gives the fastest strategy for
+  a transfer to every bank, from the largest size measured not above its size
+  per bank (migrations only for whole buffers, parallel writes only for
+  buffers of the context of the profile). As the measures transfer to all the
+  banks at once, the strategy only applies to uploads of all the data
+  buffers: a single region or a single bank is better served by a plain
+  write. fpga_transfer_write issues the transfer to one bank with the
+  strategy, and fpga_transfer_join makes the queue of the upload wait for the
+  parallel writes. The bank queues of the parallel writes are created by
+  fpga_transfer_queues for the caller, so that uploads that run at the same
+  time (e.g. of the pools of two compute units) don't share them.
+*/
+
+// this define avoids the warning about deprecated function "clCreateCommandQueue"
+// (see opencl_lib.cpp)
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <CL/opencl.h>
+
+#include "fpga_transfer.hpp"
+#include "fpga_functions_bicgstab.hpp"
+#include "host_alloc.hpp"
+#include "bda_utils.hpp"
+
+// chunk sizes of TRANSFER_CHUNKED
+#define TRANSFER_CHUNKS 3
+static const size_t transfer_chunks[TRANSFER_CHUNKS] = {256*1024, 1024*1024, 4*1024*1024};
+
+const char *fpga_transfer_strategy_name(int strategy) {
+  switch (strategy) {
+    case TRANSFER_MIGRATE:  return "migrate";
+    case TRANSFER_WRITE:    return "write";
+    case TRANSFER_CHUNKED:  return "chunked";
+    case TRANSFER_PARALLEL: return "parallel";
+    default:                return "unknown";
+  }
+}
+
+// empty profile (plain writes and migrations) of the device
+int fpga_transfer_init(cl_device_id device_id, cl_context context, struct fpga_transfer_profile *profile) {
+  int err;
+
+  memset(profile, 0, sizeof(struct fpga_transfer_profile));
+  profile->context = context;
+  err = clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(profile->device_name), profile->device_name, NULL);
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: cannot get the name of the device (%d)\n",__func__,err);
+    return 1;
+  }
+  profile->device_name[sizeof(profile->device_name)-1] = '\0';
+  return 0;
+}
+
+// -----------------------------
+// measure of the strategies
+// -----------------------------
+
+// transfer bytes to each bank; returns the time in ms, < 0 on error
+static double fpga_transfer_measure(cl_command_queue *bank_queues, cl_command_queue commands,
+ int strategy, size_t bytes, size_t chunk, cl_mem *cldata, cl_mem *clsub, unsigned char **host) {
+  struct timespec time_start, time_end;
+  int err = CL_SUCCESS;
+
+  clock_gettime(CLOCK_REALTIME, &time_start);
+  if (strategy == TRANSFER_MIGRATE) {
+    err = clEnqueueMigrateMemObjects(commands, RW_BUF, clsub, 0, 0, NULL, NULL);
+  } else {
+    for (int b=0;b<RW_BUF && err == CL_SUCCESS;b++) {
+      cl_command_queue queue = (strategy == TRANSFER_PARALLEL) ? bank_queues[b] : commands;
+      size_t step = (strategy == TRANSFER_CHUNKED) ? chunk : bytes;
+      for (size_t offset=0;offset<bytes && err == CL_SUCCESS;offset+=step) {
+        size_t size = (bytes - offset < step) ? bytes - offset : step;
+        err = clEnqueueWriteBuffer(queue, cldata[b], CL_FALSE, offset, size, host[b]+offset, 0, NULL, NULL);
+      }
+      if (strategy == TRANSFER_PARALLEL) clFlush(queue);
+    }
+  }
+  if (strategy == TRANSFER_PARALLEL) {
+    for (int b=0;b<RW_BUF;b++) clFinish(bank_queues[b]);
+  } else {
+    clFinish(commands);
+  }
+  clock_gettime(CLOCK_REALTIME, &time_end);
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: %s transfer of %lu bytes failed (%d)\n",__func__,
+     fpga_transfer_strategy_name(strategy),(unsigned long)bytes,err);
+    return -1.0;
+  }
+  return elapsed_ms(&time_start, &time_end);
+}
+
+// GB/s of the fastest of the repeats
+static double fpga_transfer_rate(cl_command_queue *bank_queues, cl_command_queue commands,
+ int strategy, size_t bytes, size_t chunk, int repeats, cl_mem *cldata, cl_mem *clsub, unsigned char **host) {
+  double best_ms = -1.0;
+  for (int i=0;i<=repeats;i++) {
+    double ms = fpga_transfer_measure(bank_queues, commands, strategy, bytes, chunk, cldata, clsub, host);
+    if (ms < 0.0) return -1.0;
+    // the first transfer is not timed
+    if (i > 0 && (best_ms < 0.0 || ms < best_ms)) best_ms = ms;
+  }
+  if (best_ms <= 0.0) best_ms = 1e-6;
+  return (double)bytes * RW_BUF / (best_ms * 1e6);
+}
+
+// kernel selects the memory banks of the buffers (see fpga_create_device_buffer);
+// commands must be a queue of the context of the profile
+int fpga_transfer_tune(cl_command_queue commands, cl_kernel kernel, size_t max_bytes, int repeats,
+ struct fpga_transfer_profile *profile) {
+  unsigned char *host[RW_BUF];
+  cl_mem cldata[RW_BUF];
+  cl_command_queue bank_queues[RW_BUF];
+  int rc = 0;
+
+  if (max_bytes == 0) max_bytes = TRANSFER_MAX_BYTES;
+  if (max_bytes < TRANSFER_MIN_BYTES || max_bytes > 0x40000000) {
+    printf("ERROR: %s: the largest size must be between %d bytes and 1 GiB (%lu).\n",
+     __func__,TRANSFER_MIN_BYTES,(unsigned long)max_bytes);
+    return 1;
+  }
+  if (repeats < 1) repeats = 1;
+  if (fpga_transfer_queues(__func__, commands, bank_queues)) return 1;
+  for (int b=0;b<RW_BUF;b++) {
+    host[b] = NULL;
+    cldata[b] = NULL;
+  }
+  for (int b=0;b<RW_BUF && rc == 0;b++) {
+    rc = host_alloc("transfer buffer", max_bytes, (void **)&host[b]);
+    if (rc == 0) {
+      memset(host[b], b+1, max_bytes);
+      rc = fpga_create_device_buffer(profile->context, kernel, b, (unsigned int)max_bytes, host[b], &cldata[b]);
+    }
+  }
+
+  profile->sizes = 0;
+  for (size_t bytes=TRANSFER_MIN_BYTES;bytes<=max_bytes && rc == 0 && profile->sizes<TRANSFER_SIZES_MAX;bytes*=4) {
+    int s = profile->sizes;
+    cl_mem clsub[RW_BUF];
+    cl_buffer_region region = {0, bytes};
+    int subs = 0;
+    for (int b=0;b<RW_BUF;b++) {
+      int err;
+      clsub[b] = clCreateSubBuffer(cldata[b], CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+      if (!clsub[b] || err != CL_SUCCESS) {
+        printf("ERROR: %s: cannot create sub-buffer %d of %lu bytes (%d)\n",__func__,b,(unsigned long)bytes,err);
+        rc = 1;
+        break;
+      }
+      subs++;
+    }
+    memset(profile->gbps[s], 0, sizeof(profile->gbps[s]));
+    profile->bytes[s] = bytes;
+    profile->chunk[s] = 0;
+    for (int strategy=0;strategy<TRANSFER_STRATEGIES && rc == 0;strategy++) {
+      if (strategy != TRANSFER_CHUNKED) {
+        double gbps = fpga_transfer_rate(bank_queues, commands, strategy, bytes, 0, repeats, cldata, clsub, host);
+        if (gbps < 0.0) rc = 1;
+        else profile->gbps[s][strategy] = gbps;
+        continue;
+      }
+      for (int c=0;c<TRANSFER_CHUNKS && transfer_chunks[c]<bytes && rc == 0;c++) {
+        double gbps = fpga_transfer_rate(bank_queues, commands, strategy, bytes, transfer_chunks[c], repeats,
+         cldata, clsub, host);
+        if (gbps < 0.0) rc = 1;
+        else if (gbps > profile->gbps[s][strategy]) {
+          profile->gbps[s][strategy] = gbps;
+          profile->chunk[s] = transfer_chunks[c];
+        }
+      }
+    }
+    for (int b=0;b<subs;b++) clReleaseMemObject(clsub[b]);
+    if (rc == 0) {
+      BDA_DEBUG(1,printf("INFO: %s: %lu bytes: migrate %.2f, write %.2f, chunked %.2f, parallel %.2f GB/s.\n",
+       __func__,(unsigned long)bytes,profile->gbps[s][TRANSFER_MIGRATE],profile->gbps[s][TRANSFER_WRITE],
+       profile->gbps[s][TRANSFER_CHUNKED],profile->gbps[s][TRANSFER_PARALLEL]);)
+      profile->sizes++;
+    }
+  }
+
+  for (int b=0;b<RW_BUF;b++) {
+    if (cldata[b] != NULL) clReleaseMemObject(cldata[b]);
+    host_free(host[b]);
+  }
+  fpga_transfer_queues_release(bank_queues);
+  if (rc) profile->sizes = 0;
+  return rc;
+}
+
+// -----------------------------
+// profile file
+// -----------------------------
+
+// a measured size: bytes above the previous size, a chunk size of
+// TRANSFER_CHUNKED (0 if not measured) and finite rates
+static bool fpga_transfer_valid(size_t prev_bytes, size_t bytes, size_t chunk, double *gbps) {
+  bool chunk_valid = (chunk == 0);
+  if (bytes <= prev_bytes) return false;
+  for (int c=0;c<TRANSFER_CHUNKS;c++) {
+    if (chunk == transfer_chunks[c]) chunk_valid = true;
+  }
+  if (!chunk_valid) return false;
+  for (int t=0;t<TRANSFER_STRATEGIES;t++) {
+    if (!isfinite(gbps[t]) || gbps[t] < 0.0) return false;
+  }
+  return true;
+}
+
+// returns 1 if the file does not exist, is not valid or is not a profile of
+// the device of the profile (or for another number of data buffers): the
+// profile is left empty
+int fpga_transfer_load(const char *path, struct fpga_transfer_profile *profile) {
+  char line[256], name[64];
+  int banks = 0, sizes = 0;
+  bool device = false;
+
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    BDA_DEBUG(1,printf("INFO: %s: no transfer profile %s.\n",__func__,path);)
+    return 1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    unsigned long bytes, chunk;
+    double gbps[TRANSFER_STRATEGIES];
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (sscanf(line, "device %63s", name) == 1) {
+      device = (strcmp(name, profile->device_name) == 0);
+    } else if (sscanf(line, "banks %d", &banks) == 1) {
+      continue;
+    } else if (sscanf(line, "%lu %lu %lf %lf %lf %lf", &bytes, &chunk,
+     &gbps[0], &gbps[1], &gbps[2], &gbps[3]) == 2 + TRANSFER_STRATEGIES && sizes < TRANSFER_SIZES_MAX &&
+     fpga_transfer_valid((sizes > 0) ? profile->bytes[sizes-1] : 0, bytes, chunk, gbps)) {
+      profile->bytes[sizes] = bytes;
+      profile->chunk[sizes] = chunk;
+      memcpy(profile->gbps[sizes], gbps, sizeof(gbps));
+      sizes++;
+    } else {
+      printf("ERROR: %s: invalid line in transfer profile %s (ignored): %s",__func__,path,line);
+      fclose(f);
+      return 1;
+    }
+  }
+  fclose(f);
+  if (!device || banks != RW_BUF || sizes == 0) {
+    printf("WARNING: %s: transfer profile %s is not for this device or configuration: ignored.\n",__func__,path);
+    return 1;
+  }
+  profile->sizes = sizes;
+  BDA_DEBUG(1,printf("INFO: %s: transfer profile %s loaded (%d sizes).\n",__func__,path,sizes);)
+  return 0;
+}
+
+int fpga_transfer_save(const char *path, const struct fpga_transfer_profile *profile) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    printf("ERROR: %s: cannot create transfer profile %s.\n",__func__,path);
+    return 1;
+  }
+  fprintf(f, "# transfer profile: bytes per bank, best chunk, GB/s of migrate write chunked parallel\n");
+  fprintf(f, "device %s\n", profile->device_name);
+  fprintf(f, "banks %d\n", RW_BUF);
+  for (int s=0;s<profile->sizes;s++) {
+    fprintf(f, "%lu %lu", (unsigned long)profile->bytes[s], (unsigned long)profile->chunk[s]);
+    for (int t=0;t<TRANSFER_STRATEGIES;t++) fprintf(f, " %.4f", profile->gbps[s][t]);
+    fprintf(f, "\n");
+  }
+  if (fclose(f) != 0) {
+    printf("ERROR: %s: cannot write transfer profile %s.\n",__func__,path);
+    return 1;
+  }
+  return 0;
+}
+
+// the profile is loaded from path if it is a profile of the device,
+// otherwise it is tuned and saved to path (path can be NULL: always tuned)
+int fpga_transfer_setup(cl_device_id device_id, cl_context context, cl_command_queue commands,
+ cl_kernel kernel, const char *path, size_t max_bytes, int repeats, struct fpga_transfer_profile *profile) {
+  if (fpga_transfer_init(device_id, context, profile)) return 1;
+  if (path != NULL && fpga_transfer_load(path, profile) == 0) return 0;
+  if (fpga_transfer_tune(commands, kernel, max_bytes, repeats, profile)) {
+    fpga_transfer_release(profile);
+    return 1;
+  }
+  if (path != NULL && fpga_transfer_save(path, profile)) {
+    fpga_transfer_release(profile);
+    return 1;
+  }
+  return 0;
+}
+
+void fpga_transfer_print(const struct fpga_transfer_profile *profile) {
+  printf("transfer profile of %s (%d data buffers), GB/s:\n",profile->device_name,RW_BUF);
+  printf("%12s %10s %10s %10s %10s  %s\n","bytes/bank","migrate","write","chunked","parallel","best (chunk)");
+  for (int s=0;s<profile->sizes;s++) {
+    size_t chunk;
+    int best = fpga_transfer_select(profile, profile->context, profile->bytes[s], true, &chunk);
+    printf("%12lu",(unsigned long)profile->bytes[s]);
+    for (int t=0;t<TRANSFER_STRATEGIES;t++) printf(" %10.3f",profile->gbps[s][t]);
+    if (best == TRANSFER_CHUNKED) printf("  %s (%lu)\n",fpga_transfer_strategy_name(best),(unsigned long)chunk);
+    else printf("  %s\n",fpga_transfer_strategy_name(best));
+  }
+}
+
+// -----------------------------
+// transfers
+// -----------------------------
+
+// fastest strategy for a transfer of bytes to each data buffer of context;
+// whole is true if the transfers are whole buffers (they can be migrated).
+// Without a profile, whole buffers are migrated and the others written
+int fpga_transfer_select(const struct fpga_transfer_profile *profile, cl_context context,
+ size_t bytes, bool whole, size_t *chunk) {
+  *chunk = 0;
+  if (profile == NULL || profile->sizes == 0) return whole ? TRANSFER_MIGRATE : TRANSFER_WRITE;
+  int s = 0;
+  while (s+1 < profile->sizes && profile->bytes[s+1] <= bytes) s++;
+  int best = TRANSFER_WRITE;
+  for (int t=0;t<TRANSFER_STRATEGIES;t++) {
+    if (t == TRANSFER_MIGRATE && !whole) continue;
+    if (t == TRANSFER_PARALLEL && (context == NULL || context != profile->context)) continue;
+    if (t == TRANSFER_CHUNKED && (profile->chunk[s] == 0 || profile->chunk[s] >= bytes)) continue;
+    if (profile->gbps[s][t] > profile->gbps[s][best]) best = t;
+  }
+  if (best == TRANSFER_CHUNKED) *chunk = profile->chunk[s];
+  return best;
+}
+
+// one queue per data buffer bank for the parallel writes, on the device and
+// context of commands
+int fpga_transfer_queues(const char *caller, cl_command_queue commands, cl_command_queue *bank_queues) {
+  cl_context context;
+  cl_device_id device_id;
+  int err;
+
+  for (int b=0;b<RW_BUF;b++) bank_queues[b] = NULL;
+  err = clGetCommandQueueInfo(commands, CL_QUEUE_CONTEXT, sizeof(context), &context, NULL);
+  if (err == CL_SUCCESS) err = clGetCommandQueueInfo(commands, CL_QUEUE_DEVICE, sizeof(device_id), &device_id, NULL);
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: cannot get the device of the upload queue (%d)\n",caller,err);
+    return 1;
+  }
+  for (int b=0;b<RW_BUF;b++) {
+    bank_queues[b] = clCreateCommandQueue(context, device_id, 0, &err); // DEPRECATED
+    if (!bank_queues[b]) {
+      printf("ERROR: %s: failed to create the command queue of bank %d (%d)\n",caller,b,err);
+      fpga_transfer_queues_release(bank_queues);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void fpga_transfer_queues_release(cl_command_queue *bank_queues) {
+  for (int b=0;b<RW_BUF;b++) {
+    if (bank_queues[b] != NULL) clReleaseCommandQueue(bank_queues[b]);
+    bank_queues[b] = NULL;
+  }
+}
+
+// write bytes of data buffer b at offset (non blocking) with strategy (see
+// fpga_transfer_select); the parallel writes are issued on bank_queues and add
+// the bank to bank_mask: the queue of the upload must wait for them with
+// fpga_transfer_join
+int fpga_transfer_write(const char *caller, cl_command_queue commands, cl_command_queue *bank_queues,
+ int strategy, size_t chunk, cl_mem cldata, int b, size_t offset, size_t bytes, const void *ptr,
+ unsigned int *bank_mask) {
+  int err = CL_SUCCESS;
+
+  if (strategy == TRANSFER_PARALLEL) {
+    err = clEnqueueWriteBuffer(bank_queues[b], cldata, CL_FALSE, offset, bytes, ptr, 0, NULL, NULL);
+    *bank_mask |= 1U << b;
+  } else if (strategy == TRANSFER_CHUNKED) {
+    for (size_t done=0;done<bytes && err == CL_SUCCESS;done+=chunk) {
+      size_t size = (bytes - done < chunk) ? bytes - done : chunk;
+      err = clEnqueueWriteBuffer(commands, cldata, CL_FALSE, offset+done, size,
+       (const unsigned char *)ptr+done, 0, NULL, NULL);
+    }
+  } else {
+    err = clEnqueueWriteBuffer(commands, cldata, CL_FALSE, offset, bytes, ptr, 0, NULL, NULL);
+  }
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: failed to transfer %lu bytes of data buffer %d to device (%s, %d)\n",
+     caller,(unsigned long)bytes,b,fpga_transfer_strategy_name(strategy),err);
+    return 1;
+  }
+  return 0;
+}
+
+// with wait, wait for the parallel writes of the banks of bank_mask;
+// otherwise the queue of the upload waits for them before its next commands
+int fpga_transfer_join(const char *caller, cl_command_queue commands, cl_command_queue *bank_queues,
+ unsigned int bank_mask, bool wait) {
+  cl_event events[RW_BUF];
+  int num = 0, err = CL_SUCCESS;
+
+  if (bank_mask == 0) return 0;
+  for (int b=0;b<RW_BUF;b++) {
+    if (!(bank_mask & (1U << b))) continue;
+    if (wait) {
+      clFinish(bank_queues[b]);
+      continue;
+    }
+    err = clEnqueueMarkerWithWaitList(bank_queues[b], 0, NULL, &events[num]);
+    if (err != CL_SUCCESS) break;
+    clFlush(bank_queues[b]);
+    num++;
+  }
+  if (err == CL_SUCCESS && num > 0) err = clEnqueueMarkerWithWaitList(commands, num, events, NULL);
+  for (int i=0;i<num;i++) clReleaseEvent(events[i]);
+  if (err != CL_SUCCESS) {
+    printf("ERROR: %s: cannot synchronize the parallel transfers (%d)\n",caller,err);
+    // the transfers must not run after the upload
+    for (int b=0;b<RW_BUF;b++) {
+      if (bank_mask & (1U << b)) clFinish(bank_queues[b]);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+void fpga_transfer_release(struct fpga_transfer_profile *profile) {
+  profile->sizes = 0;
+}
@@ -0,0 +1,75 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __FPGA_TRANSFER_HPP__
+#define __FPGA_TRANSFER_HPP__
+
+#include <stddef.h>
+#include <CL/opencl.h>
+
+#include "bicgstab_solver_config.hpp"
+
+// --- strategy of the host -> device transfers
+// (fpga_transfer_tune measures the GB/s of each strategy for transfers of
+// 16 KiB to max_bytes to every data buffer bank at once; the profile can be
+// saved and loaded instead of tuned at each setup. Once set with
+// fpga_set_transfer_profile, the uploads of all the data buffers of a pool
+// use the fastest strategy for their size. The queues of the parallel writes
+// belong to the caller, e.g. one set per pool)
+
+#define TRANSFER_MIGRATE     0   // clEnqueueMigrateMemObjects (whole buffers only)
+#define TRANSFER_WRITE       1   // one clEnqueueWriteBuffer on the queue of the upload
+#define TRANSFER_CHUNKED     2   // clEnqueueWriteBuffer in chunks of the best chunk size
+#define TRANSFER_PARALLEL    3   // clEnqueueWriteBuffer on the queue of the data buffer bank
+#define TRANSFER_STRATEGIES  4
+
+#define TRANSFER_SIZES_MAX   12
+#define TRANSFER_MIN_BYTES   (16*1024)
+#define TRANSFER_MAX_BYTES   (64*1024*1024)   // default largest size measured
+
+struct fpga_transfer_profile {
+  char device_name[64];
+  cl_context context;                 // context of the measures
+  int sizes;                          // sizes measured (0: no profile, plain writes)
+  size_t bytes[TRANSFER_SIZES_MAX];   // bytes transferred to each bank
+  double gbps[TRANSFER_SIZES_MAX][TRANSFER_STRATEGIES];  // 0 if not measured
+  size_t chunk[TRANSFER_SIZES_MAX];   // best chunk size of TRANSFER_CHUNKED
+};
+
+const char *fpga_transfer_strategy_name(int strategy);
+int fpga_transfer_init(cl_device_id device_id, cl_context context, struct fpga_transfer_profile *profile);
+int fpga_transfer_tune(cl_command_queue commands, cl_kernel kernel, size_t max_bytes, int repeats,
+ struct fpga_transfer_profile *profile);
+int fpga_transfer_load(const char *path, struct fpga_transfer_profile *profile);
+int fpga_transfer_save(const char *path, const struct fpga_transfer_profile *profile);
+int fpga_transfer_setup(cl_device_id device_id, cl_context context, cl_command_queue commands,
+ cl_kernel kernel, const char *path, size_t max_bytes, int repeats, struct fpga_transfer_profile *profile);
+void fpga_transfer_print(const struct fpga_transfer_profile *profile);
+int fpga_transfer_select(const struct fpga_transfer_profile *profile, cl_context context,
+ size_t bytes, bool whole, size_t *chunk);
+int fpga_transfer_queues(const char *caller, cl_command_queue commands, cl_command_queue *bank_queues);
+void fpga_transfer_queues_release(cl_command_queue *bank_queues);
+int fpga_transfer_write(const char *caller, cl_command_queue commands, cl_command_queue *bank_queues,
+ int strategy, size_t chunk, cl_mem cldata, int b, size_t offset, size_t bytes, const void *ptr,
+ unsigned int *bank_mask);
+int fpga_transfer_join(const char *caller, cl_command_queue commands, cl_command_queue *bank_queues,
+ unsigned int bank_mask, bool wait);
+void fpga_transfer_release(struct fpga_transfer_profile *profile);
+
+#endif //__FPGA_TRANSFER_HPP__
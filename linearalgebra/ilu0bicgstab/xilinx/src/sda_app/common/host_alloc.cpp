@@ -0,0 +1,279 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Allocator of the host buffers shared with the device
+
+  The policy selects how the buffers are backed: default pages
+  (posix_memalign), transparent huge pages (madvise) or explicit huge pages
+  (mmap with MAP_HUGETLB). When the requested kind of pages is not available,
+  the allocator falls back to the next policy in the order
+  1G hugetlb -> 2M hugetlb -> THP -> default pages.
+  Buffers smaller than half a huge page always use default pages.
+  Optionally, the pages are pre-faulted and locked in memory at allocation,
+  so that the runtime doesn't have to fault them in when pinning the buffers.
+  Every allocation is recorded, so that host_free can release it in the right
+  way: buffers allocated with mmap must not be released with free().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "bda_utils.hpp"
+#include "host_alloc.hpp"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define HUGE_PAGE_2M (2UL*1024*1024)
+#define HUGE_PAGE_1G (1024UL*1024*1024)
+
+static const char *policy_names[] = {"default pages", "THP", "2M hugetlb", "1G hugetlb", "custom"};
+
+// allocation record
+struct host_alloc_entry {
+  void *ptr;
+  size_t bytes;   // allocated size (rounded up to the page size for mmap)
+  int policy;     // policy actually used
+  bool locked;
+  host_free_fn free_fn;  // release function of a custom allocation
+};
+
+static int alloc_policy = HOST_ALLOC_ALIGNED;
+static bool alloc_prefault = false;
+static bool alloc_lock = false;
+static host_alloc_fn custom_alloc = NULL;
+static host_free_fn custom_free = NULL;
+
+static pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct host_alloc_entry *alloc_list = NULL;
+static int alloc_num = 0;
+static int alloc_max = 0;
+
+int host_alloc_set_policy(int policy, bool prefault, bool lock) {
+  if (policy < HOST_ALLOC_ALIGNED || policy > HOST_ALLOC_CUSTOM) {
+    printf("ERROR: %s: unknown allocation policy %d.\n",__func__,policy);
+    return 1;
+  }
+  if (policy == HOST_ALLOC_CUSTOM && (custom_alloc == NULL || custom_free == NULL)) {
+    printf("ERROR: %s: custom allocation functions must be set first.\n",__func__);
+    return 1;
+  }
+  pthread_mutex_lock(&alloc_mutex);
+  alloc_policy = policy;
+  alloc_prefault = prefault;
+  alloc_lock = lock;
+  pthread_mutex_unlock(&alloc_mutex);
+  BDA_DEBUG(1,printf("INFO: %s: host buffers allocated with %s%s%s.\n",__func__,
+   policy_names[policy],prefault ? ", pre-faulted" : "",lock ? ", locked" : "");)
+  return 0;
+}
+
+int host_alloc_set_custom(host_alloc_fn alloc_fn, host_free_fn free_fn) {
+  if (alloc_fn == NULL || free_fn == NULL) {
+    printf("ERROR: %s: both allocation and release functions must be given.\n",__func__);
+    return 1;
+  }
+  pthread_mutex_lock(&alloc_mutex);
+  custom_alloc = alloc_fn;
+  custom_free = free_fn;
+  pthread_mutex_unlock(&alloc_mutex);
+  return 0;
+}
+
+int host_alloc_get_policy(void) {
+  return alloc_policy;
+}
+
+// allocate with a given policy; returns NULL if the policy cannot be used
+static void *host_alloc_policy(int policy, size_t *bytes, bool prefault, host_alloc_fn alloc_fn) {
+  void *ptr = NULL;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (prefault ? MAP_POPULATE : 0);
+  switch (policy) {
+    case HOST_ALLOC_HUGETLB_1G:
+      *bytes = (*bytes + HUGE_PAGE_1G - 1) & ~(HUGE_PAGE_1G - 1);
+      ptr = mmap(NULL, *bytes, PROT_READ | PROT_WRITE, flags | MAP_HUGE_1GB, -1, 0);
+      return (ptr == MAP_FAILED) ? NULL : ptr;
+    case HOST_ALLOC_HUGETLB_2M:
+      *bytes = (*bytes + HUGE_PAGE_2M - 1) & ~(HUGE_PAGE_2M - 1);
+      ptr = mmap(NULL, *bytes, PROT_READ | PROT_WRITE, flags | MAP_HUGE_2MB, -1, 0);
+      return (ptr == MAP_FAILED) ? NULL : ptr;
+    case HOST_ALLOC_THP:
+      if (posix_memalign(&ptr, HUGE_PAGE_2M, *bytes)) return NULL;
+      // without THP support the buffer still works with default pages
+      if (madvise(ptr, *bytes, MADV_HUGEPAGE)) {
+        BDA_DEBUG(1,printf("INFO: %s: madvise(MADV_HUGEPAGE) failed: %s.\n",__func__,strerror(errno));)
+      }
+      return ptr;
+    case HOST_ALLOC_CUSTOM:
+      return alloc_fn(*bytes, SDX_MEM_ALIGNMENT);
+    default:
+      if (posix_memalign(&ptr, SDX_MEM_ALIGNMENT, *bytes)) return NULL;
+      return ptr;
+  }
+}
+
+// report the kind of pages backing a buffer, from /proc/self/smaps
+static void host_alloc_report(const char *name, void *ptr, size_t bytes, int policy) {
+  FILE *fin = fopen("/proc/self/smaps", "r");
+  char line[256];
+  unsigned long start = (unsigned long)ptr, end = start + bytes;
+  unsigned long rss = 0, anon_huge = 0, locked = 0, page_kb = 0;
+  bool inside = false;
+
+  if (fin == NULL) return;
+  while (fgets(line, sizeof(line), fin) != NULL) {
+    unsigned long vma_start, vma_end, value;
+    if (sscanf(line, "%lx-%lx ", &vma_start, &vma_end) == 2) {
+      inside = (vma_start < end && vma_end > start);
+    } else if (inside) {
+      if (sscanf(line, "Rss: %lu kB", &value) == 1) rss += value;
+      else if (sscanf(line, "AnonHugePages: %lu kB", &value) == 1) anon_huge += value;
+      else if (sscanf(line, "Locked: %lu kB", &value) == 1) locked += value;
+      else if (sscanf(line, "KernelPageSize: %lu kB", &value) == 1 && value > page_kb) page_kb = value;
+    }
+  }
+  fclose(fin);
+  // values refer to the whole mappings, which can be larger than the buffer
+  printf("INFO: %s: %s: %lu bytes, %s, page size %lu kB, resident %lu kB, THP %lu kB, locked %lu kB\n",
+   __func__,name,(unsigned long)bytes,policy_names[policy],page_kb,rss,anon_huge,locked);
+}
+
+// release a buffer allocated with a given policy
+static void host_alloc_release(void *ptr, size_t bytes, int policy, host_free_fn free_fn) {
+  switch (policy) {
+    case HOST_ALLOC_HUGETLB_1G:
+    case HOST_ALLOC_HUGETLB_2M:
+      munmap(ptr, bytes);
+      break;
+    case HOST_ALLOC_CUSTOM:
+      free_fn(ptr, bytes);
+      break;
+    default:
+      free(ptr);
+  }
+}
+
+int host_alloc(const char *name, size_t bytes, void **ptr) {
+  void *buf = NULL;
+  size_t alloc_bytes = bytes;
+
+  // the settings of this allocation; the pages are allocated, pre-faulted and
+  // locked without the mutex, which only protects the settings and the list
+  pthread_mutex_lock(&alloc_mutex);
+  int policy = alloc_policy;
+  bool prefault = alloc_prefault;
+  bool lock = alloc_lock;
+  host_alloc_fn alloc_fn = custom_alloc;
+  host_free_fn free_fn = custom_free;
+  pthread_mutex_unlock(&alloc_mutex);
+
+  // small buffers don't benefit from huge pages
+  if (policy != HOST_ALLOC_CUSTOM && bytes < HUGE_PAGE_2M/2) policy = HOST_ALLOC_ALIGNED;
+  while (true) {
+    alloc_bytes = bytes;
+    buf = host_alloc_policy(policy, &alloc_bytes, prefault, alloc_fn);
+    if (buf != NULL || policy == HOST_ALLOC_ALIGNED || policy == HOST_ALLOC_CUSTOM) break;
+    BDA_DEBUG(1,printf("INFO: %s: %s: %s not available, falling back.\n",__func__,name,policy_names[policy]);)
+    policy = (policy == HOST_ALLOC_HUGETLB_1G) ? HOST_ALLOC_HUGETLB_2M :
+             (policy == HOST_ALLOC_HUGETLB_2M) ? HOST_ALLOC_THP : HOST_ALLOC_ALIGNED;
+  }
+  if (buf == NULL) {
+    printf("ERROR: %s: failed to allocate %s (%lu bytes).\n",__func__,name,(unsigned long)bytes);
+    return 1;
+  }
+
+  // pre-fault the pages (mmap already did it with MAP_POPULATE)
+  if (prefault && policy != HOST_ALLOC_HUGETLB_2M && policy != HOST_ALLOC_HUGETLB_1G) {
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t p=0;p<alloc_bytes;p+=page) ((volatile unsigned char *)buf)[p] = 0;
+  }
+  // lock the pages: this fails if RLIMIT_MEMLOCK is too low, which is not fatal
+  bool locked = false;
+  if (lock) {
+    if (mlock(buf, alloc_bytes) == 0) {
+      locked = true;
+    } else {
+      printf("WARNING: %s: %s: cannot lock %lu bytes in memory: %s.\n",
+       __func__,name,(unsigned long)alloc_bytes,strerror(errno));
+    }
+  }
+
+  // record the allocation
+  pthread_mutex_lock(&alloc_mutex);
+  if (alloc_num == alloc_max) {
+    int new_max = (alloc_max == 0) ? 16 : alloc_max * 2;
+    struct host_alloc_entry *new_list = (struct host_alloc_entry *)realloc(alloc_list, sizeof(struct host_alloc_entry) * new_max);
+    if (new_list == NULL) {
+      pthread_mutex_unlock(&alloc_mutex);
+      printf("ERROR: %s: cannot record the allocation of %s.\n",__func__,name);
+      if (locked) munlock(buf, alloc_bytes);
+      host_alloc_release(buf, alloc_bytes, policy, free_fn);
+      return 1;
+    }
+    alloc_list = new_list;
+    alloc_max = new_max;
+  }
+  alloc_list[alloc_num].ptr = buf;
+  alloc_list[alloc_num].bytes = alloc_bytes;
+  alloc_list[alloc_num].policy = policy;
+  alloc_list[alloc_num].locked = locked;
+  alloc_list[alloc_num].free_fn = free_fn;
+  alloc_num++;
+  pthread_mutex_unlock(&alloc_mutex);
+
+  BDA_DEBUG(1,host_alloc_report(name, buf, alloc_bytes, policy);)
+  *ptr = buf;
+  return 0;
+}
+
+void host_free(void *ptr) {
+  struct host_alloc_entry entry;
+  bool found = false;
+
+  if (ptr == NULL) return;
+  pthread_mutex_lock(&alloc_mutex);
+  for (int i=0;i<alloc_num;i++) {
+    if (alloc_list[i].ptr == ptr) {
+      entry = alloc_list[i];
+      alloc_list[i] = alloc_list[--alloc_num];
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&alloc_mutex);
+  if (!found) {
+    free(ptr);
+    return;
+  }
+  if (entry.locked) munlock(ptr, entry.bytes);
+  host_alloc_release(ptr, entry.bytes, entry.policy, entry.free_fn);
+}
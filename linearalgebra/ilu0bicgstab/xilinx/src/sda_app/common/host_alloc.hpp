@@ -0,0 +1,51 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __HOST_ALLOC_HPP__
+#define __HOST_ALLOC_HPP__
+
+#include <stddef.h>
+
+// allocator of the host buffers shared with the device (CL_MEM_USE_HOST_PTR):
+// the buffers can be backed by huge pages, to reduce the number of pages that
+// must be pinned by the runtime and the TLB misses in the packing loops
+
+enum host_alloc_policy {
+  HOST_ALLOC_ALIGNED = 0,  // posix_memalign, default pages (default policy)
+  HOST_ALLOC_THP,          // posix_memalign on 2 MiB boundary + madvise(MADV_HUGEPAGE)
+  HOST_ALLOC_HUGETLB_2M,   // mmap with MAP_HUGETLB, 2 MiB pages
+  HOST_ALLOC_HUGETLB_1G,   // mmap with MAP_HUGETLB, 1 GiB pages
+  HOST_ALLOC_CUSTOM        // functions given to host_alloc_set_custom
+};
+
+// custom allocation functions: the returned memory must be aligned to at
+// least SDX_MEM_ALIGNMENT bytes
+typedef void *(*host_alloc_fn)(size_t bytes, size_t alignment);
+typedef void (*host_free_fn)(void *ptr, size_t bytes);
+
+int host_alloc_set_policy(int policy, bool prefault, bool lock);
+int host_alloc_set_custom(host_alloc_fn alloc_fn, host_free_fn free_fn);
+int host_alloc_get_policy(void);
+
+// buffers allocated with host_alloc must be released with host_free; pointers
+// not allocated by host_alloc are released with free()
+int host_alloc(const char *name, size_t bytes, void **ptr);
+void host_free(void *ptr);
+
+#endif //__HOST_ALLOC_HPP__
@@ -28,6 +28,7 @@
 // which in 2018.x has no alternatives in Xilinx OpenCL 1.2 impementation
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #include <CL/opencl.h>
+#include "opencl_lib.hpp"
 #include "bda_utils.hpp"
 
 // load a bitstream into memory
@@ -56,63 +57,73 @@ static size_t load_file_to_memory(const char *filename, unsigned char **result,
   return fsize;
 }
 
-// setup OpenCL platform for one kernel instance
-int setup_opencl(const char *target_device_name,
- cl_device_id *device_id, cl_context *context,
- cl_command_queue *commands, cl_program *program, cl_kernel *kernel,
- char *kernel_name, char *xclbin, bool *platform_awsf1) {
+// list the devices of type accelerator of the Xilinx platform (at most 16)
+static int get_xilinx_devices(const char *caller, cl_device_id devices[16], cl_uint *device_count) {
   int err;
-  int status;
   char platform_vendor[1024];
   bool platform_found = false;
-  bool autoselect = false;
-  bool device_found = false;
-  unsigned char *kernelbinary;
-  size_t bitsize;
-  char device_name_cl[1024];
-  char device_name[1024];
   cl_platform_id platforms[16]; // platform ids list
   cl_platform_id platform_id=0; // platform id
   cl_uint platform_count;
-  cl_device_id devices[16];  // compute device id
-  cl_uint device_count;
-
-  *platform_awsf1 = false;
 
   // Get all platforms and then select Xilinx platform
   err = clGetPlatformIDs(16, platforms, &platform_count);
   if (err != CL_SUCCESS) {
-    printf("ERROR: %s: failed to find an OpenCL platform (%d)\n",__func__,err);
+    printf("ERROR: %s: failed to find an OpenCL platform (%d)\n",caller,err);
     return 1;
   }
-  BDA_DEBUG(1,printf("INFO: %s: found %d platforms.\n",__func__, platform_count);)
+  BDA_DEBUG(1,printf("INFO: %s: found %d platforms.\n",caller, platform_count);)
 
   // Find Xilinx Plaftorm
   for (unsigned int iplat=0; iplat<platform_count; iplat++) {
     err = clGetPlatformInfo(platforms[iplat], CL_PLATFORM_VENDOR, 1000, (void *)platform_vendor,NULL);
     if (err != CL_SUCCESS) {
-      printf("ERROR: %s: clGetPlatformInfo(CL_PLATFORM_VENDOR) failed (%d)\n",__func__,err);
+      printf("ERROR: %s: clGetPlatformInfo(CL_PLATFORM_VENDOR) failed (%d)\n",caller,err);
       return 1;
     }
     if (strcmp(platform_vendor, "Xilinx") == 0) {
-      BDA_DEBUG(1,printf("INFO: %s: selected platform %d from %s\n",__func__, iplat, platform_vendor);)
+      BDA_DEBUG(1,printf("INFO: %s: selected platform %d from %s\n",caller, iplat, platform_vendor);)
       platform_id = platforms[iplat];
       platform_found = true;
     }
   }
   if (!platform_found) {
-    printf("ERROR: %s: platform Xilinx not found.\n",__func__);
+    printf("ERROR: %s: platform Xilinx not found.\n",caller);
     return 1;
   }
 
   // List all devices of type accelerator
   err = clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ACCELERATOR,
-    16, devices, &device_count);
+    16, devices, device_count);
   if (err != CL_SUCCESS) {
-    printf("ERROR: %s: failed to create a device list (%d)\n",__func__,err);
+    printf("ERROR: %s: failed to create a device list (%d)\n",caller,err);
     return 1;
   }
 
+  return 0;
+}
+
+// setup OpenCL platform for one kernel instance
+int setup_opencl(const char *target_device_name,
+ cl_device_id *device_id, cl_context *context,
+ cl_command_queue *commands, cl_program *program, cl_kernel *kernel,
+ char *kernel_name, char *xclbin, bool *platform_awsf1) {
+  int err;
+  int status;
+  bool autoselect = false;
+  bool device_found = false;
+  unsigned char *kernelbinary;
+  size_t bitsize;
+  char device_name_cl[1024];
+  char device_name[1024];
+  cl_device_id devices[16];  // compute device id
+  cl_uint device_count;
+
+  *platform_awsf1 = false;
+
+  // List all devices of type accelerator of the Xilinx platform
+  if (get_xilinx_devices(__func__, devices, &device_count)) return 1;
+
   // Load bitstream from disk
   BDA_DEBUG(1,printf("INFO: %s: loading %s\n",__func__, xclbin);)
   bitsize = load_file_to_memory(xclbin, (unsigned char **)&kernelbinary, &err);
@@ -230,6 +241,118 @@ int setup_opencl(const char *target_device_name,
   return 0;
 }
 
+// setup OpenCL platform for all the devices that match target_device_name
+// (all the devices if NULL) and accept the bitstream, up to max_devices: each
+// device gets its own context and program (the command queues and kernels are
+// created by the caller); devices that cannot load the bitstream are skipped
+int setup_opencl_devices(const char *target_device_name, int max_devices,
+ cl_device_id *device_ids, cl_context *contexts, cl_program *programs,
+ char *xclbin, int *num_devices) {
+  int err;
+  int status;
+  unsigned char *kernelbinary;
+  size_t bitsize;
+  char device_name_cl[1024];
+  cl_device_id devices[16];  // compute device id
+  cl_uint device_count;
+
+  *num_devices = 0;
+  if (get_xilinx_devices(__func__, devices, &device_count)) return 1;
+
+  // Load bitstream from disk
+  BDA_DEBUG(1,printf("INFO: %s: loading %s\n",__func__, xclbin);)
+  bitsize = load_file_to_memory(xclbin, (unsigned char **)&kernelbinary, &err);
+  if (err < 0) {
+    printf("ERROR: %s: failed to load kernel from xclbin (%d): %s\n",__func__, err, xclbin);
+    return 1;
+  }
+
+  for (int i=0; i<(int)device_count && *num_devices<max_devices; i++) {
+    int n = *num_devices;
+    err = clGetDeviceInfo(devices[i], CL_DEVICE_NAME, 1024, device_name_cl, 0);
+    if (err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to get device name for device %d (%d)\n",__func__, i,err);
+      continue;
+    }
+    if (target_device_name != NULL && strcmp(device_name_cl, target_device_name) != 0) continue;
+    device_ids[n] = devices[i];
+
+    // Create a compute context
+    contexts[n] = clCreateContext(0, 1, &device_ids[n], NULL, NULL, &err);
+    if (!contexts[n]) {
+      printf("WARNING: %s: failed to create a compute context for device %d (%d)\n",__func__,i,err);
+      continue;
+    }
+
+    // Create the compute program from offline, and build it
+    programs[n] = clCreateProgramWithBinary(contexts[n], 1, &device_ids[n], &bitsize,
+     (const unsigned char **)&kernelbinary, &status, &err);
+    if ( (!programs[n]) || (err!=CL_SUCCESS) ) {
+      BDA_DEBUG(1,printf("WARNING: %s: device %d (%s) could not load the bitstream (%d)\n",__func__, i, device_name_cl, err);)
+      clReleaseContext(contexts[n]);
+      continue;
+    }
+    err = clBuildProgram(programs[n], 0, NULL, NULL, NULL, NULL);
+    if (err != CL_SUCCESS) {
+      printf("WARNING: %s: failed to build program executable for device %d (%d)\n",__func__,i,err);
+      clReleaseProgram(programs[n]);
+      clReleaseContext(contexts[n]);
+      continue;
+    }
+    BDA_DEBUG(1,printf("INFO: %s: selected device %d (%s) as device %d.\n",__func__, i, device_name_cl, n);)
+    (*num_devices)++;
+  }
+
+  free(kernelbinary);
+
+  if (*num_devices == 0) {
+    printf("ERROR: %s: could not find any suitable/free device.\n",__func__);
+    return 1;
+  }
+  return 0;
+}
+
+// find the compute units of kernel kernel_name in the program: they are
+// named <kernel_name>_1, <kernel_name>_2, ... as in the kernel linker options
+// (nk=<kernel_name>:<n>:<kernel_name>_1.<kernel_name>_2...). For each compute
+// unit, cu_names receives the name that selects it when given to
+// clCreateKernel ("<kernel_name>:{<kernel_name>_<n>}"); if the compute units
+// are named otherwise, the kernel is used as a single compute unit
+int find_compute_units(cl_program program, const char *kernel_name, int max_cus,
+ char cu_names[][CU_NAME_LEN], int *num_cus) {
+  int err;
+  char name[CU_NAME_LEN];
+
+  *num_cus = 0;
+  if (max_cus < 1) {
+    printf("ERROR: %s: at least one compute unit must be requested (%d).\n",__func__,max_cus);
+    return 1;
+  }
+  for (int n=1; n<=max_cus; n++) {
+    if (snprintf(name, CU_NAME_LEN, "%s:{%s_%d}", kernel_name, kernel_name, n) >= CU_NAME_LEN) {
+      printf("ERROR: %s: kernel name %s is too long.\n",__func__,kernel_name);
+      return 1;
+    }
+    cl_kernel kernel = clCreateKernel(program, name, &err);
+    if (!kernel || err != CL_SUCCESS) break;
+    clReleaseKernel(kernel);
+    strcpy(cu_names[*num_cus], name);
+    (*num_cus)++;
+  }
+  if (*num_cus == 0) {
+    cl_kernel kernel = clCreateKernel(program, kernel_name, &err);
+    if (!kernel || err != CL_SUCCESS) {
+      printf("ERROR: %s: failed to create compute kernel %s (%d)\n",__func__,kernel_name,err);
+      return 1;
+    }
+    clReleaseKernel(kernel);
+    snprintf(cu_names[0], CU_NAME_LEN, "%s", kernel_name);
+    *num_cus = 1;
+  }
+  BDA_DEBUG(1,printf("INFO: %s: kernel %s has %d compute unit(s).\n",__func__,kernel_name,*num_cus);)
+  return 0;
+}
+
 // This function will swap two kernels, one of which is the main
 // one and another one is a "dummy" kernel.
 // The puspose is to force FPGA reconfiguration in case of a
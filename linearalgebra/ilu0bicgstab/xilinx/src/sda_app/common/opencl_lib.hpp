@@ -22,10 +22,18 @@
 
 #include <CL/opencl.h>
 
+// maximum length of the names that select a compute unit (find_compute_units)
+#define CU_NAME_LEN 256
+
 int setup_opencl(const char *target_device_name,
  cl_device_id *device_id, cl_context *context,
  cl_command_queue *commands, cl_program *program, cl_kernel *kernel,
  char *kernel_name, char *xclbin, bool *platform_awsf1);
+int setup_opencl_devices(const char *target_device_name, int max_devices,
+ cl_device_id *device_ids, cl_context *contexts, cl_program *programs,
+ char *xclbin, int *num_devices);
+int find_compute_units(cl_program program, const char *kernel_name, int max_cus,
+ char cu_names[][CU_NAME_LEN], int *num_cus);
 int swap_kernel(cl_device_id device_id, cl_context context, cl_program *program,
  cl_kernel *kernel, char *dummy_kernel_name, char *dummy_xclbin,
  char *main_kernel_name, char *main_xclbin);
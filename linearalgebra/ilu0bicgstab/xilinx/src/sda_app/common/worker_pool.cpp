@@ -0,0 +1,160 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Pool of worker threads
+
+  worker_pool_run executes the tasks 0..num_tasks-1 of a parallel loop: tasks
+  are taken dynamically by the workers and by the calling thread, which
+  returns when all the tasks are completed. A pool with a single thread (or a
+  NULL pool) executes the tasks serially in the calling thread.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bda_utils.hpp"
+#include "worker_pool.hpp"
+
+struct worker_pool {
+  int num_threads;          // including the calling thread
+  pthread_t *threads;
+  pthread_mutex_t run_lock; // serializes calls to worker_pool_run
+  pthread_mutex_t lock;
+  pthread_cond_t start_cond;
+  pthread_cond_t done_cond;
+  // current parallel loop
+  worker_task_fn fn;
+  void *arg;
+  int num_tasks;
+  int next_task;
+  int pending_tasks;
+  unsigned int generation;  // incremented for each parallel loop
+  bool shutdown;
+};
+
+// take and execute tasks until none is left
+static void worker_pool_work(struct worker_pool *pool) {
+  int done = 0;
+  pthread_mutex_lock(&pool->lock);
+  while (pool->next_task < pool->num_tasks) {
+    int task = pool->next_task++;
+    pthread_mutex_unlock(&pool->lock);
+    pool->fn(pool->arg, task);
+    done++;
+    pthread_mutex_lock(&pool->lock);
+  }
+  pool->pending_tasks -= done;
+  if (pool->pending_tasks == 0) pthread_cond_broadcast(&pool->done_cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_pool_thread(void *data) {
+  struct worker_pool *pool = (struct worker_pool *)data;
+  unsigned int seen = 0;
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->shutdown && pool->generation == seen) {
+      pthread_cond_wait(&pool->start_cond, &pool->lock);
+    }
+    if (pool->shutdown) break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+    worker_pool_work(pool);
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+int worker_pool_create(int num_threads, struct worker_pool **pool) {
+  struct worker_pool *p;
+
+  if (num_threads < 1) {
+    printf("ERROR: %s: the number of threads must be at least 1 (%d).\n",__func__,num_threads);
+    return 1;
+  }
+  p = (struct worker_pool *)malloc(sizeof(struct worker_pool));
+  memset(p,0,sizeof(struct worker_pool));
+  p->num_threads = num_threads;
+  pthread_mutex_init(&p->run_lock, NULL);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->start_cond, NULL);
+  pthread_cond_init(&p->done_cond, NULL);
+  // the calling thread is also a worker: create only num_threads-1 threads
+  p->threads = (pthread_t *)malloc(sizeof(pthread_t) * num_threads);
+  for (int t=0;t<num_threads-1;t++) {
+    if (pthread_create(&p->threads[t], NULL, worker_pool_thread, p) != 0) {
+      printf("ERROR: %s: failed to create worker thread %d.\n",__func__,t);
+      p->num_threads = t+1;
+      worker_pool_destroy(p);
+      return 1;
+    }
+  }
+  BDA_DEBUG(1,printf("INFO: %s: created pool with %d threads.\n",__func__,num_threads);)
+  *pool = p;
+  return 0;
+}
+
+void worker_pool_destroy(struct worker_pool *pool) {
+  if (pool == NULL) return;
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->start_cond);
+  pthread_mutex_unlock(&pool->lock);
+  for (int t=0;t<pool->num_threads-1;t++) pthread_join(pool->threads[t], NULL);
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->start_cond);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->run_lock);
+  free(pool->threads);
+  free(pool);
+}
+
+int worker_pool_threads(struct worker_pool *pool) {
+  return (pool == NULL) ? 1 : pool->num_threads;
+}
+
+int worker_pool_run(struct worker_pool *pool, worker_task_fn fn, void *arg, int num_tasks) {
+  if (num_tasks <= 0) return 0;
+  // serial execution
+  if (pool == NULL || pool->num_threads == 1 || num_tasks == 1) {
+    for (int t=0;t<num_tasks;t++) fn(arg, t);
+    return 0;
+  }
+  pthread_mutex_lock(&pool->run_lock);
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->num_tasks = num_tasks;
+  pool->next_task = 0;
+  pool->pending_tasks = num_tasks;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start_cond);
+  pthread_mutex_unlock(&pool->lock);
+  // the calling thread takes part in the work
+  worker_pool_work(pool);
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending_tasks > 0) pthread_cond_wait(&pool->done_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->run_lock);
+  return 0;
+}
@@ -0,0 +1,36 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __WORKER_POOL_HPP__
+#define __WORKER_POOL_HPP__
+
+// pool of worker threads used to split host-side work (e.g. the packing of
+// the data buffers) in independent tasks
+
+struct worker_pool;
+
+// function executing task number "task" of a parallel loop
+typedef void (*worker_task_fn)(void *arg, int task);
+
+int worker_pool_create(int num_threads, struct worker_pool **pool);
+void worker_pool_destroy(struct worker_pool *pool);
+int worker_pool_threads(struct worker_pool *pool);
+int worker_pool_run(struct worker_pool *pool, worker_task_fn fn, void *arg, int num_tasks);
+
+#endif //__WORKER_POOL_HPP__
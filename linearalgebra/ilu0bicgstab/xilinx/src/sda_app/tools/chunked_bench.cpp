@@ -0,0 +1,158 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Check of the chunked solve
+
+  Solves each matrix (Matrix Market coordinate format) with the decisions of
+  the chunked solve (fpga_chunked_run), the chunks being run by the host
+  reference of the ILU0-preconditioned BiCGSTAB as the kernel runs them: from
+  the initial guess X1 to the right-hand side R1, which stays b for every
+  chunk. The right-hand side is A times a vector of ones and the initial guess
+  is zero. The solution is compared with the one of a single solve of the
+  whole budget: the check fails if the solve takes less than 2 chunks, does
+  not converge, or if the relative difference of the solutions is above
+  max_diff.
+
+  usage: chunked_bench [-c chunk_iter] [-t tolerance] [-m max_iter] [-g stagnation_ratio]
+          [-e max_diff] matrix.mtx [matrix.mtx ...]
+  (the default stagnation ratio, 1000, lets the norm grow during a chunk, as
+  it can in BiCGSTAB)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bicgstab_reference.hpp"
+#include "fpga_chunked.hpp"
+
+// host model of the kernel runs
+struct host_runner {
+  struct csr_matrix *A;
+  double *b;
+};
+
+// r = b - A x, returns ||r||
+static double residual(struct csr_matrix *A, double *b, double *x, double *r) {
+  double r2 = 0.0;
+  for (int i=0;i<A->rows;i++) {
+    r[i] = b[i];
+    for (int e=A->row_ptr[i];e<A->row_ptr[i+1];e++) r[i] -= A->vals[e] * x[A->cols[e]];
+    r2 += r[i]*r[i];
+  }
+  return sqrt(r2);
+}
+
+// a chunk (fpga_chunk_runner): the BiCGSTAB restarts from x, with the same b
+static int host_run(void *data, int chunk, unsigned int iter, double precision,
+ double *x, double *r, struct fpga_chunk_run *run) {
+  struct host_runner *host = (struct host_runner *)data;
+  double iterations, rel_residual;
+  bool converged;
+
+  run->initial_norm = residual(host->A, host->b, x, r);
+  if (run->initial_norm == 0.0) {
+    run->noresults = true;
+    return 0;
+  }
+  if (bicgstab_reference_solve(host->A, NULL, host->b, x, 0, iter, precision,
+   &iterations, &rel_residual, &converged, NULL)) return 1;
+  run->iterations = iterations;
+  run->final_norm = rel_residual * run->initial_norm;
+  run->overflow = !isfinite(rel_residual);
+  residual(host->A, host->b, x, r);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  struct fpga_chunk_policy policy = {10, 1000, 1e-8, 1e3, 1e6};
+  double max_diff = 1e-4;
+  int first = 1, failures = 0;
+
+  while (first + 1 < argc && argv[first][0] == '-') {
+    if (strcmp(argv[first], "-c") == 0) policy.chunk_iter = atoi(argv[first+1]);
+    else if (strcmp(argv[first], "-t") == 0) policy.tolerance = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-m") == 0) policy.max_iter = atoi(argv[first+1]);
+    else if (strcmp(argv[first], "-g") == 0) policy.stagnation_ratio = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-e") == 0) max_diff = atof(argv[first+1]);
+    else break;
+    first += 2;
+  }
+  if (first >= argc || max_diff <= 0.0) {
+    printf("usage: %s [-c chunk_iter] [-t tolerance] [-m max_iter] [-g stagnation_ratio]\n"
+     "        [-e max_diff] matrix.mtx [matrix.mtx ...]\n",argv[0]);
+    return 1;
+  }
+
+  printf("matrix                          rows      nnz  chunks  iterations  status          residual   single solve  difference  check\n");
+  for (int m=first;m<argc;m++) {
+    struct csr_matrix A;
+    if (csr_matrix_read(argv[m], &A)) {
+      failures++;
+      continue;
+    }
+    double *b = (double *)malloc(sizeof(double) * A.rows);
+    double *x = (double *)calloc(A.rows, sizeof(double));
+    double *r = (double *)malloc(sizeof(double) * A.rows);
+    double *x_single = (double *)calloc(A.rows, sizeof(double));
+    if (b == NULL || x == NULL || r == NULL || x_single == NULL) {
+      printf("ERROR: %s: cannot allocate the vectors of %s.\n",__func__,argv[m]);
+      failures++;
+    } else {
+      for (int i=0;i<A.rows;i++) {
+        b[i] = 0.0;
+        for (int e=A.row_ptr[i];e<A.row_ptr[i+1];e++) b[i] += A.vals[e];
+      }
+      struct host_runner host = {&A, b};
+      struct fpga_chunked_result result;
+      double iterations, rel_residual;
+      bool converged;
+      int rc = fpga_chunked_run(&policy, host_run, &host, x, r, &result);
+      if (rc == 0) rc = bicgstab_reference_solve(&A, NULL, b, x_single, 0, policy.max_iter, policy.tolerance,
+       &iterations, &rel_residual, &converged, NULL);
+      if (rc == 0) {
+        double d2 = 0.0, x2 = 0.0;
+        for (int i=0;i<A.rows;i++) {
+          d2 += (x[i] - x_single[i]) * (x[i] - x_single[i]);
+          x2 += x_single[i] * x_single[i];
+        }
+        double diff = (x2 > 0.0) ? sqrt(d2/x2) : sqrt(d2);
+        double b2 = 0.0;
+        for (int i=0;i<A.rows;i++) b2 += b[i]*b[i];
+        double true_rel = residual(&A, b, x, r) / sqrt(b2);
+        bool ok = (result.chunks >= 2) && (result.status == CHUNKED_CONVERGED) && converged && (diff <= max_diff);
+        printf("%-30.30s %6d %9d  %6d  %10.1lf  %-14s  %9.2le  %13.1lf  %10.2le  %s\n",
+         argv[m],A.rows,A.nnz,result.chunks,result.iterations,fpga_chunked_status_name(result.status),
+         true_rel,iterations,diff,ok ? "OK" : (result.chunks < 2 ? "FAILED (1 chunk)" : "FAILED"));
+        if (!ok) failures++;
+      } else {
+        failures++;
+      }
+    }
+    free(b);
+    free(x);
+    free(r);
+    free(x_single);
+    csr_matrix_free(&A);
+  }
+
+  return (failures > 0);
+}
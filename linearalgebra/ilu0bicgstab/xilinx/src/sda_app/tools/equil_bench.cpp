@@ -0,0 +1,247 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Convergence model of the row and column equilibration
+
+  Solves each matrix (Matrix Market coordinate format, scalar entries of a
+  block matrix) with the host reference of the ILU0-preconditioned BiCGSTAB,
+  without scaling and with the scalar and block scale factors computed by
+  fpga_equilibration_compute from the streams of the matrix (one color, no
+  padding). The first row of each block is multiplied by ratio, as the
+  pressure equation of a reservoir Jacobian; the right-hand side is A times a
+  vector of ones and the initial guess is zero. The tool reports the
+  iterations, whether the solve converged or broke down, and the true
+  residual of the unscaled solution; it also checks that the values scaled by
+  fpga_equilibration_scale (in chunks) are those of the scaled matrix.
+
+  The factors are powers of 2 and ILU0(Dr A Dc) = (Dr L Dr^-1)(Dr U Dc), so
+  the preconditioned iterations are those of the unscaled system: the counts
+  differ only through the stopping test, which uses the norm of the scaled
+  residual, or when the dot products of the unscaled system overflow (e.g.
+  -r 1e300, where the unscaled solve breaks down). This is why the
+  equilibration is not applied to the device systems (see
+  fpga_equilibrate.hpp).
+
+  usage: equil_bench [-b block_size] [-r ratio] [-f] [-t tolerance] [-m max_iter]
+          matrix.mtx [matrix.mtx ...]
+  (-f: L/U values and block diagonal rounded to single precision)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bicgstab_reference.hpp"
+#include "fpga_equilibrate.hpp"
+#include "fpga_layout.hpp"
+
+// values are packed in chunks of this size, to check the rows found from the
+// stored ones
+#define CHECK_CHUNK 1000
+
+// streams of A, L and U at the positions of fpga_copy_host_datamem's
+// vectorPointers and vectorSizes
+struct streams {
+  void *vectorPointers[21];
+  int vectorSizes[18];
+  double *vals[3];
+  int sizes[3];
+};
+
+static void streams_free(struct streams *s) {
+  for (int m=0;m<3;m++) {
+    free(s->vectorPointers[3 + 6 * m]);
+    free(s->vectorPointers[4 + 6 * m]);
+    free(s->vals[m]);
+  }
+}
+
+static int streams_build(struct csr_matrix *A, int block_size, struct streams *s) {
+  memset(s, 0, sizeof(struct streams));
+  for (int m=0;m<3;m++) {
+    short unsigned int *col = (short unsigned int *)malloc(sizeof(short unsigned int) * (A->nnz + 1));
+    unsigned char *nr = (unsigned char *)malloc(A->nnz + 1);
+    s->vals[m] = (double *)malloc(sizeof(double) * (A->nnz + 1));
+    s->vectorPointers[3 + 6 * m] = col;
+    s->vectorPointers[4 + 6 * m] = nr;
+    s->vectorPointers[2 + 6 * m] = &s->vals[m];
+    if (col == NULL || nr == NULL || s->vals[m] == NULL) {
+      printf("ERROR: %s: cannot allocate the streams.\n",__func__);
+      return 1;
+    }
+    if (csr_matrix_streams(A, block_size, m, col, nr, s->vals[m], &s->vectorSizes[1 + 6 * m])) return 1;
+    s->vectorSizes[4 + 6 * m] = s->vectorSizes[1 + 6 * m];
+    s->sizes[m] = s->vectorSizes[1 + 6 * m];
+  }
+  s->vectorSizes[0] = A->rows;
+  s->vectorSizes[5] = A->rows * block_size;
+  return 0;
+}
+
+// ||b - A x|| / ||b||, with the squares divided by max |b_i| so that badly
+// scaled rows don't overflow the sums
+static double true_residual(struct csr_matrix *A, double *b, double *x) {
+  double r2 = 0.0, b2 = 0.0, bmax = 0.0;
+  for (int i=0;i<A->rows;i++) bmax = fmax(bmax, fabs(b[i]));
+  if (bmax == 0.0 || !isfinite(bmax)) bmax = 1.0;
+  for (int i=0;i<A->rows;i++) {
+    double r = b[i];
+    for (int e=A->row_ptr[i];e<A->row_ptr[i+1];e++) r -= A->vals[e] * x[A->cols[e]];
+    r /= bmax;
+    r2 += r*r;
+    b2 += (b[i]/bmax)*(b[i]/bmax);
+  }
+  return (b2 > 0.0) ? sqrt(r2/b2) : sqrt(r2);
+}
+
+// the values of A and U scaled in chunks must be those of the streams of
+// the scaled matrix (the factors are powers of 2: the products are exact)
+static int check_packing(struct fpga_equilibration *eq, struct streams *s, struct streams *scaled) {
+  const int regions[2] = {REG_NNZ_VALS, REG_U_NNZ_VALS};
+  const int matrices[2] = {0, 2};
+  int rc = 0;
+  for (int k=0;k<2;k++) {
+    int m = matrices[k], num = s->sizes[m];
+    double *out = (double *)malloc(sizeof(double) * (num + 1));
+    if (out == NULL) return 1;
+    for (int first=0;first<num;first+=CHECK_CHUNK) {
+      int n = (num - first < CHECK_CHUNK) ? num - first : CHECK_CHUNK;
+      fpga_equilibration_scale(eq, regions[k], s->vals[m] + first, out + first, false, first, n);
+    }
+    if (memcmp(out, scaled->vals[m], sizeof(double) * num) != 0) {
+      printf("ERROR: %s: the values of %s scaled in chunks differ from the scaled matrix.\n",
+       __func__,fpga_region_name(regions[k]));
+      rc = 1;
+    }
+    free(out);
+  }
+  return rc;
+}
+
+int main(int argc, char *argv[]) {
+  int block_size = 3, max_iter = 1000;
+  double ratio = 1e4, tolerance = 1e-6;
+  unsigned int rounding = 0;
+  int first = 1;
+  const int modes[3] = {0, EQUIL_SCALAR, EQUIL_BLOCK};
+  const char *mode_names[3] = {"none", "scalar", "block"};
+
+  while (first < argc && argv[first][0] == '-') {
+    if (strcmp(argv[first], "-f") == 0) {
+      rounding = REF_ROUND_LU | REF_ROUND_DIAG;
+      first++;
+      continue;
+    }
+    if (first + 1 >= argc) break;
+    if (strcmp(argv[first], "-b") == 0) block_size = atoi(argv[first+1]);
+    else if (strcmp(argv[first], "-r") == 0) ratio = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-t") == 0) tolerance = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-m") == 0) max_iter = atoi(argv[first+1]);
+    else break;
+    first += 2;
+  }
+  if (first >= argc || block_size < 1 || ratio <= 0.0 || tolerance <= 0.0 || max_iter < 1) {
+    printf("usage: %s [-b block_size] [-r ratio] [-f] [-t tolerance] [-m max_iter]\n"
+     "        matrix.mtx [matrix.mtx ...]\n",argv[0]);
+    return 1;
+  }
+
+  int rc = 0;
+  printf("matrix                          rows      nnz  scaling  iterations  conv.      rel. residual  true residual\n");
+  for (int m=first;m<argc;m++) {
+    struct csr_matrix A, As;
+    struct streams s;
+    struct fpga_equilibration eq;
+    if (csr_matrix_read(argv[m], &A)) {
+      rc = 1;
+      continue;
+    }
+    if (A.rows % block_size != 0) {
+      printf("ERROR: %s: %d rows are not a multiple of the block size %d.\n",argv[m],A.rows,block_size);
+      csr_matrix_free(&A);
+      rc = 1;
+      continue;
+    }
+    // badly scaled first equation of each block
+    for (int i=0;i<A.rows;i+=block_size) {
+      for (int e=A.row_ptr[i];e<A.row_ptr[i+1];e++) A.vals[e] *= ratio;
+    }
+    memset(&eq, 0, sizeof(eq));
+    memset(&s, 0, sizeof(s));
+    As = A;
+    As.vals = (double *)malloc(sizeof(double) * A.nnz);
+    double *b = (double *)malloc(sizeof(double) * A.rows);
+    double *bs = (double *)malloc(sizeof(double) * A.rows);
+    double *x = (double *)malloc(sizeof(double) * A.rows);
+    int err = (As.vals == NULL || b == NULL || bs == NULL || x == NULL);
+    if (err) printf("ERROR: %s: cannot allocate the system of %s.\n",__func__,argv[m]);
+    if (!err) err = streams_build(&A, block_size, &s);
+    for (int i=0;i<A.rows && !err;i++) {
+      b[i] = 0.0;
+      for (int e=A.row_ptr[i];e<A.row_ptr[i+1];e++) b[i] += A.vals[e];
+    }
+
+    for (int k=0;k<3 && !err;k++) {
+      double iterations, rel_residual;
+      bool converged, breakdown;
+      if (modes[k] == 0) {
+        memcpy(As.vals, A.vals, sizeof(double) * A.nnz);
+        memcpy(bs, b, sizeof(double) * A.rows);
+      } else {
+        err = fpga_equilibration_compute(&eq, modes[k], s.vectorPointers, s.vectorSizes,
+         &s.sizes[0], &s.sizes[1], &s.sizes[2], 1);
+        if (err) break;
+        for (int i=0;i<A.rows;i++) {
+          for (int e=A.row_ptr[i];e<A.row_ptr[i+1];e++) {
+            As.vals[e] = A.vals[e] * eq.row_scale[i] * eq.col_scale[A.cols[e]];
+          }
+        }
+        fpga_equilibration_scale(&eq, REG_R1, b, bs, false, 0, A.rows);
+        struct streams scaled;
+        err = streams_build(&As, block_size, &scaled);
+        if (!err) err = check_packing(&eq, &s, &scaled);
+        streams_free(&scaled);
+        if (err) break;
+      }
+      memset(x, 0, sizeof(double) * A.rows);
+      err = bicgstab_reference_solve(&As, NULL, bs, x, rounding, max_iter, tolerance,
+       &iterations, &rel_residual, &converged, &breakdown);
+      if (err) break;
+      if (modes[k] != 0) err = fpga_equilibration_unscale(&eq, REG_X1, x, x, A.rows);
+      if (err) break;
+      printf("%-30.30s %6d %9d  %-7s  %10.1lf  %-9s  %13.3le  %13.3le\n",
+       (k == 0) ? argv[m] : "",A.rows,A.nnz,mode_names[k],iterations,
+       converged ? "yes" : (breakdown ? "breakdown" : "no"),
+       rel_residual,true_residual(&A, b, x));
+    }
+    if (err) rc = 1;
+
+    streams_free(&s);
+    fpga_equilibration_free(&eq);
+    free(As.vals);
+    free(b);
+    free(bs);
+    free(x);
+    csr_matrix_free(&A);
+  }
+
+  return rc;
+}
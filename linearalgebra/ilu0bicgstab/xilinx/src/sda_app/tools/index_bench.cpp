@@ -0,0 +1,93 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Index bandwidth of the block index streams
+
+  Builds the column index and new row offset arrays of each matrix (Matrix
+  Market coordinate format, scalar entries of a block matrix) and of its
+  block triangular parts L and U, in the natural row order (the colored
+  arrays are built by the simulator: here there is one color and no
+  padding), then encodes them as block index streams, checks that the
+  decoder reproduces them and reports the bytes saved.
+
+  usage: index_bench [-b block_size] matrix.mtx [matrix.mtx ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bicgstab_reference.hpp"
+#include "fpga_block_index.hpp"
+
+int main(int argc, char *argv[]) {
+  int block_size = 3;
+  int first = 1;
+
+  if (first + 1 < argc && strcmp(argv[first], "-b") == 0) {
+    block_size = atoi(argv[first+1]);
+    first += 2;
+  }
+  if (first >= argc || block_size < BLOCK_INDEX_SIZE_MIN || block_size > BLOCK_INDEX_SIZE_MAX) {
+    printf("usage: %s [-b block_size (%d-%d)] matrix.mtx [matrix.mtx ...]\n",argv[0],
+     BLOCK_INDEX_SIZE_MIN,BLOCK_INDEX_SIZE_MAX);
+    return 1;
+  }
+
+  int rc = 0;
+  for (int m=first;m<argc;m++) {
+    struct csr_matrix A;
+    if (csr_matrix_read(argv[m], &A)) {
+      rc = 1;
+      continue;
+    }
+    printf("%s: %d rows, %d nonzeros\n",argv[m],A.rows,A.nnz);
+
+    // column indices and new row offsets of A, L and U, at the positions of
+    // fpga_copy_host_datamem's vectorPointers and vectorSizes
+    void *vectorPointers[21];
+    int vectorSizes[18];
+    memset(vectorPointers, 0, sizeof(vectorPointers));
+    memset(vectorSizes, 0, sizeof(vectorSizes));
+    int err = 0;
+    for (int part=0;part<3;part++) {
+      short unsigned int *col = (short unsigned int *)malloc(sizeof(short unsigned int) * (A.nnz + 1));
+      unsigned char *nr = (unsigned char *)malloc(A.nnz + 1);
+      vectorPointers[3 + 6 * part] = col;
+      vectorPointers[4 + 6 * part] = nr;
+      if (col == NULL || nr == NULL ||
+       csr_matrix_streams(&A, block_size, part, col, nr, NULL, &vectorSizes[1 + 6 * part])) {
+        err = 1;
+        break;
+      }
+      vectorSizes[4 + 6 * part] = vectorSizes[1 + 6 * part];
+    }
+    if (err == 0) err = fpga_block_index_report(vectorPointers, vectorSizes, block_size);
+    if (err) rc = 1;
+
+    for (int part=0;part<3;part++) {
+      free(vectorPointers[3 + 6 * part]);
+      free(vectorPointers[4 + 6 * part]);
+    }
+    csr_matrix_free(&A);
+  }
+
+  return rc;
+}
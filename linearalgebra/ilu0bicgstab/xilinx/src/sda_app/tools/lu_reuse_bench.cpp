@@ -0,0 +1,144 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Convergence model of the reuse of the ILU0 factors
+
+  Models a sequence of Newton iterations on each matrix (Matrix Market
+  coordinate format): at step k the values of A are perturbed by up to
+  drift*k (relative, a fixed pseudo-random pattern), the right-hand side is
+  A times a vector of ones and the initial guess is zero. The sequence is
+  solved with the host reference of the ILU0-preconditioned BiCGSTAB, with
+  the factors refreshed as decided by fpga_lu_reuse for each policy, and the
+  tool reports the iterations, the factorizations and the bytes of the L/U
+  values not uploaded by the solves that converged with reused factors.
+
+  usage: lu_reuse_bench [-s steps] [-d drift] [-g max_iter_growth] [-a max_age]
+          [-c max_value_change] [-t tolerance] [-m max_iter] matrix.mtx [matrix.mtx ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bicgstab_reference.hpp"
+#include "fpga_lu_reuse.hpp"
+
+// relative perturbation of entry k, in [-1, 1]
+static double perturbation(int k) {
+  unsigned int h = (unsigned int)k * 2654435761U;
+  h ^= h >> 15;
+  h *= 2246822519U;
+  h ^= h >> 13;
+  return (double)(h & 0xFFFF) / 32767.5 - 1.0;
+}
+
+int main(int argc, char *argv[]) {
+  int steps = 10, max_age = 4, max_iter = 200;
+  double drift = 0.01, max_iter_growth = 1.5, max_value_change = 0.02, tolerance = 1e-2;
+  int first = 1;
+  const unsigned int policies[5] = {0, LU_REFRESH_ITER_GROWTH, LU_REFRESH_AGE, LU_REFRESH_VALUE_CHANGE,
+   LU_REFRESH_ITER_GROWTH | LU_REFRESH_AGE | LU_REFRESH_VALUE_CHANGE};
+  const char *policy_names[5] = {"always", "iter growth", "age", "values change", "all"};
+
+  while (first + 1 < argc && argv[first][0] == '-') {
+    if (strcmp(argv[first], "-s") == 0) steps = atoi(argv[first+1]);
+    else if (strcmp(argv[first], "-d") == 0) drift = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-g") == 0) max_iter_growth = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-a") == 0) max_age = atoi(argv[first+1]);
+    else if (strcmp(argv[first], "-c") == 0) max_value_change = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-t") == 0) tolerance = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-m") == 0) max_iter = atoi(argv[first+1]);
+    else break;
+    first += 2;
+  }
+  if (first >= argc || steps < 1 || drift < 0.0 || tolerance <= 0.0 || max_iter < 1) {
+    printf("usage: %s [-s steps] [-d drift] [-g max_iter_growth] [-a max_age]\n"
+     "        [-c max_value_change] [-t tolerance] [-m max_iter] matrix.mtx [matrix.mtx ...]\n",argv[0]);
+    return 1;
+  }
+
+  printf("matrix                          rows      nnz  policy          iterations  not conv.  factorizations  L/U bytes not uploaded\n");
+  for (int m=first;m<argc;m++) {
+    struct csr_matrix A, Ak, M;
+    if (csr_matrix_read(argv[m], &A)) continue;
+
+    // the factored matrix M has the pattern of A: it shares its arrays
+    size_t LU_nnz = (size_t)A.nnz - A.rows;
+    Ak = A;
+    M = A;
+    Ak.vals = (double *)malloc(sizeof(double) * A.nnz);
+    M.vals = (double *)malloc(sizeof(double) * A.nnz);
+    double *b = (double *)malloc(sizeof(double) * A.rows);
+    double *x = (double *)malloc(sizeof(double) * A.rows);
+    if (Ak.vals == NULL || M.vals == NULL || b == NULL || x == NULL) {
+      printf("ERROR: %s: cannot allocate the sequence of %s.\n",__func__,argv[m]);
+      free(Ak.vals);
+      free(M.vals);
+      free(b);
+      free(x);
+      csr_matrix_free(&A);
+      continue;
+    }
+
+    for (int p=0;p<5;p++) {
+      struct fpga_lu_reuse lu;
+      double total_iterations = 0.0;
+      int not_converged = 0;
+      // steps solved with reused factors: a reuse that does not converge is
+      // followed by an upload of new factors, and saves nothing
+      unsigned int saved_uploads = 0;
+      if (fpga_lu_reuse_init(&lu, policies[p], max_iter_growth, max_age, max_value_change)) break;
+      for (int k=0;k<steps;k++) {
+        for (int e=0;e<A.nnz;e++) Ak.vals[e] = A.vals[e] * (1.0 + drift * k * perturbation(e));
+        for (int i=0;i<A.rows;i++) {
+          b[i] = 0.0;
+          for (int e=A.row_ptr[i];e<A.row_ptr[i+1];e++) b[i] += Ak.vals[e];
+        }
+        double iterations, rel_residual;
+        bool converged, refresh;
+        int nnz = A.nnz;
+        // a solve that does not converge with reused factors is run again with new ones
+        for (int attempt=0;attempt<2;attempt++) {
+          if (fpga_lu_reuse_decide(&lu, &Ak.vals, &nnz, 1, &refresh)) break;
+          if (refresh) memcpy(M.vals, Ak.vals, sizeof(double) * A.nnz);
+          memset(x, 0, sizeof(double) * A.rows);
+          if (bicgstab_reference_solve(&Ak, &M, b, x, 0, max_iter, tolerance,
+           &iterations, &rel_residual, &converged, NULL)) break;
+          fpga_lu_reuse_record(&lu, iterations, converged);
+          total_iterations += iterations;
+          if (converged || refresh) break;
+        }
+        if (!converged) not_converged++;
+        else if (!refresh) saved_uploads++;
+      }
+      printf("%-30.30s %6d %9d  %-14s  %10.1lf  %9d  %14u  %22.0lf\n",
+       (p == 0) ? argv[m] : "",A.rows,A.nnz,policy_names[p],total_iterations,not_converged,
+       lu.refreshes,sizeof(double) * (double)LU_nnz * saved_uploads);
+      fpga_lu_reuse_free(&lu);
+    }
+    free(Ak.vals);
+    free(M.vals);
+    free(b);
+    free(x);
+    csr_matrix_free(&A);
+  }
+
+  return 0;
+}
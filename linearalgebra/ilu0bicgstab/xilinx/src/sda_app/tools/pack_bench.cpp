@@ -0,0 +1,163 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Benchmark of the packing of the host data buffers
+
+  Builds synthetic systems with 1M to 2M nonzeros, with array sizes similar to
+  the ones produced by level scheduling/graph coloring, and measures the time
+  spent in fpga_copy_host_datamem for an increasing number of packing threads.
+  The data buffers packed with more threads are checked to be identical to the
+  ones packed serially.
+
+  usage: pack_bench [max_threads] [repetitions]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fpga_functions_bicgstab.hpp"
+#include "bda_utils.hpp"
+
+#define NUM_COLORS 16
+
+// fill an array with random data
+static void *random_array(size_t bytes) {
+  unsigned char *a = (unsigned char *)malloc(bytes);
+  for (size_t i=0;i<bytes;i++) a[i] = (unsigned char)rand();
+  return a;
+}
+
+int main(int argc, char *argv[]) {
+  int max_threads = (argc > 1) ? atoi(argv[1]) : 8;
+  int repetitions = (argc > 2) ? atoi(argv[2]) : 10;
+  int nnz_list[3] = {1000000, 1500000, 2000000};
+
+  if (max_threads < 1 || repetitions < 1) {
+    printf("usage: %s [max_threads] [repetitions]\n",argv[0]);
+    return 1;
+  }
+  srand(1);
+  printf("nnz       threads  pack time (ms)  speedup  check\n");
+
+  for (int m=0;m<3;m++) {
+    // sizes of the system (about 20 nonzeros per row, half of them in L and U)
+    int nnz = nnz_list[m];
+    int rows = nnz/20;
+    int L_nnz = (nnz - rows)/2;
+    int U_nnz = nnz - rows - L_nnz;
+    int cols = roundUpTo(rows, 16) + 16*NUM_COLORS;
+    int newrows = roundUpTo(nnz/8, 64);
+    int blkd = roundUpTo(3*rows, CACHELINE_DBL_WORDS);
+    int vectorSizes[18] = {
+      rows, nnz,   NUM_COLORS, cols, newrows,   blkd,
+      rows, L_nnz, NUM_COLORS, cols, newrows/2, blkd,
+      rows, U_nnz, NUM_COLORS, cols, newrows/2, blkd };
+    int nnzValArrays_sizes[1] = {nnz};
+    int L_nnzValArrays_sizes[1] = {L_nnz};
+    int U_nnzValArrays_sizes[1] = {U_nnz};
+
+    // input vectors, as created by level scheduling/graph coloring
+    double *nnzVals[1], *L_nnzVals[1], *U_nnzVals[1];
+    nnzVals[0] = (double *)random_array(sizeof(double)*nnz);
+    L_nnzVals[0] = (double *)random_array(sizeof(double)*L_nnz);
+    U_nnzVals[0] = (double *)random_array(sizeof(double)*U_nnz);
+    void *vectorPointers[21] = {
+      random_array(sizeof(int)*(8+4*NUM_COLORS)), random_array(sizeof(int)*cols),
+      nnzVals, random_array(sizeof(short)*nnz), random_array(newrows), NULL,
+      random_array(sizeof(int)*(8+4*NUM_COLORS)), random_array(sizeof(int)*cols),
+      L_nnzVals, random_array(sizeof(short)*L_nnz), random_array(newrows/2), NULL,
+      random_array(sizeof(int)*(8+4*NUM_COLORS)), random_array(sizeof(int)*cols),
+      U_nnzVals, random_array(sizeof(short)*U_nnz), random_array(newrows/2), NULL,
+      random_array(sizeof(double)*blkd), random_array(sizeof(double)*rows), random_array(sizeof(double)*rows) };
+
+    long unsigned int *setupArray;
+    double **nnzValArrays, **L_nnzValArrays, **U_nnzValArrays;
+    short unsigned int *columnIndexArray, *L_columnIndexArray, *U_columnIndexArray;
+    unsigned char *newRowOffsetArray, *L_newRowOffsetArray, *U_newRowOffsetArray;
+    unsigned int *PIndexArray, *L_PIndexArray, *U_PIndexArray;
+    unsigned int *colorSizesArray, *L_colorSizesArray, *U_colorSizesArray;
+    double *BLKDArray, *X1Array, *R1Array, *X2Array, *R2Array, *LresArray, *UresArray;
+    unsigned int *totalSize;
+    unsigned char *dataBuffer[RW_BUF];
+    unsigned char *reference[RW_BUF];
+    unsigned int result_offsets[6];
+
+    if (fpga_setup_host_datamem(true, 0, vectorSizes, &setupArray,
+     &nnzValArrays, nnzValArrays_sizes, &columnIndexArray, &newRowOffsetArray, &PIndexArray, &colorSizesArray,
+     &L_nnzValArrays, L_nnzValArrays_sizes, &L_columnIndexArray, &L_newRowOffsetArray, &L_PIndexArray, &L_colorSizesArray,
+     &U_nnzValArrays, U_nnzValArrays_sizes, &U_columnIndexArray, &U_newRowOffsetArray, &U_PIndexArray, &U_colorSizesArray,
+     &BLKDArray, &X1Array, &R1Array, &X2Array, &R2Array, &LresArray, &UresArray,
+     &totalSize, dataBuffer, result_offsets, 1, true, 0)) {
+      printf("ERROR: %s: cannot setup the data buffers.\n",__func__);
+      return 1;
+    }
+
+    double serial_ms = 0;
+    for (int threads=1;threads<=max_threads;threads*=2) {
+      if (fpga_set_pack_threads(threads)) return 1;
+      double best_ms = 0;
+      for (int rep=0;rep<repetitions;rep++) {
+        struct timespec time_start, time_end;
+        clock_gettime(CLOCK_REALTIME, &time_start);
+        fpga_copy_host_datamem(vectorPointers, vectorSizes, setupArray,
+         nnzValArrays, nnzValArrays_sizes, columnIndexArray, newRowOffsetArray, PIndexArray, colorSizesArray,
+         L_nnzValArrays, L_nnzValArrays_sizes, L_columnIndexArray, L_newRowOffsetArray, L_PIndexArray, L_colorSizesArray,
+         U_nnzValArrays, U_nnzValArrays_sizes, U_columnIndexArray, U_newRowOffsetArray, U_PIndexArray, U_colorSizesArray,
+         BLKDArray, X1Array, R1Array, X2Array, R2Array, true, LresArray, UresArray,
+         totalSize, dataBuffer, 1, true, true, 0, 0);
+        clock_gettime(CLOCK_REALTIME, &time_end);
+        double ms = elapsed_ms(&time_start, &time_end);
+        if (rep == 0 || ms < best_ms) best_ms = ms;
+      }
+      // the serial packing is the reference for the check
+      bool identical = true;
+      for (int b=0;b<RW_BUF;b++) {
+        if (threads == 1) {
+          reference[b] = (unsigned char *)malloc(totalSize[b]);
+          memcpy(reference[b], dataBuffer[b], totalSize[b]);
+        } else if (memcmp(reference[b], dataBuffer[b], totalSize[b]) != 0) {
+          identical = false;
+        }
+      }
+      if (threads == 1) serial_ms = best_ms;
+      printf("%-9d %7d  %14.3lf  %7.2lf  %s\n",nnz,threads,best_ms,serial_ms/best_ms,identical ? "identical" : "MISMATCH");
+    }
+
+    for (int b=0;b<RW_BUF;b++) {
+      free(reference[b]);
+      host_free(dataBuffer[b]);
+    }
+    for (int v=0;v<21;v++) {
+      if (v != 2 && v != 8 && v != 14) free(vectorPointers[v]);
+    }
+    free(nnzVals[0]);
+    free(L_nnzVals[0]);
+    free(U_nnzVals[0]);
+    free(nnzValArrays);
+    free(L_nnzValArrays);
+    free(U_nnzValArrays);
+    free(totalSize);
+  }
+  fpga_set_pack_threads(1);
+
+  return 0;
+}
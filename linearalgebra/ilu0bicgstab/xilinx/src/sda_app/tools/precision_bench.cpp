@@ -0,0 +1,113 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Convergence model of the single precision preconditioner
+
+  Solves each matrix (Matrix Market coordinate format, real, general or
+  symmetric) with the host reference of the ILU0-preconditioned BiCGSTAB,
+  with the preconditioner stored in double precision, with the L/U values
+  rounded to floats and with the inverted diagonal rounded too, and reports
+  the number of iterations and the bytes saved by the single precision
+  regions: transferred per solve and read by the kernel per iteration. The
+  right-hand side is A times a vector of ones, and the initial guess is zero.
+
+  usage: precision_bench [-t tolerance] [-m max_iter] matrix.mtx [matrix.mtx ...]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bicgstab_reference.hpp"
+#include "fpga_layout.hpp"
+#include "bda_utils.hpp"
+
+int main(int argc, char *argv[]) {
+  double tolerance = 1e-2;
+  int max_iter = 200;
+  int first = 1;
+  const unsigned int modes[3] = {0, REF_ROUND_LU, REF_ROUND_LU | REF_ROUND_DIAG};
+  const char *mode_names[3] = {"double", "fp32 L/U", "fp32 L/U+diag"};
+
+  while (first + 1 < argc && argv[first][0] == '-') {
+    if (strcmp(argv[first], "-t") == 0) tolerance = atof(argv[first+1]);
+    else if (strcmp(argv[first], "-m") == 0) max_iter = atoi(argv[first+1]);
+    else break;
+    first += 2;
+  }
+  if (first >= argc || tolerance <= 0.0 || max_iter < 1) {
+    printf("usage: %s [-t tolerance] [-m max_iter] matrix.mtx [matrix.mtx ...]\n",argv[0]);
+    return 1;
+  }
+
+  printf("matrix                          rows      nnz  preconditioner  iterations  rel. residual  time (ms)  upload saved  read saved/iter\n");
+  for (int m=first;m<argc;m++) {
+    struct csr_matrix A;
+    if (csr_matrix_read(argv[m], &A)) continue;
+
+    // L and U hold the elements below and above the diagonal
+    size_t L_nnz = 0, U_nnz = 0;
+    for (int i=0;i<A.rows;i++) {
+      for (int k=A.row_ptr[i];k<A.row_ptr[i+1];k++) {
+        if (A.cols[k] < i) L_nnz++;
+        else if (A.cols[k] > i) U_nnz++;
+      }
+    }
+    double *b = (double *)malloc(sizeof(double) * A.rows);
+    double *x = (double *)malloc(sizeof(double) * A.rows);
+    for (int i=0;i<A.rows;i++) {
+      b[i] = 0.0;
+      for (int k=A.row_ptr[i];k<A.row_ptr[i+1];k++) b[i] += A.vals[k];
+    }
+
+    for (int mode=0;mode<3;mode++) {
+      double iterations, rel_residual, ms;
+      bool converged;
+      struct timespec time_start, time_end;
+      memset(x, 0, sizeof(double) * A.rows);
+      clock_gettime(CLOCK_REALTIME, &time_start);
+      if (bicgstab_reference_solve(&A, NULL, b, x, modes[mode], max_iter, tolerance,
+       &iterations, &rel_residual, &converged, NULL)) break;
+      clock_gettime(CLOCK_REALTIME, &time_end);
+      ms = elapsed_ms(&time_start, &time_end);
+      // bytes of the values stored as floats instead of doubles
+      double upload_saved = 0.0, read_saved = 0.0;
+      if (modes[mode] & REF_ROUND_LU) {
+        upload_saved += sizeof(float) * (double)(L_nnz + U_nnz);
+        read_saved += sizeof(float) * (fpga_region_traffic(REG_L_NNZ_VALS) * L_nnz +
+         fpga_region_traffic(REG_U_NNZ_VALS) * U_nnz);
+      }
+      if (modes[mode] & REF_ROUND_DIAG) {
+        upload_saved += sizeof(float) * (double)A.rows;
+        read_saved += sizeof(float) * fpga_region_traffic(REG_BLKD) * A.rows;
+      }
+      printf("%-30.30s %6d %9d  %-14s  %9.1lf%s  %13.3le  %9.1lf  %12.0lf  %15.0lf\n",
+       (mode == 0) ? argv[m] : "",A.rows,A.nnz,mode_names[mode],
+       iterations,converged ? " " : "*",rel_residual,ms,upload_saved,read_saved);
+    }
+    free(b);
+    free(x);
+    csr_matrix_free(&A);
+  }
+  printf("(* not converged)\n");
+
+  return 0;
+}
@@ -0,0 +1,93 @@
+/*
+  Copyright 2020 Equinor ASA
+
+  This file is part of the Open Porous Media project (OPM).
+
+  OPM is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  OPM is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with OPM.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Benchmark of the strategies of the host -> device transfers
+
+  Loads the bitstream on the device, measures the GB/s of each transfer
+  strategy with fpga_transfer_tune (sizes from 16 KiB to max_bytes per data
+  buffer bank, in the memory banks of the kernel) and prints the profile with
+  the strategy selected for each size. With -p, the profile is set up as by
+  the solver (fpga_transfer_setup): loaded from the file if it is a valid
+  profile of the device, otherwise tuned and saved; the saved profile is then
+  loaded again and checked to be the one measured.
+
+  usage: transfer_bench [-d device_name] [-m max_bytes] [-r repeats] [-p profile]
+          xclbin kernel_name
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/opencl.h>
+
+#include "fpga_transfer.hpp"
+#include "opencl_lib.hpp"
+
+int main(int argc, char *argv[]) {
+  const char *device_name = NULL, *path = NULL;
+  size_t max_bytes = TRANSFER_MAX_BYTES;
+  int repeats = 5;
+  int first = 1;
+
+  while (first + 1 < argc && argv[first][0] == '-') {
+    if (strcmp(argv[first], "-d") == 0) device_name = argv[first+1];
+    else if (strcmp(argv[first], "-m") == 0) max_bytes = strtoul(argv[first+1], NULL, 0);
+    else if (strcmp(argv[first], "-r") == 0) repeats = atoi(argv[first+1]);
+    else if (strcmp(argv[first], "-p") == 0) path = argv[first+1];
+    else break;
+    first += 2;
+  }
+  if (first + 2 != argc || max_bytes < TRANSFER_MIN_BYTES || repeats < 1) {
+    printf("usage: %s [-d device_name] [-m max_bytes] [-r repeats] [-p profile]\n"
+     "        xclbin kernel_name\n",argv[0]);
+    return 1;
+  }
+
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue commands;
+  cl_program program;
+  cl_kernel kernel;
+  bool platform_awsf1;
+  if (setup_opencl(device_name, &device_id, &context, &commands, &program, &kernel,
+   argv[first+1], argv[first], &platform_awsf1)) return 1;
+
+  struct fpga_transfer_profile profile, loaded;
+  int rc = fpga_transfer_setup(device_id, context, commands, kernel, path, max_bytes, repeats, &profile);
+  if (rc == 0) {
+    fpga_transfer_print(&profile);
+    if (path != NULL) {
+      // the profile of the next setups
+      rc = fpga_transfer_init(device_id, context, &loaded) || fpga_transfer_load(path, &loaded);
+      if (rc == 0 && (loaded.sizes != profile.sizes ||
+       memcmp(loaded.bytes, profile.bytes, sizeof(size_t) * profile.sizes) != 0 ||
+       memcmp(loaded.chunk, profile.chunk, sizeof(size_t) * profile.sizes) != 0)) rc = 1;
+      printf("profile %s: %s\n",path,rc ? "FAILED to load back" : "loads back");
+      fpga_transfer_release(&loaded);
+    }
+    fpga_transfer_release(&profile);
+  }
+
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  clReleaseCommandQueue(commands);
+  clReleaseContext(context);
+  return rc;
+}